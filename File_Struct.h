@@ -29,6 +29,30 @@
 #include <time.h>
 #include <string>
 
+/*
+*	=====================================================
+*	 Optional behaviours of Op, set from the command line
+*	=====================================================
+*/
+struct Op_Options
+{
+	int bDurable = 0;		// /sync : output files and directories are on disk when Op returns
+	int bSparse = 0;		// /sparse : encrypt the data extents of the input files only (format 2, see Idx_Format.h)
+	int bDigest = 0;		// /digest : store the SHA-256 of the plaintext in the output, checked by the decryption (format 2)
+	int bMerkle = 0;		// /merkle : append the hash tree of the encrypted data, checked chunk by chunk by the decryption (format 2, Idx_Merkle.h)
+	int bEnvelope = 0;		// /envelope : encrypt the data with a random key held by the header, so that /rekey changes the password in place (format 2)
+	int bCompress = 0;		// /compress : compress the data by blocks before encrypting it, decompressed by the decryption (format 2, Idx_Compress.h)
+	int bRequireMerkle = 0;	// /require merkle : the decryption refuses an input without a hash tree (the flags of the header are not authenticated)
+	int bRequireDigest = 0;	// /require digest : the decryption refuses an input without a digest
+	long long volumeSize = 0;	// /volume size : write the output of the encryption of a file in volumes of that size (Linux_Volume.h)
+	std::string manifestPath{};	// /manifest path : incremental folder job, unchanged files are skipped
+	int bPrune = 0;			// /prune : delete the outputs of the inputs which disappeared since the previous run (with /manifest)
+	std::string journalPath{};	// /journal path : record the progress of a folder job
+	int bResume = 0;		// /resume : skip the files completed by the interrupted run (with /journal), or resume from the checkpoint (with /checkpoint)
+	int bCheckpoint = 0;	// /checkpoint : checkpoint the encryption of a file, so that it can be resumed (Linux_Checkpoint.h)
+	int bWatch = 0;			// /watch : after the folder job, process the new and modified files of the input folder as they come (Linux_Watch.h)
+};
+
 class File_Struct
 {
 public:
@@ -57,7 +81,7 @@ public:
 	*	Starts the encryption/decryption process
 	*	========================================
 	*/
-	virtual int Op(Hmac_PRF & prf, const char szPassword[], const size_t & cbSalt, const int & bForDecrypt) = 0;
+	virtual int Op(Hmac_PRF & prf, const char szPassword[], const size_t & cbSalt, const int & bForDecrypt, const Op_Options & options) = 0;
 };
 
 #endif // !FILE_STRUCT_H
@@ -0,0 +1,315 @@
+/*
+*	=====================================
+*	Copyright (c) El Mostafa IDRASSI 2017
+*	mostafa.idrassi@tutanota.com
+*	Apache License
+*	=====================================
+*/
+
+#include "Idx_Async.h"
+
+#ifdef IDX_HAS_COROUTINES
+
+#include "File_Struct.h"						// READ_BUFFER_SIZE
+
+#include <cstring>								// memcpy
+
+Idx_Executor::~Idx_Executor()
+{
+}
+
+Idx_Thread_Pool::Idx_Thread_Pool(const size_t & count)
+{
+	try
+	{
+		for (size_t i = 0; i < ((count > 0) ? count : 1); i++) threads.emplace_back(&Idx_Thread_Pool::run, this);
+	}
+	catch (...)
+	{
+		stop();
+		throw;
+	}
+}
+
+Idx_Thread_Pool::~Idx_Thread_Pool()
+{
+	stop();
+}
+
+void Idx_Thread_Pool::stop()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		bStopping = true;
+	}
+	ready.notify_all();
+
+	for (auto & thread : threads) thread.join();
+	threads.clear();
+}
+
+void Idx_Thread_Pool::run()
+{
+	std::unique_lock<std::mutex> lock(mutex);
+
+	while (true)
+	{
+		ready.wait(lock, [&]() { return bStopping || !queue.empty(); });
+
+		if (queue.empty()) return;
+
+		std::function<void()> work = std::move(queue.front());
+		queue.pop_front();
+
+		lock.unlock();
+		work();
+		lock.lock();
+	}
+}
+
+void Idx_Thread_Pool::post(std::function<void()> work)
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		queue.push_back(std::move(work));
+	}
+	ready.notify_one();
+}
+
+Idx_Io_Backend::~Idx_Io_Backend()
+{
+}
+
+Idx_File_Io::Idx_File_Io(FILE * file, Idx_Executor & executor)
+	: file(file), executor(executor)
+{
+}
+
+void Idx_File_Io::read(unsigned char * buffer, const size_t & cb, Idx_Io_Done done)
+{
+	executor.post([this, buffer, cb, done]() {
+		size_t cbRead = fread(buffer, 1, cb, file);
+		done(ferror(file) ? IDX_ERR_IO : IDX_OK, cbRead);
+	});
+}
+
+void Idx_File_Io::write(const unsigned char * buffer, const size_t & cb, Idx_Io_Done done)
+{
+	executor.post([this, buffer, cb, done]() {
+		size_t cbWritten = fwrite(buffer, 1, cb, file);
+		done((cbWritten == cb) ? IDX_OK : IDX_ERR_IO, cbWritten);
+	});
+}
+
+Idx_Task::Idx_Task(Handle handle)
+	: handle(handle)
+{
+}
+
+Idx_Task::Idx_Task(Idx_Task && other) noexcept
+	: handle(other.handle)
+{
+	other.handle = {};
+}
+
+Idx_Task & Idx_Task::operator=(Idx_Task && other) noexcept
+{
+	if (this != &other)
+	{
+		if (handle) handle.destroy();
+		handle = other.handle;
+		other.handle = {};
+	}
+
+	return *this;
+}
+
+Idx_Task::~Idx_Task()
+{
+	if (handle) handle.destroy();
+}
+
+/*
+* The task hands over to the coroutine awaiting it, or, if it was started by start, reports its status and frees itself
+*/
+std::coroutine_handle<> Idx_Task::Final_Awaiter::await_suspend(Handle handle) noexcept
+{
+	promise_type & promise = handle.promise();
+
+	if (promise.continuation) return promise.continuation;
+
+	if (promise.done)
+	{
+		std::function<void(const int &)> done = std::move(promise.done);
+		int iStatus = promise.iStatus;
+
+		handle.destroy();
+		done(iStatus);
+	}
+
+	return std::noop_coroutine();
+}
+
+void Idx_Task::start(std::function<void(const int & iStatus)> done)
+{
+	Handle started = handle;
+
+	handle = {};
+	started.promise().done = std::move(done);
+	started.resume();
+}
+
+Idx_Schedule_Awaiter idxSchedule(Idx_Executor & executor)
+{
+	return Idx_Schedule_Awaiter{ executor };
+}
+
+Idx_Io_Awaiter::Idx_Io_Awaiter(Idx_Io_Backend & io, unsigned char * buffer, const size_t & cb, const bool & bWrite)
+	: io(io), buffer(buffer), cb(cb), bWrite(bWrite)
+{
+}
+
+bool Idx_Io_Awaiter::await_suspend(std::coroutine_handle<> handle)
+{
+	int issued = 0;
+
+	awaiting = handle;
+
+	Idx_Io_Done done = [this](const int & iStatus, const size_t & cbDone) {
+		this->iStatus = iStatus;
+		this->cbDone = cbDone;
+
+		// Resumed here only if the coroutine was suspended already
+		if (1 == step.exchange(2)) awaiting.resume();
+	};
+
+	if (bWrite) io.write(buffer, cb, done);
+	else io.read(buffer, cb, done);
+
+	// Completed in the meantime : the coroutine goes on without being suspended
+	return step.compare_exchange_strong(issued, 1);
+}
+
+Idx_Async_Encryptor::Idx_Async_Encryptor(Idx_Executor & executor, Idx_Io_Backend & io)
+	: executor(executor), io(io), buffer(IDX_PREFIX_SIZE(IDX_MAX_SALT) + READ_BUFFER_SIZE + 16)
+{
+}
+
+Idx_Task Idx_Async_Encryptor::init(Hmac_PRF & prf, const char * szPassword, const size_t cbSalt)
+{
+	co_await idxSchedule(executor);
+
+	co_return encryptor.init(prf, szPassword, cbSalt);
+}
+
+Idx_Task Idx_Async_Encryptor::restart()
+{
+	co_return encryptor.restart();
+}
+
+Idx_Task Idx_Async_Encryptor::write(const unsigned char * in, const size_t cbIn)
+{
+	size_t cbLeft = cbIn, cbTake = 0, cbData = 0;
+	int iStatus = IDX_OK;
+
+	// READ_BUFFER_SIZE bytes at a time : AES on the executor, then the write of their encryption
+	while (IDX_OK == iStatus && cbLeft > 0)
+	{
+		cbTake = (cbLeft < READ_BUFFER_SIZE) ? cbLeft : READ_BUFFER_SIZE;
+
+		co_await idxSchedule(executor);
+
+		iStatus = encryptor.update(in, cbTake, buffer.data(), buffer.size(), cbData);
+
+		if (IDX_OK == iStatus && 0 != cbData)
+		{
+			Idx_Io_Awaiter op(io, buffer.data(), cbData, true);
+
+			if (IDX_OK == (iStatus = co_await op) && op.getDone() != cbData) iStatus = IDX_ERR_IO;
+		}
+
+		in += cbTake;
+		cbLeft -= cbTake;
+	}
+
+	co_return iStatus;
+}
+
+Idx_Task Idx_Async_Encryptor::finish()
+{
+	size_t cbData = 0;
+	int iStatus = encryptor.finish(buffer.data(), buffer.size(), cbData);
+
+	if (IDX_OK == iStatus)
+	{
+		Idx_Io_Awaiter op(io, buffer.data(), cbData, true);
+
+		if (IDX_OK == (iStatus = co_await op) && op.getDone() != cbData) iStatus = IDX_ERR_IO;
+	}
+
+	co_return iStatus;
+}
+
+Idx_Async_Decryptor::Idx_Async_Decryptor(Idx_Executor & executor, Idx_Io_Backend & io)
+	: executor(executor), io(io), input(READ_BUFFER_SIZE), output(READ_BUFFER_SIZE + 16)
+{
+}
+
+Idx_Task Idx_Async_Decryptor::init(Hmac_PRF & prf, const char * szPassword, const size_t cbSalt)
+{
+	cbOutput = 0;
+	cbConsumed = 0;
+	bEnd = false;
+
+	co_return decryptor.init(prf, szPassword, cbSalt);
+}
+
+Idx_Task Idx_Async_Decryptor::restart()
+{
+	cbOutput = 0;
+	cbConsumed = 0;
+	bEnd = false;
+
+	co_return decryptor.restart();
+}
+
+Idx_Task Idx_Async_Decryptor::read(unsigned char * out, const size_t cb, size_t & cbRead)
+{
+	int iStatus = IDX_OK;
+
+	cbRead = 0;
+
+	// The plaintext left by the previous read first, then READ_BUFFER_SIZE bytes of the stream at a time
+	while (IDX_OK == iStatus && cbConsumed == cbOutput && !bEnd)
+	{
+		Idx_Io_Awaiter op(io, input.data(), input.size(), false);
+
+		if (IDX_OK != (iStatus = co_await op)) break;
+
+		// Key derivation (first read) and AES on the executor
+		co_await idxSchedule(executor);
+
+		cbConsumed = 0;
+
+		if (0 == op.getDone())
+		{
+			iStatus = decryptor.finish(output.data(), output.size(), cbOutput);
+			bEnd = true;
+		}
+		else
+		{
+			iStatus = decryptor.update(input.data(), op.getDone(), output.data(), output.size(), cbOutput);
+		}
+	}
+
+	if (IDX_OK == iStatus)
+	{
+		cbRead = (cb < cbOutput - cbConsumed) ? cb : cbOutput - cbConsumed;
+		memcpy(out, output.data() + cbConsumed, cbRead);
+		cbConsumed += cbRead;
+	}
+
+	co_return iStatus;
+}
+
+#endif // !IDX_HAS_COROUTINES
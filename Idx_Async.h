@@ -0,0 +1,315 @@
+/*
+*	=====================================
+*	Copyright (c) El Mostafa IDRASSI 2017
+*	mostafa.idrassi@tutanota.com
+*	Apache License
+*	=====================================
+*/
+
+#ifndef IDX_ASYNC_H
+#define IDX_ASYNC_H
+
+/*
+*	IDX_HAS_COROUTINES is defined when the compiler supports C++20 coroutines (CMake : -DIDX_ASYNC=ON),
+*	unless IDX_NO_COROUTINES is defined. Without it, this header declares nothing.
+*/
+#if !defined(IDX_NO_COROUTINES) && defined(__cpp_impl_coroutine) && defined(__has_include)
+#if __has_include(<coroutine>)
+#define IDX_HAS_COROUTINES
+#endif
+#endif
+
+#ifdef IDX_HAS_COROUTINES
+
+#include "Idx_Engine.h"					// Idx_Encryptor, Idx_Decryptor
+
+#include <atomic>
+#include <condition_variable>
+#include <coroutine>
+#include <cstdio>						// FILE
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/*
+*	=====================================================================================================
+*	 Asynchronous API (C++20 coroutines) around Idx_Encryptor and Idx_Decryptor
+*
+*	 co_await encryptor.write(chunk) / co_await decryptor.read(buffer) : a stream waiting for its data
+*	 holds no thread, so that thousands of streams share a few threads.
+*	 The work runs where the program says :
+*	  - Idx_Executor runs the CPU work (key derivation, AES). Idx_Thread_Pool is a fixed pool of threads.
+*	  - Idx_Io_Backend reads and writes the encrypted or decrypted stream, and reports the completion
+*	    through a callback (sockets, io_uring, ...). Idx_File_Io runs fread/fwrite on an executor of its
+*	    own, so that the threads of the CPU executor never block on the disk.
+*	 A stream must not be used by several coroutines at once. Its Hmac_PRF, password and buffers must
+*	 remain valid until the call that was given them completes.
+*	=====================================================================================================
+*/
+
+class Idx_Executor
+{
+public:
+
+	virtual ~Idx_Executor();
+
+	/*
+	*	Runs work later, on a thread of the executor. Must not run it before returning.
+	*/
+	virtual void post(std::function<void()> work) = 0;
+};
+
+class Idx_Thread_Pool
+	: public Idx_Executor
+{
+private:
+
+	std::vector<std::thread> threads{};
+	std::deque<std::function<void()>> queue{};
+	std::mutex mutex{};
+	std::condition_variable ready{};
+	bool bStopping = false;
+
+	void run();
+	void stop();
+
+public:
+
+	/*
+	*	count threads (at least 1). Throws std::system_error if a thread can't be started.
+	*/
+	explicit Idx_Thread_Pool(const size_t & count);
+
+	// Copy, Move constructor and assignment operators deleted : the object owns threads
+	Idx_Thread_Pool(const Idx_Thread_Pool & other) = delete;
+	Idx_Thread_Pool & operator=(const Idx_Thread_Pool & other) = delete;
+	Idx_Thread_Pool(Idx_Thread_Pool && other) = delete;
+	Idx_Thread_Pool & operator=(Idx_Thread_Pool && other) = delete;
+
+	/*
+	*	Runs the work already posted, then joins the threads
+	*/
+	~Idx_Thread_Pool();
+
+	void post(std::function<void()> work) override;
+};
+
+typedef std::function<void(const int & iStatus, const size_t & cbDone)> Idx_Io_Done;
+
+class Idx_Io_Backend
+{
+public:
+
+	virtual ~Idx_Io_Backend();
+
+	/*
+	*	Reads up to cb bytes (0 at the end of the stream), then calls done, possibly before returning
+	*/
+	virtual void read(unsigned char * buffer, const size_t & cb, Idx_Io_Done done) = 0;
+
+	/*
+	*	Writes the cb bytes, then calls done, possibly before returning
+	*/
+	virtual void write(const unsigned char * buffer, const size_t & cb, Idx_Io_Done done) = 0;
+};
+
+class Idx_File_Io
+	: public Idx_Io_Backend
+{
+private:
+
+	FILE * file = nullptr;
+	Idx_Executor & executor;
+
+public:
+
+	/*
+	*	The stdio calls on file run on executor (file remains owned by the caller)
+	*/
+	Idx_File_Io(FILE * file, Idx_Executor & executor);
+
+	void read(unsigned char * buffer, const size_t & cb, Idx_Io_Done done) override;
+	void write(const unsigned char * buffer, const size_t & cb, Idx_Io_Done done) override;
+};
+
+/*
+*	Coroutine returning a status (IDX_OK or IDX_ERR_*). It starts when it is awaited, or by start.
+*/
+class Idx_Task
+{
+public:
+
+	struct promise_type;
+	typedef std::coroutine_handle<promise_type> Handle;
+
+	struct Final_Awaiter
+	{
+		bool await_ready() noexcept { return false; }
+		std::coroutine_handle<> await_suspend(Handle handle) noexcept;
+		void await_resume() noexcept {}
+	};
+
+	struct promise_type
+	{
+		int iStatus = IDX_OK;
+		std::coroutine_handle<> continuation{};
+		std::function<void(const int & iStatus)> done{};		// started by start
+
+		Idx_Task get_return_object() { return Idx_Task(Handle::from_promise(*this)); }
+		std::suspend_always initial_suspend() noexcept { return {}; }
+		Final_Awaiter final_suspend() noexcept { return {}; }
+		void return_value(const int & iStatus) { this->iStatus = iStatus; }
+		void unhandled_exception() { iStatus = IDX_ERR_CRYPTO; }
+	};
+
+	struct Awaiter
+	{
+		Handle handle;
+
+		bool await_ready() noexcept { return false; }
+		std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting) noexcept { handle.promise().continuation = awaiting; return handle; }
+		int await_resume() noexcept { return handle.promise().iStatus; }
+	};
+
+private:
+
+	Handle handle{};
+
+	explicit Idx_Task(Handle handle);
+
+public:
+
+	Idx_Task(const Idx_Task & other) = delete;
+	Idx_Task & operator=(const Idx_Task & other) = delete;
+	Idx_Task(Idx_Task && other) noexcept;
+	Idx_Task & operator=(Idx_Task && other) noexcept;
+
+	~Idx_Task();
+
+	Awaiter operator co_await() && noexcept { return Awaiter{ handle }; }
+
+	/*
+	*	Runs the task on the calling thread until it first waits, then done is called with its status when it ends
+	*	(on the thread that completes it). The task owns itself from then on.
+	*/
+	void start(std::function<void(const int & iStatus)> done);
+};
+
+/*
+*	co_await idxSchedule(executor) : the coroutine goes on on a thread of executor
+*/
+struct Idx_Schedule_Awaiter
+{
+	Idx_Executor & executor;
+
+	bool await_ready() noexcept { return false; }
+	void await_suspend(std::coroutine_handle<> handle) { executor.post([handle]() { handle.resume(); }); }
+	void await_resume() noexcept {}
+};
+
+Idx_Schedule_Awaiter idxSchedule(Idx_Executor & executor);
+
+/*
+*	co_await of a read or a write of an Idx_Io_Backend. A completion reported before the backend
+*	returns doesn't suspend the coroutine.
+*/
+class Idx_Io_Awaiter
+{
+private:
+
+	Idx_Io_Backend & io;
+	unsigned char * buffer = nullptr;
+	size_t cb = 0;
+	bool bWrite = false;
+	int iStatus = IDX_OK;
+	size_t cbDone = 0;
+	std::atomic<int> step{ 0 };			// 0 : issued, 1 : the awaiting coroutine is suspended, 2 : completed
+	std::coroutine_handle<> awaiting{};
+
+public:
+
+	Idx_Io_Awaiter(Idx_Io_Backend & io, unsigned char * buffer, const size_t & cb, const bool & bWrite);
+
+	bool await_ready() noexcept { return false; }
+	bool await_suspend(std::coroutine_handle<> handle);
+	int await_resume() noexcept { return iStatus; }
+
+	size_t getDone() const { return cbDone; }
+};
+
+class Idx_Async_Encryptor
+{
+private:
+
+	Idx_Encryptor encryptor{};
+	Idx_Executor & executor;
+	Idx_Io_Backend & io;
+	std::vector<unsigned char> buffer{};		// encrypted data, READ_BUFFER_SIZE at a time
+
+public:
+
+	/*
+	*	The encrypted stream is written to io
+	*/
+	Idx_Async_Encryptor(Idx_Executor & executor, Idx_Io_Backend & io);
+
+	Idx_Async_Encryptor(const Idx_Async_Encryptor & other) = delete;
+	Idx_Async_Encryptor & operator=(const Idx_Async_Encryptor & other) = delete;
+	Idx_Async_Encryptor(Idx_Async_Encryptor && other) = delete;
+	Idx_Async_Encryptor & operator=(Idx_Async_Encryptor && other) = delete;
+
+	/*
+	*	Idx_Encryptor::init, on the executor (key derivation)
+	*/
+	Idx_Task init(Hmac_PRF & prf, const char * szPassword, const size_t cbSalt);
+
+	Idx_Task restart();
+
+	Idx_Task write(const unsigned char * in, const size_t cbIn);
+
+	Idx_Task finish();
+};
+
+class Idx_Async_Decryptor
+{
+private:
+
+	Idx_Decryptor decryptor{};
+	Idx_Executor & executor;
+	Idx_Io_Backend & io;
+	std::vector<unsigned char> input{};			// encrypted data, READ_BUFFER_SIZE at a time
+	std::vector<unsigned char> output{};		// its decryption, until it is read
+	size_t cbOutput = 0;
+	size_t cbConsumed = 0;
+	bool bEnd = false;
+
+public:
+
+	/*
+	*	The encrypted stream is read from io
+	*/
+	Idx_Async_Decryptor(Idx_Executor & executor, Idx_Io_Backend & io);
+
+	Idx_Async_Decryptor(const Idx_Async_Decryptor & other) = delete;
+	Idx_Async_Decryptor & operator=(const Idx_Async_Decryptor & other) = delete;
+	Idx_Async_Decryptor(Idx_Async_Decryptor && other) = delete;
+	Idx_Async_Decryptor & operator=(Idx_Async_Decryptor && other) = delete;
+
+	/*
+	*	Idx_Decryptor::init. The key is derived on the executor, by the first read.
+	*/
+	Idx_Task init(Hmac_PRF & prf, const char * szPassword, const size_t cbSalt);
+
+	Idx_Task restart();
+
+	/*
+	*	Up to cb bytes of plaintext. cbRead is 0 at the end of the stream.
+	*/
+	Idx_Task read(unsigned char * out, const size_t cb, size_t & cbRead);
+};
+
+#endif // !IDX_HAS_COROUTINES
+
+#endif // !IDX_ASYNC_H
@@ -0,0 +1,446 @@
+/*
+*	=====================================
+*	Copyright (c) El Mostafa IDRASSI 2017
+*	mostafa.idrassi@tutanota.com
+*	Apache License
+*	=====================================
+*/
+
+#include "Idx_Compress.h"
+#include "mem_impl.h"							// my_memclr
+
+#include <atomic>
+#include <cstring>								// memcpy, memcmp
+#include <system_error>
+#include <thread>
+
+#define LZ4_MIN_MATCH			4
+#define LZ4_LAST_LITERALS		5				// the last bytes of a block are literals
+#define LZ4_MF_LIMIT			12				// no match starts in the last bytes of a block
+#define LZ4_MAX_OFFSET			65535
+#define LZ4_HASH_LOG			12
+
+static uint32_t read32(const unsigned char * p)
+{
+	uint32_t v = 0;
+
+	memcpy(&v, p, 4);
+
+	return v;
+}
+
+static uint32_t readLE32(const unsigned char * p)
+{
+	return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static void appendLE32(std::vector<unsigned char> & out, const uint32_t & v)
+{
+	for (int i = 0; i < 4; i++) out.push_back((unsigned char)(v >> (8 * i)));
+}
+
+static uint32_t hashSequence(const uint32_t & v)
+{
+	return (v * 2654435761U) >> (32 - LZ4_HASH_LOG);
+}
+
+/*
+* A length of 15 or more : 255 until the last byte
+*/
+static int writeLength(unsigned char * & op, const unsigned char * opEnd, size_t len)
+{
+	for (; len >= 255; len -= 255)
+	{
+		if (op >= opEnd) return 1;
+		*op++ = 255;
+	}
+
+	if (op >= opEnd) return 1;
+	*op++ = (unsigned char)len;
+
+	return 0;
+}
+
+static int readLength(const unsigned char * in, const size_t & cbIn, size_t & ip, size_t & len)
+{
+	unsigned char b = 255;
+
+	while (255 == b)
+	{
+		if (ip >= cbIn) return 1;
+		b = in[ip++];
+		len += b;
+	}
+
+	return 0;
+}
+
+/*
+* token | literals | offset (2 bytes LE) | rest of the match length. cbMatch == 0 : the last sequence, literals only.
+*/
+static int writeSequence(unsigned char * & op, const unsigned char * opEnd, const unsigned char * pbLiterals, const size_t & cbLiterals, const size_t & offset, size_t cbMatch)
+{
+	unsigned char* token = op;
+
+	if (op >= opEnd) return 1;
+
+	*op++ = (unsigned char)(((cbLiterals >= 15) ? 15 : cbLiterals) << 4);
+
+	if (cbLiterals >= 15 && 0 != writeLength(op, opEnd, cbLiterals - 15)) return 1;
+	if ((size_t)(opEnd - op) < cbLiterals) return 1;
+
+	memcpy(op, pbLiterals, cbLiterals);
+	op += cbLiterals;
+
+	if (0 == cbMatch) return 0;
+	if (opEnd - op < 2) return 1;
+
+	*op++ = (unsigned char)(offset & 0xFF);
+	*op++ = (unsigned char)(offset >> 8);
+
+	cbMatch -= LZ4_MIN_MATCH;
+	*token |= (unsigned char)((cbMatch >= 15) ? 15 : cbMatch);
+
+	if (cbMatch >= 15 && 0 != writeLength(op, opEnd, cbMatch - 15)) return 1;
+
+	return 0;
+}
+
+size_t getCompressBound(const size_t & cbIn)
+{
+	return cbIn + COMPRESS_FRAME_HEADER * ((cbIn + IDX_COMPRESS_BLOCK_SIZE - 1) / IDX_COMPRESS_BLOCK_SIZE);
+}
+
+int compressBlock(const unsigned char * in, const size_t & cbIn, unsigned char * out, const size_t & cbOut, size_t & cbWritten)
+{
+	uint32_t table[1 << LZ4_HASH_LOG] = {};		// position + 1 of the last sequence of each hash
+	unsigned char* op = out;
+	const unsigned char* opEnd = out + cbOut;
+	size_t anchor = 0, ip = 0, ref = 0, cMisses = 0, cbMatch = 0;
+	uint32_t v = 0, h = 0;
+
+	cbWritten = 0;
+
+	if (cbIn > IDX_COMPRESS_BLOCK_SIZE) return 1;
+
+	if (cbIn > LZ4_MF_LIMIT)
+	{
+		const size_t ipLimit = cbIn - LZ4_MF_LIMIT;
+		const size_t matchLimit = cbIn - LZ4_LAST_LITERALS;
+
+		while (ip < ipLimit)
+		{
+			v = read32(in + ip);
+			h = hashSequence(v);
+			ref = table[h];
+			table[h] = (uint32_t)(ip + 1);
+
+			if (0 == ref-- || ip - ref > LZ4_MAX_OFFSET || read32(in + ref) != v)
+			{
+				ip += 1 + (cMisses++ >> 6);		// the longer nothing matches, the faster it is skipped
+				continue;
+			}
+
+			cMisses = 0;
+
+			while (ip > anchor && ref > 0 && in[ip - 1] == in[ref - 1])
+			{
+				ip--;
+				ref--;
+			}
+
+			cbMatch = LZ4_MIN_MATCH;
+			while (ip + cbMatch + 8 <= matchLimit && 0 == memcmp(in + ip + cbMatch, in + ref + cbMatch, 8)) cbMatch += 8;
+			while (ip + cbMatch < matchLimit && in[ip + cbMatch] == in[ref + cbMatch]) cbMatch++;
+
+			if (0 != writeSequence(op, opEnd, in + anchor, ip - anchor, ip - ref, cbMatch)) return 1;
+
+			ip += cbMatch;
+			anchor = ip;
+
+			if (ip - 2 < ipLimit) table[hashSequence(read32(in + ip - 2))] = (uint32_t)(ip - 1);
+		}
+	}
+
+	if (0 != writeSequence(op, opEnd, in + anchor, cbIn - anchor, 0, 0)) return 1;
+
+	cbWritten = (size_t)(op - out);
+
+	return 0;
+}
+
+int decompressBlock(const unsigned char * in, const size_t & cbIn, unsigned char * out, const size_t & cbOut, size_t & cbWritten)
+{
+	size_t ip = 0, op = 0, cbLiterals = 0, cbMatch = 0, offset = 0;
+	unsigned char token = 0;
+
+	cbWritten = 0;
+
+	while (ip < cbIn)
+	{
+		token = in[ip++];
+		cbLiterals = token >> 4;
+
+		if (15 == cbLiterals && 0 != readLength(in, cbIn, ip, cbLiterals)) return 1;
+		if (cbLiterals > cbIn - ip || cbLiterals > cbOut - op) return 1;
+
+		memcpy(out + op, in + ip, cbLiterals);
+		ip += cbLiterals;
+		op += cbLiterals;
+
+		// The last sequence has no match
+		if (ip == cbIn) break;
+		if (cbIn - ip < 2) return 1;
+
+		offset = (size_t)in[ip] | ((size_t)in[ip + 1] << 8);
+		ip += 2;
+		cbMatch = token & 15;
+
+		if (15 == cbMatch && 0 != readLength(in, cbIn, ip, cbMatch)) return 1;
+
+		cbMatch += LZ4_MIN_MATCH;
+
+		if (0 == offset || offset > op || cbMatch > cbOut - op) return 1;
+
+		// A match may overlap the bytes it produces (a repeated pattern)
+		if (offset >= cbMatch) memcpy(out + op, out + op - offset, cbMatch);
+		else for (size_t i = 0; i < cbMatch; i++) out[op + i] = out[op - offset + i];
+
+		op += cbMatch;
+	}
+
+	cbWritten = op;
+
+	return 0;
+}
+
+std::vector<unsigned char> encodeCompression()
+{
+	std::vector<unsigned char> value{ IDX_CODEC_LZ4 };
+
+	appendLE32(value, IDX_COMPRESS_BLOCK_SIZE);
+
+	return value;
+}
+
+Block_Compressor::Block_Compressor()
+{
+}
+
+Block_Compressor::~Block_Compressor()
+{
+	clean();
+}
+
+void Block_Compressor::init(const size_t & cThreads)
+{
+	clean();
+
+	this->cThreads = (0 == cThreads) ? 1 : cThreads;
+}
+
+size_t Block_Compressor::getBatchSize() const
+{
+	return (cThreads > 1) ? cThreads * COMPRESS_BATCH_BLOCKS * IDX_COMPRESS_BLOCK_SIZE : IDX_COMPRESS_BLOCK_SIZE;
+}
+
+int Block_Compressor::compress(const unsigned char * in, const size_t & cbIn, std::vector<unsigned char> & out)
+{
+	size_t cBlocks = (cbIn + IDX_COMPRESS_BLOCK_SIZE - 1) / IDX_COMPRESS_BLOCK_SIZE;
+	std::vector<std::thread> threads{};
+	std::atomic<size_t> next{ 0 };
+
+	if (cBlocks > blocks.size())
+	{
+		blocks.resize(cBlocks);
+		lengths.resize(cBlocks);
+	}
+
+	// A block is kept compressed only if it is shorter
+	auto work = [&]() {
+		size_t i = 0, cb = 0;
+
+		while ((i = next++) < cBlocks)
+		{
+			cb = (cbIn - i * IDX_COMPRESS_BLOCK_SIZE < IDX_COMPRESS_BLOCK_SIZE) ? cbIn - i * IDX_COMPRESS_BLOCK_SIZE : IDX_COMPRESS_BLOCK_SIZE;
+			blocks[i].resize(IDX_COMPRESS_BLOCK_SIZE);
+
+			if (0 != compressBlock(in + i * IDX_COMPRESS_BLOCK_SIZE, cb, blocks[i].data(), cb - 1, lengths[i])) lengths[i] = 0;
+		}
+	};
+
+	// A thread that can't be created leaves its share to the others
+	try
+	{
+		for (size_t t = 1; t < cThreads && t < cBlocks; t++) threads.emplace_back(work);
+	}
+	catch (const std::system_error &) {}
+
+	work();
+
+	for (auto & thread : threads) thread.join();
+
+	for (size_t i = 0; i < cBlocks; i++)
+	{
+		const unsigned char* pbBlock = in + i * IDX_COMPRESS_BLOCK_SIZE;
+		size_t cb = (cbIn - i * IDX_COMPRESS_BLOCK_SIZE < IDX_COMPRESS_BLOCK_SIZE) ? cbIn - i * IDX_COMPRESS_BLOCK_SIZE : IDX_COMPRESS_BLOCK_SIZE;
+
+		if (0 != lengths[i])
+		{
+			appendLE32(out, (uint32_t)lengths[i]);
+			out.insert(out.end(), blocks[i].data(), blocks[i].data() + lengths[i]);
+		}
+		else
+		{
+			appendLE32(out, IDX_FRAME_STORED | (uint32_t)cb);
+			out.insert(out.end(), pbBlock, pbBlock + cb);
+		}
+	}
+
+	return 0;
+}
+
+void Block_Compressor::clean()
+{
+	for (auto & block : blocks) my_memclr(block.data(), block.size());
+
+	blocks.clear();
+	lengths.clear();
+	cThreads = 1;
+}
+
+Frame_Decoder::Frame_Decoder()
+{
+}
+
+Frame_Decoder::~Frame_Decoder()
+{
+	clean();
+}
+
+int Frame_Decoder::init(const std::vector<unsigned char> & record)
+{
+	clean();
+
+	if (5 != record.size() || IDX_CODEC_LZ4 != record[0]) return 1;
+
+	cbBlockSize = readLE32(record.data() + 1);
+
+	if (0 == cbBlockSize || cbBlockSize > IDX_COMPRESS_BLOCK_SIZE) return 1;
+
+	frame.resize(COMPRESS_FRAME_HEADER + cbBlockSize);
+	block.resize(cbBlockSize);
+
+	return 0;
+}
+
+void Frame_Decoder::feed(const unsigned char * pb, const size_t & cb)
+{
+	pbIn = pb;
+	cbIn = cb;
+}
+
+int Frame_Decoder::next(const unsigned char * & pbBlock, size_t & cbBlock)
+{
+	const unsigned char* pbFrame = nullptr;
+	size_t cbTake = 0, cbPayload = 0;
+	uint32_t frameHeader = 0;
+
+	cbBlock = 0;
+
+	if (0 == cbIn) return 0;
+
+	// The header of the frame : read in place, or gathered from pieces of the input
+	if (0 == cbFrame && cbIn >= COMPRESS_FRAME_HEADER)
+	{
+		frameHeader = readLE32(pbIn);
+	}
+	else
+	{
+		if (cbFrame < COMPRESS_FRAME_HEADER)
+		{
+			cbTake = (COMPRESS_FRAME_HEADER - cbFrame < cbIn) ? COMPRESS_FRAME_HEADER - cbFrame : cbIn;
+			memcpy(frame.data() + cbFrame, pbIn, cbTake);
+			cbFrame += cbTake;
+			pbIn += cbTake;
+			cbIn -= cbTake;
+
+			if (cbFrame < COMPRESS_FRAME_HEADER) return 0;
+		}
+
+		frameHeader = readLE32(frame.data());
+	}
+
+	cbPayload = frameHeader & ~IDX_FRAME_STORED;
+
+	if (0 == cbPayload || cbPayload > cbBlockSize || bShort) return 1;
+
+	// The whole frame in the input : used in place
+	if (0 == cbFrame)
+	{
+		if (cbIn >= COMPRESS_FRAME_HEADER + cbPayload)
+		{
+			pbFrame = pbIn + COMPRESS_FRAME_HEADER;
+			pbIn += COMPRESS_FRAME_HEADER + cbPayload;
+			cbIn -= COMPRESS_FRAME_HEADER + cbPayload;
+		}
+		else
+		{
+			memcpy(frame.data(), pbIn, cbIn);
+			cbFrame = cbIn;
+			cbIn = 0;
+			return 0;
+		}
+	}
+	else
+	{
+		cbTake = (COMPRESS_FRAME_HEADER + cbPayload - cbFrame < cbIn) ? COMPRESS_FRAME_HEADER + cbPayload - cbFrame : cbIn;
+		memcpy(frame.data() + cbFrame, pbIn, cbTake);
+		cbFrame += cbTake;
+		pbIn += cbTake;
+		cbIn -= cbTake;
+
+		if (cbFrame < COMPRESS_FRAME_HEADER + cbPayload) return 0;
+
+		pbFrame = frame.data() + COMPRESS_FRAME_HEADER;
+		cbFrame = 0;
+	}
+
+	if (frameHeader & IDX_FRAME_STORED)
+	{
+		pbBlock = pbFrame;
+		cbBlock = cbPayload;
+	}
+	else if (0 != decompressBlock(pbFrame, cbPayload, block.data(), cbBlockSize, cbBlock) || 0 == cbBlock)
+	{
+		cbBlock = 0;
+		return 1;
+	}
+	else
+	{
+		pbBlock = block.data();
+	}
+
+	// Only the last block of the stream may be shorter
+	bShort = (cbBlock < cbBlockSize);
+
+	return 0;
+}
+
+bool Frame_Decoder::atFrameEnd() const
+{
+	return 0 == cbFrame && 0 == cbIn;
+}
+
+void Frame_Decoder::clean()
+{
+	my_memclr(frame.data(), frame.size());
+	my_memclr(block.data(), block.size());
+	frame.clear();
+	block.clear();
+	pbIn = nullptr;
+	cbIn = 0;
+	cbFrame = 0;
+	cbBlockSize = 0;
+	bShort = false;
+}
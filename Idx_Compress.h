@@ -0,0 +1,139 @@
+/*
+*	=====================================
+*	Copyright (c) El Mostafa IDRASSI 2017
+*	mostafa.idrassi@tutanota.com
+*	Apache License
+*	=====================================
+*/
+
+#ifndef IDX_COMPRESS_H
+#define IDX_COMPRESS_H
+
+#include "Idx_Format.h"					// IDX_COMPRESS_BLOCK_SIZE, IDX_FRAME_STORED
+
+#include <cstddef>						// size_t
+#include <cstdint>
+#include <vector>
+
+#define COMPRESS_FRAME_HEADER		4
+#define COMPRESS_BATCH_BLOCKS		4							// blocks of a batch per thread
+
+/*
+*	=====================================================================================================
+*	 Compression of the plaintext before its encryption (IDX_FLAG_COMPRESSED, /compress)
+*
+*	 The plaintext is cut in IDX_COMPRESS_BLOCK_SIZE blocks, compressed independently in the LZ4 block
+*	 format (greedy matching, a 4096 entries hash table of the positions of the block) : logs and CSV
+*	 files shrink several times, at hundreds of MB/s per core. A block that doesn't shrink is stored as
+*	 it is, so the data grows by 4 bytes per block at worst. As the blocks don't depend on each other,
+*	 the blocks of a batch are compressed by several threads, and written in order.
+*	 Decompression is fused into the decryption : the frames are taken from the decrypted data as it
+*	 comes, whatever the size of the pieces, and one block at a time is given back.
+*	 The buffers hold plaintext : they are wiped by clean.
+*	=====================================================================================================
+*/
+
+/*
+*	Length of the frames of cbIn bytes of plaintext, at most
+*/
+size_t getCompressBound(const size_t & cbIn);
+
+/*
+*	Compresses a block (LZ4 block format). Returns 1 if it doesn't fit in cbOut bytes (the block should be stored).
+*/
+int compressBlock(const unsigned char * in, const size_t & cbIn, unsigned char * out, const size_t & cbOut, size_t & cbWritten);
+
+/*
+*	Decompresses a block into at most cbOut bytes. Returns 1 if in is not a valid block, or doesn't fit.
+*/
+int decompressBlock(const unsigned char * in, const size_t & cbIn, unsigned char * out, const size_t & cbOut, size_t & cbWritten);
+
+class Block_Compressor
+{
+private:
+
+	std::vector<std::vector<unsigned char>> blocks{};	// compressed blocks of the batch, before they are written in order
+	std::vector<size_t> lengths{};						// compressed length of each block, 0 if it is stored
+	size_t cThreads = 1;
+
+public:
+
+	Block_Compressor();
+
+	// Copy, Move constructor and assignment operators deleted : the object holds plaintext
+	Block_Compressor(const Block_Compressor & other) = delete;
+	Block_Compressor & operator=(const Block_Compressor & other) = delete;
+	Block_Compressor(Block_Compressor && other) = delete;
+	Block_Compressor & operator=(Block_Compressor && other) = delete;
+
+	~Block_Compressor();
+
+	void init(const size_t & cThreads);
+
+	/*
+	*	Plaintext to give to compress at a time : a few blocks per thread
+	*/
+	size_t getBatchSize() const;
+
+	/*
+	*	Appends to out the frames of in, compressed by the threads. Every block but the last of the stream must be full.
+	*/
+	int compress(const unsigned char * in, const size_t & cbIn, std::vector<unsigned char> & out);
+
+	void clean();
+};
+
+class Frame_Decoder
+{
+private:
+
+	std::vector<unsigned char> frame{};				// the frame being received : header, then payload
+	std::vector<unsigned char> block{};				// the last block decompressed
+	const unsigned char * pbIn = nullptr;			// input not consumed yet
+	size_t cbIn = 0;
+	size_t cbFrame = 0;								// bytes of the frame received
+	size_t cbBlockSize = 0;
+	bool bShort = false;							// a block shorter than cbBlockSize was given : it was the last
+
+public:
+
+	Frame_Decoder();
+
+	// Copy, Move constructor and assignment operators deleted : the object holds plaintext
+	Frame_Decoder(const Frame_Decoder & other) = delete;
+	Frame_Decoder & operator=(const Frame_Decoder & other) = delete;
+	Frame_Decoder(Frame_Decoder && other) = delete;
+	Frame_Decoder & operator=(Frame_Decoder && other) = delete;
+
+	~Frame_Decoder();
+
+	/*
+	*	Codec and size of the blocks, from the record IDX_EXT_COMPRESSION. Returns 1 if they are not supported.
+	*/
+	int init(const std::vector<unsigned char> & record);
+
+	/*
+	*	Data decrypted : it must remain valid until next returns cbBlock == 0
+	*/
+	void feed(const unsigned char * pb, const size_t & cb);
+
+	/*
+	*	The next block decompressed (valid until the next call), cbBlock == 0 once the input fed is consumed.
+	*	Returns 1 if a frame is not valid.
+	*/
+	int next(const unsigned char * & pbBlock, size_t & cbBlock);
+
+	/*
+	*	The input fed so far ends with a complete frame (the end of the stream must)
+	*/
+	bool atFrameEnd() const;
+
+	void clean();
+};
+
+/*
+*	The record IDX_EXT_COMPRESSION of the codec used by Block_Compressor
+*/
+std::vector<unsigned char> encodeCompression();
+
+#endif // !IDX_COMPRESS_H
@@ -0,0 +1,66 @@
+/*
+*	=====================================
+*	Copyright (c) El Mostafa IDRASSI 2017
+*	mostafa.idrassi@tutanota.com
+*	Apache License
+*	=====================================
+*/
+
+#include "Idx_Context.h"
+
+#include <new>									// bad_alloc
+
+std::unique_ptr<Hmac_PRF> clone(const Hmac_PRF & prf)
+{
+	return std::unique_ptr<Hmac_PRF>(new (std::nothrow) Hmac_PRF(prf));
+}
+
+std::unique_ptr<HMAC_Context> clone(const HMAC_Context & hmac)
+{
+	return std::unique_ptr<HMAC_Context>(new (std::nothrow) HMAC_Context(hmac));
+}
+
+Context_Pool::Context_Pool()
+{
+}
+
+Context_Pool::~Context_Pool()
+{
+	clean();
+}
+
+int Context_Pool::init(const Hmac_PRF & prf, const size_t & cWorkers)
+{
+	clean();
+	prfs.clear();
+
+	try
+	{
+		for (size_t i = 0; i < cWorkers; i++)
+		{
+			prfs.push_back(clone(prf));
+			if (!prfs.back()) return 1;
+		}
+	}
+	catch (const std::bad_alloc &)
+	{
+		return 1;
+	}
+
+	return 0;
+}
+
+Hmac_PRF & Context_Pool::get(const size_t & worker)
+{
+	return *prfs[worker];
+}
+
+size_t Context_Pool::size() const
+{
+	return prfs.size();
+}
+
+void Context_Pool::clean()
+{
+	for (auto & prf : prfs) if (prf) prf->cleanData();
+}
@@ -0,0 +1,74 @@
+/*
+*	=====================================
+*	Copyright (c) El Mostafa IDRASSI 2017
+*	mostafa.idrassi@tutanota.com
+*	Apache License
+*	=====================================
+*/
+
+#ifndef IDX_CONTEXT_H
+#define IDX_CONTEXT_H
+
+#include "Hmac_PRF.h"					// Hmac_PRF
+#include "HMAC_Context.h"				// HMAC_Context
+
+#include <cstddef>						// size_t
+#include <memory>
+#include <vector>
+
+/*
+*	=====================================================================================================
+*	 Crypto contexts and threads
+*
+*	 A Hmac_PRF or a HMAC_Context keeps its state between calls (PBKDF2 keys the PRF with the password
+*	 of each derivation) : it must be used by one thread at a time. An AES_CTX neither, and each file
+*	 has its own, on the stack of the thread processing it. The progress display is per thread.
+*	 The self-tests (Idx_SelfTest.h), the random generator (Idx_Random.h) and the secure arena
+*	 (Linux_Arena.h) may be called from any thread.
+*	 So that threads never share a context, nor lock around a crypto call, a context is cloned (copy :
+*	 algorithm, key and pads, without a new key schedule), and each worker of a pool takes its own
+*	 from a Context_Pool. A context being cloned must not be used meanwhile.
+*	=====================================================================================================
+*/
+
+std::unique_ptr<Hmac_PRF> clone(const Hmac_PRF & prf);
+
+std::unique_ptr<HMAC_Context> clone(const HMAC_Context & hmac);
+
+/*
+*	A clone of a PRF for each worker of a pool, ready to use : worker i only uses get(i)
+*/
+class Context_Pool
+{
+private:
+
+	std::vector<std::unique_ptr<Hmac_PRF>> prfs{};	// allocated one by one : two workers don't write to the same cache line
+
+public:
+
+	Context_Pool();
+
+	// Copy, Move constructor and assignment operators deleted : the object holds the contexts of running workers
+	Context_Pool(const Context_Pool & other) = delete;
+	Context_Pool & operator=(const Context_Pool & other) = delete;
+	Context_Pool(Context_Pool && other) = delete;
+	Context_Pool & operator=(Context_Pool && other) = delete;
+
+	~Context_Pool();
+
+	/*
+	*	cWorkers clones of prf (its algorithm set, keyed or not)
+	*/
+	int init(const Hmac_PRF & prf, const size_t & cWorkers);
+
+	Hmac_PRF & get(const size_t & worker);
+
+	size_t size() const;
+
+	/*
+	*	Wipes the contexts, once the workers are done
+	*/
+	void clean();
+};
+
+#endif // !IDX_CONTEXT_H
@@ -0,0 +1,504 @@
+/*
+*	=====================================
+*	Copyright (c) El Mostafa IDRASSI 2017
+*	mostafa.idrassi@tutanota.com
+*	Apache License
+*	=====================================
+*/
+
+#include "Idx_Engine.h"
+
+#include "File_Struct.h"						// STRONG_ITERATIONS, READ_BUFFER_SIZE, crypto libraries
+#include "Idx_Random.h"						// getRandomBytes
+#include "Idx_SelfTest.h"						// requireSelfTests
+#include "mem_impl.h"							// my_memclr
+
+#ifdef __linux__
+#include "Linux_Agent.h"						// Key_Agent_Client
+#endif
+
+#include <cstring>								// memcpy, memcmp, strlen
+
+#define STREAM_NONE			0					// not initialized
+#define STREAM_OPEN			1
+#define STREAM_FINISHED		2
+
+static int runSelfTests()
+{
+	int mode = getSelfTestMode();
+
+	if (SELFTEST_MODE_LAZY == mode || (SELFTEST_MODE_CACHED == mode && 0 == loadSelfTestCache())) return 0;
+
+	if (0 != requireSelfTests(SELFTEST_ALL)) return 1;
+
+	if (SELFTEST_MODE_CACHED == mode) saveSelfTestCache();
+
+	return 0;
+}
+
+int IdxLib_Init()
+{
+	static const int iStatus = runSelfTests();
+
+	return iStatus;
+}
+
+int deriveKey(Hmac_PRF & prf, const char szPassword[], const unsigned char pbSalt[], const size_t & cbSalt, unsigned char pbDerivedKey[32])
+{
+	// The derived key is cleared with my_memclr by the callers
+	if (0 != requireSelfTests(SELFTEST_KDF | SELFTEST_MEMCLR)) return 1;
+
+#ifdef __linux__
+	Key_Agent_Client agent{};
+
+	if (agent.isEnabled() && 0 == agent.getKey(prf.getHmacAlgo(), szPassword, pbSalt, cbSalt, pbDerivedKey)) return 0;
+#endif
+
+	if (0 != PBKDF2(prf, STRONG_ITERATIONS, (unsigned char*)szPassword, (unsigned int)strlen(szPassword), pbSalt, (unsigned int)cbSalt, pbDerivedKey, 32)) return 1;
+
+#ifdef __linux__
+	if (agent.isEnabled()) agent.addKey(prf.getHmacAlgo(), szPassword, pbSalt, cbSalt, pbDerivedKey);
+#endif
+
+	return 0;
+}
+
+size_t getEncryptedLength(const size_t & cbIn, const size_t & cbSalt)
+{
+	return IDX_PREFIX_SIZE(cbSalt) + (cbIn / 16 + 1) * 16;
+}
+
+static bool isValidSalt(const size_t & cbSalt)
+{
+	return 16 == cbSalt || 64 == cbSalt;
+}
+
+Idx_Encryptor::Idx_Encryptor()
+{
+}
+
+Idx_Encryptor::~Idx_Encryptor()
+{
+	clean();
+}
+
+/*
+* New IV, and the prefix of the stream : salt | IV | encrypted header
+*/
+int Idx_Encryptor::start()
+{
+	unsigned char pbIV[16]{};
+	unsigned char pbHeader[IDX_HEADER_SIZE]{};
+	size_t cbData = 0;
+	Idx_Header header{};
+	int iStatus = IDX_OK;
+
+	header.version = IDX_VERSION_2;
+
+	if (0 != getRandomBytes(pbIV, 16) || 0 != buildHeader(header, pbHeader) || 0 != requireSelfTests(SELFTEST_AES) || 0 != CreateCipher(ctx, CBC, pbKey, 256, pbIV, 1) ||
+		0 != OpCipher(ctx, pbHeader, IDX_HEADER_SIZE, pbHeader, IDX_HEADER_SIZE, cbData, 0))
+	{
+		iStatus = IDX_ERR_CRYPTO;
+		state = STREAM_NONE;
+	}
+	else
+	{
+		memcpy(pbPrefix, pbSalt, cbSalt);
+		memcpy(pbPrefix + cbSalt, pbIV, 16);
+		memcpy(pbPrefix + cbSalt + 16, pbHeader, IDX_HEADER_SIZE);
+
+		cbPrefix = IDX_PREFIX_SIZE(cbSalt);
+		cbBlock = 0;
+		totalLength = 0;
+		state = STREAM_OPEN;
+	}
+
+	my_memclr(pbIV, 16);
+
+	return iStatus;
+}
+
+int Idx_Encryptor::init(Hmac_PRF & prf, const char szPassword[], const size_t & cbSalt)
+{
+	clean();
+
+	if (nullptr == szPassword || strlen(szPassword) > IDX_MAX_PASSWORD || !isValidSalt(cbSalt)) return IDX_ERR_PARAM;
+
+	this->cbSalt = cbSalt;
+
+	if (0 != getRandomBytes(pbSalt, cbSalt) || 0 != deriveKey(prf, szPassword, pbSalt, cbSalt, pbKey))
+	{
+		clean();
+		return IDX_ERR_CRYPTO;
+	}
+
+	return start();
+}
+
+int Idx_Encryptor::init(const Idx_Encryptor & other)
+{
+	if (this == &other || 0 == other.cbSalt) return IDX_ERR_PARAM;
+
+	clean();
+
+	cbSalt = other.cbSalt;
+	memcpy(pbSalt, other.pbSalt, cbSalt);
+	memcpy(pbKey, other.pbKey, sizeof(pbKey));
+
+	return start();
+}
+
+int Idx_Encryptor::restart()
+{
+	if (0 == cbSalt) return IDX_ERR_PARAM;
+
+	return start();
+}
+
+size_t Idx_Encryptor::getUpdateLength(const size_t & cbIn) const
+{
+	return cbPrefix + ((cbBlock + cbIn) / 16) * 16;
+}
+
+int Idx_Encryptor::update(const unsigned char * in, const size_t & cbIn, unsigned char * out, const size_t & cbOut, size_t & cbWritten)
+{
+	size_t cbLeft = cbIn, cbData = 0, cbTake = 0;
+
+	cbWritten = 0;
+
+	if (STREAM_OPEN != state || (nullptr == in && 0 != cbIn)) return IDX_ERR_PARAM;
+	if (cbOut < getUpdateLength(cbIn)) return IDX_ERR_BUFFER;
+
+	memcpy(out, pbPrefix, cbPrefix);
+	cbWritten = cbPrefix;
+	cbPrefix = 0;
+
+	// Complete the block left by the previous update first
+	if (0 != cbBlock)
+	{
+		cbTake = (cbLeft < 16 - cbBlock) ? cbLeft : 16 - cbBlock;
+		memcpy(pbBlock + cbBlock, in, cbTake);
+		cbBlock += cbTake;
+		in += cbTake;
+		cbLeft -= cbTake;
+
+		if (16 == cbBlock)
+		{
+			if (0 != OpCipher(ctx, pbBlock, 16, out + cbWritten, 16, cbData, 0)) return IDX_ERR_CRYPTO;
+			cbWritten += 16;
+			cbBlock = 0;
+		}
+	}
+
+	// Then the whole blocks, straight from in, READ_BUFFER_SIZE bytes at a time as the command line
+	while (cbLeft >= 16)
+	{
+		cbTake = (cbLeft < READ_BUFFER_SIZE) ? (cbLeft / 16) * 16 : READ_BUFFER_SIZE;
+
+		if (0 != OpCipher(ctx, in, cbTake, out + cbWritten, cbTake, cbData, 0)) return IDX_ERR_CRYPTO;
+
+		cbWritten += cbTake;
+		in += cbTake;
+		cbLeft -= cbTake;
+	}
+
+	memcpy(pbBlock + cbBlock, in, cbLeft);
+	cbBlock += cbLeft;
+	totalLength += (__int64)cbIn;
+
+	return IDX_OK;
+}
+
+int Idx_Encryptor::finish(unsigned char * out, const size_t & cbOut, size_t & cbWritten)
+{
+	unsigned char pbLast[16]{};
+	size_t cbLast = 0;
+
+	cbWritten = 0;
+
+	if (STREAM_OPEN != state) return IDX_ERR_PARAM;
+	if (cbOut < cbPrefix + 16) return IDX_ERR_BUFFER;
+
+	if (0 != OpCipher(ctx, pbBlock, cbBlock, pbLast, sizeof(pbLast), cbLast, 1)) return IDX_ERR_CRYPTO;
+
+	memcpy(out, pbPrefix, cbPrefix);
+	memcpy(out + cbPrefix, pbLast, cbLast);
+	cbWritten = cbPrefix + cbLast;
+
+	cbPrefix = 0;
+	state = STREAM_FINISHED;
+	my_memclr(pbBlock, 16);
+
+	return IDX_OK;
+}
+
+int Idx_Encryptor::encrypt(const unsigned char * in, const size_t & cbIn, unsigned char * out, const size_t & cbOut, size_t & cbWritten)
+{
+	size_t cbUpdate = 0, cbFinish = 0;
+	int iStatus = IDX_OK;
+
+	cbWritten = 0;
+
+	if (STREAM_FINISHED == state && IDX_OK != (iStatus = restart())) return iStatus;
+	if (STREAM_OPEN != state || 0 != totalLength || 0 != cbBlock) return IDX_ERR_PARAM;
+	if (cbOut < getEncryptedLength(cbIn, cbSalt)) return IDX_ERR_BUFFER;
+
+	if (IDX_OK == (iStatus = update(in, cbIn, out, cbOut, cbUpdate)))
+		iStatus = finish(out + cbUpdate, cbOut - cbUpdate, cbFinish);
+
+	cbWritten = cbUpdate + cbFinish;
+
+	return iStatus;
+}
+
+void Idx_Encryptor::clean()
+{
+	ctx.cleanCtx();
+	my_memclr(pbKey, sizeof(pbKey));
+	my_memclr(pbSalt, sizeof(pbSalt));
+	my_memclr(pbPrefix, sizeof(pbPrefix));
+	my_memclr(pbBlock, sizeof(pbBlock));
+	cbSalt = 0;
+	cbPrefix = 0;
+	cbBlock = 0;
+	totalLength = 0;
+	state = STREAM_NONE;
+}
+
+Idx_Decryptor::Idx_Decryptor()
+{
+}
+
+Idx_Decryptor::~Idx_Decryptor()
+{
+	clean();
+}
+
+/*
+* The prefix is complete : key (unless it was derived from the same salt already), IV, then the header
+*/
+int Idx_Decryptor::start()
+{
+	unsigned char pbHeader[IDX_HEADER_SIZE]{};
+	size_t cbData = 0, cbExt = 0;
+	Idx_Header header{};
+	int iStatus = IDX_OK;
+
+	if (!bKey || 0 != memcmp(pbKeySalt, pbPrefix, cbSalt))
+	{
+		bKey = false;
+		if (0 != deriveKey(*prf, szPassword, pbPrefix, cbSalt, pbKey)) return IDX_ERR_CRYPTO;
+
+		memcpy(pbKeySalt, pbPrefix, cbSalt);
+		bKey = true;
+	}
+
+	if (0 != requireSelfTests(SELFTEST_AES) || 0 != CreateCipher(ctx, CBC, pbKey, 256, pbPrefix + cbSalt, 0) ||
+		0 != OpCipher(ctx, pbPrefix + cbSalt + 16, IDX_HEADER_SIZE, pbHeader, IDX_HEADER_SIZE, cbData, 0))
+	{
+		iStatus = IDX_ERR_CRYPTO;
+	}
+	else
+	{
+		iStatus = parseHeader(pbHeader, header, cbExt);
+
+		if (1 == iStatus) iStatus = IDX_ERR_PASSWORD;
+		// The extension records only describe sparse files, which need a file to be recreated
+		else if (2 == iStatus || 0 != cbExt || 0 != header.flags) iStatus = IDX_ERR_FORMAT;
+		else version = header.version;
+	}
+
+	my_memclr(pbHeader, IDX_HEADER_SIZE);
+
+	return iStatus;
+}
+
+int Idx_Decryptor::decryptBlocks(const unsigned char * in, const size_t & cbIn, unsigned char * out)
+{
+	size_t cbData = 0;
+
+	if (0 != OpCipher(ctx, in, cbIn, out, cbIn, cbData, 0)) return IDX_ERR_CRYPTO;
+
+	dataLength += (__int64)cbIn;
+
+	return IDX_OK;
+}
+
+int Idx_Decryptor::init(Hmac_PRF & prf, const char szPassword[], const size_t & cbSalt)
+{
+	clean();
+
+	if (nullptr == szPassword || strlen(szPassword) > IDX_MAX_PASSWORD || !isValidSalt(cbSalt)) return IDX_ERR_PARAM;
+
+	this->prf = &prf;
+	this->cbSalt = cbSalt;
+	memcpy(this->szPassword, szPassword, strlen(szPassword) + 1);
+	state = STREAM_OPEN;
+
+	return IDX_OK;
+}
+
+int Idx_Decryptor::restart()
+{
+	if (nullptr == prf) return IDX_ERR_PARAM;
+
+	my_memclr(pbPrefix, sizeof(pbPrefix));
+	my_memclr(pbBlock, sizeof(pbBlock));
+	cbPrefix = 0;
+	cbBlock = 0;
+	dataLength = 0;
+	version = 0;
+	state = STREAM_OPEN;
+
+	return IDX_OK;
+}
+
+size_t Idx_Decryptor::getUpdateLength(const size_t & cbIn) const
+{
+	size_t cbNeeded = IDX_PREFIX_SIZE(cbSalt) - cbPrefix;
+	size_t cbData = (cbIn > cbNeeded) ? cbIn - cbNeeded : 0;
+
+	return ((cbBlock + cbData) / 16) * 16;
+}
+
+int Idx_Decryptor::update(const unsigned char * in, const size_t & cbIn, unsigned char * out, const size_t & cbOut, size_t & cbWritten)
+{
+	size_t cbLeft = cbIn, cbTake = 0;
+	int iStatus = IDX_OK;
+
+	cbWritten = 0;
+
+	if (STREAM_OPEN != state || (nullptr == in && 0 != cbIn)) return IDX_ERR_PARAM;
+	if (cbOut < getUpdateLength(cbIn)) return IDX_ERR_BUFFER;
+
+	// salt | IV | header, gathered across updates
+	if (cbPrefix < IDX_PREFIX_SIZE(cbSalt))
+	{
+		cbTake = (cbLeft < IDX_PREFIX_SIZE(cbSalt) - cbPrefix) ? cbLeft : IDX_PREFIX_SIZE(cbSalt) - cbPrefix;
+		memcpy(pbPrefix + cbPrefix, in, cbTake);
+		cbPrefix += cbTake;
+		in += cbTake;
+		cbLeft -= cbTake;
+
+		if (cbPrefix < IDX_PREFIX_SIZE(cbSalt)) return IDX_OK;
+
+		if (IDX_OK != (iStatus = start()))
+		{
+			state = STREAM_FINISHED;
+			return iStatus;
+		}
+	}
+
+	// The last block received is only decrypted once more data follows it : it may be the padded one
+	while (cbLeft > 0)
+	{
+		if (16 == cbBlock)
+		{
+			if (IDX_OK != (iStatus = decryptBlocks(pbBlock, 16, out + cbWritten))) return iStatus;
+			cbWritten += 16;
+			cbBlock = 0;
+		}
+
+		if (0 != cbBlock || cbLeft <= 16)
+		{
+			cbTake = (cbLeft < 16 - cbBlock) ? cbLeft : 16 - cbBlock;
+			memcpy(pbBlock + cbBlock, in, cbTake);
+			cbBlock += cbTake;
+		}
+		else
+		{
+			// Whole blocks straight from in, all but the last one
+			cbTake = ((cbLeft - 1) / 16) * 16;
+			if (cbTake > READ_BUFFER_SIZE) cbTake = READ_BUFFER_SIZE;
+
+			if (IDX_OK != (iStatus = decryptBlocks(in, cbTake, out + cbWritten))) return iStatus;
+			cbWritten += cbTake;
+		}
+
+		in += cbTake;
+		cbLeft -= cbTake;
+	}
+
+	// Format 1 : the block which ends a whole block of the format is never padded
+	if (16 == cbBlock && !isPaddedEnd(version, dataLength + 16))
+	{
+		if (IDX_OK != (iStatus = decryptBlocks(pbBlock, 16, out + cbWritten))) return iStatus;
+		cbWritten += 16;
+		cbBlock = 0;
+	}
+
+	return IDX_OK;
+}
+
+int Idx_Decryptor::finish(unsigned char * out, const size_t & cbOut, size_t & cbWritten)
+{
+	unsigned char pbLast[16]{};
+	size_t cbLast = 0;
+	int iStatus = IDX_OK;
+
+	cbWritten = 0;
+
+	if (STREAM_OPEN != state) return IDX_ERR_PARAM;
+
+	// Format 1 ends either with a padded block, or at the end of a chunk. Format 2 always ends with a padded block.
+	if (cbPrefix < IDX_PREFIX_SIZE(cbSalt) || (16 != cbBlock && (0 != cbBlock || isPaddedEnd(version, dataLength) || 0 == dataLength)))
+	{
+		iStatus = IDX_ERR_TRUNCATED;
+	}
+	// Invalid padding : the stream was altered
+	else if (16 == cbBlock && 0 != OpCipher(ctx, pbBlock, 16, pbLast, 16, cbLast, 1))
+	{
+		iStatus = IDX_ERR_CRYPTO;
+	}
+	else if (cbOut < cbLast)
+	{
+		return IDX_ERR_BUFFER;
+	}
+	else
+	{
+		memcpy(out, pbLast, cbLast);
+		cbWritten = cbLast;
+	}
+
+	state = STREAM_FINISHED;
+	my_memclr(pbLast, 16);
+	my_memclr(pbBlock, 16);
+
+	return iStatus;
+}
+
+int Idx_Decryptor::decrypt(const unsigned char * in, const size_t & cbIn, unsigned char * out, const size_t & cbOut, size_t & cbWritten)
+{
+	size_t cbUpdate = 0, cbFinish = 0;
+	int iStatus = IDX_OK;
+
+	cbWritten = 0;
+
+	if (STREAM_FINISHED == state && IDX_OK != (iStatus = restart())) return iStatus;
+	if (STREAM_OPEN != state || 0 != cbPrefix) return IDX_ERR_PARAM;
+
+	if (IDX_OK == (iStatus = update(in, cbIn, out, cbOut, cbUpdate)))
+		iStatus = finish(out + cbUpdate, cbOut - cbUpdate, cbFinish);
+
+	cbWritten = cbUpdate + cbFinish;
+
+	return iStatus;
+}
+
+void Idx_Decryptor::clean()
+{
+	ctx.cleanCtx();
+	my_memclr(szPassword, sizeof(szPassword));
+	my_memclr(pbKey, sizeof(pbKey));
+	my_memclr(pbKeySalt, sizeof(pbKeySalt));
+	my_memclr(pbPrefix, sizeof(pbPrefix));
+	my_memclr(pbBlock, sizeof(pbBlock));
+	prf = nullptr;
+	cbSalt = 0;
+	cbPrefix = 0;
+	cbBlock = 0;
+	dataLength = 0;
+	bKey = false;
+	version = 0;
+	state = STREAM_NONE;
+}
@@ -0,0 +1,199 @@
+/*
+*	=====================================
+*	Copyright (c) El Mostafa IDRASSI 2017
+*	mostafa.idrassi@tutanota.com
+*	Apache License
+*	=====================================
+*/
+
+#ifndef IDX_ENGINE_H
+#define IDX_ENGINE_H
+
+#include "AesApiFuncs.h"				// AES_CTX
+#include "Hmac_PRF.h"					// Hmac_PRF
+#include "Idx_Format.h"					// IDX_HEADER_SIZE
+
+#include <cstddef>						// size_t
+
+#define IDX_OK					0
+#define IDX_ERR_PARAM			1		// invalid parameter, or call out of sequence (not initialized, already finished)
+#define IDX_ERR_BUFFER			2		// output buffer too small : nothing was consumed
+#define IDX_ERR_CRYPTO			3		// key derivation, cipher or random generator failure
+#define IDX_ERR_PASSWORD		4		// password incorrect, or not an encrypted stream
+#define IDX_ERR_FORMAT			5		// format not supported in memory (sparse files)
+#define IDX_ERR_TRUNCATED		6		// the encrypted stream ended too early
+#define IDX_ERR_IO				7		// read or write failure (Idx_Async.h, Idx_Merkle.h)
+#define IDX_ERR_CORRUPTED		8		// the encrypted data doesn't match its hash tree (Idx_Merkle.h)
+
+#define IDX_MAX_PASSWORD		128
+#define IDX_MAX_SALT			64
+#define IDX_PREFIX_SIZE(cbSalt)	((cbSalt) + 16 + IDX_HEADER_SIZE)		// salt | IV | encrypted header
+
+/*
+*	=====================================================================================================
+*	 MiD_idxcryptLib : the encryption engine of MiD_idxcrypt, for the programs that embed it
+*
+*	 Idx_Encryptor and Idx_Decryptor process a stream given in pieces of any size, in memory, in the
+*	 format of the command line (Idx_Format.h). The encryption is in format 2 : format 1 doesn't tell a
+*	 final 65536 bytes block which is padded from one which is not, so the length of the plaintext of
+*	 a stream read in pieces is not always recovered. The decryption reads formats 1 and 2 (without
+*	 sparse map, digest, hash tree, data key, compression nor volumes). Their buffers are members : once initialized, they don't allocate.
+*	 An object processes streams one after another : restart keeps the key, so that the next stream
+*	 doesn't cost a key derivation (same salt, new IV for the encryption ; the decryption derives the
+*	 key again only if the salt of the stream differs from the previous one).
+*	 The key derivation goes through the key agent if IDXCRYPT_AGENT is set (Linux_Agent.h).
+*	 The command line keeps its own loop (opFile, Linux_File.cpp) : it works on FILEs, format 1 by default,
+*	 and adds what a stream in memory doesn't have (sparse maps, digests, hash trees, data keys, compression,
+*	 volumes, checkpoints). Both take the format from Idx_Format.h (header, padding rule isPaddedEnd) and
+*	 the key from deriveKey, so that what one writes, the other reads.
+*	 An object must not be used by several threads at once, the Hmac_PRF given to it neither (Idx_Context.h).
+*	=====================================================================================================
+*/
+
+/*
+*	Self-tests of the 4 crypto libraries, once per process (thread-safe) : skipped if they passed with this binary
+*	on this CPU, or deferred to the first use of each library (Idx_SelfTest.h). Returns 0 if they all passed.
+*/
+int IdxLib_Init();
+
+/*
+*	PBKDF2 (STRONG_ITERATIONS), through the key agent if one is used
+*/
+int deriveKey(Hmac_PRF & prf, const char szPassword[], const unsigned char pbSalt[], const size_t & cbSalt, unsigned char pbDerivedKey[32]);
+
+/*
+*	Length of the encryption of cbIn bytes (format 2, without extension records)
+*/
+size_t getEncryptedLength(const size_t & cbIn, const size_t & cbSalt);
+
+class Idx_Encryptor
+{
+private:
+
+	AES_CTX ctx{};
+	unsigned char pbKey[32]{};
+	unsigned char pbSalt[IDX_MAX_SALT]{};
+	unsigned char pbPrefix[IDX_PREFIX_SIZE(IDX_MAX_SALT)]{};	// salt | IV | encrypted header, until written
+	unsigned char pbBlock[16]{};				// plaintext of the incomplete block
+	size_t cbSalt = 0;
+	size_t cbPrefix = 0;						// bytes of pbPrefix still to be written
+	size_t cbBlock = 0;
+	__int64 totalLength = 0;					// plaintext of the stream
+	int state = 0;
+
+	int start();
+
+public:
+
+	Idx_Encryptor();
+
+	// Copy, Move constructor and assignment operators deleted : the object holds a key
+	Idx_Encryptor(const Idx_Encryptor & other) = delete;
+	Idx_Encryptor & operator=(const Idx_Encryptor & other) = delete;
+	Idx_Encryptor(Idx_Encryptor && other) = delete;
+	Idx_Encryptor & operator=(Idx_Encryptor && other) = delete;
+
+	~Idx_Encryptor();
+
+	/*
+	*	New salt and key (cbSalt : 16 for sha256, 64 otherwise, as the command line), then starts a stream
+	*/
+	int init(Hmac_PRF & prf, const char szPassword[], const size_t & cbSalt);
+
+	/*
+	*	Same salt and key as other (initialized), then starts a stream : the workers of a pool share one key derivation
+	*/
+	int init(const Idx_Encryptor & other);
+
+	/*
+	*	Starts a new stream with the same salt and key, and a new IV
+	*/
+	int restart();
+
+	/*
+	*	Exact number of bytes that update writes for cbIn bytes of input
+	*/
+	size_t getUpdateLength(const size_t & cbIn) const;
+
+	int update(const unsigned char * in, const size_t & cbIn, unsigned char * out, const size_t & cbOut, size_t & cbWritten);
+
+	/*
+	*	Ends the stream (the padded last block, after the prefix if nothing was written yet)
+	*/
+	int finish(unsigned char * out, const size_t & cbOut, size_t & cbWritten);
+
+	/*
+	*	Encrypts a whole buffer as one stream (out : getEncryptedLength(cbIn, cbSalt) bytes).
+	*	An encryptor whose stream is finished is restarted first.
+	*/
+	int encrypt(const unsigned char * in, const size_t & cbIn, unsigned char * out, const size_t & cbOut, size_t & cbWritten);
+
+	void clean();
+};
+
+class Idx_Decryptor
+{
+private:
+
+	AES_CTX ctx{};
+	Hmac_PRF * prf = nullptr;
+	char szPassword[IDX_MAX_PASSWORD + 1]{};
+	unsigned char pbKey[32]{};
+	unsigned char pbKeySalt[IDX_MAX_SALT]{};	// salt pbKey was derived from
+	unsigned char pbPrefix[IDX_PREFIX_SIZE(IDX_MAX_SALT)]{};	// salt | IV | encrypted header, as they come
+	unsigned char pbBlock[16]{};				// ciphertext of the last block, kept until it is known whether it is padded
+	size_t cbSalt = 0;
+	size_t cbPrefix = 0;						// bytes of pbPrefix received
+	size_t cbBlock = 0;
+	__int64 dataLength = 0;						// ciphertext of the data decrypted so far
+	bool bKey = false;
+	int version = 0;
+	int state = 0;
+
+	int start();
+	int decryptBlocks(const unsigned char * in, const size_t & cbIn, unsigned char * out);
+
+public:
+
+	Idx_Decryptor();
+
+	// Copy, Move constructor and assignment operators deleted : the object holds a key and a password
+	Idx_Decryptor(const Idx_Decryptor & other) = delete;
+	Idx_Decryptor & operator=(const Idx_Decryptor & other) = delete;
+	Idx_Decryptor(Idx_Decryptor && other) = delete;
+	Idx_Decryptor & operator=(Idx_Decryptor && other) = delete;
+
+	~Idx_Decryptor();
+
+	/*
+	*	The key is derived once the salt of the stream is read. prf must remain valid until clean.
+	*/
+	int init(Hmac_PRF & prf, const char szPassword[], const size_t & cbSalt);
+
+	/*
+	*	Starts a new stream with the same password
+	*/
+	int restart();
+
+	/*
+	*	Number of bytes that update writes at most for cbIn bytes of input
+	*/
+	size_t getUpdateLength(const size_t & cbIn) const;
+
+	int update(const unsigned char * in, const size_t & cbIn, unsigned char * out, const size_t & cbOut, size_t & cbWritten);
+
+	/*
+	*	Ends the stream (at most 15 bytes : the last block, without its padding)
+	*/
+	int finish(unsigned char * out, const size_t & cbOut, size_t & cbWritten);
+
+	/*
+	*	Decrypts a whole buffer as one stream (out : cbIn bytes at most).
+	*	A decryptor whose stream is finished is restarted first.
+	*/
+	int decrypt(const unsigned char * in, const size_t & cbIn, unsigned char * out, const size_t & cbOut, size_t & cbWritten);
+
+	void clean();
+};
+
+#endif // !IDX_ENGINE_H
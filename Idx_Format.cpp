@@ -0,0 +1,179 @@
+/*
+*	=====================================
+*	Copyright (c) El Mostafa IDRASSI 2017
+*	mostafa.idrassi@tutanota.com
+*	Apache License
+*	=====================================
+*/
+
+#include "Idx_Format.h"
+
+#include <cstring>				// memcpy, memcmp
+
+/*
+* Little-endian encoding of the integers of the header and of the records
+*/
+static void putLE(std::vector<unsigned char> & out, unsigned long long value, const size_t & cbValue)
+{
+	for (size_t i = 0; i < cbValue; i++, value >>= 8) out.push_back((unsigned char)(value & 0xFF));
+}
+
+static unsigned long long getLE(const unsigned char * pbIn, const size_t & cbValue)
+{
+	unsigned long long value = 0;
+
+	for (size_t i = cbValue; i > 0; i--) value = (value << 8) | pbIn[i - 1];
+
+	return value;
+}
+
+void addExtRecord(Idx_Header & header, const unsigned short & type, const std::vector<unsigned char> & value)
+{
+	putLE(header.ext, type, 2);
+	putLE(header.ext, value.size(), 4);
+	header.ext.insert(header.ext.end(), value.begin(), value.end());
+}
+
+int buildHeader(Idx_Header & header, unsigned char pbHeader[IDX_HEADER_SIZE])
+{
+	std::vector<unsigned char> fixed{};
+
+	if (IDX_VERSION_1 == header.version)
+	{
+		memcpy(pbHeader, IDX_HEADER_V1, IDX_HEADER_SIZE);
+		return 0;
+	}
+
+	// Zero padding, read back as an IDX_EXT_END record
+	header.ext.resize((header.ext.size() + 15) / 16 * 16, 0);
+
+	if (header.ext.size() > IDX_MAX_EXT_LENGTH) return 1;
+
+	fixed.insert(fixed.end(), IDX_MAGIC, IDX_MAGIC + 8);
+	fixed.push_back((unsigned char)header.version);
+	fixed.push_back(header.flags);
+	putLE(fixed, 0, 2);
+	putLE(fixed, header.ext.size(), 4);
+
+	memcpy(pbHeader, fixed.data(), IDX_HEADER_SIZE);
+
+	return 0;
+}
+
+int parseHeader(const unsigned char pbHeader[IDX_HEADER_SIZE], Idx_Header & header, size_t & cbExt)
+{
+	cbExt = 0;
+
+	if (0 == memcmp(pbHeader, IDX_HEADER_V1, IDX_HEADER_SIZE))
+	{
+		header.version = IDX_VERSION_1;
+		header.flags = 0;
+		return 0;
+	}
+
+	// Anything else than "IDXCRYPT" + a version is what a wrong password gives
+	if (0 != memcmp(pbHeader, IDX_MAGIC, 8) || pbHeader[8] < IDX_VERSION_2 || 0 != getLE(pbHeader + 10, 2)) return 1;
+
+	header.version = pbHeader[8];
+	header.flags = pbHeader[9];
+	cbExt = (size_t)getLE(pbHeader + 12, 4);
+
+	if (IDX_VERSION_2 != header.version || 0 != (header.flags & ~IDX_KNOWN_FLAGS) || 0 != (cbExt % 16) || cbExt > IDX_MAX_EXT_LENGTH) return 2;
+
+	return 0;
+}
+
+bool isPaddedEnd(const int & version, const __int64 & dataLength)
+{
+	return IDX_VERSION_1 != version || 0 != dataLength % IDX_V1_BLOCK_SIZE;
+}
+
+int findExtRecord(const Idx_Header & header, const unsigned short & type, std::vector<unsigned char> & value)
+{
+	size_t pos = 0;
+
+	while (pos + 6 <= header.ext.size())
+	{
+		unsigned short recordType = (unsigned short)getLE(header.ext.data() + pos, 2);
+		size_t cbRecord = (size_t)getLE(header.ext.data() + pos + 2, 4);
+
+		if (IDX_EXT_END == recordType || cbRecord > header.ext.size() - pos - 6) break;
+
+		if (type == recordType)
+		{
+			value.assign(header.ext.begin() + pos + 6, header.ext.begin() + pos + 6 + cbRecord);
+			return 0;
+		}
+
+		pos += 6 + cbRecord;
+	}
+
+	return 1;
+}
+
+std::vector<unsigned char> encodeSparseMap(const __int64 & fileLength, const std::vector<Idx_Extent> & extents)
+{
+	std::vector<unsigned char> value{};
+
+	value.reserve(8 + 16 * extents.size());
+	putLE(value, (unsigned long long)fileLength, 8);
+
+	for (const Idx_Extent & extent : extents)
+	{
+		putLE(value, (unsigned long long)extent.offset, 8);
+		putLE(value, (unsigned long long)extent.length, 8);
+	}
+
+	return value;
+}
+
+int decodeSparseMap(const std::vector<unsigned char> & value, __int64 & fileLength, std::vector<Idx_Extent> & extents)
+{
+	__int64 end = 0;
+
+	extents.clear();
+
+	if (value.size() < 8 || 0 != ((value.size() - 8) % 16)) return 1;
+
+	fileLength = (__int64)getLE(value.data(), 8);
+	if (fileLength < 0) return 1;
+
+	for (size_t pos = 8; pos < value.size(); pos += 16)
+	{
+		Idx_Extent extent{ (__int64)getLE(value.data() + pos, 8), (__int64)getLE(value.data() + pos + 8, 8) };
+
+		if (extent.offset < end || extent.length <= 0 || extent.length > fileLength - extent.offset) return 1;
+
+		end = extent.offset + extent.length;
+		extents.push_back(extent);
+	}
+
+	return 0;
+}
+
+std::vector<unsigned char> encodeVolumes(const __int64 & volumeSize)
+{
+	std::vector<unsigned char> value{};
+
+	putLE(value, (unsigned long long)volumeSize, 8);
+
+	return value;
+}
+
+int decodeVolumes(const std::vector<unsigned char> & value, __int64 & volumeSize)
+{
+	if (8 != value.size()) return 1;
+
+	volumeSize = (__int64)getLE(value.data(), 8);
+
+	return (volumeSize > 0 && 0 == (volumeSize % 16)) ? 0 : 1;
+}
+
+__int64 getDataLength(const std::vector<Idx_Extent> & extents)
+{
+	__int64 dataLength = 0;
+
+	for (const Idx_Extent & extent : extents) dataLength += extent.length;
+
+	return dataLength;
+}
@@ -0,0 +1,145 @@
+/*
+*	=====================================
+*	Copyright (c) El Mostafa IDRASSI 2017
+*	mostafa.idrassi@tutanota.com
+*	Apache License
+*	=====================================
+*/
+
+#ifndef IDX_FORMAT_H
+#define IDX_FORMAT_H
+
+#ifdef __linux__
+#include "MyLinuxSysFunctions.h"		// __int64
+#endif
+
+#include <cstddef>						// size_t
+#include <vector>
+
+#define IDX_HEADER_SIZE			16
+#define IDX_HEADER_V1			"IDXCRYPTTPYRCXDI"		// format 1 : fixed header
+#define IDX_MAGIC				"IDXCRYPT"				// format >= 2 : magic, then version, flags and length of the extension records
+
+#define IDX_VERSION_1			1
+#define IDX_VERSION_2			2
+
+#define IDX_V1_BLOCK_SIZE		65536					// format 1 : the data is encrypted by blocks of that size, only a trailing shorter one is padded
+
+#define IDX_FLAG_SPARSE			0x01					// the data is made of the data extents of the input only (IDX_EXT_SPARSE_MAP)
+#define IDX_FLAG_DIGEST			0x02					// the data is followed by its SHA-256, before the padding
+#define IDX_FLAG_MERKLE			0x04					// the encrypted file ends with a hash tree of the encrypted data (Idx_Merkle.h)
+#define IDX_FLAG_ENVELOPE		0x08					// the data is encrypted with a random key, held by the header (IDX_EXT_DATA_KEY)
+#define IDX_FLAG_COMPRESSED		0x10					// the data is compressed before being encrypted (IDX_EXT_COMPRESSION, Idx_Compress.h)
+#define IDX_KNOWN_FLAGS			(IDX_FLAG_SPARSE | IDX_FLAG_DIGEST | IDX_FLAG_MERKLE | IDX_FLAG_ENVELOPE | IDX_FLAG_COMPRESSED)
+
+#define IDX_DIGEST_SIZE			32
+
+#define IDX_DATA_KEY_SIZE		48						// AES-256 key | IV of the data (IDX_FLAG_ENVELOPE)
+
+#define IDX_CODEC_LZ4			1						// LZ4 block format
+#define IDX_COMPRESS_BLOCK_SIZE	65536					// plaintext compressed at a time : each block is a frame
+#define IDX_FRAME_STORED		0x80000000				// frame header (4 bytes LE) : length of the payload, and this bit if it is not compressed
+
+#define IDX_MERKLE_CHUNK_SIZE	65536					// leaves of the tree : the encrypted data by chunks of that size, the last one shorter
+#define IDX_MERKLE_NODE_SIZE	32						// SHA-256
+#define IDX_MERKLE_FOOTER_SIZE	48						// number of chunks (8 bytes LE) | 0 (8 bytes) | HMAC-SHA256 of the root
+
+#define IDX_EXT_END				0						// padding : no more records
+#define IDX_EXT_SPARSE_MAP		1						// apparent size of the file, then (offset, length) of each data extent
+#define IDX_EXT_DATA_KEY		2						// key and IV of the data (IDX_DATA_KEY_SIZE bytes)
+#define IDX_EXT_COMPRESSION		3						// codec (1 byte), then size of the blocks (4 bytes LE)
+#define IDX_EXT_VOLUMES			4						// size of the volumes the file was written in (8 bytes LE)
+
+#define IDX_MAX_EXT_LENGTH		(16 * 1024 * 1024)		// the extension records are read in memory at once
+
+/*
+*	=====================================================================================================
+*	 Layout of an encrypted file
+*
+*	 salt | IV | AES-256-CBC( header | data ) [ | hash tree ]
+*
+*	 Format 1 : header = "IDXCRYPTTPYRCXDI". The data is split in 65536 bytes blocks, only a trailing
+*	            block < 65536 bytes is PKCS#7 padded.
+*	 Format 2 : header = "IDXCRYPT" | version (1 byte) | flags (1 byte) | 0 (2 bytes) | extLength (4 bytes LE)
+*	            followed by extLength bytes of extension records (type (2 bytes LE) | length (4 bytes LE) | value),
+*	            zero padded to a multiple of 16 bytes. The data always ends with PKCS#7 padding, so that its
+*	            last block is recognized whatever the length of the data.
+*	            With IDX_FLAG_DIGEST, the SHA-256 of the plaintext is encrypted between the data and the
+*	            padding : computed as the data is encrypted, and checked as it is decrypted.
+*	            With IDX_FLAG_MERKLE, the hash tree of the encrypted data follows it, in clear (Idx_Merkle.h) :
+*	            nodes level by level from the leaves to the root, then the footer.
+*	            With IDX_FLAG_ENVELOPE, the key derived from the password only encrypts the header and the
+*	            records : the data is encrypted with the key and IV of IDX_EXT_DATA_KEY, random for each file.
+*	            Changing the password rewrites salt | IV | encrypted header and records only (/rekey).
+*	            With IDX_FLAG_COMPRESSED, the data is a sequence of frames, one per block of plaintext :
+*	            a header (4 bytes LE), then the block compressed with the codec of IDX_EXT_COMPRESSION, or
+*	            as it is (IDX_FRAME_STORED) when it doesn't compress. Every block but the last is full.
+*	            With IDX_EXT_VOLUMES, the file was written in volumes of that size (File.idx.000, .001...) :
+*	            consecutive slices of it, every volume but the last one full (Linux_Volume.h).
+*
+*	 Format 1 remains the default, it is the only one the Windows version reads.
+*	=====================================================================================================
+*/
+
+struct Idx_Extent
+{
+	__int64 offset;
+	__int64 length;
+};
+
+struct Idx_Header
+{
+	int version = IDX_VERSION_1;
+	unsigned char flags = 0;
+	std::vector<unsigned char> ext{};		// extension records (format 2)
+};
+
+/*
+*	Appends an extension record to header.ext
+*/
+void addExtRecord(Idx_Header & header, const unsigned short & type, const std::vector<unsigned char> & value);
+
+/*
+*	Fills pbHeader with the fixed part of the header, and pads header.ext to a multiple of 16 bytes
+*	Returns 1 if the extension records are too long
+*/
+int buildHeader(Idx_Header & header, unsigned char pbHeader[IDX_HEADER_SIZE]);
+
+/*
+*	Reads the fixed part of a decrypted header. cbExt receives the length of the extension records that follow (format 2).
+*	Returns 0 if successful, 1 if pbHeader is not a valid header (wrong password), 2 if the format is not supported.
+*/
+int parseHeader(const unsigned char pbHeader[IDX_HEADER_SIZE], Idx_Header & header, size_t & cbExt);
+
+/*
+*	True if the data of a stream, dataLength bytes long, ends with a PKCS#7 padded block : always in format 2, in format 1
+*	only if it doesn't end with a whole IDX_V1_BLOCK_SIZE block (plaintext when encrypting, ciphertext when decrypting).
+*	The one rule of both engines : the command line (Linux_File.cpp) and MiD_idxcryptLib (Idx_Engine.h).
+*/
+bool isPaddedEnd(const int & version, const __int64 & dataLength);
+
+/*
+*	Looks for the record of type type in header.ext
+*	Returns 0 if found, 1 otherwise (or if the records are malformed)
+*/
+int findExtRecord(const Idx_Header & header, const unsigned short & type, std::vector<unsigned char> & value);
+
+/*
+*	IDX_EXT_SPARSE_MAP : apparent size (8 bytes LE), then offset and length (8 bytes LE each) of every data extent
+*	decodeSparseMap returns 1 if the extents are not sorted, overlap, are empty or go beyond the apparent size
+*/
+std::vector<unsigned char> encodeSparseMap(const __int64 & fileLength, const std::vector<Idx_Extent> & extents);
+int decodeSparseMap(const std::vector<unsigned char> & value, __int64 & fileLength, std::vector<Idx_Extent> & extents);
+
+/*
+*	IDX_EXT_VOLUMES : size of the volumes (8 bytes LE). decodeVolumes returns 1 if it is not a positive multiple of 16.
+*/
+std::vector<unsigned char> encodeVolumes(const __int64 & volumeSize);
+int decodeVolumes(const std::vector<unsigned char> & value, __int64 & volumeSize);
+
+/*
+*	Sum of the lengths of the extents
+*/
+__int64 getDataLength(const std::vector<Idx_Extent> & extents);
+
+#endif // !IDX_FORMAT_H
@@ -0,0 +1,436 @@
+/*
+*	=====================================
+*	Copyright (c) El Mostafa IDRASSI 2017
+*	mostafa.idrassi@tutanota.com
+*	Apache License
+*	=====================================
+*/
+
+#include "Idx_Merkle.h"
+
+#include "HMAC_Context.h"						// HMAC-SHA256 of the root
+#include "Idx_Engine.h"							// deriveKey, IDX_ERR_*
+#include "Idx_SelfTest.h"						// requireSelfTests
+#include "mem_impl.h"							// my_memclr
+
+#include <cstring>								// memcpy, strlen
+
+#ifdef __linux__
+#include "AesApiFuncs.h"						// AES_CTX
+
+#include <errno.h>
+#include <unistd.h>								// pread
+#include <sys/stat.h>
+#include <atomic>
+#include <mutex>
+#include <system_error>
+#include <thread>
+#endif
+
+#define NODE_LEAF				0x00			// domain of the hashes : a leaf never has the hash of a node
+#define NODE_PARENT				0x01
+
+/*
+* Nodes of a tree of cChunks leaves, the leaves first
+*/
+static std::vector<uint64_t> getLevelCounts(uint64_t cChunks)
+{
+	std::vector<uint64_t> counts{};
+
+	while (0 != cChunks)
+	{
+		counts.push_back(cChunks);
+		if (1 == cChunks) break;
+		cChunks = (cChunks + 1) / 2;
+	}
+
+	return counts;
+}
+
+static uint64_t getNodeCount(const uint64_t & cChunks)
+{
+	uint64_t cNodes = 0;
+
+	for (uint64_t count : getLevelCounts(cChunks)) cNodes += count;
+
+	return cNodes;
+}
+
+__int64 getMerkleTreeLength(const __int64 & dataLength)
+{
+	uint64_t cChunks = (dataLength <= 0) ? 0 : ((uint64_t)dataLength + IDX_MERKLE_CHUNK_SIZE - 1) / IDX_MERKLE_CHUNK_SIZE;
+
+	return (__int64)(getNodeCount(cChunks) * IDX_MERKLE_NODE_SIZE + IDX_MERKLE_FOOTER_SIZE);
+}
+
+static void putLE64(unsigned char pb[8], uint64_t value)
+{
+	for (size_t i = 0; i < 8; i++, value >>= 8) pb[i] = (unsigned char)(value & 0xFF);
+}
+
+static uint64_t getLE64(const unsigned char pb[8])
+{
+	uint64_t value = 0;
+
+	for (size_t i = 8; i > 0; i--) value = (value << 8) | pb[i - 1];
+
+	return value;
+}
+
+static int hashNode(HashContext & hash, const unsigned char pbLeft[IDX_MERKLE_NODE_SIZE], const unsigned char pbRight[IDX_MERKLE_NODE_SIZE], unsigned char out[IDX_MERKLE_NODE_SIZE])
+{
+	const char type = NODE_PARENT;
+
+	if (0 != hash.InitHashCtx() || 0 != hash.UpdateHashCtx(&type, 1) || 0 != hash.UpdateHashCtx((const char*)pbLeft, IDX_MERKLE_NODE_SIZE) ||
+		0 != hash.UpdateHashCtx((const char*)pbRight, IDX_MERKLE_NODE_SIZE) || 0 != hash.FinalHashCtx(out))
+		return 1;
+
+	return 0;
+}
+
+/*
+* HMAC-SHA256(HMAC-SHA256(key, MERKLE_KEY_LABEL), prefix | root | number of chunks) : the AES key itself is not used twice
+*/
+static int authenticateRoot(const unsigned char pbKey[32], const std::vector<unsigned char> & prefix, const unsigned char pbRoot[IDX_MERKLE_NODE_SIZE], const uint64_t & cChunks, unsigned char pbMac[32])
+{
+	std::vector<unsigned char> message(prefix);
+	unsigned char pbMacKey[32]{};
+	size_t cbMac = 0;
+	HMAC_Context hmac{};
+	int iStatus = 0;
+
+	message.insert(message.end(), pbRoot, pbRoot + IDX_MERKLE_NODE_SIZE);
+	message.resize(message.size() + 8);
+	putLE64(message.data() + message.size() - 8, cChunks);
+
+	if (0 != requireSelfTests(SELFTEST_HMAC) || 0 != hmac.setHPtr(sha256f) || 0 != hmac.setKey(pbKey, 32) ||
+		0 != hmac.HMAC((const unsigned char*)MERKLE_KEY_LABEL, strlen(MERKLE_KEY_LABEL), pbMacKey, cbMac) || 32 != cbMac ||
+		0 != hmac.setKey(pbMacKey, 32) || 0 != hmac.HMAC(message.data(), message.size(), pbMac, cbMac) || 32 != cbMac)
+		iStatus = 1;
+
+	hmac.cleanData();
+	my_memclr(pbMacKey, sizeof(pbMacKey));
+
+	return iStatus;
+}
+
+/*
+* A new SHA-256 context, nullptr on failure
+*/
+static HashContext* createHash()
+{
+	if (0 != requireSelfTests(SELFTEST_HASH)) return nullptr;
+
+	return HashContext::CreateHashContext(sha256);
+}
+
+Merkle_Builder::Merkle_Builder() {}
+
+Merkle_Builder::~Merkle_Builder()
+{
+	clean();
+}
+
+int Merkle_Builder::init(const unsigned char * pbPrefix, const size_t & cbPrefix)
+{
+	const char type = NODE_LEAF;
+
+	clean();
+
+	if (!hash && (hash.reset(createHash()), !hash)) return 1;
+
+	prefix.assign(pbPrefix, pbPrefix + cbPrefix);
+
+	return (0 == hash->InitHashCtx() && 0 == hash->UpdateHashCtx(&type, 1)) ? 0 : 1;
+}
+
+/*
+* Ends the leaf being hashed, and starts the next one
+*/
+int Merkle_Builder::endChunk()
+{
+	const char type = NODE_LEAF;
+
+	nodes.resize(nodes.size() + IDX_MERKLE_NODE_SIZE);
+
+	if (0 != hash->FinalHashCtx(nodes.data() + nodes.size() - IDX_MERKLE_NODE_SIZE)) return 1;
+
+	cChunks++;
+	cbChunk = 0;
+
+	return (0 == hash->InitHashCtx() && 0 == hash->UpdateHashCtx(&type, 1)) ? 0 : 1;
+}
+
+int Merkle_Builder::update(const unsigned char * pb, const size_t & cb)
+{
+	size_t cbDone = 0, cbTake = 0;
+
+	if (!hash) return 1;
+
+	while (cbDone < cb)
+	{
+		if (IDX_MERKLE_CHUNK_SIZE == cbChunk && 0 != endChunk()) return 1;
+
+		cbTake = (cb - cbDone < IDX_MERKLE_CHUNK_SIZE - cbChunk) ? cb - cbDone : IDX_MERKLE_CHUNK_SIZE - cbChunk;
+
+		if (0 != hash->UpdateHashCtx((const char*)pb + cbDone, cbTake)) return 1;
+
+		cbChunk += cbTake;
+		cbDone += cbTake;
+	}
+
+	return 0;
+}
+
+int Merkle_Builder::finish(const unsigned char pbKey[32], std::vector<unsigned char> & tree)
+{
+	std::vector<uint64_t> counts{};
+	size_t first = 0;						// first node of the level being reduced
+
+	// The last chunk, however short (the data always ends with a padded block)
+	if (!hash || (0 != cbChunk && 0 != endChunk()) || 0 == cChunks) return 1;
+
+	counts = getLevelCounts(cChunks);
+	nodes.reserve((size_t)getNodeCount(cChunks) * IDX_MERKLE_NODE_SIZE);
+
+	for (size_t level = 0; level + 1 < counts.size(); level++)
+	{
+		for (uint64_t i = 0; i < counts[level]; i += 2)
+		{
+			nodes.resize(nodes.size() + IDX_MERKLE_NODE_SIZE);
+
+			// After the resize, which may move the nodes
+			const unsigned char* pbLeft = nodes.data() + (first + i) * IDX_MERKLE_NODE_SIZE;
+
+			if (i + 1 == counts[level]) memcpy(nodes.data() + nodes.size() - IDX_MERKLE_NODE_SIZE, pbLeft, IDX_MERKLE_NODE_SIZE);
+			else if (0 != hashNode(*hash, pbLeft, pbLeft + IDX_MERKLE_NODE_SIZE, nodes.data() + nodes.size() - IDX_MERKLE_NODE_SIZE)) return 1;
+		}
+
+		first += (size_t)counts[level];
+	}
+
+	tree.assign(nodes.begin(), nodes.end());
+	tree.resize(tree.size() + IDX_MERKLE_FOOTER_SIZE);
+	putLE64(tree.data() + nodes.size(), cChunks);
+
+	return authenticateRoot(pbKey, prefix, nodes.data() + nodes.size() - IDX_MERKLE_NODE_SIZE, cChunks, tree.data() + nodes.size() + 16);
+}
+
+void Merkle_Builder::clean()
+{
+	if (hash) hash->cleanup();
+
+	prefix.clear();
+	nodes.clear();
+	cbChunk = 0;
+	cChunks = 0;
+}
+
+#ifdef __linux__
+
+/*
+* cb bytes at offset, read whatever the size of the reads the system makes
+*/
+static int readAt(int fd, unsigned char * pb, const size_t & cb, __int64 offset)
+{
+	size_t cbDone = 0;
+	ssize_t cbRead = 0;
+
+	while (cbDone < cb)
+	{
+		if ((cbRead = pread(fd, pb + cbDone, cb - cbDone, (off_t)offset + (off_t)cbDone)) < 0 && EINTR == errno) continue;
+		if (cbRead <= 0) return 1;
+
+		cbDone += (size_t)cbRead;
+	}
+
+	return 0;
+}
+
+Merkle_Reader::Merkle_Reader() {}
+
+Merkle_Reader::~Merkle_Reader() {}
+
+int Merkle_Reader::readNode(const uint64_t & index, unsigned char pbNode[IDX_MERKLE_NODE_SIZE]) const
+{
+	return readAt(fd, pbNode, IDX_MERKLE_NODE_SIZE, treeOffset + (__int64)(index * IDX_MERKLE_NODE_SIZE));
+}
+
+int Merkle_Reader::open(int fd, const __int64 & dataOffset, const unsigned char pbKey[32])
+{
+	unsigned char pbFooter[IDX_MERKLE_FOOTER_SIZE]{};
+	unsigned char pbMac[32]{};
+	unsigned char diff = 0;
+	std::vector<unsigned char> prefix((size_t)dataOffset);
+	struct stat stat_buf {};
+	__int64 cbTree = 0;
+
+	this->fd = fd;
+	this->dataOffset = dataOffset;
+
+	if (0 != fstat(fd, &stat_buf) || 0 != requireSelfTests(SELFTEST_HASH)) return IDX_ERR_IO;
+
+	if ((__int64)stat_buf.st_size < dataOffset + IDX_MERKLE_FOOTER_SIZE) return IDX_ERR_CORRUPTED;
+
+	if (0 != readAt(fd, pbFooter, IDX_MERKLE_FOOTER_SIZE, (__int64)stat_buf.st_size - IDX_MERKLE_FOOTER_SIZE) || 0 != readAt(fd, prefix.data(), prefix.size(), 0))
+		return IDX_ERR_IO;
+
+	// The number of chunks tells the length of the tree, hence of the data : they must agree
+	cChunks = getLE64(pbFooter);
+
+	if (0 == cChunks || cChunks > (uint64_t)stat_buf.st_size / IDX_MERKLE_CHUNK_SIZE + 1 || 0 != getLE64(pbFooter + 8)) return IDX_ERR_CORRUPTED;
+
+	levelCounts = getLevelCounts(cChunks);
+	levelFirsts.clear();
+
+	for (uint64_t count : levelCounts)
+	{
+		levelFirsts.push_back((uint64_t)cbTree / IDX_MERKLE_NODE_SIZE);
+		cbTree += (__int64)(count * IDX_MERKLE_NODE_SIZE);
+	}
+
+	treeOffset = (__int64)stat_buf.st_size - IDX_MERKLE_FOOTER_SIZE - cbTree;
+	dataLength = treeOffset - dataOffset;
+
+	if (dataLength <= 0 || 0 != (dataLength % 16) || ((uint64_t)dataLength + IDX_MERKLE_CHUNK_SIZE - 1) / IDX_MERKLE_CHUNK_SIZE != cChunks) return IDX_ERR_CORRUPTED;
+
+	if (0 != readNode(levelFirsts.back(), pbRoot)) return IDX_ERR_IO;
+
+	if (0 != authenticateRoot(pbKey, prefix, pbRoot, cChunks, pbMac)) return IDX_ERR_CRYPTO;
+
+	// Compared whole : the time taken doesn't tell how much of the HMAC is right
+	for (size_t i = 0; i < sizeof(pbMac); i++) diff |= (unsigned char)(pbMac[i] ^ pbFooter[16 + i]);
+
+	return (0 == diff) ? IDX_OK : IDX_ERR_CORRUPTED;
+}
+
+__int64 Merkle_Reader::getDataLength() const
+{
+	return dataLength;
+}
+
+uint64_t Merkle_Reader::getChunkCount() const
+{
+	return cChunks;
+}
+
+__int64 Merkle_Reader::getChunkOffset(const uint64_t & index) const
+{
+	return dataOffset + (__int64)(index * IDX_MERKLE_CHUNK_SIZE);
+}
+
+size_t Merkle_Reader::getChunkLength(const uint64_t & index) const
+{
+	if (index >= cChunks) return 0;
+
+	return (index + 1 < cChunks) ? IDX_MERKLE_CHUNK_SIZE : (size_t)(dataLength - (__int64)(index * IDX_MERKLE_CHUNK_SIZE));
+}
+
+int Merkle_Reader::verifyChunk(const uint64_t & index, const unsigned char * pb, const size_t & cb) const
+{
+	const char type = NODE_LEAF;
+	unsigned char pbNode[IDX_MERKLE_NODE_SIZE]{};
+	unsigned char pbSibling[IDX_MERKLE_NODE_SIZE]{};
+	std::unique_ptr<HashContext> hash(createHash());
+	uint64_t i = index;
+
+	if (index >= cChunks || cb != getChunkLength(index)) return IDX_ERR_PARAM;
+
+	if (!hash || 0 != hash->InitHashCtx() || 0 != hash->UpdateHashCtx(&type, 1) || 0 != hash->UpdateHashCtx((const char*)pb, cb) || 0 != hash->FinalHashCtx(pbNode))
+		return IDX_ERR_CRYPTO;
+
+	// Up to the root : a node without sibling goes up as it is
+	for (size_t level = 0; level + 1 < levelCounts.size(); level++, i /= 2)
+	{
+		if ((i ^ 1) >= levelCounts[level]) continue;
+
+		if (0 != readNode(levelFirsts[level] + (i ^ 1), pbSibling)) return IDX_ERR_IO;
+
+		if (0 != ((i & 1) ? hashNode(*hash, pbSibling, pbNode, pbNode) : hashNode(*hash, pbNode, pbSibling, pbNode))) return IDX_ERR_CRYPTO;
+	}
+
+	hash->cleanup();
+
+	return (0 == memcmp(pbNode, pbRoot, IDX_MERKLE_NODE_SIZE)) ? IDX_OK : IDX_ERR_CORRUPTED;
+}
+
+int Merkle_Reader::verifyAll(const size_t & cThreads, uint64_t & badChunk) const
+{
+	std::vector<std::thread> threads{};
+	std::atomic<uint64_t> next{ 0 };
+	std::atomic<bool> bStop{ false };
+	std::mutex mutex{};
+	int iStatus = IDX_OK;
+
+	badChunk = cChunks;
+
+	auto work = [&]() {
+		std::vector<unsigned char> chunk(IDX_MERKLE_CHUNK_SIZE);
+		uint64_t i = 0;
+		int iChunk = IDX_OK;
+
+		while (!bStop && (i = next++) < cChunks)
+		{
+			if (0 != readAt(fd, chunk.data(), getChunkLength(i), getChunkOffset(i))) iChunk = IDX_ERR_IO;
+			else iChunk = verifyChunk(i, chunk.data(), getChunkLength(i));
+
+			if (IDX_OK == iChunk) continue;
+
+			// The first chunk in the file, whichever thread finds it
+			std::lock_guard<std::mutex> lock(mutex);
+
+			if (IDX_OK == iStatus || i < badChunk)
+			{
+				iStatus = iChunk;
+				badChunk = i;
+			}
+
+			bStop = true;
+		}
+	};
+
+	// A thread that can't be created leaves its share to the others
+	try
+	{
+		for (size_t t = 1; t < cThreads && t < cChunks; t++) threads.emplace_back(work);
+	}
+	catch (const std::system_error &) {}
+
+	work();
+
+	for (auto & thread : threads) thread.join();
+
+	return iStatus;
+}
+
+int verifyMerkleFile(int fd, Hmac_PRF & prf, const char szPassword[], const size_t & cbSalt, const size_t & cThreads, uint64_t & badChunk)
+{
+	unsigned char pbPrefix[IDX_PREFIX_SIZE(IDX_MAX_SALT)]{};
+	unsigned char pbKey[32]{};
+	size_t cbData = 0, cbExt = 0;
+	Idx_Header header{};
+	Merkle_Reader reader{};
+	AES_CTX ctx{};
+	int iStatus = IDX_OK;
+
+	badChunk = UINT64_MAX;
+
+	if (cbSalt > IDX_MAX_SALT) return IDX_ERR_PARAM;
+
+	// salt | IV | encrypted header : the header tells whether the password is right, and where the data starts
+	if (0 != readAt(fd, pbPrefix, IDX_PREFIX_SIZE(cbSalt), 0)) iStatus = IDX_ERR_IO;
+	else if (0 != deriveKey(prf, szPassword, pbPrefix, cbSalt, pbKey) || 0 != requireSelfTests(SELFTEST_AES) ||
+		0 != CreateCipher(ctx, CBC, pbKey, 256, pbPrefix + cbSalt, 0) ||
+		0 != OpCipher(ctx, pbPrefix + cbSalt + 16, IDX_HEADER_SIZE, pbPrefix + cbSalt + 16, IDX_HEADER_SIZE, cbData, 0)) iStatus = IDX_ERR_CRYPTO;
+	else if (0 != (iStatus = parseHeader(pbPrefix + cbSalt + 16, header, cbExt))) iStatus = (1 == iStatus) ? IDX_ERR_PASSWORD : IDX_ERR_FORMAT;
+	else if (0 == (header.flags & IDX_FLAG_MERKLE)) iStatus = IDX_ERR_FORMAT;
+	else if (IDX_OK == (iStatus = reader.open(fd, (__int64)(IDX_PREFIX_SIZE(cbSalt) + cbExt), pbKey))) iStatus = reader.verifyAll(cThreads, badChunk);
+
+	ctx.cleanCtx();
+	my_memclr(pbKey, sizeof(pbKey));
+	my_memclr(pbPrefix, sizeof(pbPrefix));
+
+	return iStatus;
+}
+
+#endif
@@ -0,0 +1,154 @@
+/*
+*	=====================================
+*	Copyright (c) El Mostafa IDRASSI 2017
+*	mostafa.idrassi@tutanota.com
+*	Apache License
+*	=====================================
+*/
+
+#ifndef IDX_MERKLE_H
+#define IDX_MERKLE_H
+
+#include "HashContext.h"				// SHA-256
+#include "Hmac_PRF.h"					// Hmac_PRF
+#include "Idx_Format.h"					// IDX_MERKLE_*
+
+#include <cstddef>						// size_t
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#define MERKLE_KEY_LABEL		"IDXCRYPT merkle root"		// the key of the HMAC : HMAC-SHA256(key of the file, label)
+
+/*
+*	=====================================================================================================
+*	 Hash tree of an encrypted file (IDX_FLAG_MERKLE, /merkle)
+*
+*	 The encrypted data is split in IDX_MERKLE_CHUNK_SIZE chunks, the leaves of a binary tree of SHA-256
+*	 (HashContext) : leaf = SHA-256(0x00 | chunk), node = SHA-256(0x01 | left | right), and a node
+*	 without right child is its left child. The nodes are written after the data, level by level from
+*	 the leaves to the root, followed by the footer : the number of chunks, 8 zero bytes (the file remains
+*	 a multiple of 16 bytes) and an HMAC-SHA256 of salt | IV | encrypted header | root | number of chunks,
+*	 keyed from the key of the file.
+*	 Once the HMAC is checked, each chunk is checked on its own, from the siblings on its path to the
+*	 root (one node per level) : threads verify chunks in parallel, and a random-access read verifies
+*	 only the chunks it touches. The hashes are those of the ciphertext, so that a chunk is known to be
+*	 intact before anything is decrypted from it.
+*	 The tree takes 64 bytes per chunk (0.1 % of the file). Its leaves are kept in memory while a file
+*	 is encrypted (32 bytes per chunk).
+*	 IDX_FLAG_MERKLE itself is not authenticated (the IV can flip it) : a file stripped of its tree is
+*	 only refused by a reader which requires one (verifyMerkleFile, the decryption with /require merkle).
+*	=====================================================================================================
+*/
+
+/*
+*	Length of the tree and footer that follow dataLength bytes of encrypted data
+*/
+__int64 getMerkleTreeLength(const __int64 & dataLength);
+
+/*
+*	Builds the tree of the encrypted data as it is written
+*/
+class Merkle_Builder
+{
+private:
+
+	std::unique_ptr<HashContext> hash{};
+	std::vector<unsigned char> prefix{};			// salt | IV | encrypted header and extension records
+	std::vector<unsigned char> nodes{};				// the leaves, then the whole tree once finished
+	size_t cbChunk = 0;								// encrypted data hashed in the current leaf
+	uint64_t cChunks = 0;
+
+	int endChunk();
+
+public:
+
+	Merkle_Builder();
+
+	// Copy, Move constructor and assignment operators deleted : the object owns a hash context
+	Merkle_Builder(const Merkle_Builder & other) = delete;
+	Merkle_Builder & operator=(const Merkle_Builder & other) = delete;
+	Merkle_Builder(Merkle_Builder && other) = delete;
+	Merkle_Builder & operator=(Merkle_Builder && other) = delete;
+
+	~Merkle_Builder();
+
+	/*
+	*	Starts a tree : pbPrefix is what precedes the encrypted data in the file (salt | IV | encrypted header)
+	*/
+	int init(const unsigned char * pbPrefix, const size_t & cbPrefix);
+
+	/*
+	*	Adds the encrypted data written after the prefix, in pieces of any size
+	*/
+	int update(const unsigned char * pb, const size_t & cb);
+
+	/*
+	*	The tree and the footer to write after the data (getMerkleTreeLength bytes), authenticated with the key of the file
+	*/
+	int finish(const unsigned char pbKey[32], std::vector<unsigned char> & tree);
+
+	void clean();
+};
+
+#ifdef __linux__
+/*
+*	Verifies the chunks of an encrypted file against its tree, in place (pread : the file offset is not used)
+*	Its methods are const and thread-safe once open returned : several threads may verify chunks at once.
+*/
+class Merkle_Reader
+{
+private:
+
+	int fd = -1;
+	__int64 dataOffset = 0;							// prefix of the file
+	__int64 dataLength = 0;							// encrypted data
+	__int64 treeOffset = 0;
+	uint64_t cChunks = 0;
+	std::vector<uint64_t> levelCounts{};			// nodes of each level, the leaves first
+	std::vector<uint64_t> levelFirsts{};			// index of the first node of each level in the tree
+	unsigned char pbRoot[IDX_MERKLE_NODE_SIZE]{};
+
+	int readNode(const uint64_t & index, unsigned char pbNode[IDX_MERKLE_NODE_SIZE]) const;
+
+public:
+
+	Merkle_Reader();
+	~Merkle_Reader();
+
+	/*
+	*	Reads the footer and checks the HMAC of the root. dataOffset : length of salt | IV | encrypted header.
+	*	Returns IDX_OK, IDX_ERR_IO, or IDX_ERR_CORRUPTED if the tree is not the one of the file or the key is not its key.
+	*/
+	int open(int fd, const __int64 & dataOffset, const unsigned char pbKey[32]);
+
+	__int64 getDataLength() const;
+	uint64_t getChunkCount() const;
+
+	/*
+	*	Offset in the file and length of a chunk
+	*/
+	__int64 getChunkOffset(const uint64_t & index) const;
+	size_t getChunkLength(const uint64_t & index) const;
+
+	/*
+	*	Checks that pb is the chunk index (its hash and the siblings on its path give the root).
+	*	Returns IDX_OK, IDX_ERR_IO, IDX_ERR_PARAM (no such chunk) or IDX_ERR_CORRUPTED.
+	*/
+	int verifyChunk(const uint64_t & index, const unsigned char * pb, const size_t & cb) const;
+
+	/*
+	*	Reads and checks every chunk, cThreads at a time. badChunk receives the first chunk found corrupted.
+	*/
+	int verifyAll(const size_t & cThreads, uint64_t & badChunk) const;
+};
+
+/*
+*	Derives the key of the encrypted file fd (IDX_FLAG_MERKLE) and verifies its data against its tree with cThreads threads,
+*	without decrypting it. Returns IDX_OK, IDX_ERR_PASSWORD, IDX_ERR_FORMAT (no tree), IDX_ERR_CORRUPTED (badChunk is set
+*	if a chunk is), IDX_ERR_IO or IDX_ERR_CRYPTO.
+*/
+int verifyMerkleFile(int fd, Hmac_PRF & prf, const char szPassword[], const size_t & cbSalt, const size_t & cThreads, uint64_t & badChunk);
+#endif
+
+#endif // !IDX_MERKLE_H
@@ -0,0 +1,198 @@
+/*
+*	=====================================
+*	Copyright (c) El Mostafa IDRASSI 2017
+*	mostafa.idrassi@tutanota.com
+*	Apache License
+*	=====================================
+*/
+
+#include "Idx_Random.h"
+
+#include "File_Struct.h"						// AES, RAND_bytes
+
+#ifdef __linux__
+
+#include "Idx_SelfTest.h"						// requireSelfTests
+#include "mem_impl.h"							// my_memclr
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>							// pthread_atfork
+#include <unistd.h>
+#include <sys/syscall.h>						// SYS_getrandom
+#include <atomic>
+#include <cstring>								// memcpy
+
+#define RANDOM_SEED_SIZE		48				// AES-256 key | initial counter
+
+static std::atomic<unsigned long> forkGeneration{ 0 };
+
+static void onFork()
+{
+	forkGeneration++;
+}
+
+/*
+* Seed material from the kernel (getrandom, else /dev/urandom on kernels older than 3.17)
+*/
+static int getSystemRandom(unsigned char * out, const size_t & cb)
+{
+	size_t cbDone = 0;
+	ssize_t cbRead = 0;
+	int fd = -1;
+
+#ifdef SYS_getrandom
+	while (cbDone < cb)
+	{
+		if ((cbRead = syscall(SYS_getrandom, out + cbDone, cb - cbDone, 0)) < 0)
+		{
+			if (EINTR == errno) continue;
+			break;
+		}
+
+		cbDone += (size_t)cbRead;
+	}
+
+	if (cbDone == cb) return 0;
+	if (ENOSYS != errno) return 1;
+#endif
+
+	if ((fd = open("/dev/urandom", O_RDONLY | O_CLOEXEC)) < 0) return 1;
+
+	cbDone = 0;
+
+	while (cbDone < cb)
+	{
+		if ((cbRead = read(fd, out + cbDone, cb - cbDone)) < 0 && EINTR == errno) continue;
+		if (cbRead <= 0) break;
+
+		cbDone += (size_t)cbRead;
+	}
+
+	close(fd);
+
+	return (cbDone == cb) ? 0 : 1;
+}
+
+/*
+*	=====================================================================================================
+*	 Generator of a thread
+*	=====================================================================================================
+*/
+class Random_Generator
+{
+private:
+
+	AES_CTX ctx{};
+	unsigned char pbPool[RANDOM_SEED_SIZE + RANDOM_POOL_SIZE]{};		// next key and counter | bytes to serve
+	size_t cbLeft = 0;							// bytes of the pool not served yet (at its end)
+	size_t cbServed = 0;						// since the last seed
+	unsigned long generation = 0;				// forkGeneration when seeded
+	bool bSeeded = false;
+
+	int setKey(const unsigned char pbSeed[RANDOM_SEED_SIZE])
+	{
+		ctx.cleanCtx();
+
+		return CreateCipher(ctx, CTR, pbSeed, 256, pbSeed + 32, 1);
+	}
+
+	int seed()
+	{
+		static const int iAtFork = pthread_atfork(nullptr, nullptr, onFork);
+		unsigned char pbSeed[RANDOM_SEED_SIZE]{};
+		int iStatus = 1;
+
+		if (0 == iAtFork && 0 == requireSelfTests(SELFTEST_AES) && 0 == getSystemRandom(pbSeed, RANDOM_SEED_SIZE))
+		{
+			generation = forkGeneration.load();
+			iStatus = setKey(pbSeed);
+		}
+
+		my_memclr(pbSeed, RANDOM_SEED_SIZE);
+
+		cbLeft = 0;
+		cbServed = 0;
+		bSeeded = (0 == iStatus);
+
+		return iStatus;
+	}
+
+	/*
+	* The keystream over a zeroed pool, whose first bytes become the next key and counter
+	*/
+	int refill()
+	{
+		size_t cbData = 0;
+
+		my_memclr(pbPool, sizeof(pbPool));
+
+		if (0 != OpCipher(ctx, pbPool, sizeof(pbPool), pbPool, sizeof(pbPool), cbData, 0) || sizeof(pbPool) != cbData || 0 != setKey(pbPool))
+		{
+			bSeeded = false;
+			return 1;
+		}
+
+		my_memclr(pbPool, RANDOM_SEED_SIZE);
+		cbLeft = RANDOM_POOL_SIZE;
+
+		return 0;
+	}
+
+public:
+
+	Random_Generator() {}
+
+	// Copy, Move constructor and assignment operators deleted : the object holds a key
+	Random_Generator(const Random_Generator & other) = delete;
+	Random_Generator & operator=(const Random_Generator & other) = delete;
+	Random_Generator(Random_Generator && other) = delete;
+	Random_Generator & operator=(Random_Generator && other) = delete;
+
+	~Random_Generator()
+	{
+		ctx.cleanCtx();
+		my_memclr(pbPool, sizeof(pbPool));
+	}
+
+	int generate(unsigned char * out, const size_t & cb)
+	{
+		size_t cbDone = 0, cbTake = 0;
+
+		if ((!bSeeded || generation != forkGeneration.load() || cbServed >= RANDOM_RESEED_BYTES) && 0 != seed()) return 1;
+
+		while (cbDone < cb)
+		{
+			if (0 == cbLeft && 0 != refill()) return 1;
+
+			cbTake = (cb - cbDone < cbLeft) ? cb - cbDone : cbLeft;
+
+			// Wiped as soon as served
+			memcpy(out + cbDone, pbPool + sizeof(pbPool) - cbLeft, cbTake);
+			my_memclr(pbPool + sizeof(pbPool) - cbLeft, cbTake);
+
+			cbLeft -= cbTake;
+			cbDone += cbTake;
+		}
+
+		cbServed += cb;
+
+		return 0;
+	}
+};
+
+int getRandomBytes(unsigned char * out, const size_t & cb)
+{
+	static thread_local Random_Generator generator{};
+
+	return generator.generate(out, cb);
+}
+
+#else
+
+int getRandomBytes(unsigned char * out, const size_t & cb)
+{
+	return (1 == RAND_bytes(out, (int)cb)) ? 0 : 1;
+}
+
+#endif
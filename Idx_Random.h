@@ -0,0 +1,36 @@
+/*
+*	=====================================
+*	Copyright (c) El Mostafa IDRASSI 2017
+*	mostafa.idrassi@tutanota.com
+*	Apache License
+*	=====================================
+*/
+
+#ifndef IDX_RANDOM_H
+#define IDX_RANDOM_H
+
+#include <cstddef>						// size_t
+
+#define RANDOM_POOL_SIZE		4096					// bytes generated at a time, then served from the pool
+#define RANDOM_RESEED_BYTES		((size_t)1 << 20)		// fresh seed from the kernel once that many bytes were served
+
+/*
+*	=====================================================================================================
+*	 Salts and IVs
+*
+*	 Each thread has its own generator : AES-256-CTR keyed by 48 bytes of getrandom (key | counter), so
+*	 that the threads of a job never share a lock, and a file costs no system call. The output is
+*	 generated RANDOM_POOL_SIZE bytes at a time, and the bytes served are wiped from the pool. Every
+*	 refill replaces the key and the counter by the first 48 bytes it generates, so that the state of a
+*	 generator doesn't reveal what it served before ; getrandom seeds it again every RANDOM_RESEED_BYTES
+*	 bytes, and in a child process after a fork (the parent and the child never serve the same bytes).
+*	 On Windows, the bytes come from RAND_bytes (OpenSSL).
+*	=====================================================================================================
+*/
+
+/*
+*	cb random bytes. Returns 0 on success.
+*/
+int getRandomBytes(unsigned char * out, const size_t & cb);
+
+#endif // !IDX_RANDOM_H
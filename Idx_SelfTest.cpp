@@ -0,0 +1,205 @@
+/*
+*	=====================================
+*	Copyright (c) El Mostafa IDRASSI 2017
+*	mostafa.idrassi@tutanota.com
+*	Apache License
+*	=====================================
+*/
+
+#include "Idx_SelfTest.h"
+
+#include "File_Struct.h"						// crypto libraries
+#include "Idx_TreeHash.h"						// TreeHash_Init
+#include "mem_impl.h"							// MemClr_Init
+
+#include <atomic>
+#include <cstdlib>								// getenv
+#include <cstring>								// memcpy, memcmp, strcmp
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+
+#ifdef __linux__
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/auxv.h>							// getauxval
+#include <sys/mman.h>
+#include <sys/stat.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#endif
+#endif
+
+static std::atomic<unsigned int> passedTests{ 0 };
+static std::atomic<unsigned int> failedTests{ 0 };
+static std::mutex testMutex{};
+
+int getSelfTestMode()
+{
+	const char* szMode = getenv(SELFTEST_ENV);
+
+	if (nullptr != szMode && 0 == strcmp(szMode, "always")) return SELFTEST_MODE_ALWAYS;
+	if (nullptr != szMode && 0 == strcmp(szMode, "lazy")) return SELFTEST_MODE_LAZY;
+
+	return SELFTEST_MODE_CACHED;
+}
+
+int requireSelfTests(const unsigned int & tests)
+{
+	static const struct { unsigned int test; int(*run)(); const char* szName; } libs[] = {
+		{ SELFTEST_HASH, HashLib_Init, "HashLib" },
+		{ SELFTEST_HMAC, HMACLib_Init, "HmacLib" },
+		{ SELFTEST_PBKDF2, PBKDF2_Init, "PBKDF2" },
+		{ SELFTEST_AES, AesLib_Init, "AesLib" },
+		{ SELFTEST_TREEHASH, TreeHash_Init, "TreeHash" },
+		{ SELFTEST_MEMCLR, MemClr_Init, "my_memclr" },
+	};
+
+	// Once they passed, a check without lock : this is on the path of every key derivation and cipher context
+	if (tests == (passedTests.load() & tests)) return 0;
+
+	std::lock_guard<std::mutex> lock(testMutex);
+
+	for (const auto & lib : libs)
+	{
+		if (0 == (tests & lib.test) || 0 != ((passedTests.load() | failedTests.load()) & lib.test)) continue;
+
+		if (0 == lib.run())
+		{
+			passedTests |= lib.test;
+		}
+		else
+		{
+			failedTests |= lib.test;
+			std::cerr << "\nThe self-test of " << lib.szName << " failed.\n";
+		}
+	}
+
+	return (tests == (passedTests.load() & tests)) ? 0 : 1;
+}
+
+#ifdef __linux__
+
+static std::string getCachePath()
+{
+	const char* szDir = getenv("XDG_CACHE_HOME");
+	std::string dir{};
+
+	if (nullptr != szDir && '/' == szDir[0]) dir = szDir;
+	else if (nullptr != (szDir = getenv("HOME")) && '/' == szDir[0]) dir = std::string(szDir) + "/.cache";
+	else return std::string();
+
+	if (0 != mkdir(dir.data(), 0700) && EEXIST != errno) return std::string();
+
+	return dir + "/idxcrypt-selftest";
+}
+
+/*
+* SHA-256 of the binary and of the CPU : identification and features (cpuid on x86), and those reported by the kernel
+*/
+static int getFingerprint(unsigned char pbFingerprint[32])
+{
+	std::unique_ptr<HashContext> hash(HashContext::CreateHashContext(sha256));
+	struct stat stat_buf {};
+	unsigned long hwcaps[2] = { getauxval(AT_HWCAP), getauxval(AT_HWCAP2) };
+	const char* szPlatform = (const char*)getauxval(AT_PLATFORM);
+	void* binary = MAP_FAILED;
+	int fd = -1;
+	int iStatus = 1;
+
+	if (!hash || 0 != hash->InitHashCtx()) return 1;
+
+	if ((fd = open("/proc/self/exe", O_RDONLY | O_CLOEXEC)) >= 0 && 0 == fstat(fd, &stat_buf) && stat_buf.st_size > 0 &&
+		MAP_FAILED != (binary = mmap(nullptr, (size_t)stat_buf.st_size, PROT_READ, MAP_PRIVATE, fd, 0)))
+	{
+		iStatus = hash->UpdateHashCtx((const char*)binary, (size_t)stat_buf.st_size);
+		munmap(binary, (size_t)stat_buf.st_size);
+	}
+
+	if (fd >= 0) close(fd);
+
+#if defined(__x86_64__) || defined(__i386__)
+	unsigned int regs[3][4]{};
+
+	// Vendor, family / model / stepping and features, extended features
+	__cpuid(0, regs[0][0], regs[0][1], regs[0][2], regs[0][3]);
+	if (regs[0][0] >= 1) __cpuid(1, regs[1][0], regs[1][1], regs[1][2], regs[1][3]);
+	if (regs[0][0] >= 7) __cpuid_count(7, 0, regs[2][0], regs[2][1], regs[2][2], regs[2][3]);
+
+	regs[1][1] &= 0x0000FFFF;		// APIC id and logical processor count : the same CPU, whichever core runs the process
+
+	if (0 == iStatus) iStatus = hash->UpdateHashCtx((const char*)regs, sizeof(regs));
+#endif
+
+	if (0 == iStatus) iStatus = hash->UpdateHashCtx((const char*)hwcaps, sizeof(hwcaps));
+	if (0 == iStatus && nullptr != szPlatform) iStatus = hash->UpdateHashCtx(szPlatform, strlen(szPlatform));
+	if (0 == iStatus) iStatus = hash->FinalHashCtx(pbFingerprint);
+
+	hash->cleanup();
+
+	return iStatus;
+}
+
+int loadSelfTestCache()
+{
+	std::string path = getCachePath();
+	SelfTest_Cache cache{};
+	unsigned char pbFingerprint[32]{};
+	struct stat stat_buf {};
+	int fd = -1;
+	int iStatus = 1;
+
+	if (path.empty() || (fd = open(path.data(), O_RDONLY | O_CLOEXEC | O_NOFOLLOW)) < 0) return 1;
+
+	// Only a file of the user, which no one else can write, is trusted
+	if (0 == fstat(fd, &stat_buf) && S_ISREG(stat_buf.st_mode) && stat_buf.st_uid == geteuid() && 0 == (stat_buf.st_mode & 0022) &&
+		sizeof(cache) == read(fd, &cache, sizeof(cache)) && 0 == memcmp(cache.magic, SELFTEST_CACHE_MAGIC, 8) &&
+		SELFTEST_CACHE_VERSION == cache.version && SELFTEST_ALL == cache.tests &&
+		0 == getFingerprint(pbFingerprint) && 0 == memcmp(cache.fingerprint, pbFingerprint, 32))
+	{
+		passedTests |= SELFTEST_ALL;
+		iStatus = 0;
+	}
+
+	close(fd);
+
+	return iStatus;
+}
+
+void saveSelfTestCache()
+{
+	std::string path = getCachePath();
+	std::string tmpPath = path + "." + std::to_string(getpid());
+	SelfTest_Cache cache{};
+	int fd = -1;
+
+	if (SELFTEST_ALL != (passedTests.load() & SELFTEST_ALL) || path.empty()) return;
+
+	memcpy(cache.magic, SELFTEST_CACHE_MAGIC, 8);
+	cache.version = SELFTEST_CACHE_VERSION;
+	cache.tests = SELFTEST_ALL;
+
+	if (0 != getFingerprint(cache.fingerprint)) return;
+
+	// Replaced at once : a process reading it meanwhile sees the old record or the new one
+	if ((fd = open(tmpPath.data(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0600)) < 0) return;
+
+	bool bWritten = (sizeof(cache) == write(fd, &cache, sizeof(cache)));
+
+	if (0 != close(fd) || !bWritten || 0 != rename(tmpPath.data(), path.data())) unlink(tmpPath.data());
+}
+
+#else
+
+int loadSelfTestCache()
+{
+	return 1;
+}
+
+void saveSelfTestCache()
+{
+}
+
+#endif
@@ -0,0 +1,74 @@
+/*
+*	=====================================
+*	Copyright (c) El Mostafa IDRASSI 2017
+*	mostafa.idrassi@tutanota.com
+*	Apache License
+*	=====================================
+*/
+
+#ifndef IDX_SELFTEST_H
+#define IDX_SELFTEST_H
+
+#define SELFTEST_HASH			0x01		// HashLib_Init
+#define SELFTEST_HMAC			0x02		// HMACLib_Init
+#define SELFTEST_PBKDF2			0x04		// PBKDF2_Init
+#define SELFTEST_AES			0x08		// AesLib_Init
+#define SELFTEST_KDF			(SELFTEST_HASH | SELFTEST_HMAC | SELFTEST_PBKDF2)	// what a key derivation relies on
+#define SELFTEST_ALL			(SELFTEST_KDF | SELFTEST_AES)
+#define SELFTEST_TREEHASH		0x10		// TreeHash_Init (Idx_TreeHash.h) : always before its first use, not cached
+#define SELFTEST_MEMCLR			0x20		// MemClr_Init (mem_impl.h) : always before the first key derivation, not cached
+
+#define SELFTEST_ENV			"IDXCRYPT_SELFTEST"
+
+#define SELFTEST_MODE_CACHED	0			// default : run once per binary and CPU, the result is kept in a cache file
+#define SELFTEST_MODE_ALWAYS	1			// IDXCRYPT_SELFTEST=always : run by every process
+#define SELFTEST_MODE_LAZY		2			// IDXCRYPT_SELFTEST=lazy : each test runs when its library is first used
+
+#define SELFTEST_CACHE_MAGIC	"IDXSTST"
+#define SELFTEST_CACHE_VERSION	1
+
+/*
+*	=====================================================================================================
+*	 Known-answer tests of the 4 crypto libraries
+*
+*	 They only depend on the code of the binary and on the CPU it runs on : once they passed, a process
+*	 of the same binary on the same CPU skips them. The cache file ($XDG_CACHE_HOME/idxcrypt-selftest,
+*	 else ~/.cache/idxcrypt-selftest, Linux only) records the SHA-256 of the binary (libcrypto is linked
+*	 statically), of the CPU identification (cpuid on x86) and of the CPU features reported by the kernel :
+*	 a rebuilt binary, or the same one moved to another machine, runs the tests again.
+*	 In lazy mode the key derivation and the creation of a cipher context run the tests they depend on
+*	 first, so that a process which fails before them, or only uses some of them, doesn't pay for the others.
+*	=====================================================================================================
+*/
+
+struct SelfTest_Cache
+{
+	char magic[8];
+	unsigned int version;
+	unsigned int tests;						// SELFTEST_* passed
+	unsigned char fingerprint[32];			// SHA-256(binary | CPU)
+};
+
+/*
+*	SELFTEST_MODE_* from IDXCRYPT_SELFTEST
+*/
+int getSelfTestMode();
+
+/*
+*	Returns 0 if the cache file records that all the tests passed with this binary on this CPU : they are
+*	then considered passed by this process. Returns 1 otherwise (and always on Windows).
+*/
+int loadSelfTestCache();
+
+/*
+*	Records in the cache file that all the tests passed, if they did in this process
+*/
+void saveSelfTestCache();
+
+/*
+*	Runs those of tests (SELFTEST_*) not run yet by this process (thread-safe). Returns 0 if they all passed.
+*	A failed test is reported once, on the standard error, and never run again.
+*/
+int requireSelfTests(const unsigned int & tests);
+
+#endif // !IDX_SELFTEST_H
@@ -0,0 +1,546 @@
+/*
+*	=====================================
+*	Copyright (c) El Mostafa IDRASSI 2017
+*	mostafa.idrassi@tutanota.com
+*	Apache License
+*	=====================================
+*/
+
+#include "Idx_TreeHash.h"
+
+#include "Idx_SelfTest.h"						// requireSelfTests
+#include "mem_impl.h"							// my_memclr
+
+#include <atomic>
+#include <cstring>								// memcpy, memcmp
+#include <system_error>
+#include <thread>
+#include <vector>
+
+#ifdef __linux__
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+#define FLAG_CHUNK_START		0x01
+#define FLAG_CHUNK_END			0x02
+#define FLAG_PARENT				0x04
+#define FLAG_ROOT				0x08
+
+#define TREEHASH_READ_SIZE		(1024 * 1024)	// pipes
+
+static const uint32_t IV[8] = { 0x6A09E667, 0xBB67AE85, 0x3C6EF372, 0xA54FF53A, 0x510E527F, 0x9B05688C, 0x1F83D9AB, 0x5BE0CD19 };
+
+// Order of the message words in each of the 7 rounds
+static const unsigned char SCHEDULE[7][16] = {
+	{ 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15 },
+	{ 2, 6, 3, 10, 7, 0, 4, 13, 1, 11, 12, 5, 9, 14, 15, 8 },
+	{ 3, 4, 10, 12, 13, 2, 7, 14, 6, 5, 9, 0, 11, 15, 8, 1 },
+	{ 10, 7, 12, 9, 14, 3, 13, 15, 4, 0, 11, 2, 5, 8, 1, 6 },
+	{ 12, 13, 9, 11, 15, 10, 14, 8, 7, 2, 5, 3, 0, 1, 6, 4 },
+	{ 9, 14, 11, 5, 8, 12, 15, 1, 13, 3, 0, 10, 2, 6, 4, 7 },
+	{ 11, 15, 5, 0, 1, 9, 8, 6, 14, 10, 2, 12, 3, 4, 7, 13 },
+};
+
+static inline uint32_t load32(const unsigned char * p)
+{
+	return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static inline void store32(unsigned char * p, const uint32_t & x)
+{
+	p[0] = (unsigned char)x;
+	p[1] = (unsigned char)(x >> 8);
+	p[2] = (unsigned char)(x >> 16);
+	p[3] = (unsigned char)(x >> 24);
+}
+
+/*
+* The rounds, on words (one compression) or on vectors of words (one compression per lane)
+*/
+template <typename T>
+static inline T rotr(const T & x, const int & n)
+{
+	return (x >> n) | (x << (32 - n));
+}
+
+template <typename T>
+static inline void g(T v[16], const int & a, const int & b, const int & c, const int & d, const T & mx, const T & my)
+{
+	v[a] = v[a] + v[b] + mx;
+	v[d] = rotr<T>(v[d] ^ v[a], 16);
+	v[c] = v[c] + v[d];
+	v[b] = rotr<T>(v[b] ^ v[c], 12);
+	v[a] = v[a] + v[b] + my;
+	v[d] = rotr<T>(v[d] ^ v[a], 8);
+	v[c] = v[c] + v[d];
+	v[b] = rotr<T>(v[b] ^ v[c], 7);
+}
+
+template <typename T>
+static inline void rounds(T v[16], const T m[16])
+{
+	for (int r = 0; r < 7; r++)
+	{
+		const unsigned char * s = SCHEDULE[r];
+
+		g<T>(v, 0, 4, 8, 12, m[s[0]], m[s[1]]);
+		g<T>(v, 1, 5, 9, 13, m[s[2]], m[s[3]]);
+		g<T>(v, 2, 6, 10, 14, m[s[4]], m[s[5]]);
+		g<T>(v, 3, 7, 11, 15, m[s[6]], m[s[7]]);
+		g<T>(v, 0, 5, 10, 15, m[s[8]], m[s[9]]);
+		g<T>(v, 1, 6, 11, 12, m[s[10]], m[s[11]]);
+		g<T>(v, 2, 7, 8, 13, m[s[12]], m[s[13]]);
+		g<T>(v, 3, 4, 9, 14, m[s[14]], m[s[15]]);
+	}
+}
+
+/*
+* out : the 16 words of the compression of block (the first 8 are the chaining value)
+*/
+static void compress(const uint32_t cv[8], const unsigned char block[TREEHASH_BLOCK_SIZE], const uint32_t & blockLen, const uint64_t & counter, const uint32_t & flags, uint32_t out[16])
+{
+	uint32_t m[16];
+	uint32_t v[16] = { cv[0], cv[1], cv[2], cv[3], cv[4], cv[5], cv[6], cv[7], IV[0], IV[1], IV[2], IV[3],
+		(uint32_t)counter, (uint32_t)(counter >> 32), blockLen, flags };
+
+	for (int i = 0; i < 16; i++) m[i] = load32(block + 4 * i);
+
+	rounds<uint32_t>(v, m);
+
+	for (int i = 0; i < 8; i++)
+	{
+		out[i] = v[i] ^ v[i + 8];
+		out[i + 8] = v[i + 8] ^ cv[i];
+	}
+}
+
+static void compressInPlace(uint32_t cv[8], const unsigned char block[TREEHASH_BLOCK_SIZE], const uint32_t & blockLen, const uint64_t & counter, const uint32_t & flags)
+{
+	uint32_t out[16];
+
+	compress(cv, block, blockLen, counter, flags, out);
+	memcpy(cv, out, 32);
+}
+
+static void parentChainingValue(const uint32_t left[8], const uint32_t right[8], uint32_t cv[8])
+{
+	unsigned char block[TREEHASH_BLOCK_SIZE];
+
+	for (int i = 0; i < 8; i++)
+	{
+		store32(block + 4 * i, left[i]);
+		store32(block + 32 + 4 * i, right[i]);
+	}
+
+	memcpy(cv, IV, 32);
+	compressInPlace(cv, block, TREEHASH_BLOCK_SIZE, 0, FLAG_PARENT);
+}
+
+#if defined(__GNUC__) || defined(__clang__)
+
+// As many chunks as words in a vector register : 8 with AVX2, 4 with SSE2 or NEON
+#ifdef __AVX2__
+#define TREEHASH_LANES			8
+#else
+#define TREEHASH_LANES			4
+#endif
+
+typedef uint32_t Lanes __attribute__((vector_size(4 * TREEHASH_LANES)));
+
+/*
+* Chaining values of TREEHASH_LANES whole chunks, the first one being the chunk counter of the input : one chunk per lane
+*/
+static void hashChunks(const unsigned char * in, const uint64_t & counter, uint32_t cvs[][8])
+{
+	Lanes h[8], v[16], m[16];
+	Lanes counterLow, counterHigh;
+	uint32_t words[16][TREEHASH_LANES];
+
+	for (int j = 0; j < TREEHASH_LANES; j++)
+	{
+		for (int i = 0; i < 8; i++) h[i][j] = IV[i];
+
+		counterLow[j] = (uint32_t)(counter + j);
+		counterHigh[j] = (uint32_t)((counter + j) >> 32);
+	}
+
+	for (size_t b = 0; b < TREEHASH_CHUNK_SIZE / TREEHASH_BLOCK_SIZE; b++)
+	{
+		uint32_t flags = ((0 == b) ? FLAG_CHUNK_START : 0) | ((TREEHASH_CHUNK_SIZE / TREEHASH_BLOCK_SIZE - 1 == b) ? FLAG_CHUNK_END : 0);
+
+		// Transposition : word i of the block of every chunk in the lanes of m[i]
+		for (int j = 0; j < TREEHASH_LANES; j++)
+		{
+			const unsigned char * block = in + j * TREEHASH_CHUNK_SIZE + b * TREEHASH_BLOCK_SIZE;
+
+			for (int i = 0; i < 16; i++) words[i][j] = load32(block + 4 * i);
+		}
+
+		memcpy(m, words, sizeof(m));
+
+		for (int i = 0; i < 8; i++) v[i] = h[i];
+		for (int i = 0; i < 4; i++) v[8 + i] = Lanes{} + IV[i];
+		v[12] = counterLow;
+		v[13] = counterHigh;
+		v[14] = Lanes{} + (uint32_t)TREEHASH_BLOCK_SIZE;
+		v[15] = Lanes{} + flags;
+
+		rounds<Lanes>(v, m);
+
+		for (int i = 0; i < 8; i++) h[i] = v[i] ^ v[i + 8];
+	}
+
+	for (int j = 0; j < TREEHASH_LANES; j++)
+		for (int i = 0; i < 8; i++) cvs[j][i] = h[i][j];
+}
+
+#else
+
+#define TREEHASH_LANES			1
+
+static void hashChunks(const unsigned char * in, const uint64_t & counter, uint32_t cvs[][8])
+{
+	memcpy(cvs[0], IV, 32);
+
+	for (size_t b = 0; b < TREEHASH_CHUNK_SIZE / TREEHASH_BLOCK_SIZE; b++)
+	{
+		uint32_t flags = ((0 == b) ? FLAG_CHUNK_START : 0) | ((TREEHASH_CHUNK_SIZE / TREEHASH_BLOCK_SIZE - 1 == b) ? FLAG_CHUNK_END : 0);
+
+		compressInPlace(cvs[0], in + b * TREEHASH_BLOCK_SIZE, TREEHASH_BLOCK_SIZE, counter, flags);
+	}
+}
+
+#endif
+
+/*
+* Chaining value of the TREEHASH_SUBTREE_CHUNKS chunks at in (a complete subtree : its leaves are paired level by level)
+*/
+static void hashSubtree(const unsigned char * in, const uint64_t & counter, uint32_t cvs[TREEHASH_SUBTREE_CHUNKS][8], uint32_t cv[8])
+{
+	for (size_t i = 0; i < TREEHASH_SUBTREE_CHUNKS; i += TREEHASH_LANES) hashChunks(in + i * TREEHASH_CHUNK_SIZE, counter + i, cvs + i);
+
+	for (size_t width = TREEHASH_SUBTREE_CHUNKS; width > 1; width /= 2)
+		for (size_t i = 0; i < width / 2; i++) parentChainingValue(cvs[2 * i], cvs[2 * i + 1], cvs[i]);
+
+	memcpy(cv, cvs[0], 32);
+}
+
+Tree_Hash::Tree_Hash()
+{
+	init();
+}
+
+Tree_Hash::~Tree_Hash()
+{
+	clean();
+}
+
+void Tree_Hash::init()
+{
+	memcpy(cvChunk, IV, 32);
+	cbBlock = 0;
+	cBlocks = 0;
+	chunkCounter = 0;
+	cStack = 0;
+}
+
+/*
+* Merges the value of a complete subtree of 2^log2Chunks chunks, which ends after totalChunks chunks, with the
+* subtrees on its left of the same size, as long as there are : the stack holds a subtree per bit set in totalChunks
+*/
+void Tree_Hash::addChainingValue(uint32_t cv[8], uint64_t totalChunks, const unsigned int & log2Chunks)
+{
+	totalChunks >>= log2Chunks;
+
+	while (0 == (totalChunks & 1))
+	{
+		parentChainingValue(cvStack[--cStack], cv, cv);
+		totalChunks >>= 1;
+	}
+
+	memcpy(cvStack[cStack++], cv, 32);
+}
+
+/*
+* Bytes of the chunk being hashed (cb at most the rest of it). Its last block is kept, as it is the end of the chunk
+* if no more input comes.
+*/
+void Tree_Hash::updateChunk(const unsigned char * in, const size_t & cb)
+{
+	size_t cbDone = 0, cbTake = 0;
+
+	while (cbDone < cb)
+	{
+		if (TREEHASH_BLOCK_SIZE == cbBlock)
+		{
+			compressInPlace(cvChunk, pbBlock, TREEHASH_BLOCK_SIZE, chunkCounter, (0 == cBlocks) ? FLAG_CHUNK_START : 0);
+			cBlocks++;
+			cbBlock = 0;
+		}
+
+		cbTake = (cb - cbDone < TREEHASH_BLOCK_SIZE - cbBlock) ? cb - cbDone : TREEHASH_BLOCK_SIZE - cbBlock;
+
+		memcpy(pbBlock + cbBlock, in + cbDone, cbTake);
+		cbBlock += cbTake;
+		cbDone += cbTake;
+	}
+}
+
+/*
+* cSubtrees complete subtrees, hashed by cThreads threads, then merged in order
+*/
+void Tree_Hash::updateSubtrees(const unsigned char * in, const size_t & cSubtrees, const size_t & cThreads)
+{
+	std::vector<uint32_t> cvs(cSubtrees * 8);
+	std::vector<std::thread> threads{};
+	std::atomic<size_t> next{ 0 };
+	uint64_t firstCounter = chunkCounter;
+
+	auto work = [&]() {
+		std::vector<uint32_t> leaves(TREEHASH_SUBTREE_CHUNKS * 8);
+		size_t i = 0;
+
+		while ((i = next++) < cSubtrees)
+			hashSubtree(in + i * TREEHASH_SUBTREE_CHUNKS * TREEHASH_CHUNK_SIZE, firstCounter + i * TREEHASH_SUBTREE_CHUNKS,
+				(uint32_t(*)[8])leaves.data(), &cvs[i * 8]);
+
+		my_memclr(leaves.data(), leaves.size() * sizeof(uint32_t));
+	};
+
+	// A thread that can't be created leaves its share to the others
+	try
+	{
+		for (size_t t = 1; t < cThreads && t < cSubtrees; t++) threads.emplace_back(work);
+	}
+	catch (const std::system_error &) {}
+
+	work();
+
+	for (auto & thread : threads) thread.join();
+
+	for (size_t i = 0; i < cSubtrees; i++)
+	{
+		chunkCounter += TREEHASH_SUBTREE_CHUNKS;
+		addChainingValue(&cvs[i * 8], chunkCounter, TREEHASH_SUBTREE_LOG);
+	}
+
+	my_memclr(cvs.data(), cvs.size() * sizeof(uint32_t));
+}
+
+void Tree_Hash::update(const unsigned char * in, const size_t & cb, const size_t & cThreads)
+{
+	uint32_t cvs[TREEHASH_LANES][8];
+	size_t cbDone = 0, cbTake = 0;
+
+	while (cbDone < cb)
+	{
+		// The chunk is complete and more input comes : it is a leaf, the next one starts
+		if (TREEHASH_CHUNK_SIZE == cBlocks * TREEHASH_BLOCK_SIZE + cbBlock)
+		{
+			compressInPlace(cvChunk, pbBlock, TREEHASH_BLOCK_SIZE, chunkCounter, FLAG_CHUNK_END | ((0 == cBlocks) ? FLAG_CHUNK_START : 0));
+			addChainingValue(cvChunk, ++chunkCounter, 0);
+
+			memcpy(cvChunk, IV, 32);
+			cbBlock = 0;
+			cBlocks = 0;
+		}
+
+		// At the start of a chunk : whole subtrees, then whole chunks, as long as some input follows them (the last
+		// chunk of the input is the root, or under it on the right)
+		if (0 == cBlocks && 0 == cbBlock)
+		{
+			size_t cbSubtree = TREEHASH_SUBTREE_CHUNKS * TREEHASH_CHUNK_SIZE;
+			size_t cSubtrees = (cb - cbDone - 1) / cbSubtree;
+
+			if (cThreads > 1 && cSubtrees >= 2 && 0 == chunkCounter % TREEHASH_SUBTREE_CHUNKS)
+			{
+				updateSubtrees(in + cbDone, cSubtrees, cThreads);
+				cbDone += cSubtrees * cbSubtree;
+			}
+
+			while (cb - cbDone > TREEHASH_LANES * TREEHASH_CHUNK_SIZE)
+			{
+				hashChunks(in + cbDone, chunkCounter, cvs);
+
+				for (size_t j = 0; j < TREEHASH_LANES; j++) addChainingValue(cvs[j], ++chunkCounter, 0);
+
+				cbDone += TREEHASH_LANES * TREEHASH_CHUNK_SIZE;
+			}
+		}
+
+		cbTake = TREEHASH_CHUNK_SIZE - (cBlocks * TREEHASH_BLOCK_SIZE + cbBlock);
+		if (cbTake > cb - cbDone) cbTake = cb - cbDone;
+
+		updateChunk(in + cbDone, cbTake);
+		cbDone += cbTake;
+	}
+
+	my_memclr(cvs, sizeof(cvs));
+}
+
+/*
+* The last chunk, then the parents of the subtrees of the stack from right to left : the last node is compressed as the root
+*/
+void Tree_Hash::final(unsigned char out[TREEHASH_SIZE]) const
+{
+	uint32_t cv[8], words[16];
+	unsigned char block[TREEHASH_BLOCK_SIZE]{};
+	uint32_t blockLen = (uint32_t)cbBlock;
+	uint64_t counter = chunkCounter;
+	uint32_t flags = FLAG_CHUNK_END | ((0 == cBlocks) ? FLAG_CHUNK_START : 0);
+
+	memcpy(cv, cvChunk, 32);
+	memcpy(block, pbBlock, cbBlock);
+
+	for (size_t i = cStack; i > 0; i--)
+	{
+		compressInPlace(cv, block, blockLen, counter, flags);
+
+		for (int k = 0; k < 8; k++)
+		{
+			store32(block + 4 * k, cvStack[i - 1][k]);
+			store32(block + 32 + 4 * k, cv[k]);
+		}
+
+		memcpy(cv, IV, 32);
+		blockLen = TREEHASH_BLOCK_SIZE;
+		counter = 0;
+		flags = FLAG_PARENT;
+	}
+
+	compress(cv, block, blockLen, counter, flags | FLAG_ROOT, words);
+
+	for (int k = 0; k < 8; k++) store32(out + 4 * k, words[k]);
+
+	my_memclr(cv, sizeof(cv));
+	my_memclr(words, sizeof(words));
+	my_memclr(block, sizeof(block));
+}
+
+void Tree_Hash::clean()
+{
+	my_memclr(cvChunk, sizeof(cvChunk));
+	my_memclr(pbBlock, sizeof(pbBlock));
+	my_memclr(cvStack, sizeof(cvStack));
+	init();
+}
+
+int treeHash(const unsigned char * in, const size_t & cb, unsigned char out[TREEHASH_SIZE], const size_t & cThreads)
+{
+	Tree_Hash hash{};
+
+	if (0 != requireSelfTests(SELFTEST_TREEHASH)) return 1;
+
+	hash.update(in, cb, cThreads);
+	hash.final(out);
+
+	return 0;
+}
+
+#ifdef __linux__
+
+int treeHashFile(int fd, unsigned char out[TREEHASH_SIZE], const size_t & cThreads)
+{
+	Tree_Hash hash{};
+	struct stat stat_buf {};
+	void* data = MAP_FAILED;
+	ssize_t cbRead = 0;
+
+	if (0 != requireSelfTests(SELFTEST_TREEHASH) || 0 != fstat(fd, &stat_buf)) return 1;
+
+	if (S_ISREG(stat_buf.st_mode) && stat_buf.st_size > 0)
+	{
+		if (MAP_FAILED == (data = mmap(nullptr, (size_t)stat_buf.st_size, PROT_READ, MAP_PRIVATE, fd, 0))) return 1;
+
+		// Read ahead for all the threads at once
+		madvise(data, (size_t)stat_buf.st_size, MADV_WILLNEED);
+
+		hash.update((const unsigned char*)data, (size_t)stat_buf.st_size, cThreads);
+		munmap(data, (size_t)stat_buf.st_size);
+	}
+	else if (!S_ISREG(stat_buf.st_mode))
+	{
+		std::vector<unsigned char> buffer(TREEHASH_READ_SIZE);
+
+		while (0 != (cbRead = read(fd, buffer.data(), buffer.size())))
+		{
+			if (cbRead < 0 && EINTR == errno) continue;
+			if (cbRead < 0) return 1;
+
+			hash.update(buffer.data(), (size_t)cbRead, cThreads);
+		}
+
+		my_memclr(buffer.data(), buffer.size());
+	}
+
+	hash.final(out);
+
+	return 0;
+}
+
+#endif
+
+int TreeHash_Init()
+{
+	// Test vectors of BLAKE3 : input of length bytes, byte i being i % 251. The last one spans several subtrees.
+	static const struct { size_t length; const char* szDigest; } vectors[] = {
+		{ 0, "af1349b9f5f9a1a6a0404dea36dcc9499bcb25c9adc112b7cc9a93cae41f3262" },
+		{ 1, "2d3adedff11b61f14c886e35afa036736dcd87a74d27b5c1510225d0f592e213" },
+		{ 1023, "10108970eeda3eb932baac1428c7a2163b0e924c9a9e25b35bba72b28f70bd11" },
+		{ 1024, "42214739f095a406f3fc83deb889744ac00df831c10daa55189b5d121c855af7" },
+		{ 1025, "d00278ae47eb27b34faecf67b4fe263f82d5412916c1ffd97c8cb7fb814b8444" },
+		{ 2048, "e776b6028c7cd22a4d0ba182a8bf62205d2ef576467e838ed6f2529b85fba24a" },
+		{ 2049, "5f4d72f40d7a5f82b15ca2b2e44b1de3c2ef86c426c95c1af0b6879522563030" },
+		{ 3072, "b98cb0ff3623be03326b373de6b9095218513e64f1ee2edd2525c7ad1e5cffd2" },
+		{ 3073, "7124b49501012f81cc7f11ca069ec9226cecb8a2c850cfe644e327d22d3e1cd3" },
+		{ 4096, "015094013f57a5277b59d8475c0501042c0b642e531b0a1c8f58d2163229e969" },
+		{ 4097, "9b4052b38f1c5fc8b1f9ff7ac7b27cd242487b3d890d15c96a1c25b8aa0fb995" },
+		{ 5120, "9cadc15fed8b5d854562b26a9536d9707cadeda9b143978f319ab34230535833" },
+		{ 5121, "628bd2cb2004694adaab7bbd778a25df25c47b9d4155a55f8fbd79f2fe154cff" },
+		{ 6144, "3e2e5b74e048f3add6d21faab3f83aa44d3b2278afb83b80b3c35164ebeca205" },
+		{ 6145, "f1323a8631446cc50536a9f705ee5cb619424d46887f3c376c695b70e0f0507f" },
+		{ 7168, "61da957ec2499a95d6b8023e2b0e604ec7f6b50e80a9678b89d2628e99ada77a" },
+		{ 7169, "a003fc7a51754a9b3c7fae0367ab3d782dccf28855a03d435f8cfe74605e7817" },
+		{ 8192, "aae792484c8efe4f19e2ca7d371d8c467ffb10748d8a5a1ae579948f718a2a63" },
+		{ 8193, "bab6c09cb8ce8cf459261398d2e7aef35700bf488116ceb94a36d0f5f1b7bc3b" },
+		{ 16384, "f875d6646de28985646f34ee13be9a576fd515f76b5b0a26bb324735041ddde4" },
+		{ 31744, "62b6960e1a44bcc1eb1a611a8d6235b6b4b78f32e7abc4fb4c6cdcce94895c47" },
+		{ 102400, "bc3e3d41a1146b069abffad3c0d44860cf664390afce4d9661f7902e7943e085" },
+		{ 3145729, "fd984eaa20053d346cc7c79a175338f91556e68b871d877b23568a4587d9875b" },
+	};
+	static const char szHex[] = "0123456789abcdef";
+	std::vector<unsigned char> input(3145729);
+	Tree_Hash hash{};
+	unsigned char pbDigest[TREEHASH_SIZE];
+	char szDigest[2 * TREEHASH_SIZE + 1]{};
+
+	for (size_t i = 0; i < input.size(); i++) input[i] = (unsigned char)(i % 251);
+
+	for (const auto & vector : vectors)
+	{
+		// At once with 4 threads (one for the small ones), then in pieces of 4097 bytes (not aligned on the chunks)
+		for (int pass = 0; pass < ((vector.length > TREEHASH_SUBTREE_CHUNKS * TREEHASH_CHUNK_SIZE) ? 1 : 2); pass++)
+		{
+			hash.init();
+
+			if (0 == pass) hash.update(input.data(), vector.length, 4);
+			else for (size_t cbDone = 0; cbDone < vector.length; cbDone += 4097)
+				hash.update(input.data() + cbDone, (vector.length - cbDone < 4097) ? vector.length - cbDone : 4097);
+
+			hash.final(pbDigest);
+
+			for (size_t i = 0; i < TREEHASH_SIZE; i++)
+			{
+				szDigest[2 * i] = szHex[pbDigest[i] >> 4];
+				szDigest[2 * i + 1] = szHex[pbDigest[i] & 0x0F];
+			}
+
+			if (0 != memcmp(szDigest, vector.szDigest, 2 * TREEHASH_SIZE)) return 1;
+		}
+	}
+
+	return 0;
+}
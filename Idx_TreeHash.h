@@ -0,0 +1,98 @@
+/*
+*	=====================================
+*	Copyright (c) El Mostafa IDRASSI 2017
+*	mostafa.idrassi@tutanota.com
+*	Apache License
+*	=====================================
+*/
+
+#ifndef IDX_TREEHASH_H
+#define IDX_TREEHASH_H
+
+#include <cstddef>						// size_t
+#include <cstdint>
+
+#define TREEHASH_SIZE				32
+#define TREEHASH_CHUNK_SIZE			1024					// leaves of the tree
+#define TREEHASH_BLOCK_SIZE			64
+#define TREEHASH_SUBTREE_CHUNKS		1024					// 1 MiB : what a thread hashes at a time
+#define TREEHASH_SUBTREE_LOG		10						// log2(TREEHASH_SUBTREE_CHUNKS)
+#define TREEHASH_MAX_DEPTH			54						// 2^54 chunks : 2^64 bytes
+
+/*
+*	=====================================================================================================
+*	 Tree hash (BLAKE3, 32 bytes, unkeyed)
+*
+*	 SHA-256 and the other hashes of the hash library chain every block to the previous one : a file is
+*	 hashed by one core, one block after another. BLAKE3 splits the input in 1024 bytes chunks, the
+*	 leaves of a binary tree whose nodes hash the values of their two children : the chunks are
+*	 independent, so that several of them are compressed at once in the lanes of the SIMD registers
+*	 (GCC / Clang vector extensions, SSE2 to AVX2 and NEON as the compiler targets), and subtrees of
+*	 TREEHASH_SUBTREE_CHUNKS chunks are spread over threads. The digest doesn't depend on the number of
+*	 threads nor on how the input is given to update : it is the one of b3sum.
+*	 The known-answer tests (TreeHash_Init) run before the first use in a process (SELFTEST_TREEHASH).
+*	=====================================================================================================
+*/
+
+class Tree_Hash
+{
+private:
+
+	uint32_t cvChunk[8]{};						// chaining value of the chunk being hashed
+	unsigned char pbBlock[TREEHASH_BLOCK_SIZE]{};	// its last block, compressed once more input comes
+	size_t cbBlock = 0;
+	size_t cBlocks = 0;							// blocks of the chunk compressed
+	uint64_t chunkCounter = 0;					// chunks before the one being hashed
+	uint32_t cvStack[TREEHASH_MAX_DEPTH][8]{};	// values of the complete subtrees on the left, the smallest last
+	size_t cStack = 0;
+
+	void addChainingValue(uint32_t cv[8], uint64_t totalChunks, const unsigned int & log2Chunks);
+	void updateChunk(const unsigned char * in, const size_t & cb);
+	void updateSubtrees(const unsigned char * in, const size_t & cSubtrees, const size_t & cThreads);
+
+public:
+
+	Tree_Hash();
+
+	// Copy, Move constructor and assignment operators deleted : the object holds the state of a secret input
+	Tree_Hash(const Tree_Hash & other) = delete;
+	Tree_Hash & operator=(const Tree_Hash & other) = delete;
+	Tree_Hash(Tree_Hash && other) = delete;
+	Tree_Hash & operator=(Tree_Hash && other) = delete;
+
+	~Tree_Hash();
+
+	void init();
+
+	/*
+	*	Hashes cb more bytes. With cThreads > 1, the whole subtrees of a large input (several MiB) are hashed
+	*	by that many threads (the calling one included).
+	*/
+	void update(const unsigned char * in, const size_t & cb, const size_t & cThreads = 1);
+
+	/*
+	*	The digest of the input so far (the object may go on hashing)
+	*/
+	void final(unsigned char out[TREEHASH_SIZE]) const;
+
+	void clean();
+};
+
+/*
+*	Digest of a whole buffer. Returns 0 on success (1 if the known-answer tests failed).
+*/
+int treeHash(const unsigned char * in, const size_t & cb, unsigned char out[TREEHASH_SIZE], const size_t & cThreads);
+
+#ifdef __linux__
+/*
+*	Digest of the file fd : mapped at once if it is a regular file, read up to its end otherwise (pipes). Returns 0 on success.
+*/
+int treeHashFile(int fd, unsigned char out[TREEHASH_SIZE], const size_t & cThreads);
+#endif
+
+/*
+*	Known-answer tests (the test vectors of BLAKE3), through every path : one update, pieces, threads. Returns 0 if they pass.
+*/
+int TreeHash_Init();
+
+#endif // !IDX_TREEHASH_H
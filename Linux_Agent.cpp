@@ -0,0 +1,419 @@
+/*
+*	=====================================
+*	Copyright (c) El Mostafa IDRASSI 2017
+*	mostafa.idrassi@tutanota.com
+*	Apache License
+*	=====================================
+*/
+
+#ifdef __linux__
+
+#include "Linux_Agent.h"
+
+#include "MyLinuxSysFunctions.h"				// stat, unlink
+#include "HMAC_Context.h"						// HMAC-SHA256 (key ids)
+#include "mem_impl.h"							// my_memclr
+
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/mman.h>							// mmap, mlock, madvise
+#include <sys/prctl.h>							// PR_SET_DUMPABLE
+#include <sys/resource.h>						// RLIMIT_CORE
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <atomic>
+
+/*
+* Seconds of the monotonic clock : the TTLs don't depend on the wall clock
+*/
+static int64_t getNow()
+{
+	struct timespec ts {};
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (int64_t)ts.tv_sec;
+}
+
+static int fillAddress(const std::string & path, struct sockaddr_un & addr)
+{
+	addr.sun_family = AF_UNIX;
+
+	if (path.empty() || path.size() >= sizeof(addr.sun_path))
+	{
+		std::cerr << "The path of the socket " << path << " is empty or too long (" << sizeof(addr.sun_path) - 1 << " characters at most). Aborting...\n";
+		return 1;
+	}
+
+	memcpy(addr.sun_path, path.data(), path.size());
+
+	return 0;
+}
+
+/*
+*	=====================================================================================================
+*	 Keys held by the agent, in one locked mapping left out of core dumps
+*	=====================================================================================================
+*/
+class Key_Store
+{
+private:
+
+	struct Entry
+	{
+		int64_t expiry;						// 0 : free
+		unsigned char id[AGENT_ID_SIZE];
+		unsigned char key[AGENT_KEY_SIZE];
+	};
+
+	Entry* entries = nullptr;
+	size_t cbEntries = AGENT_MAX_KEYS * sizeof(Entry);
+	unsigned int ttl = 0;
+
+	void wipe(Entry & entry)
+	{
+		my_memclr(&entry, sizeof(Entry));
+	}
+
+public:
+
+	Key_Store() {}
+
+	Key_Store(const Key_Store & other) = delete;
+	Key_Store & operator=(const Key_Store & other) = delete;
+	Key_Store(Key_Store && other) = delete;
+	Key_Store & operator=(Key_Store && other) = delete;
+
+	~Key_Store()
+	{
+		if (nullptr == entries) return;
+
+		my_memclr(entries, cbEntries);
+		munlock(entries, cbEntries);
+		munmap(entries, cbEntries);
+	}
+
+	int open(const unsigned int & ttl)
+	{
+		this->ttl = ttl;
+
+		entries = (Entry*)mmap(nullptr, cbEntries, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+		if (MAP_FAILED == entries)
+		{
+			entries = nullptr;
+			std::cerr << "An error occured while allocating the memory of the agent. Error code : " << errno << ". Aborting...\n";
+			return 1;
+		}
+
+		// The keys must never reach the swap nor a core dump
+		if (0 != mlock(entries, cbEntries) || 0 != madvise(entries, cbEntries, MADV_DONTDUMP))
+		{
+			std::cerr << "An error occured while locking the memory of the agent (see ulimit -l). Error code : " << errno << ". Aborting...\n";
+			return 1;
+		}
+
+		return 0;
+	}
+
+	/*
+	* Wipes the expired keys, and returns the delay until the next expiry (-1 if there is no key)
+	*/
+	int64_t purge()
+	{
+		int64_t now = getNow(), next = -1;
+
+		for (size_t i = 0; i < AGENT_MAX_KEYS; i++)
+		{
+			if (0 == entries[i].expiry) continue;
+
+			if (entries[i].expiry <= now) wipe(entries[i]);
+			else if (next < 0 || entries[i].expiry - now < next) next = entries[i].expiry - now;
+		}
+
+		return next;
+	}
+
+	int get(const unsigned char id[AGENT_ID_SIZE], unsigned char key[AGENT_KEY_SIZE])
+	{
+		for (size_t i = 0; i < AGENT_MAX_KEYS; i++)
+		{
+			if (0 != entries[i].expiry && 0 == memcmp(entries[i].id, id, AGENT_ID_SIZE))
+			{
+				memcpy(key, entries[i].key, AGENT_KEY_SIZE);
+				return AGENT_OK;
+			}
+		}
+
+		return AGENT_NOT_FOUND;
+	}
+
+	void add(const unsigned char id[AGENT_ID_SIZE], const unsigned char key[AGENT_KEY_SIZE])
+	{
+		Entry* slot = nullptr;
+
+		// The same id, else a free entry, else the one closest to its expiry
+		for (size_t i = 0; i < AGENT_MAX_KEYS; i++)
+		{
+			if (0 != entries[i].expiry && 0 == memcmp(entries[i].id, id, AGENT_ID_SIZE)) { slot = &entries[i]; break; }
+			if (nullptr == slot || (0 != slot->expiry && entries[i].expiry < slot->expiry)) slot = &entries[i];
+		}
+
+		memcpy(slot->id, id, AGENT_ID_SIZE);
+		memcpy(slot->key, key, AGENT_KEY_SIZE);
+		slot->expiry = getNow() + ttl;
+	}
+};
+
+int listenOnSocket(const std::string & path, const char szName[])
+{
+	struct sockaddr_un addr {};
+	struct stat stat_buf {};
+	int fd = -1, probe = -1;
+	mode_t oldMask = 0;
+
+	if (0 != fillAddress(path, addr)) return -1;
+
+	if (0 == lstat(path.data(), &stat_buf))
+	{
+		if (!S_ISSOCK(stat_buf.st_mode))
+		{
+			std::cerr << path << " exists and is not a socket. Aborting...\n";
+			return -1;
+		}
+
+		if ((probe = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)) >= 0 && 0 == connect(probe, (struct sockaddr*)&addr, sizeof(addr)))
+		{
+			close(probe);
+			std::cerr << "A " << szName << " is already running on " << path << " . Aborting...\n";
+			return -1;
+		}
+		if (probe >= 0) close(probe);
+
+		unlink(path.data());
+	}
+
+	if ((fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)) < 0)
+	{
+		std::cerr << "An error occured while creating the " << szName << " socket. Error code : " << errno << ". Aborting...\n";
+		return -1;
+	}
+
+	// The socket is created with mode 0600 : only its owner can connect
+	oldMask = umask(0177);
+
+	if (0 != bind(fd, (struct sockaddr*)&addr, sizeof(addr)) || 0 != listen(fd, 16))
+	{
+		std::cerr << "An error occured while binding the " << szName << " socket " << path << " . Error code : " << errno << ". Aborting...\n";
+		close(fd);
+		fd = -1;
+	}
+
+	umask(oldMask);
+
+	return fd;
+}
+
+/*
+* Serves the requests of a client until it disconnects. Only processes of the same user are served.
+*/
+static void serveClient(int fd, Key_Store & store)
+{
+	struct ucred cred {};
+	socklen_t cbCred = sizeof(cred);
+	struct timeval timeout { 1, 0 };		// a client can't hold the agent
+	Agent_Request req{};
+	Agent_Reply reply{};
+
+	if (0 != getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &cbCred) || cred.uid != geteuid())
+	{
+		std::cerr << "Connection to the agent refused (uid " << cred.uid << ").\n";
+		return;
+	}
+
+	setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+	setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+	while (sizeof(req) == recv(fd, &req, sizeof(req), MSG_WAITALL))
+	{
+		if (0 != memcmp(req.magic, AGENT_MAGIC, 8) || AGENT_VERSION != req.version) break;
+
+		my_memclr(&reply, sizeof(reply));
+
+		if (AGENT_GET == req.op) reply.status = store.get(req.id, reply.key);
+		else if (AGENT_ADD == req.op) { store.add(req.id, req.key); reply.status = AGENT_OK; }
+		else break;
+
+		if (sizeof(reply) != send(fd, &reply, sizeof(reply), MSG_NOSIGNAL)) break;
+	}
+
+	my_memclr(&req, sizeof(req));
+	my_memclr(&reply, sizeof(reply));
+}
+
+int runKeyAgent(const std::string & socketPath, const unsigned int & ttl)
+{
+	struct rlimit noCore { 0, 0 };
+	Key_Store store{};
+	sigset_t mask{};
+	int fd = -1, sfd = -1, client = -1;
+	int iStatus = 0;
+
+	// Neither core dumps nor ptrace by other processes of the user : the keys only live in this process
+	if (0 != prctl(PR_SET_DUMPABLE, 0, 0, 0, 0) || 0 != setrlimit(RLIMIT_CORE, &noCore))
+	{
+		std::cerr << "An error occured while protecting the agent process. Error code : " << errno << ". Aborting...\n";
+		return 1;
+	}
+
+	if (0 != store.open(ttl)) return 1;
+
+	sigemptyset(&mask);
+	sigaddset(&mask, SIGINT);
+	sigaddset(&mask, SIGTERM);
+	sigaddset(&mask, SIGHUP);
+
+	if (0 != sigprocmask(SIG_BLOCK, &mask, nullptr) || (sfd = signalfd(-1, &mask, SFD_CLOEXEC)) < 0)
+	{
+		std::cerr << "An error occured while setting up the signals of the agent. Error code : " << errno << ". Aborting...\n";
+		return 1;
+	}
+
+	if ((fd = listenOnSocket(socketPath, "key agent")) < 0)
+	{
+		close(sfd);
+		return 1;
+	}
+
+	printf("Key agent listening on %s (keys held %u s). Use it with :\n%s=%s; export %s\n", socketPath.data(), ttl, AGENT_ENV, socketPath.data(), AGENT_ENV);
+	fflush(stdout);
+
+	while (0 == iStatus)
+	{
+		struct pollfd fds[2] = { { fd, POLLIN, 0 }, { sfd, POLLIN, 0 } };
+		int64_t next = store.purge();
+
+		// Woken up for the next expiry at the latest
+		if (poll(fds, 2, (next < 0) ? -1 : (int)(next * 1000)) < 0 && EINTR != errno)
+		{
+			std::cerr << "An error occured while waiting for the clients of the agent. Error code : " << errno << ".\n";
+			iStatus = 1;
+		}
+		else if (fds[1].revents & POLLIN)
+		{
+			break;
+		}
+		else if ((fds[0].revents & POLLIN) && (client = accept4(fd, nullptr, nullptr, SOCK_CLOEXEC)) >= 0)
+		{
+			store.purge();
+			serveClient(client, store);
+			close(client);
+		}
+	}
+
+	printf("Key agent stopped, its keys are wiped.\n");
+
+	close(fd);
+	close(sfd);
+	unlink(socketPath.data());
+
+	return iStatus;
+}
+
+Key_Agent_Client::Key_Agent_Client()
+{
+	const char* szPath = getenv(AGENT_ENV);
+
+	if (szPath) path = szPath;
+}
+
+bool Key_Agent_Client::isEnabled() const
+{
+	return !path.empty();
+}
+
+/*
+* id = HMAC-SHA256(password, algo | salt) : keys derived with another password, salt or algorithm never match
+*/
+int Key_Agent_Client::getId(const HmacAlgo & algo, const char szPassword[], const unsigned char pbSalt[], const size_t & cbSalt, unsigned char pbId[AGENT_ID_SIZE]) const
+{
+	unsigned char pbMessage[1 + 64]{};
+	size_t cbId = 0;
+	HMAC_Context hmac{};
+	int iStatus = 0;
+
+	pbMessage[0] = (unsigned char)algo;
+	memcpy(pbMessage + 1, pbSalt, cbSalt);
+
+	if (0 != hmac.setHPtr(sha256f) || 0 != hmac.setKey((const unsigned char*)szPassword, (unsigned int)strlen(szPassword)) ||
+		0 != hmac.HMAC(pbMessage, 1 + cbSalt, pbId, cbId) || AGENT_ID_SIZE != cbId)
+		iStatus = 1;
+
+	hmac.cleanData();
+	my_memclr(pbMessage, sizeof(pbMessage));
+
+	return iStatus;
+}
+
+int Key_Agent_Client::request(const Agent_Request & req, Agent_Reply & reply) const
+{
+	static std::atomic<bool> bReported{ false };
+	struct sockaddr_un addr {};
+	int fd = -1;
+	int iStatus = 1;
+
+	if (0 == fillAddress(path, addr) && (fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)) >= 0 && 0 == connect(fd, (struct sockaddr*)&addr, sizeof(addr)))
+	{
+		if (sizeof(req) == send(fd, &req, sizeof(req), MSG_NOSIGNAL) && sizeof(reply) == recv(fd, &reply, sizeof(reply), MSG_WAITALL)) iStatus = 0;
+	}
+
+	if (fd >= 0) close(fd);
+
+	if (0 != iStatus && !bReported.exchange(true))
+		std::cerr << "\nThe key agent " << path << " can't be reached (Error code : " << errno << "), the keys are derived without it.\n";
+
+	return iStatus;
+}
+
+int Key_Agent_Client::getKey(const HmacAlgo & algo, const char szPassword[], const unsigned char pbSalt[], const size_t & cbSalt, unsigned char pbKey[AGENT_KEY_SIZE]) const
+{
+	Agent_Request req{};
+	Agent_Reply reply{};
+	int iStatus = 1;
+
+	memcpy(req.magic, AGENT_MAGIC, 8);
+	req.version = AGENT_VERSION;
+	req.op = AGENT_GET;
+
+	if (0 == getId(algo, szPassword, pbSalt, cbSalt, req.id) && 0 == request(req, reply) && AGENT_OK == reply.status)
+	{
+		memcpy(pbKey, reply.key, AGENT_KEY_SIZE);
+		iStatus = 0;
+	}
+
+	my_memclr(&req, sizeof(req));
+	my_memclr(&reply, sizeof(reply));
+
+	return iStatus;
+}
+
+void Key_Agent_Client::addKey(const HmacAlgo & algo, const char szPassword[], const unsigned char pbSalt[], const size_t & cbSalt, const unsigned char pbKey[AGENT_KEY_SIZE]) const
+{
+	Agent_Request req{};
+	Agent_Reply reply{};
+
+	memcpy(req.magic, AGENT_MAGIC, 8);
+	req.version = AGENT_VERSION;
+	req.op = AGENT_ADD;
+	memcpy(req.key, pbKey, AGENT_KEY_SIZE);
+
+	if (0 == getId(algo, szPassword, pbSalt, cbSalt, req.id)) request(req, reply);
+
+	my_memclr(&req, sizeof(req));
+	my_memclr(&reply, sizeof(reply));
+}
+
+#endif
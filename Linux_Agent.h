@@ -0,0 +1,105 @@
+/*
+*	=====================================
+*	Copyright (c) El Mostafa IDRASSI 2017
+*	mostafa.idrassi@tutanota.com
+*	Apache License
+*	=====================================
+*/
+
+#ifndef LINUX_AGENT_H
+#define LINUX_AGENT_H
+
+#ifdef __linux__
+
+#include "Hmac_PRF.h"					// HmacAlgo
+
+#include <cstdint>
+#include <cstddef>
+#include <string>
+
+#define AGENT_ENV				"IDXCRYPT_AGENT"	// socket of the agent, for the processes that use it
+#define AGENT_MAGIC				"IDXAGNT"
+#define AGENT_VERSION			1
+
+#define AGENT_GET				1		// the key of an id, if the agent holds it
+#define AGENT_ADD				2		// a key and its id, held until its TTL expires
+
+#define AGENT_OK				0
+#define AGENT_NOT_FOUND			1
+
+#define AGENT_ID_SIZE			32
+#define AGENT_KEY_SIZE			32
+#define AGENT_MAX_KEYS			4096	// the keys closest to their expiry are dropped first
+#define AGENT_DEFAULT_TTL		600		// seconds
+
+/*
+*	=====================================================================================================
+*	 Key agent ("/agent SocketPath [/ttl seconds]"), in the manner of ssh-agent
+*
+*	 PBKDF2 costs 500000 iterations per file. The agent keeps the keys derived by the processes that
+*	 use it (IDXCRYPT_AGENT=SocketPath), so that decrypting a file whose key was already derived, by an
+*	 earlier encryption or decryption, costs a request on a Unix socket.
+*	 A key is looked up by its id, HMAC-SHA256(password, algo | salt) : the agent never sees passwords.
+*	 The keys are kept in locked memory (mlock) which is left out of core dumps (MADV_DONTDUMP), in a
+*	 process which can't be dumped nor traced by other processes (PR_SET_DUMPABLE 0), and wiped once
+*	 their TTL expires. The socket is only reachable by its owner (0600), and the agent checks the
+*	 identity of every client (SO_PEERCRED). SIGINT, SIGTERM and SIGHUP wipe the keys and stop the agent.
+*	=====================================================================================================
+*/
+
+struct Agent_Request
+{
+	char magic[8];
+	uint32_t version;
+	uint32_t op;
+	unsigned char id[AGENT_ID_SIZE];
+	unsigned char key[AGENT_KEY_SIZE];	// AGENT_ADD only
+};
+
+struct Agent_Reply
+{
+	uint32_t status;
+	uint32_t reserved;
+	unsigned char key[AGENT_KEY_SIZE];	// AGENT_GET, AGENT_OK only
+};
+
+/*
+*	Listens on the Unix socket path, created with mode 0600. path must not be the socket of a running process
+*	(a stale socket is replaced). szName names the process in the messages. Returns the socket, -1 on error.
+*/
+int listenOnSocket(const std::string & path, const char szName[]);
+
+/*
+*	Runs the agent on socketPath until it is stopped by a signal. The keys are held ttl seconds.
+*/
+int runKeyAgent(const std::string & socketPath, const unsigned int & ttl);
+
+/*
+*	Client side : used if IDXCRYPT_AGENT is set. An agent that can't be reached is reported once, then ignored.
+*/
+class Key_Agent_Client
+{
+private:
+
+	std::string path{};
+
+	int getId(const HmacAlgo & algo, const char szPassword[], const unsigned char pbSalt[], const size_t & cbSalt, unsigned char pbId[AGENT_ID_SIZE]) const;
+	int request(const Agent_Request & req, Agent_Reply & reply) const;
+
+public:
+
+	Key_Agent_Client();
+
+	bool isEnabled() const;
+
+	/*
+	*	Returns 0 if the agent gave the key derived from szPassword and pbSalt
+	*/
+	int getKey(const HmacAlgo & algo, const char szPassword[], const unsigned char pbSalt[], const size_t & cbSalt, unsigned char pbKey[AGENT_KEY_SIZE]) const;
+
+	void addKey(const HmacAlgo & algo, const char szPassword[], const unsigned char pbSalt[], const size_t & cbSalt, const unsigned char pbKey[AGENT_KEY_SIZE]) const;
+};
+
+#endif // !__linux__
+
+#endif // !LINUX_AGENT_H
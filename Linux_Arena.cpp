@@ -0,0 +1,163 @@
+/*
+*	=====================================
+*	Copyright (c) El Mostafa IDRASSI 2017
+*	mostafa.idrassi@tutanota.com
+*	Apache License
+*	=====================================
+*/
+
+#ifdef __linux__
+
+#include "Linux_Arena.h"
+
+#include "mem_impl.h"							// my_memclr
+
+#include <errno.h>
+#include <unistd.h>								// sysconf
+#include <sys/mman.h>							// mmap, mprotect, mlock, madvise
+#include <cstdlib>								// getenv
+#include <cstring>								// strcmp
+#include <iostream>
+
+Secure_Arena::Secure_Arena()
+{
+	const char* szHugePages = getenv(ARENA_HUGEPAGES_ENV);
+	long cbSysPage = sysconf(_SC_PAGESIZE);
+
+	cbPage = (cbSysPage > 0) ? (size_t)cbSysPage : 4096;
+	cbSlot = ((ARENA_SLOT_SIZE + cbPage - 1) / cbPage) * cbPage;
+	bHugePages = (nullptr != szHugePages && 0 == strcmp(szHugePages, "1"));
+}
+
+Secure_Arena::~Secure_Arena()
+{
+	for (auto & chunk : chunks) munmap(chunk.base, chunk.cb);
+}
+
+Secure_Arena & Secure_Arena::getArena()
+{
+	static Secure_Arena arena{};
+
+	return arena;
+}
+
+void Secure_Arena::lockMemory(void* pv, const size_t & cb)
+{
+	if (0 == mlock(pv, cb) || bLockReported) return;
+
+	bLockReported = true;
+	std::cerr << "\nThe memory of the keys and buffers can't be locked (see ulimit -l), it may be swapped. Error code : " << errno << ".\n";
+}
+
+/*
+* guard | slot | guard | slot | ... | guard
+*/
+int Secure_Arena::addChunk()
+{
+	size_t cbChunk = cbPage + ARENA_CHUNK_SLOTS * (cbSlot + cbPage);
+	unsigned char* base = (unsigned char*)mmap(nullptr, cbChunk, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+	if (MAP_FAILED == (void*)base) return 1;
+
+	chunks.push_back(Chunk{ base, cbChunk });
+	madvise(base, cbChunk, MADV_DONTDUMP);
+
+	for (size_t i = 0; i < ARENA_CHUNK_SLOTS; i++)
+	{
+		unsigned char* slot = base + cbPage + i * (cbSlot + cbPage);
+
+		if (0 != mprotect(slot, cbSlot, PROT_READ | PROT_WRITE)) return (0 == i) ? 1 : 0;
+
+		lockMemory(slot, cbSlot);
+		freeSlots.push_back(slot);
+	}
+
+	return 0;
+}
+
+/*
+* guard | huge page of contiguous slots | guard : the page is aligned within a reservation whose rest stays PROT_NONE
+*/
+int Secure_Arena::addHugeChunk()
+{
+	size_t cbReserved = 3 * ARENA_HUGE_PAGE_SIZE;
+	unsigned char* base = (unsigned char*)mmap(nullptr, cbReserved, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	unsigned char* page = nullptr;
+
+	if (MAP_FAILED == (void*)base) return 1;
+
+	chunks.push_back(Chunk{ base, cbReserved });
+
+	page = base + ARENA_HUGE_PAGE_SIZE - ((size_t)base % ARENA_HUGE_PAGE_SIZE);
+
+	if (0 != mprotect(page, ARENA_HUGE_PAGE_SIZE, PROT_READ | PROT_WRITE)) return 1;
+
+#ifdef MADV_HUGEPAGE
+	madvise(page, ARENA_HUGE_PAGE_SIZE, MADV_HUGEPAGE);
+#endif
+	madvise(base, cbReserved, MADV_DONTDUMP);
+	lockMemory(page, ARENA_HUGE_PAGE_SIZE);
+
+	for (size_t i = 0; i < ARENA_HUGE_PAGE_SIZE / cbSlot; i++) freeSlots.push_back(page + i * cbSlot);
+
+	return 0;
+}
+
+unsigned char* Secure_Arena::acquire()
+{
+	unsigned char* slot = nullptr;
+
+	std::lock_guard<std::mutex> lock(mutex);
+
+	// Huge pages not available : ordinary pages
+	if (freeSlots.empty() && bHugePages && 0 != addHugeChunk()) bHugePages = false;
+
+	if (freeSlots.empty() && 0 != addChunk()) return nullptr;
+
+	slot = freeSlots.back();
+	freeSlots.pop_back();
+
+	return slot;
+}
+
+void Secure_Arena::release(unsigned char* slot, const size_t & cbUsed)
+{
+	if (nullptr == slot) return;
+
+	my_memclr(slot, (cbUsed < cbSlot) ? cbUsed : cbSlot);
+
+	std::lock_guard<std::mutex> lock(mutex);
+
+	freeSlots.push_back(slot);
+}
+
+Secure_Buffer::Secure_Buffer(const size_t & cb)
+{
+	if (cb > ARENA_SLOT_SIZE) return;
+
+	if (nullptr != (slot = Secure_Arena::getArena().acquire())) this->cb = cb;
+}
+
+Secure_Buffer::~Secure_Buffer()
+{
+	Secure_Arena::getArena().release(slot, bTracked ? cbTouched : cb);
+}
+
+unsigned char* Secure_Buffer::data() const
+{
+	return slot;
+}
+
+size_t Secure_Buffer::size() const
+{
+	return cb;
+}
+
+void Secure_Buffer::touch(const size_t & cb)
+{
+	bTracked = true;
+
+	if (cb > cbTouched) cbTouched = (cb < this->cb) ? cb : this->cb;
+}
+
+#endif
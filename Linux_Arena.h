@@ -0,0 +1,125 @@
+/*
+*	=====================================
+*	Copyright (c) El Mostafa IDRASSI 2017
+*	mostafa.idrassi@tutanota.com
+*	Apache License
+*	=====================================
+*/
+
+#ifndef LINUX_ARENA_H
+#define LINUX_ARENA_H
+
+#ifdef __linux__
+
+#include "File_Struct.h"				// READ_BUFFER_SIZE
+
+#include <cstddef>
+#include <mutex>
+#include <vector>
+
+#define ARENA_SLOT_SIZE			(READ_BUFFER_SIZE + 8192)	// a data buffer and the key material of a file
+#define ARENA_CHUNK_SLOTS		16							// slots mapped at a time (more in a huge page)
+#define ARENA_HUGE_PAGE_SIZE	(2 * 1024 * 1024)
+#define ARENA_HUGEPAGES_ENV		"IDXCRYPT_HUGEPAGES"		// =1 : the chunks are backed by transparent huge pages
+
+/*
+*	=====================================================================================================
+*	 Secure arena : the buffers which hold keys or plaintext
+*
+*	 Process-wide pool of fixed-size slots, taken and given back by the workers without a system call :
+*	 the memory is mapped, locked (mlock) and left out of core dumps (MADV_DONTDUMP) once, by chunks of
+*	 ARENA_CHUNK_SLOTS slots, and never given back to the system before the process ends. Every slot is
+*	 surrounded by guard pages (PROT_NONE), so that an overflow faults rather than reading or
+*	 overwriting the secrets of another file. A slot is wiped when it is given back.
+*	 With IDXCRYPT_HUGEPAGES=1 a chunk is a 2 MiB huge page (fewer TLB misses on the data buffers) :
+*	 the guard pages are then around the chunk only, as a huge page can't be split by mprotect.
+*	 If the memory can't be locked (RLIMIT_MEMLOCK, see ulimit -l), it is reported once, and the
+*	 slots are used unlocked.
+*	=====================================================================================================
+*/
+class Secure_Arena
+{
+private:
+
+	struct Chunk
+	{
+		void* base;
+		size_t cb;
+	};
+
+	std::vector<Chunk> chunks{};
+	std::vector<unsigned char*> freeSlots{};
+	std::mutex mutex{};
+	size_t cbPage = 0;
+	size_t cbSlot = 0;							// ARENA_SLOT_SIZE rounded up to pages
+	bool bHugePages = false;
+	bool bLockReported = false;
+
+	Secure_Arena();
+
+	int addChunk();
+	int addHugeChunk();
+	void lockMemory(void* pv, const size_t & cb);
+
+public:
+
+	// Copy, Move constructor and assignment operators deleted : the object owns mappings
+	Secure_Arena(const Secure_Arena & other) = delete;
+	Secure_Arena & operator=(const Secure_Arena & other) = delete;
+	Secure_Arena(Secure_Arena && other) = delete;
+	Secure_Arena & operator=(Secure_Arena && other) = delete;
+
+	~Secure_Arena();
+
+	static Secure_Arena & getArena();
+
+	/*
+	*	A wiped slot of ARENA_SLOT_SIZE bytes, nullptr if no memory can be mapped
+	*/
+	unsigned char* acquire();
+
+	/*
+	*	Wipes the first cbUsed bytes of slot (its user wrote none beyond), and gives it back
+	*/
+	void release(unsigned char* slot, const size_t & cbUsed);
+};
+
+/*
+*	A slot of the arena, given back when the object is destroyed
+*/
+class Secure_Buffer
+{
+private:
+
+	unsigned char* slot = nullptr;
+	size_t cb = 0;
+	size_t cbTouched = 0;						// high-water mark of the bytes written
+	bool bTracked = false;
+
+public:
+
+	/*
+	*	cb bytes at most ARENA_SLOT_SIZE. data() is nullptr if they can't be allocated.
+	*/
+	explicit Secure_Buffer(const size_t & cb);
+
+	Secure_Buffer(const Secure_Buffer & other) = delete;
+	Secure_Buffer & operator=(const Secure_Buffer & other) = delete;
+	Secure_Buffer(Secure_Buffer && other) = delete;
+	Secure_Buffer & operator=(Secure_Buffer && other) = delete;
+
+	~Secure_Buffer();
+
+	unsigned char* data() const;
+	size_t size() const;
+
+	/*
+	*	Records that the first cb bytes may have been written : only the bytes below the highest mark are wiped
+	*	when the slot is given back (the rest is still zero). A buffer never marked is wiped whole.
+	*/
+	void touch(const size_t & cb);
+};
+
+#endif // !__linux__
+
+#endif // !LINUX_ARENA_H
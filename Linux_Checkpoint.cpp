@@ -0,0 +1,142 @@
+/*
+*	=====================================
+*	Copyright (c) El Mostafa IDRASSI 2017
+*	mostafa.idrassi@tutanota.com
+*	Apache License
+*	=====================================
+*/
+
+#ifdef __linux__
+
+#include "Linux_Checkpoint.h"
+
+#include "Linux_Output.h"						// Output_File
+#include "File_Struct.h"						// READ_BUFFER_SIZE
+
+#include <errno.h>
+
+File_Checkpoint::File_Checkpoint()
+{
+}
+
+int File_Checkpoint::open(const std::string & outPath, FILE* fin, const size_t & cbSalt, const int & bResume)
+{
+	struct stat stat_buf {}, partial_buf {};
+	Checkpoint_Record saved{};
+	FILE* fckpt = nullptr;
+
+	partialPath = outPath + CHECKPOINT_PARTIAL_EXT;
+	ckptPath = outPath + CHECKPOINT_EXT;
+
+	if (0 != fstat(fileno(fin), &stat_buf))
+	{
+		std::cerr << "An error occured when trying to get the input file ST_STAT. (File_Checkpoint - fstat) Error code : " << errno << ". Aborting...\n";
+		return 1;
+	}
+
+	memcpy(record.magic, CHECKPOINT_MAGIC, 8);
+	record.version = CHECKPOINT_VERSION;
+	record.cbSalt = (uint32_t)cbSalt;
+	record.dev = (uint64_t)stat_buf.st_dev;
+	record.ino = (uint64_t)stat_buf.st_ino;
+	record.size = (int64_t)stat_buf.st_size;
+	record.mtimeNs = (int64_t)stat_buf.st_mtim.tv_sec * 1000000000 + (int64_t)stat_buf.st_mtim.tv_nsec;
+
+	// A new encryption : the checkpoint of a previous one doesn't describe the new partial output
+	if (!bResume) return finish();
+
+	if (nullptr == (fckpt = fopen(ckptPath.data(), "rb")) || 0 != stat(partialPath.data(), &partial_buf))
+	{
+		printf("There is no interrupted encryption of this file to resume, starting from the beginning.\n");
+		if (fckpt) fclose(fckpt);
+		return 0;
+	}
+
+	if (1 != fread(&saved, sizeof(saved), 1, fckpt))
+	{
+		std::cerr << "The checkpoint " << ckptPath << " can't be read. Aborting...\n";
+		fclose(fckpt);
+		return 1;
+	}
+	fclose(fckpt);
+
+	// Same input, same kind of job, and the partial output is at least as long as the checkpoint says
+	if (0 != memcmp(saved.magic, record.magic, 8) || saved.version != record.version || saved.cbSalt != record.cbSalt ||
+		saved.dev != record.dev || saved.ino != record.ino || saved.size != record.size || saved.mtimeNs != record.mtimeNs ||
+		saved.inputOffset <= 0 || saved.inputOffset % READ_BUFFER_SIZE || saved.inputOffset >= saved.size ||
+		saved.outputOffset < (int64_t)(cbSalt + 48) || saved.outputOffset > (int64_t)partial_buf.st_size)
+	{
+		std::cerr << "The checkpoint " << ckptPath << " doesn't match the input file or the partial output (input modified ?). Run without /resume to start over. Aborting...\n";
+		return 1;
+	}
+
+	record = saved;
+	lastInputOffset = record.inputOffset;
+	bResuming = true;
+
+	printf("Resuming the encryption at %.2f%%.\n", (double)record.inputOffset * 100.0 / (double)record.size);
+
+	return 0;
+}
+
+bool File_Checkpoint::isResuming() const
+{
+	return bResuming;
+}
+
+const Checkpoint_Record & File_Checkpoint::getRecord() const
+{
+	return record;
+}
+
+const std::string & File_Checkpoint::getPartialPath() const
+{
+	return partialPath;
+}
+
+bool File_Checkpoint::isDue(const __int64 & inputOffset) const
+{
+	return inputOffset - lastInputOffset >= CHECKPOINT_INTERVAL;
+}
+
+int File_Checkpoint::save(FILE* fout, const __int64 & inputOffset, const unsigned char lastBlock[16])
+{
+	Output_File output{};
+	off_t outputOffset = 0;
+
+	// The data first : a checkpoint never describes data that is not on disk
+	if (0 != fflush(fout) || (outputOffset = ftello(fout)) < 0 || 0 != fdatasync(fileno(fout)))
+	{
+		std::cerr << "\nAn error occured while synchronizing the partial output. Error code : " << errno << ". Aborting...\n";
+		return 1;
+	}
+
+	record.inputOffset = (int64_t)inputOffset;
+	record.outputOffset = (int64_t)outputOffset;
+	memcpy(record.lastBlock, lastBlock, 16);
+
+	// Atomic replacement of the sidecar : the previous checkpoint stays valid until this one is complete
+	if (0 != output.create(ckptPath) || 1 != fwrite(&record, sizeof(record), 1, output.getFile()) ||
+		0 != fflush(output.getFile()) || 0 != fdatasync(fileno(output.getFile())) || 0 != output.publish())
+	{
+		std::cerr << "\nAn error occured while writing the checkpoint " << ckptPath << " . Error code : " << errno << ". Aborting...\n";
+		return 1;
+	}
+
+	lastInputOffset = inputOffset;
+
+	return 0;
+}
+
+int File_Checkpoint::finish()
+{
+	if (0 != unlink(ckptPath.data()) && ENOENT != errno)
+	{
+		std::cerr << "An error occured while deleting the checkpoint " << ckptPath << " . Error code : " << errno << ".\n";
+		return 1;
+	}
+
+	return 0;
+}
+
+#endif
@@ -0,0 +1,99 @@
+/*
+*	=====================================
+*	Copyright (c) El Mostafa IDRASSI 2017
+*	mostafa.idrassi@tutanota.com
+*	Apache License
+*	=====================================
+*/
+
+#ifndef LINUX_CHECKPOINT_H
+#define LINUX_CHECKPOINT_H
+
+#ifdef __linux__
+
+#include "MyLinuxSysFunctions.h"		// __int64, stat
+
+#include <cstdint>
+#include <cstdio>						// FILE
+#include <string>
+
+#define CHECKPOINT_MAGIC		"IDXCKPT"
+#define CHECKPOINT_VERSION		1
+
+#define CHECKPOINT_INTERVAL		((__int64)256 * 1024 * 1024)	// bytes of input encrypted between 2 checkpoints
+
+#define CHECKPOINT_PARTIAL_EXT	".partial"						// the output, until it is complete
+#define CHECKPOINT_EXT			".ckpt"							// the sidecar file
+
+/*
+*	=====================================================================================================
+*	 Resumable encryption of a single file ("/checkpoint", then "/checkpoint /resume")
+*
+*	 The output is written under a visible name (output.partial) which is kept if the job is interrupted.
+*	 Every CHECKPOINT_INTERVAL bytes, the partial output is made durable (fdatasync), then the sidecar
+*	 file (output.ckpt) is atomically replaced with the input offset reached, the length of the valid
+*	 output and its last ciphertext block.
+*	 A resumed job re-derives the key from the salt at the start of the partial output, checks the
+*	 header (password) and the last block against the sidecar, drops what follows the checkpoint, and
+*	 goes on encrypting from the input offset with the last block as IV (CBC).
+*	=====================================================================================================
+*/
+
+struct Checkpoint_Record
+{
+	char magic[8];
+	uint32_t version;
+	uint32_t cbSalt;
+	uint64_t dev;						// identity of the input : it must not change between the runs
+	uint64_t ino;
+	int64_t size;
+	int64_t mtimeNs;
+	int64_t inputOffset;				// bytes of input encrypted (multiple of READ_BUFFER_SIZE)
+	int64_t outputOffset;				// bytes of the partial output that are valid
+	unsigned char lastBlock[16];		// last ciphertext block written : IV of the rest
+};
+
+class File_Checkpoint
+{
+private:
+
+	std::string partialPath{};
+	std::string ckptPath{};
+	Checkpoint_Record record{};
+	bool bResuming = false;
+	__int64 lastInputOffset = 0;
+
+public:
+
+	File_Checkpoint();
+
+	/*
+	*	Prepares the checkpoints of the encryption of fin into outPath
+	*	With bResume, the sidecar of the interrupted run is loaded. Returns 1 if it doesn't match the input.
+	*	Without a sidecar or a partial output, the encryption starts from the beginning.
+	*/
+	int open(const std::string & outPath, FILE* fin, const size_t & cbSalt, const int & bResume);
+
+	bool isResuming() const;
+	const Checkpoint_Record & getRecord() const;
+	const std::string & getPartialPath() const;
+
+	/*
+	*	True if a checkpoint is due after inputOffset bytes of input
+	*/
+	bool isDue(const __int64 & inputOffset) const;
+
+	/*
+	*	Makes the partial output durable up to its current position, then records the checkpoint
+	*/
+	int save(FILE* fout, const __int64 & inputOffset, const unsigned char lastBlock[16]);
+
+	/*
+	*	The output is complete : the sidecar is deleted
+	*/
+	int finish();
+};
+
+#endif // !__linux__
+
+#endif // !LINUX_CHECKPOINT_H
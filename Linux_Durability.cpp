@@ -0,0 +1,193 @@
+/*
+*	=====================================
+*	Copyright (c) El Mostafa IDRASSI 2017
+*	mostafa.idrassi@tutanota.com
+*	Apache License
+*	=====================================
+*/
+
+#ifdef __linux__
+
+#include "Linux_Durability.h"
+
+#include <errno.h>
+#include <iostream>								// cerr
+#include <algorithm>							// sort, unique
+
+Durability_Tracker::Durability_Tracker(const bool & bQuiet) : bQuiet(bQuiet)
+{
+}
+
+Durability_Tracker::~Durability_Tracker()
+{
+	// Files never published (the job failed) : anonymous ones vanish on close, named ones are deleted
+	for (const Pending_File & file : pendingFiles)
+	{
+		close(file.fd);
+		if (!file.tmpPath.empty()) unlink(file.tmpPath.data());
+	}
+}
+
+void Durability_Tracker::addParentDirectory(const std::string & path, const dev_t & dev)
+{
+	std::string dir{}, base{};
+
+	dirname_base_separator(path, dir, base);
+	pendingDirs.push_back(Pending_Dir{ dir, dev });
+}
+
+int Durability_Tracker::addFile(Output_File & output, std::function<int()> published)
+{
+	struct stat stat_buf {};
+	FILE* fout = output.getFile();
+	int fd = -1;
+
+	// Push the stdio buffer to the kernel, then keep our own descriptor : the output is closed right after
+	if (nullptr == fout || 0 != fflush(fout) || (fd = dup(fileno(fout))) < 0 || 0 != fstat(fd, &stat_buf))
+	{
+		std::cerr << "An error occured while registering " << output.getPath() << " for synchronization. Error code : " << errno << ". Aborting...\n";
+		if (fd >= 0) close(fd);
+		return 1;
+	}
+
+	pendingFiles.push_back(Pending_File{ fd, stat_buf.st_dev, output.getTmpPath(), output.getPath(), std::move(published) });
+	pendingBytes += (__int64)stat_buf.st_size;
+	addParentDirectory(output.getPath(), stat_buf.st_dev);
+
+	if (0 != output.release()) return 1;
+
+	if (pendingFiles.size() >= DURABILITY_MAX_PENDING_FILES || pendingBytes >= DURABILITY_MAX_PENDING_BYTES)
+		return checkpoint();
+
+	return 0;
+}
+
+int Durability_Tracker::addDirectory(const std::string & path)
+{
+	struct stat stat_buf {};
+
+	if (0 != stat(path.data(), &stat_buf))
+	{
+		std::cerr << "An error occured when trying to get " << path << " ST_STAT. (addDirectory - stat) Error code : " << errno << ". Aborting...\n";
+		return 1;
+	}
+
+	addParentDirectory(path, stat_buf.st_dev);
+
+	return 0;
+}
+
+int Durability_Tracker::checkpoint()
+{
+	std::vector<dev_t> syncfsDevs{};				// filesystems synced with syncfs
+	std::vector<dev_t> failedDevs{};				// filesystems whose syncfs failed : none of their files is durable
+	std::vector<char> bDone(pendingFiles.size(), 0);	// published, and durable under its name
+	int iStatus = 0;
+
+	if (pendingFiles.empty() && pendingDirs.empty()) return 0;
+
+	if (!bQuiet) printf("Flushing %u output file(s) to disk, please wait...", (unsigned int)pendingFiles.size());
+
+	auto isIn = [](const std::vector<dev_t> & devs, const dev_t & dev) {
+		return std::find(devs.begin(), devs.end(), dev) != devs.end();
+	};
+
+	// A failure only concerns the file, or the filesystem, it happened on : the others of the batch go on
+	// The descriptors stay open until the end : one of each filesystem synced with syncfs is used again for the names
+
+	// 1 - The data : 1 syncfs for the filesystems which hold enough pending files, fdatasync for the others
+	for (const Pending_File & file : pendingFiles)
+	{
+		if (isIn(syncfsDevs, file.dev) || isIn(failedDevs, file.dev)) continue;
+
+		size_t count = (size_t)std::count_if(pendingFiles.begin(), pendingFiles.end(), [&file](const Pending_File & other) { return other.dev == file.dev; });
+		if (count < DURABILITY_SYNCFS_THRESHOLD) continue;
+
+		if (0 == syncfs(file.fd)) syncfsDevs.push_back(file.dev);
+		else
+		{
+			std::cerr << "\nAn error occured while synchronizing the output filesystem. (checkpoint - syncfs) Error code : " << errno << ".\n";
+			failedDevs.push_back(file.dev);
+		}
+	}
+
+	for (size_t i = 0; i < pendingFiles.size(); i++)
+	{
+		const Pending_File & file = pendingFiles[i];
+
+		if (isIn(failedDevs, file.dev)) continue;
+
+		if (isIn(syncfsDevs, file.dev) || 0 == fdatasync(file.fd)) bDone[i] = 1;
+		else std::cerr << "\nAn error occured while synchronizing the output file " << file.path << " . (checkpoint - fdatasync) Error code : " << errno << ".\n";
+	}
+
+	// 2 - The data is on disk : the files can get their names. The others are deleted.
+	for (size_t i = 0; i < pendingFiles.size(); i++)
+	{
+		Pending_File & file = pendingFiles[i];
+
+		if (bDone[i] && 0 == publishOutput(file.fd, file.tmpPath, file.path)) file.tmpPath.clear();
+		else bDone[i] = 0;
+
+		if (!file.tmpPath.empty()) unlink(file.tmpPath.data());
+	}
+
+	// 3 - The names : 2nd syncfs, or 1 fsync per directory in which entries were created
+	for (const dev_t & dev : syncfsDevs)
+	{
+		auto file = std::find_if(pendingFiles.begin(), pendingFiles.end(), [&dev](const Pending_File & other) { return other.dev == dev; });
+
+		if (0 != syncfs(file->fd))
+		{
+			std::cerr << "\nAn error occured while synchronizing the output filesystem. (checkpoint - syncfs) Error code : " << errno << ".\n";
+			failedDevs.push_back(dev);
+		}
+	}
+
+	std::sort(pendingDirs.begin(), pendingDirs.end(), [](const Pending_Dir & a, const Pending_Dir & b) { return a.path < b.path; });
+	pendingDirs.erase(std::unique(pendingDirs.begin(), pendingDirs.end(), [](const Pending_Dir & a, const Pending_Dir & b) { return a.path == b.path; }), pendingDirs.end());
+
+	for (const Pending_Dir & dir : pendingDirs)
+	{
+		if (isIn(syncfsDevs, dir.dev)) continue;
+
+		int fd = open(dir.path.data(), O_RDONLY | O_DIRECTORY);
+		if (fd < 0 || 0 != fsync(fd))
+		{
+			std::cerr << "\nAn error occured while synchronizing the output directory " << dir.path << " . (checkpoint - fsync) Error code : " << errno << ".\n";
+			iStatus = 1;
+
+			// The files published in it may lose their names
+			for (size_t i = 0; i < pendingFiles.size(); i++)
+			{
+				std::string parent{}, base{};
+
+				dirname_base_separator(pendingFiles[i].path, parent, base);
+				if (parent == dir.path) bDone[i] = 0;
+			}
+		}
+		if (fd >= 0) close(fd);
+	}
+
+	// 4 - Everything published is durable : what depends on it can be recorded
+	for (size_t i = 0; i < pendingFiles.size(); i++)
+	{
+		const Pending_File & file = pendingFiles[i];
+
+		if (isIn(failedDevs, file.dev)) bDone[i] = 0;
+
+		if (!bDone[i] || (file.published && 0 != file.published())) iStatus = 1;
+
+		close(file.fd);
+	}
+
+	pendingFiles.clear();
+	pendingDirs.clear();
+	pendingBytes = 0;
+
+	if (0 == iStatus && !bQuiet) printf("Done!\n");
+
+	return iStatus;
+}
+
+#endif
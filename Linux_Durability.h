@@ -0,0 +1,104 @@
+/*
+*	=====================================
+*	Copyright (c) El Mostafa IDRASSI 2017
+*	mostafa.idrassi@tutanota.com
+*	Apache License
+*	=====================================
+*/
+
+#ifndef LINUX_DURABILITY_H
+#define LINUX_DURABILITY_H
+
+#ifdef __linux__
+
+#include "MyLinuxSysFunctions.h"		// __int64
+#include "Linux_Output.h"				// Output_File
+
+#include <cstdio>						// FILE
+#include <functional>
+#include <string>
+#include <vector>
+
+#define DURABILITY_MAX_PENDING_FILES	256							// checkpoint once that many output files are waiting (bounds the number of open descriptors)
+#define DURABILITY_MAX_PENDING_BYTES	((__int64)1 << 30)			// or once that many bytes are waiting (1 GiB)
+#define DURABILITY_SYNCFS_THRESHOLD		32							// from that many files on one filesystem, 1 syncfs is cheaper than 1 fdatasync per file
+
+/*
+*	=====================================================================================================
+*	 Makes the output of a job durable with as few barriers as possible ("/sync")
+*
+*	 Instead of an fsync per output file, the files written by a job are kept open, unpublished, and
+*	 synced together at checkpoints (every DURABILITY_MAX_PENDING_FILES files or DURABILITY_MAX_PENDING_BYTES
+*	 bytes, and when the job ends) :
+*	  - a filesystem holding at least DURABILITY_SYNCFS_THRESHOLD of the pending files gets 1 syncfs,
+*	    otherwise every pending file gets an fdatasync
+*	  - only then are the files published under their final names : a published output is always complete
+*	  - the new names are persisted by a 2nd syncfs (metadata only by then), or by 1 fsync per directory in
+*	    which an entry was created (the parent of a new file or of a created directory), whatever the number
+*	    of files created in it. Directories that were only traversed are never synced.
+*	  - last, the callback given with each file is called (e.g. its journal record) : the file is durable
+*	 A failure only concerns what it happened on : the files of a filesystem whose syncfs failed, a file
+*	 whose fdatasync or publication failed, the files of a directory whose fsync failed. The other files
+*	 of the batch are published and get their callback, the checkpoint returns 1.
+*	=====================================================================================================
+*/
+class Durability_Tracker
+{
+private:
+
+	struct Pending_File
+	{
+		int fd;							// duplicate of the output descriptor, kept open until the checkpoint
+		dev_t dev;						// filesystem holding the file
+		std::string tmpPath;			// see Output_File
+		std::string path;
+		std::function<int()> published;	// called once the file is durable under its name (may be empty)
+	};
+
+	struct Pending_Dir
+	{
+		std::string path;				// directory in which an entry was created
+		dev_t dev;
+	};
+
+	std::vector<Pending_File> pendingFiles{};
+	std::vector<Pending_Dir> pendingDirs{};
+	__int64 pendingBytes = 0;
+	bool bQuiet = false;				// no progress message (workers of /watch)
+
+	void addParentDirectory(const std::string & path, const dev_t & dev);
+
+public:
+
+	explicit Durability_Tracker(const bool & bQuiet = false);
+
+	// Copy, Move constructor and assignment operators deleted : the tracker owns file descriptors
+	Durability_Tracker(const Durability_Tracker & other) = delete;
+	Durability_Tracker & operator=(const Durability_Tracker & other) = delete;
+	Durability_Tracker(Durability_Tracker && other) = delete;
+	Durability_Tracker & operator=(Durability_Tracker && other) = delete;
+
+	~Durability_Tracker();
+
+	/*
+	*	Takes over a successfully written output file, which will be published at the next checkpoint
+	*	Runs a checkpoint if the limits of pending files/bytes are reached
+	*	published, if given, is called by the checkpoint which made the file durable ; its failure fails the checkpoint
+	*/
+	int addFile(Output_File & output, std::function<int()> published = nullptr);
+
+	/*
+	*	Registers an output directory created by the job (mkdir succeeded)
+	*/
+	int addDirectory(const std::string & path);
+
+	/*
+	*	Makes every registered file durable, publishes it, makes the directory entries durable, calls the callbacks of
+	*	the files, then forgets them
+	*/
+	int checkpoint();
+};
+
+#endif // !__linux__
+
+#endif // !LINUX_DURABILITY_H
@@ -13,17 +13,46 @@
 #include "mem_impl.h"                     // my_memclr
 
 #include "MyLinuxSysFunctions.h"				// getAbsolutePath
+#include "Linux_Durability.h"					// Durability_Tracker
+#include "Linux_Output.h"						// Output_File
+#include "Linux_Sparse.h"						// getDataExtents, Extent_Reader, Extent_Writer
+#include "Idx_Format.h"						// Idx_Header
+#include "Linux_Manifest.h"					// Change_Manifest
+#include "Linux_Journal.h"					// Job_Journal
+#include "Linux_Checkpoint.h"					// File_Checkpoint
+#include "Linux_Watch.h"						// Folder_Watcher, Worker_Pool
+#include "Idx_Engine.h"						// deriveKey
+#include "Idx_SelfTest.h"						// requireSelfTests
+#include "Idx_Random.h"						// getRandomBytes
+#include "Idx_Context.h"						// Context_Pool
+#include "Linux_Arena.h"						// Secure_Buffer
+#include "Idx_Merkle.h"						// Merkle_Builder, Merkle_Reader
+#include "Idx_Compress.h"						// Block_Compressor, Frame_Decoder
+#include "Linux_Volume.h"						// Volume_Writer, Volume_Reader
 
 #include <errno.h>
 #include <iostream>								// cerr, cout
+#include <fcntl.h>								// fallocate
+#include <unistd.h>								// ftruncate
+#include <algorithm>							// max
+#include <cstddef>								// offsetof
+#include <cstring>								// memcpy, memcmp
+#include <memory>
+#include <thread>								// hardware_concurrency
 #include <sys/mman.h>							// mlock
 
+#define PIPE_BUFFER_SIZE	(1024 * 1024)		// capacity requested for pipes used as input/output ("-")
+
 /* Function to display information about the progress of the current operation */
-clock_t startClock = 0;
-clock_t currentClock = 0;
+/* Per thread : the workers of /watch process files concurrently, and don't display their progress */
+thread_local clock_t startClock = 0;
+thread_local clock_t currentClock = 0;
+static thread_local bool bShowProgress = true;
 
 void ShowProgress(char * szOperationDesc, __int64 inputLength, __int64 totalProcessed, bool bFinalBlock)
 {
+	if (!bShowProgress) return;
+
 	/* display progress information every 2 seconds */
 	clock_t t = clock();
 	if ((currentClock == 0) || bFinalBlock || ((t - currentClock) >= (2 * CLOCKS_PER_SEC)))
@@ -33,6 +62,8 @@ void ShowProgress(char * szOperationDesc, __int64 inputLength, __int64 totalProc
 		double processingTime = (double)(currentClock - startClock) / (double)CLOCKS_PER_SEC;
 		if (bFinalBlock)
 			printf("\r%sDone! (time: %.2fs - speed: %.2f MiB/s)\n", szOperationDesc, processingTime, (double)totalProcessed / (processingTime * 1024.0 * 1024.0));
+		else if (inputLength <= 0)		// unknown length (pipe)
+			printf("\r%s (%.2f MiB - %.2f MiB/s)", szOperationDesc, (double)totalProcessed / (1024.0 * 1024.0), (double)totalProcessed / (processingTime * 1024.0 * 1024.0));
 		else
 			printf("\r%s (%.2f%% - %.2f MiB/s)", szOperationDesc, ((double)totalProcessed * 100.0) / (double)inputLength, (double)totalProcessed / (processingTime * 1024.0 * 1024.0));
 	}
@@ -63,7 +94,10 @@ int Linux_File::setPaths(const std::string & pIn, const std::string & pOut)
 {
 	int iStatus = 0;
 
-	if (pIn[0] != '/') {	// input path is relative to the current working directory, get absolute path and store both
+	if (pIn == "-") {		// standard input
+		absInpath = pIn;
+	}
+	else if (pIn[0] != '/') {	// input path is relative to the current working directory, get absolute path and store both
 
 		relativeInpath = pIn;
 		iStatus = relativeToAbsolutePath(0);
@@ -77,7 +111,10 @@ int Linux_File::setPaths(const std::string & pIn, const std::string & pOut)
 	// For the output, we seperate dir from base, because the user can enter a path
 	// where the file (base) doesn't actaully exist. However, the dir should exist.
 
-	if (pOut[0] != '/') {	// output path is relative to the current working directory, get absolute path and store both
+	if (pOut == "-") {		// standard output
+		absOutpath = pOut;
+	}
+	else if (pOut[0] != '/') {	// output path is relative to the current working directory, get absolute path and store both
 
 		std::string dir{}, base{};
 
@@ -105,19 +142,718 @@ int Linux_File::setPaths(const std::string & pIn, const std::string & pOut)
 	return iStatus;
 }
 
-static int opFile(FILE* fin, FILE* fout, __int64 inputLength, const std::string & outPath, Hmac_PRF & prf, const char szPassword[], const size_t & cbSalt, const int & bForDecrypt)
+/*
+* Look-ahead of 1 byte : returns true if there is nothing left to read from fin
+*/
+static bool isEndOfStream(FILE* fin)
+{
+	int c = getc(fin);
+
+	if (EOF == c) return true;
+
+	ungetc(c, fin);
+	return false;
+}
+
+/*
+* Returns true if f is a regular file (false for pipes, terminals...)
+*/
+static bool isRegularFile(FILE* f)
+{
+	struct stat stat_buf {};
+
+	return (0 == fstat(fileno(f), &stat_buf)) && S_ISREG(stat_buf.st_mode);
+}
+
+/*
+* Enlarges the kernel buffer of fd if it is a pipe, so that the other end of a pipeline
+* is not woken up for every 64 KiB (default pipe capacity). Best effort : the limit is
+* /proc/sys/fs/pipe-max-size for unprivileged users.
+*/
+static void enlargePipe(int fd)
+{
+	struct stat stat_buf {};
+
+	if (0 == fstat(fd, &stat_buf) && S_ISFIFO(stat_buf.st_mode))
+		fcntl(fd, F_SETPIPE_SZ, PIPE_BUFFER_SIZE);
+}
+
+/*
+* "-" as output path : the data goes to the original standard output, and everything the program
+* prints (progress, errors) is sent to stderr instead (see detachStandardOutput)
+*/
+static FILE* getStdoutStream()
+{
+	FILE* fout = nullptr;
+	int fd = -1;
+
+	if ((fd = detachStandardOutput()) < 0 || nullptr == (fout = fdopen(fd, "wb")))
+	{
+		std::cerr << "An error occured while setting up the standard output. Error code : " << errno << ". Aborting...\n";
+		return nullptr;
+	}
+
+	enlargePipe(fd);
+
+	return fout;
+}
+
+/*
+* Computes the size of the output of opFile for an input of inputLength bytes (whole input file, or its data extents when sparse)
+* Encryption : salt + IV + encrypted header + data (+ hash tree). In format 1, full READ_BUFFER_SIZE blocks are encrypted without padding,
+* so only a trailing block < READ_BUFFER_SIZE gets PKCS#7 padded to the next multiple of 16. Format 2 always pads => exact size
+* (upper bound when compressed : every block stored)
+* Decryption : input minus salt, IV and header. The padding is only known once the last block is decrypted => upper bound
+*/
+static __int64 getOutputLength(__int64 inputLength, const size_t & cbSalt, const int & bForDecrypt, const Idx_Header & header)
+{
+	if (inputLength <= 0)		// unknown length (pipe)
+		return 0;
+
+	if (bForDecrypt)
+		return (inputLength > (__int64)(32 + cbSalt)) ? inputLength - (__int64)(32 + cbSalt) : 0;
+
+	if (header.flags & IDX_FLAG_COMPRESSED) inputLength = (__int64)getCompressBound((size_t)inputLength);
+
+	__int64 tailLength = inputLength % READ_BUFFER_SIZE;
+	__int64 dataLength = inputLength - tailLength;
+	if (isPaddedEnd(header.version, inputLength)) dataLength += (tailLength / 16 + 1) * 16;
+	if (header.flags & IDX_FLAG_DIGEST) dataLength += IDX_DIGEST_SIZE;
+	if (header.flags & IDX_FLAG_MERKLE) dataLength += getMerkleTreeLength(dataLength);
+
+	return (__int64)(32 + cbSalt + header.ext.size()) + dataLength;
+}
+
+/*
+* Reserves outputLength bytes of disk space for fout before any data is written, so that the filesystem
+* can allocate the output as one contiguous extent rather than growing it one write at a time.
+* FALLOC_FL_KEEP_SIZE leaves the apparent size at 0 : a reader never sees unwritten bytes, and the
+* preallocation can exceed the final size (decryption) without any effect other than trimOutput.
+* Filesystems that don't support fallocate are silently ignored. Returns 1 only if the disk is full.
+*/
+static int preallocateOutput(FILE* fout, __int64 outputLength)
+{
+	if (outputLength <= 0 || !isRegularFile(fout)) return 0;
+
+	if (0 != fallocate(fileno(fout), FALLOC_FL_KEEP_SIZE, 0, (off_t)outputLength) && errno == ENOSPC)
+	{
+		printf("Not enough space left on the output device (%lld bytes needed). Aborting...\n", (long long)outputLength);
+		return 1;
+	}
+
+	return 0;
+}
+
+/*
+* Releases the blocks preallocated by preallocateOutput past the last byte actually written
+* (the PKCS#7 padding removed during decryption)
+*/
+static int trimOutput(FILE* fout)
+{
+	off_t outputLength = 0;
+
+	if (!isRegularFile(fout)) return (0 == fflush(fout)) ? 0 : 1;
+
+	if (0 != fflush(fout) || (outputLength = ftello(fout)) < 0 || 0 != ftruncate(fileno(fout), outputLength))
+	{
+		printf("An unexpected error occured while finalizing the output file. Aborting...\n");
+		return 1;
+	}
+
+	return 0;
+}
+
+/*
+* Chooses the format of the output of an encryption and builds its header
+* Format 2 (/sparse) : the data extents of a regular input are mapped, and inputLength becomes the length of the data to encrypt
+* Format 2 (/volume) : the size of the volumes is recorded, so that the decryption checks that none is missing
+* Format 2 (/envelope) : pbDataKey, the key and IV of the data, is the last record
+*/
+static int prepareHeader(FILE* fin, __int64 & inputLength, const Op_Options & options, Idx_Header & header, std::vector<Idx_Extent> & extents, const unsigned char pbDataKey[IDX_DATA_KEY_SIZE], unsigned char pbHeader[IDX_HEADER_SIZE])
+{
+	__int64 fileLength = inputLength;
+
+	if (options.bDigest)
+	{
+		header.version = IDX_VERSION_2;
+		header.flags |= IDX_FLAG_DIGEST;
+	}
+
+	if (options.bMerkle)
+	{
+		header.version = IDX_VERSION_2;
+		header.flags |= IDX_FLAG_MERKLE;
+	}
+
+	if (options.bSparse)
+	{
+		header.version = IDX_VERSION_2;
+
+		// The map can only be made for a regular file (the input of a pipe is encrypted as it comes)
+		if (isRegularFile(fin))
+		{
+			if (0 != getDataExtents(fileno(fin), fileLength, extents))
+			{
+				printf("An unexpected error occured while mapping the data of the input file (Error code : %d). Aborting...\n", errno);
+				return 1;
+			}
+
+			header.flags |= IDX_FLAG_SPARSE;
+			addExtRecord(header, IDX_EXT_SPARSE_MAP, encodeSparseMap(fileLength, extents));
+			inputLength = getDataLength(extents);
+		}
+	}
+
+	if (options.bCompress)
+	{
+		header.version = IDX_VERSION_2;
+		header.flags |= IDX_FLAG_COMPRESSED;
+		addExtRecord(header, IDX_EXT_COMPRESSION, encodeCompression());
+	}
+
+	if (options.volumeSize > 0)
+	{
+		header.version = IDX_VERSION_2;
+		addExtRecord(header, IDX_EXT_VOLUMES, encodeVolumes(options.volumeSize));
+	}
+
+	if (options.bEnvelope)
+	{
+		std::vector<unsigned char> value(pbDataKey, pbDataKey + IDX_DATA_KEY_SIZE);
+
+		header.version = IDX_VERSION_2;
+		header.flags |= IDX_FLAG_ENVELOPE;
+
+		// Room for the padding as well : no copy of the key is left behind by a reallocation (the records are encrypted in place)
+		header.ext.reserve(header.ext.size() + 6 + IDX_DATA_KEY_SIZE + 16);
+		addExtRecord(header, IDX_EXT_DATA_KEY, value);
+		my_memclr(value.data(), value.size());
+	}
+
+	if (0 != buildHeader(header, pbHeader))
+	{
+		printf("The input file is too fragmented to be encrypted as a sparse file. Aborting...\n");
+		return 1;
+	}
+
+	return 0;
+}
+
+/*
+* Encrypts and writes the header, then the extension records (format 2)
+*/
+static int writeHeader(AES_CTX & ctx, FILE* fout, unsigned char pbHeader[IDX_HEADER_SIZE], Idx_Header & header)
 {
-	unsigned char pbDerivedKey[32] = {};
-	unsigned char pbSalt[64] = {}, pbIV[16] = {};
-	unsigned char pbData[READ_BUFFER_SIZE + 32] = {};
+	size_t cbData = 0;
+
+	// AES encryption of the header using IV,DerivedKey
+	if (0 != OpCipher(ctx, pbHeader, IDX_HEADER_SIZE, pbHeader, IDX_HEADER_SIZE, cbData, 0) ||
+		(!header.ext.empty() && 0 != OpCipher(ctx, header.ext.data(), header.ext.size(), header.ext.data(), header.ext.size(), cbData, 0)))
+	{
+		printf("Unexpected error occured while encrypting. Aborting\n");
+		return 1;
+	}
+
+	// write encrypted header
+	if (IDX_HEADER_SIZE != fwrite(pbHeader, 1, IDX_HEADER_SIZE, fout) || header.ext.size() != fwrite(header.ext.data(), 1, header.ext.size(), fout))
+	{
+		printf("An unexpected error occured while writing data to the output file. Aborting!\n");
+		return 1;
+	}
+
+	return 0;
+}
+
+/*
+* Continues with the key and IV of the data (IDX_FLAG_ENVELOPE), once the header is encrypted or decrypted
+*/
+static int useDataKey(AES_CTX & ctx, const unsigned char pbDataKey[IDX_DATA_KEY_SIZE], const int & bForEncrypt)
+{
+	ctx.cleanCtx();
+
+	return CreateCipher(ctx, CBC, pbDataKey, 256, pbDataKey + 32, bForEncrypt);
+}
+
+/*
+* Prepares the decompression of the data with the codec of the records (IDX_FLAG_COMPRESSED)
+*/
+static int openCompression(const Idx_Header & header, Frame_Decoder & decoder)
+{
+	std::vector<unsigned char> value{};
+
+	// The digest is not taken from compressed data
+	if (header.flags & IDX_FLAG_DIGEST) return 1;
+
+	return (0 == findExtRecord(header, IDX_EXT_COMPRESSION, value) && 0 == decoder.init(value)) ? 0 : 1;
+}
+
+/*
+* Takes the key of the data out of the decrypted records (IDX_FLAG_ENVELOPE), then wipes them
+*/
+static int openEnvelope(AES_CTX & ctx, Idx_Header & header, unsigned char pbDataKey[IDX_DATA_KEY_SIZE])
+{
+	std::vector<unsigned char> value{};
+	int iStatus = 1;
+
+	if (0 == findExtRecord(header, IDX_EXT_DATA_KEY, value) && IDX_DATA_KEY_SIZE == value.size())
+	{
+		memcpy(pbDataKey, value.data(), IDX_DATA_KEY_SIZE);
+		iStatus = useDataKey(ctx, pbDataKey, 0);
+	}
+
+	my_memclr(value.data(), value.size());
+	my_memclr(header.ext.data(), header.ext.size());
+
+	return iStatus;
+}
+
+/*
+* Reads and decrypts the header, then the extension records (format 2)
+* The header tells whether the password is right, and which format follows. inputLength loses the length of both.
+*/
+static int readHeader(AES_CTX & ctx, FILE* fin, __int64 & inputLength, Idx_Header & header, __int64 & fileLength, std::vector<Idx_Extent> & extents)
+{
+	unsigned char pbHeader[IDX_HEADER_SIZE]{};
+	std::vector<unsigned char> value{};
+	size_t cbData = 0, cbExt = 0;
+	int iStatus = 0;
+
+	// Read the next 16 bytes in the encrypted file, which are supposed to represent the encrypted header
+	if (IDX_HEADER_SIZE != fread(pbHeader, 1, IDX_HEADER_SIZE, fin))
+	{
+		printf("An unexpected error occured while reading data from input file. Aborting\n");
+		return 1;
+	}
+
+	// AES decryption of the header using IV,DerivedKey
+	if (0 != OpCipher(ctx, pbHeader, IDX_HEADER_SIZE, pbHeader, IDX_HEADER_SIZE, cbData, 0) || IDX_HEADER_SIZE != cbData)
+	{
+		printf("Unexpected error occured while decrypting. Aborting\n");
+		return 1;
+	}
+
+	// If the decrypted header is not a known one, maybe the password is incorrect
+	iStatus = parseHeader(pbHeader, header, cbExt);
+	my_memclr(pbHeader, IDX_HEADER_SIZE);
+
+	if (1 == iStatus)
+	{
+		printf("Password incorrect or the input file is not a valid encrypted file. Aborting!\n");
+		return 1;
+	}
+	if (2 == iStatus)
+	{
+		printf("The input file was encrypted with a format that this version doesn't support. Aborting!\n");
+		return 1;
+	}
+
+	inputLength -= (__int64)(IDX_HEADER_SIZE + cbExt);
+
+	if (0 != cbExt)
+	{
+		header.ext.resize(cbExt);
+
+		if (cbExt != fread(header.ext.data(), 1, cbExt, fin) || 0 != OpCipher(ctx, header.ext.data(), cbExt, header.ext.data(), cbExt, cbData, 0))
+		{
+			printf("An unexpected error occured while reading the header of the input file. Aborting\n");
+			return 1;
+		}
+	}
+
+	if ((header.flags & IDX_FLAG_SPARSE) && (0 != findExtRecord(header, IDX_EXT_SPARSE_MAP, value) || 0 != decodeSparseMap(value, fileLength, extents)))
+	{
+		printf("The map of the input file is not valid. Aborting!\n");
+		return 1;
+	}
+
+	return 0;
+}
+
+/*
+* Checks the partial output of an interrupted encryption against its checkpoint, then positions fin and fout
+* where the checkpoint was taken. The header tells whether the password is the same, the last block whether
+* the output is the one of the checkpoint. What was written after the checkpoint is dropped.
+*/
+static int resumeOutput(FILE* fin, FILE* fout, const unsigned char pbDerivedKey[32], const unsigned char pbIV[16], const size_t & cbSalt, const Checkpoint_Record & record)
+{
+	unsigned char pbBlock[IDX_HEADER_SIZE]{};
+	size_t cbExt = 0, cbData = 0;
+	Idx_Header header{};
+	AES_CTX ctx{};
+	int iStatus = 0;
+
+	// The header follows the salt and the IV
+	if (0 != fseeko(fout, (off_t)(cbSalt + 16), SEEK_SET) || IDX_HEADER_SIZE != fread(pbBlock, 1, IDX_HEADER_SIZE, fout) ||
+		0 != requireSelfTests(SELFTEST_AES) || 0 != CreateCipher(ctx, CBC, pbDerivedKey, 256, pbIV, 0) || 0 != OpCipher(ctx, pbBlock, IDX_HEADER_SIZE, pbBlock, IDX_HEADER_SIZE, cbData, 0))
+	{
+		printf("Error!\nAn unexpected error occured while reading the partial output file. Aborting...\n");
+		iStatus = 1;
+	}
+	else if (0 != parseHeader(pbBlock, header, cbExt) || IDX_VERSION_1 != header.version)
+	{
+		printf("Error!\nPassword incorrect or the partial output file is not the one of the checkpoint. Aborting...\n");
+		iStatus = 1;
+	}
+	else if (0 != fseeko(fout, (off_t)record.outputOffset - 16, SEEK_SET) || 16 != fread(pbBlock, 1, 16, fout) || 0 != memcmp(pbBlock, record.lastBlock, 16))
+	{
+		printf("Error!\nThe partial output file doesn't match its checkpoint. Run without /resume to start over. Aborting...\n");
+		iStatus = 1;
+	}
+	else if (0 != ftruncate(fileno(fout), (off_t)record.outputOffset) || 0 != fseeko(fout, (off_t)record.outputOffset, SEEK_SET) ||
+		0 != fseeko(fin, (off_t)record.inputOffset, SEEK_SET))
+	{
+		printf("Error!\nAn unexpected error occured while positioning the files at the checkpoint (Error code : %d). Aborting...\n", errno);
+		iStatus = 1;
+	}
+
+	ctx.cleanCtx();
+	my_memclr(pbBlock, IDX_HEADER_SIZE);
+
+	return iStatus;
+}
+
+/*
+* The buffers of opFile which hold the key or plaintext, in a slot of the secure arena
+*/
+struct File_Secrets
+{
+	unsigned char pbDerivedKey[32];
+	unsigned char pbSalt[64];
+	unsigned char pbIV[16];
+	unsigned char pbTail[IDX_DIGEST_SIZE];		// last bytes decrypted, until known to be the digest or data
+	unsigned char pbDataKey[IDX_DATA_KEY_SIZE];	// key and IV of the data (envelope)
+	unsigned char pbData[READ_BUFFER_SIZE + IDX_DIGEST_SIZE + 32];		// last : only the part a small file used is wiped
+};
+
+/*
+* Hashes a block of plaintext before it is encrypted (IDX_FLAG_DIGEST). The final one is followed by the digest.
+*/
+static int hashBlock(HashContext & hash, unsigned char* pb, const size_t & cb, const bool & bFinal, unsigned char pbDigest[IDX_DIGEST_SIZE])
+{
+	if (0 != hash.UpdateHashCtx((const char*)pb, cb)) return 1;
+
+	if (!bFinal) return 0;
+
+	if (0 != hash.FinalHashCtx(pbDigest)) return 1;
+
+	memcpy(pb + cb, pbDigest, IDX_DIGEST_SIZE);
+
+	return 0;
+}
+
+static int writePlaintext(FILE* fout, Extent_Writer & writer, const bool & bSparse, const unsigned char* pb, const size_t & cb)
+{
+	if (bSparse) return writer.write(pb, cb);
+
+	return (cb == fwrite(pb, 1, cb, fout)) ? 0 : 1;
+}
+
+/*
+* Decompresses and writes the frames decrypted (IDX_FLAG_COMPRESSED), a block at a time. Returns 2 if a frame is not valid.
+*/
+static int writeDecompressed(Frame_Decoder & decoder, FILE* fout, Extent_Writer & writer, const bool & bSparse, const unsigned char* pb, const size_t & cb)
+{
+	const unsigned char* pbBlock = nullptr;
+	size_t cbBlock = 0;
+
+	decoder.feed(pb, cb);
+
+	do
+	{
+		if (0 != decoder.next(pbBlock, cbBlock)) return 2;
+		if (0 != cbBlock && 0 != writePlaintext(fout, writer, bSparse, pbBlock, cbBlock)) return 1;
+	} while (0 != cbBlock);
+
+	return 0;
+}
+
+/*
+* Encrypts the input compressed (IDX_FLAG_COMPRESSED) : a batch of blocks is read, compressed by the threads of the compressor,
+* and its frames are encrypted as they come. The bytes after the last complete AES block wait for the next batch.
+*/
+static int encryptCompressed(AES_CTX & ctx, FILE* fin, FILE* fout, Extent_Reader & reader, const bool & bSparse, Merkle_Builder * treeBuilder, char szOpDesc[], const __int64 & inputLength, __int64 & totalProcessed)
+{
+	Block_Compressor compressor{};
+	std::vector<unsigned char> batch{};			// plaintext
+	std::vector<unsigned char> frames{};		// the bytes left by the previous batch, then the frames of this one
+	size_t readLen = 0, cbPlain = 0, cbEnc = 0, cbData = 0, cbCarry = 0;
+	bool bFinal = false;
+	int iStatus = 0;
+
+	compressor.init(std::max<size_t>(1, std::thread::hardware_concurrency()));
+	batch.resize(compressor.getBatchSize());
+
+	// Never reallocated (padding included) : no copy of the plaintext is left behind
+	frames.reserve(16 + getCompressBound(batch.size()) + 16);
+	mlock(batch.data(), batch.size());
+	mlock(frames.data(), frames.capacity());
+
+	while (0 == iStatus && false == bFinal)
+	{
+		readLen = bSparse ? reader.read(batch.data(), batch.size()) : fread(batch.data(), 1, batch.size(), fin);
+		bFinal = (readLen < batch.size()) || (bSparse ? reader.atEnd() : isEndOfStream(fin));
+		totalProcessed += (__int64)readLen;
+
+		frames.resize(cbCarry);
+
+		if (ferror(fin) || reader.failed())
+		{
+			printf("\nUnexpected error occured while reading data from input file. Aborting\n");
+			iStatus = 1;
+		}
+		else if (0 != compressor.compress(batch.data(), readLen, frames))
+		{
+			printf("\nUnexpected error occured while compressing. Aborting!\n");
+			iStatus = 1;
+		}
+		else
+		{
+			// Format 2 : the final block is always padded
+			cbPlain = frames.size();
+			cbEnc = bFinal ? cbPlain : cbPlain - cbPlain % 16;
+			frames.resize(cbPlain + 16);
+
+			if (0 != cbEnc || bFinal)
+			{
+				if (0 != OpCipher(ctx, frames.data(), cbEnc, frames.data(), cbEnc + 16, cbData, bFinal ? 1 : 0))
+				{
+					printf("\nUnexpected error occured while encrypting. Aborting!\n");
+					iStatus = 1;
+				}
+				else if (cbData != fwrite(frames.data(), 1, cbData, fout))
+				{
+					printf("Not all encrypted bytes were written to disk. Aborting!\n");
+					iStatus = 1;
+				}
+				else if (treeBuilder && 0 != treeBuilder->update(frames.data(), cbData))
+				{
+					printf("\nUnexpected error occured while hashing. Aborting!\n");
+					iStatus = 1;
+				}
+			}
+
+			if (0 == iStatus)
+			{
+				cbCarry = cbPlain - cbEnc;
+				memmove(frames.data(), frames.data() + cbEnc, cbCarry);
+				ShowProgress(szOpDesc, inputLength, totalProcessed, bFinal);
+			}
+		}
+	}
+
+	my_memclr(batch.data(), batch.size());
+	my_memclr(frames.data(), frames.capacity());
+	munlock(batch.data(), batch.size());
+	munlock(frames.data(), frames.capacity());
+	compressor.clean();
+
+	return iStatus;
+}
+
+/*
+* Hashes and writes the data decrypted (IDX_FLAG_DIGEST), but for its last 32 bytes : they are kept in pbTail until
+* more data comes, and they are the digest if nothing does
+*/
+static int writeDigested(HashContext & hash, FILE* fout, Extent_Writer & writer, const bool & bSparse, const unsigned char* pb, const size_t & cb, unsigned char pbTail[IDX_DIGEST_SIZE], size_t & cbTail)
+{
+	size_t cbOut = 0;			// bytes of the tail now known to be data
+
+	if (cbTail + cb <= IDX_DIGEST_SIZE)
+	{
+		memcpy(pbTail + cbTail, pb, cb);
+		cbTail += cb;
+		return 0;
+	}
+
+	cbOut = (cb >= IDX_DIGEST_SIZE) ? cbTail : cbTail + cb - IDX_DIGEST_SIZE;
+
+	if (0 != cbOut && (0 != hash.UpdateHashCtx((const char*)pbTail, cbOut) || 0 != writePlaintext(fout, writer, bSparse, pbTail, cbOut))) return 1;
+
+	memmove(pbTail, pbTail + cbOut, cbTail - cbOut);
+	cbTail -= cbOut;
+
+	if (cb < IDX_DIGEST_SIZE)
+	{
+		memcpy(pbTail + cbTail, pb, cb);
+		cbTail += cb;
+		return 0;
+	}
+
+	if (0 != hash.UpdateHashCtx((const char*)pb, cb - IDX_DIGEST_SIZE) || 0 != writePlaintext(fout, writer, bSparse, pb, cb - IDX_DIGEST_SIZE)) return 1;
+
+	memcpy(pbTail, pb + cb - IDX_DIGEST_SIZE, IDX_DIGEST_SIZE);
+	cbTail = IDX_DIGEST_SIZE;
+
+	return 0;
+}
+
+/*
+* A new SHA-256 context (IDX_FLAG_DIGEST), nullptr on failure
+*/
+static HashContext* createDigest()
+{
+	HashContext* hash = nullptr;
+
+	if (0 != requireSelfTests(SELFTEST_HASH) || nullptr == (hash = HashContext::CreateHashContext(sha256))) return nullptr;
+
+	if (0 != hash->InitHashCtx())
+	{
+		delete hash;
+		return nullptr;
+	}
+
+	return hash;
+}
+
+/*
+* Starts the hash tree of the output (IDX_FLAG_MERKLE) : the HMAC of its root covers what precedes the data
+*/
+static int startTree(Merkle_Builder & treeBuilder, const unsigned char* pbSalt, const size_t & cbSalt, const unsigned char pbIV[16], const unsigned char pbHeader[IDX_HEADER_SIZE], const Idx_Header & header)
+{
+	std::vector<unsigned char> prefix(pbSalt, pbSalt + cbSalt);
+
+	prefix.insert(prefix.end(), pbIV, pbIV + 16);
+	prefix.insert(prefix.end(), pbHeader, pbHeader + IDX_HEADER_SIZE);
+	prefix.insert(prefix.end(), header.ext.begin(), header.ext.end());
+
+	return treeBuilder.init(prefix.data(), prefix.size());
+}
+
+/*
+* Checks the hash tree at the end of the input (IDX_FLAG_MERKLE), fin being positioned at the start of the data.
+* The tree gives the length of the data, whose chunks are then checked as they are read, before they are decrypted.
+*/
+static int openTree(FILE* fin, Merkle_Reader & treeReader, const unsigned char pbDerivedKey[32])
+{
+	off_t dataOffset = ftello(fin);
+	int iStatus = 0;
+
+	if (!isRegularFile(fin))
+	{
+		printf("\nA file encrypted with /merkle can only be decrypted from a regular file (its hash tree is at its end). Aborting!\n");
+		return 1;
+	}
+
+	if (dataOffset < 0 || IDX_ERR_IO == (iStatus = treeReader.open(fileno(fin), (__int64)dataOffset, pbDerivedKey)))
+	{
+		printf("\nAn unexpected error occured while reading the hash tree of the input file (Error code : %d). Aborting!\n", errno);
+		return 1;
+	}
+
+	if (IDX_OK != iStatus)
+	{
+		printf("\nThe hash tree of the input file is not valid (the input file is corrupted). Aborting!\n");
+		return 1;
+	}
+
+	return 0;
+}
+
+static void showDigest(const unsigned char pbDigest[IDX_DIGEST_SIZE])
+{
+	printf("SHA-256 of the plaintext : ");
+	for (size_t i = 0; i < IDX_DIGEST_SIZE; i++) printf("%02x", pbDigest[i]);
+	printf("\n");
+}
+
+/*
+* Checks the volumes of the input against the size they were written with (IDX_EXT_VOLUMES), if it is recorded
+*/
+static int checkVolumes(const Idx_Header & header, const Volume_Reader & volumes)
+{
+	std::vector<unsigned char> value{};
+	__int64 volumeSize = 0;
+
+	if (0 != findExtRecord(header, IDX_EXT_VOLUMES, value)) return 0;
+
+	return (0 == decodeVolumes(value, volumeSize) && 0 == volumes.checkVolumeSize(volumeSize)) ? 0 : 1;
+}
+
+/*
+* Decrypts the data of the volumes of the input with a thread per volume, straight to its place in fout (a regular file).
+* The data must be nothing but the plaintext, padded : neither sparse, nor compressed, nor followed by a digest or a tree.
+*/
+static int decryptVolumesToFile(const Volume_Reader & volumes, FILE* fout, const Idx_Header & header, const unsigned char pbDerivedKey[32], const unsigned char pbDataKey[IDX_DATA_KEY_SIZE], const size_t & cbSalt)
+{
+	__int64 dataOffset = (__int64)(cbSalt + 16 + IDX_HEADER_SIZE + header.ext.size());
+	__int64 plainLength = 0;
+	bool bEnvelope = (0 != (header.flags & IDX_FLAG_ENVELOPE));
+	int iStatus = decryptVolumes(volumes, bEnvelope ? pbDataKey : pbDerivedKey, bEnvelope ? pbDataKey + 32 : nullptr, dataOffset, fileno(fout),
+		std::max<size_t>(1, std::thread::hardware_concurrency()), plainLength);
+
+	switch (iStatus)
+	{
+	case IDX_OK:
+		// The output ends where the plaintext ends : trimOutput truncates it there
+		if (0 == fflush(fout) && 0 == fseeko(fout, (off_t)plainLength, SEEK_SET)) return 0;
+		printf("\nAn unexpected error occured while finalizing the output file. Aborting!\n");
+		break;
+	case IDX_ERR_TRUNCATED:
+		printf("\nThe input file is not a valid encrypted file (truncated). Aborting!\n");
+		break;
+	case IDX_ERR_IO:
+		printf("\nAn error occured while decrypting the volumes of the input file (Error code : %d). Aborting!\n", errno);
+		break;
+	default:
+		printf("\nUnexpected error occured while decrypting data. Aborting!\n");
+		break;
+	}
+
+	return 1;
+}
+
+static int opFile(FILE* fin, FILE* fout, __int64 inputLength, const std::string & outPath, Hmac_PRF & prf, const char szPassword[], const size_t & cbSalt, const int & bForDecrypt, const Op_Options & options, File_Checkpoint * checkpoint, const Volume_Reader * volumes)
+{
+	Secure_Buffer secure(sizeof(File_Secrets));		// locked, left out of core dumps, wiped when given back
+	File_Secrets* secrets = (File_Secrets*)secure.data();
+	unsigned char pbHeader[IDX_HEADER_SIZE] = {};
+	unsigned char pbDigest[IDX_DIGEST_SIZE] = {};
 	size_t cbData = 0;
 	size_t readLen = 0;
+	size_t cbTail = 0;
 	__int64 totalProcessed = 0;
+	__int64 fileLength = 0;						// apparent size of the plaintext (sparse)
 	int iStatus = 0;
 
+	Idx_Header header{};
+	std::vector<Idx_Extent> extents{};			// data extents of the plaintext (sparse)
+	std::unique_ptr<HashContext> hash{};		// SHA-256 of the plaintext (IDX_FLAG_DIGEST)
+	Merkle_Builder treeBuilder{};				// hash tree of the encrypted data (IDX_FLAG_MERKLE)
+	Merkle_Reader treeReader{};
+	std::vector<unsigned char> tree{};
+	Frame_Decoder decoder{};					// decompression of the data (IDX_FLAG_COMPRESSED)
 	AES_CTX ctx{};
 
-	if (bForDecrypt) {
+	if (nullptr == secrets)
+	{
+		printf("An error occured while allocating the secure memory. Aborting...\n");
+		return 1;
+	}
+
+	unsigned char* pbData = secrets->pbData;
+	unsigned char* pbDerivedKey = secrets->pbDerivedKey;
+	unsigned char* pbSalt = secrets->pbSalt;
+	unsigned char* pbIV = secrets->pbIV;
+	unsigned char* pbTail = secrets->pbTail;
+	unsigned char* pbDataKey = secrets->pbDataKey;
+
+	secure.touch(offsetof(File_Secrets, pbData));
+
+	// The key of the data of an envelope : random, as the IV
+	if (!bForDecrypt && options.bEnvelope && 0 != getRandomBytes(pbDataKey, IDX_DATA_KEY_SIZE))
+	{
+		printf("An unexpected error occured while preparing for the encryption (Error code : %d). Aborting...\n", errno);
+		iStatus = 1;
+	}
+
+	// The format of the output first, its size depends on it
+	if (0 == iStatus && !bForDecrypt) iStatus = prepareHeader(fin, inputLength, options, header, extents, pbDataKey, pbHeader);
+
+	// Reserve the whole output up front (the size is known from the input length)
+	if (0 == iStatus) iStatus = preallocateOutput(fout, getOutputLength(inputLength, cbSalt, bForDecrypt, header));
+
+	if (0 != iStatus) {}
+	else if (bForDecrypt) {
 
 		// Read the salt + IV from the encrypted input file
 		// Check if we read the entire cbSalt bytes for salt and 16 bytes for IV
@@ -131,10 +867,10 @@ static int opFile(FILE* fin, FILE* fout, __int64 inputLength, const std::string
 			/* remove size of salt and IV from the input length */
 			inputLength -= (__int64)(16 + cbSalt);
 
-			printf("Generating the decryption key...");
+			if (bShowProgress) printf("Generating the decryption key...");
 
 			// Generate the decryption key using Hmac-PBKDF using the salt retrieved from the file + user password
-			if (0 != PBKDF2(prf, STRONG_ITERATIONS, (unsigned char*)szPassword, (unsigned int)strlen(szPassword), pbSalt, (unsigned int)cbSalt, pbDerivedKey, 32))
+			if (0 != deriveKey(prf, szPassword, pbSalt, cbSalt, pbDerivedKey))
 			{
 				printf("Error!\nAn unexpected error occured while creating the decryption key. Aborting...\n");
 				iStatus = 1;
@@ -142,10 +878,10 @@ static int opFile(FILE* fin, FILE* fout, __int64 inputLength, const std::string
 
 			else
 			{
-				printf("Done!\nInitializing decryption...");
+				if (bShowProgress) printf("Done!\nInitializing decryption...");
 
 				// Initialization of the AES context
-				if (0 != CreateCipher(ctx, CBC, pbDerivedKey, 256, pbIV, 0)) {
+				if (0 != requireSelfTests(SELFTEST_AES) || 0 != CreateCipher(ctx, CBC, pbDerivedKey, 256, pbIV, 0)) {
 					printf("An error occured during the creationg of the decryption context. Aborting...\n");
 					iStatus = 1;
 				}
@@ -153,280 +889,525 @@ static int opFile(FILE* fin, FILE* fout, __int64 inputLength, const std::string
 				else
 				{
 					char szOpDesc[64]{};
-					unsigned char pbHeader[16]{};
-					memcpy(pbHeader, "IDXCRYPTTPYRCXDI", 16);
 
-					printf("Done!\n");
+					if (bShowProgress) printf("Done!\n");
 
 					memcpy(szOpDesc, "Decrypting the input file...\0", 29);
 
-					printf(szOpDesc);
-
-					// Read the next 16 bytes in the encrypted file, which are supposed to represent the encrypted header
-					cbData = fread(pbData, 1, 16, fin);
-					/* remove size of header from input length */
-					inputLength -= 16;
+					if (bShowProgress) printf(szOpDesc);
 
-					if (cbData != 16) {
-						printf("An unexpected error occured while reading data from input file. Aborting\n");
+					if (0 != readHeader(ctx, fin, inputLength, header, fileLength, extents))
+					{
+						iStatus = 1;
+					}
+					// The flags can be cleared by whoever can write the input : only a required tree or digest is sure to be checked
+					else if (options.bRequireMerkle && 0 == (header.flags & IDX_FLAG_MERKLE))
+					{
+						printf("\nThe input file has no hash tree (/require merkle) : it was not encrypted with /merkle, or its header was altered. Aborting!\n");
+						iStatus = 1;
+					}
+					else if (options.bRequireDigest && 0 == (header.flags & IDX_FLAG_DIGEST))
+					{
+						printf("\nThe input file has no digest (/require digest) : it was not encrypted with /digest, or its header was altered. Aborting!\n");
 						iStatus = 1;
 					}
+					else if (volumes && 0 != checkVolumes(header, *volumes))
+					{
+						printf("\nThe volumes of the input file are incomplete (a volume is missing or truncated). Aborting!\n");
+						iStatus = 1;
+					}
+					else if ((header.flags & IDX_FLAG_COMPRESSED) && 0 != openCompression(header, decoder))
+					{
+						printf("\nThe input file was compressed with a codec that this version doesn't support. Aborting!\n");
+						iStatus = 1;
+					}
+					else if ((header.flags & IDX_FLAG_ENVELOPE) && 0 != openEnvelope(ctx, header, pbDataKey))
+					{
+						printf("\nThe key of the data of the input file is not valid. Aborting!\n");
+						iStatus = 1;
+					}
+					else if ((header.flags & IDX_FLAG_DIGEST) && (hash.reset(createDigest()), !hash))
+					{
+						printf("An error occured during the creation of the hash context. Aborting...\n");
+						iStatus = 1;
+					}
+					else if ((header.flags & IDX_FLAG_MERKLE) && 0 != openTree(fin, treeReader, pbDerivedKey))
+					{
+						iStatus = 1;
+					}
+
+					// Volumes of plain data : decrypted in parallel, each at its offset in the output
+					else if (volumes && volumes->getVolumeCount() > 1 && 0 == (header.flags & ~IDX_FLAG_ENVELOPE) && isRegularFile(fout))
+					{
+						startClock = clock();
+
+						if (0 != decryptVolumesToFile(*volumes, fout, header, pbDerivedKey, pbDataKey, cbSalt)) iStatus = 1;
+						else ShowProgress(szOpDesc, inputLength, inputLength, true);
+					}
 
 					else
 					{
-						// AES decryption of the header using IV,DerivedKey
-						if (0 != OpCipher(ctx, pbData, 16, pbData, 16, cbData, 0))
+						bool bSparse = (0 != (header.flags & IDX_FLAG_SPARSE));
+						bool bMerkle = (0 != (header.flags & IDX_FLAG_MERKLE));
+						bool bCompressed = (0 != (header.flags & IDX_FLAG_COMPRESSED));
+						bool bFinal = false;
+						__int64 cbLeft = bMerkle ? treeReader.getDataLength() : 0;	// encrypted data before the tree
+						uint64_t chunk = 0;
+						Extent_Writer writer(fout, fileLength, extents);
+						startClock = clock();
+
+						if (bMerkle) inputLength = cbLeft;
+
+						// We read 65536 bytes of the encrypted file at a time, which we decrypt
+						// A block is the final one when it is shorter than 65536 bytes, or when nothing follows it (look-ahead),
+						// so that the length of the input doesn't need to be known beforehand (pipes)
+						// Format 1 : a final block < 65536 carries the padding, a final block of 65536 bytes doesn't
+						// Format 2 : the final block always carries the padding (after the digest, if any)
+						// Hash tree : the length of the data is known, a block is a chunk of the tree (IDX_MERKLE_CHUNK_SIZE == READ_BUFFER_SIZE)
+						while (0 == iStatus && false == bFinal)
 						{
-							printf("Unexpected error occured while decrypting. Aborting\n");
+							size_t cbWant = (bMerkle && cbLeft < READ_BUFFER_SIZE) ? (size_t)cbLeft : READ_BUFFER_SIZE;
+
+							cbData = fread(pbData, 1, cbWant, fin);
+							secure.touch(offsetof(File_Secrets, pbData) + cbData + 16);
+							bFinal = bMerkle ? (cbData < cbWant || (__int64)cbData == cbLeft) : ((cbData < READ_BUFFER_SIZE) || isEndOfStream(fin));
+							totalProcessed += (__int64)cbData;
+							cbLeft -= (__int64)cbData;
+
+							int bPadding = bFinal && isPaddedEnd(header.version, totalProcessed);
+
+							if (ferror(fin))
+							{
+								printf("\nUnexpected error occured while reading data from input file. Aborting!\n");
+								iStatus = 1;
+							}
+							else if (0 == cbData || 0 != (cbData % 16))
+							{
+								printf("\nThe input file is not a valid encrypted file (truncated). Aborting!\n");
+								iStatus = 1;
+							}
+							else if (bMerkle && IDX_OK != treeReader.verifyChunk(chunk++, pbData, cbData))
+							{
+								printf("\nThe chunk %llu of the input file doesn't match its hash tree (the input file is corrupted). Aborting!\n", (unsigned long long)(chunk - 1));
+								iStatus = 1;
+							}
+							else if (0 != OpCipher(ctx, pbData, cbData, pbData, cbData + 16, cbData, bPadding))
+							{
+								printf("\nUnexpected error occured while decrypting data. Aborting!\n");
+								iStatus = 1;
+							}
+							else if (bCompressed && 0 != (iStatus = writeDecompressed(decoder, fout, writer, bSparse, pbData, cbData)))
+							{
+								if (2 == iStatus) printf("\nThe compressed data of the input file is not valid (the input file is corrupted). Aborting!\n");
+								else printf("Not all decrypted bytes were written to disk. Aborting!\n");
+								iStatus = 1;
+							}
+							else if (!bCompressed && 0 != (hash ? writeDigested(*hash, fout, writer, bSparse, pbData, cbData, pbTail, cbTail) : writePlaintext(fout, writer, bSparse, pbData, cbData)))
+							{
+								printf("Not all decrypted bytes were written to disk. Aborting!\n");
+								iStatus = 1;
+							}
+							else
+							{
+								ShowProgress(szOpDesc, inputLength, totalProcessed, bFinal);
+							}
+						}
+
+						// The data must end with a complete frame
+						if (0 == iStatus && bCompressed && !decoder.atFrameEnd())
+						{
+							printf("\nThe compressed data of the input file is not valid (truncated). Aborting!\n");
 							iStatus = 1;
 						}
 
-						else
+						// The data is all written : the last 32 bytes decrypted must be its digest
+						if (0 == iStatus && hash && (IDX_DIGEST_SIZE != cbTail || 0 != hash->FinalHashCtx(pbDigest) || 0 != memcmp(pbDigest, pbTail, IDX_DIGEST_SIZE)))
 						{
-							// If the decrypted header is different than pbHeader, maybe the password is incorrect
-							if ((cbData != 16) || (0 != memcmp(pbData, pbHeader, 16)))
+							printf("\nThe decrypted data doesn't match its digest (the input file is corrupted). Aborting!\n");
+							iStatus = 1;
+						}
+
+						// Recreate the holes (after the last extent as well)
+						if (0 == iStatus && bSparse && 0 != writer.finish())
+						{
+							printf("The data of the input file doesn't match its map, or the holes could not be recreated. Aborting!\n");
+							iStatus = 1;
+						}
+					}
+				}
+			}
+		}
+	}
+	else {
+		bool bResuming = (nullptr != checkpoint && checkpoint->isResuming());
+
+		if (bResuming)
+		{
+			/* the salt and IV of the interrupted run, at the start of the partial output */
+			rewind(fout);
+			if ((cbSalt != fread(pbSalt, 1, cbSalt, fout)) || (16 != fread(pbIV, 1, 16, fout)))
+			{
+				printf("An unexpected error occured while reading the partial output file. Aborting...\n");
+				iStatus = 1;
+			}
+		}
+		else
+		{
+			/* generate random salt and IV (generator of the thread, seeded by the system entropy source) */
+			if (0 != getRandomBytes(pbSalt, cbSalt) || 0 != getRandomBytes(pbIV, 16))
+			{
+				printf("An unexpected error occured while preparing for the encryption (Error code : %d). Aborting...\n", errno);
+				iStatus = 1;
+			}
+		}
+
+		if (0 == iStatus)
+		{
+			if (bShowProgress) printf("Generating the encryption key...");
+
+			// Generate the encryption key using Hmac-PBKDF using the salt generated randomly + user password
+			if (0 != deriveKey(prf, szPassword, pbSalt, cbSalt, pbDerivedKey))
+			{
+				printf("Error!\nAn unexpected error occured while creating the encryption key. Aborting...\n");
+				iStatus = 1;
+			}
+
+			// Resumed : the partial output must have been made with the same password, the encryption goes on from the checkpoint
+			else if (bResuming && 0 != resumeOutput(fin, fout, pbDerivedKey, pbIV, cbSalt, checkpoint->getRecord()))
+			{
+				iStatus = 1;
+			}
+
+			else
+			{
+				if (bShowProgress) printf("Done!\nInitializing encryption...");
+
+				// Initialization of the AES context (CBC : the last block written is the IV of the rest of a resumed output)
+				if (0 != requireSelfTests(SELFTEST_AES) || 0 != CreateCipher(ctx, CBC, pbDerivedKey, 256, bResuming ? checkpoint->getRecord().lastBlock : pbIV, 1)) {
+					printf("An error occured during the creationg of the encryption context. Aborting...\n");
+					iStatus = 1;
+				}
+
+				else
+				{
+					char szOpDesc[64] = {};
+
+					if (bShowProgress) printf("Done!\n");
+
+					memcpy(szOpDesc, "Encrypting the input file...\0", 29);
+
+					if (bShowProgress) printf(szOpDesc);
+
+					/* write the random salt */
+					/* write the random IV */
+
+					if (bResuming) {
+						totalProcessed = (__int64)checkpoint->getRecord().inputOffset;
+					}
+					else if ((cbSalt != fwrite(pbSalt, 1, cbSalt, fout)) || (16 != fwrite(pbIV, 1, 16, fout))) {
+						printf("An unexpected error occured while writing data to the output file. Aborting!\n");
+						iStatus = 1;
+					}
+					else if (0 != writeHeader(ctx, fout, pbHeader, header)) {
+						iStatus = 1;
+					}
+					else if ((header.flags & IDX_FLAG_ENVELOPE) && 0 != useDataKey(ctx, pbDataKey, 1)) {
+						printf("An error occured during the creationg of the encryption context. Aborting...\n");
+						iStatus = 1;
+					}
+					else if ((header.flags & IDX_FLAG_DIGEST) && (hash.reset(createDigest()), !hash)) {
+						printf("An error occured during the creation of the hash context. Aborting...\n");
+						iStatus = 1;
+					}
+					else if ((header.flags & IDX_FLAG_MERKLE) && 0 != startTree(treeBuilder, pbSalt, cbSalt, pbIV, pbHeader, header)) {
+						printf("An error occured during the creation of the hash context. Aborting...\n");
+						iStatus = 1;
+					}
+
+					if (0 == iStatus)
+					{
+						bool bSparse = (0 != (header.flags & IDX_FLAG_SPARSE));
+						bool bMerkle = (0 != (header.flags & IDX_FLAG_MERKLE));
+						bool bFinal = false;
+						Extent_Reader reader(fin, extents);
+						startClock = clock();
+
+						// Compressed, the data is encrypted by batches of blocks instead
+						if (header.flags & IDX_FLAG_COMPRESSED)
+						{
+							iStatus = encryptCompressed(ctx, fin, fout, reader, bSparse, bMerkle ? &treeBuilder : nullptr, szOpDesc, inputLength, totalProcessed);
+							bFinal = true;
+						}
+
+						// We read 65536 bytes of the file (of its data extents when sparse) at a time, which we encrypt
+						// A block is the final one when it is shorter than 65536 bytes, or when nothing follows it (look-ahead)
+						// Format 1 : only a final block < 65536 is padded. Format 2 : the final block is always padded, even if empty
+						// Each block is hashed before it is encrypted in place (digest), while it is in the cache, and after (hash tree)
+						while (0 == iStatus && false == bFinal)
+						{
+							readLen = bSparse ? reader.read(pbData, READ_BUFFER_SIZE) : fread(pbData, 1, READ_BUFFER_SIZE, fin);
+							bFinal = (readLen < READ_BUFFER_SIZE) || (bSparse ? reader.atEnd() : isEndOfStream(fin));
+							totalProcessed += (__int64)readLen;
+
+							int bPadding = bFinal && isPaddedEnd(header.version, totalProcessed);
+							size_t cbPlain = readLen + ((hash && bFinal) ? IDX_DIGEST_SIZE : 0);	// the digest follows the data
+
+							secure.touch(offsetof(File_Secrets, pbData) + cbPlain + 16);
+
+							if (ferror(fin) || reader.failed())
+							{
+								printf("\nUnexpected error occured while reading data from input file. Aborting\n");
+								iStatus = 1;
+							}
+							else if (0 == readLen && 0 == bPadding) {}		// format 1 : nothing left to encrypt
+							else if (hash && 0 != hashBlock(*hash, pbData, readLen, bFinal, pbDigest))
+							{
+								printf("\nUnexpected error occured while hashing. Aborting!\n");
+								iStatus = 1;
+							}
+							else if (0 != OpCipher(ctx, pbData, cbPlain, pbData, cbPlain + 16, cbData, bPadding))
+							{
+								printf("\nUnexpected error occured while encrypting. Aborting!\n");
+								iStatus = 1;
+							}
+							else if (cbData != fwrite(pbData, 1, cbData, fout))
+							{
+								printf("Not all encrypted bytes were written to disk. Aborting!\n");
+								iStatus = 1;
+							}
+							else if (bMerkle && 0 != treeBuilder.update(pbData, cbData))
+							{
+								printf("\nUnexpected error occured while hashing. Aborting!\n");
+								iStatus = 1;
+							}
+							// Between 2 full blocks : no padding to undo, the chaining goes on from the last ciphertext block
+							else if (!bFinal && checkpoint && checkpoint->isDue(totalProcessed) && 0 != checkpoint->save(fout, totalProcessed, pbData + cbData - 16))
 							{
-								printf("Password incorrect or the input file is not a valid encrypted file. Aborting!\n");
 								iStatus = 1;
 							}
-
 							else
 							{
-								bool bFinal = false;
-								startClock = clock();
-
-								// We read 65536 bytes of the decrypted file at a time, which we decrypt
-								// Until we reach the last 65536 block which we decrypt here, or we reach final block that is < 65536
-								// We redo the 2nd initialization for every block of 65536 by giving it the currentIV
-								while (((cbData = fread(pbData, 1, READ_BUFFER_SIZE, fin)) == READ_BUFFER_SIZE) && false == bFinal)
-								{
-									totalProcessed += (__int64)READ_BUFFER_SIZE;
-									bFinal = (totalProcessed == inputLength) ? true : false;
-									if (0 == OpCipher(ctx, pbData, cbData, pbData, cbData, cbData, 0))
-									{
-										if (cbData == fwrite(pbData, 1, cbData, fout))
-										{
-											ShowProgress(szOpDesc, inputLength, totalProcessed, bFinal);
-										}
-										else
-										{
-											printf("Not all decrypted bytes were written to disk. Aborting!\n");
-											iStatus = 1;
-											break;
-										}
-									}
-									else
-									{
-										printf("\nUnexpected error occured while decrypting data. Aborting!\n");
-										iStatus = 1;
-										break;
-									}
-								}
-
-								if (iStatus == 0) {
-									// if there is still a trailing block < 65536
-									if (false == bFinal)
-									{
-										if (ferror(fin))
-										{
-											printf("Unexpected error occured while reading data from input file. Aborting!\n");
-											iStatus = 1;
-										}
-										else
-										{
-											//cbData = (DWORD)readLen;	// cbData already contains last block size
-											totalProcessed += (__int64)cbData;
-											if (0 == OpCipher(ctx, pbData, cbData, pbData, cbData + 16, cbData, 1))
-											{
-												if (cbData == fwrite(pbData, 1, cbData, fout))
-												{
-													ShowProgress(szOpDesc, inputLength, totalProcessed, true);
-												}
-												else
-												{
-													printf("Not all decrypted bytes were written to disk. Aborting!\n");
-													iStatus = 1;
-												}
-											}
-											else {
-												printf("Unexpected error occured while decrypting. Aborting!\n");
-												iStatus = 1;
-											}
-										}
-									}
-								}
+								ShowProgress(szOpDesc, inputLength, totalProcessed, bFinal);
 							}
 						}
+
+						// The hash tree follows the data
+						if (0 == iStatus && bMerkle && (0 != treeBuilder.finish(pbDerivedKey, tree) || tree.size() != fwrite(tree.data(), 1, tree.size(), fout)))
+						{
+							printf("An unexpected error occured while writing the hash tree to the output file. Aborting!\n");
+							iStatus = 1;
+						}
 					}
 				}
 			}
 		}
 	}
-	else {
-		/* Entropy collection : seed the generator using the system entropy source */
-		RAND_poll();
-		/* generate random salt and IV */
-		if (0 == RAND_bytes(pbSalt, (int)cbSalt) || 0 == RAND_bytes(pbIV, 16))
+
+	// Give back the preallocated space that was not needed
+	if (0 == iStatus) iStatus = trimOutput(fout);
+
+	if (0 == iStatus && bShowProgress) {
+		printf("Flushing output file data to disk, please wait...");
+		printf("\rInput file %s successfully as \"%s\"\n", bForDecrypt ? "decrypted" : "encrypted", outPath.data());
+		if (hash) showDigest(pbDigest);
+	}
+
+	if (hash) hash->cleanup();
+	treeBuilder.clean();
+	decoder.clean();
+	my_memclr(pbDigest, IDX_DIGEST_SIZE);
+	ctx.cleanCtx();
+
+	return (iStatus);
+}
+/*
+* Runs opFile from fin to outPath, "-" being the standard output
+* The output file is only published once complete (after the next barrier if the job must be durable)
+* With a checkpoint, the output is written to its partial file, which is kept if the job fails
+* With /volume, the output of an encryption is written in volumes instead ; volumes is the input of a decryption read from its volumes
+*/
+static int opFileToPath(FILE* fin, __int64 inputLength, const std::string & outPath, Output_File & output, Durability_Tracker * tracker, Hmac_PRF & prf, const char szPassword[], const size_t & cbSalt, const int & bForDecrypt, const Op_Options & options, File_Checkpoint * checkpoint, const Volume_Reader * volumes)
+{
+	int iStatus = 0;
+
+	if (outPath == "-")
+	{
+		FILE* fout = getStdoutStream();
+
+		if (nullptr == fout) return 1;
+
+		iStatus = opFile(fin, fout, inputLength, "(standard output)", prf, szPassword, cbSalt, bForDecrypt, options, nullptr, volumes);
+		if (0 != fclose(fout)) iStatus = 1;
+	}
+	else if (!bForDecrypt && options.volumeSize > 0)		// outPath.000, outPath.001...
+	{
+		Volume_Writer writer{};
+
+		if (0 == (iStatus = writer.open(outPath, options.volumeSize, tracker)))
 		{
-			unsigned long dwErr = ERR_get_error();
-			printf("An unexpected error occured while preparing for the encryption (Code 0x%.8lu). Aborting...\n", dwErr);
-			iStatus = 1;
+			iStatus = opFile(fin, writer.getFile(), inputLength, getVolumePath(outPath, 0) + "...", prf, szPassword, cbSalt, bForDecrypt, options, nullptr, nullptr);
+			if (0 == iStatus) iStatus = writer.finish();
+			else writer.discard();
 		}
+	}
+	else if (0 != (checkpoint ? output.createResumable(outPath, checkpoint->getPartialPath(), checkpoint->isResuming()) : output.create(outPath)))
+	{
+		std::cerr << "Failed to open the output file " << outPath << " for writing. Error code : " << errno << " .Aborting...\n";
+		iStatus = 1;
+	}
+	else
+	{
+		iStatus = opFile(fin, output.getFile(), inputLength, outPath, prf, szPassword, cbSalt, bForDecrypt, options, checkpoint, volumes);
+		if (0 == iStatus) iStatus = tracker ? tracker->addFile(output) : output.publish();
+	}
 
-		else
-		{
-			printf("Generating the encryption key...");
+	return iStatus;
+}
 
-			// Generate the encryption key using Hmac-PBKDF using the salt generated randomly + user password
-			if (0 != PBKDF2(prf, STRONG_ITERATIONS, (unsigned char*)szPassword, (unsigned int)strlen(szPassword), pbSalt, (unsigned int)cbSalt, pbDerivedKey, 32))
+/*
+* State shared by all the files of a folder job (nullptr when not used)
+*/
+struct Dir_Job
+{
+	Durability_Tracker * tracker = nullptr;		// /sync : output files and created directories are registered with it
+	Change_Manifest * manifest = nullptr;		// /manifest : unchanged files are skipped, processed files are recorded
+	Job_Journal * journal = nullptr;			// /journal : progress is recorded, files completed by an interrupted run are skipped
+};
+
+/*
+* Name of the output of the file fileName : ".idx" added (encryption) or removed (decryption)
+*/
+static std::string getOutputName(const std::string & fileName, const int & bForDecrypt)
+{
+	if (0 == bForDecrypt) return fileName + ".idx";
+
+	return fileName.substr(0, fileName.length() - 4);
+}
+
+/*
+* True if the file path (which may not exist yet, but whose directory must) is in the folder root, given with its trailing "/"
+*/
+static bool isInFolder(const std::string & path, const std::string & root)
+{
+	std::string dir{}, base{}, absPath = path;
+
+	if ('/' != path[0])
+	{
+		dirname_base_separator(path, dir, base);
+		if (0 != getAbsolutePath(dir, absPath)) return false;
+		absPath += "/" + base;
+	}
+
+	return 0 == absPath.compare(0, root.size(), root);
+}
+
+/*
+* Processes the regular file fileInPath of a folder job into fileOutPath
+*/
+static int opDirFile(const std::string & fileInPath, const std::string & fileOutPath, Hmac_PRF & prf, const char szPassword[], const size_t & cbSalt, const int & bForDecrypt, const Op_Options & options, Dir_Job & job)
+{
+	int iStatus = 0;
+	__int64 inputLength = 0;
+	struct stat stat_buf {};
+	FILE * fin = nullptr;
+	Output_File output{};			// discarded when leaving the scope, unless published
+
+	fin = fopen(fileInPath.data(), "rb");
+
+	if (!fin)
+	{
+		printf("Failed to open the input file (%s) for reading. Aborting...\n", fileInPath.data());
+		iStatus = 1;
+	}
+	else
+	{
+		// Retrieve information about the file
+		if (0 == stat(fileInPath.data(), &stat_buf))		// stat ok
+		{
+			if ((inputLength = stat_buf.st_size) == 0)
 			{
-				printf("Error!\nAn unexpected error occured while creating the encryption key. Aborting...\n");
+				printf("The input file %s is empty. Aborting...\n", fileInPath.data());
 				iStatus = 1;
 			}
-
 			else
 			{
-				printf("Done!\nInitializing encryption...");
-
-				AES_CTX ctx = {};
-
-				// Initialization of the AES context
-				if (0 != CreateCipher(ctx, CBC, pbDerivedKey, 256, pbIV, 1)) {
-					printf("An error occured during the creationg of the encryption context. Aborting...\n");
+				if (bForDecrypt && ((strcmp(fileInPath.data() + fileInPath.size() - 4, ".idx") != 0) || (inputLength < (__int64)(48 + cbSalt)) || (inputLength % 16))) // salt+IV+header+some data (>=16) at least
+				{
+					printf("Error : input file %s is not a valid encrypted file. Aborting...\n", fileInPath.data());
 					iStatus = 1;
 				}
-
+				else if (job.manifest && job.manifest->skipUnchanged(stat_buf, fileInPath, fileOutPath))
+				{
+					// Same input, same output as the previous run : nothing to do
+				}
+				else if (job.journal && job.journal->isDone(stat_buf, fileOutPath))
+				{
+					// Completed by the interrupted run
+					if (job.manifest) job.manifest->record(stat_buf, fileInPath, fileOutPath);
+				}
 				else
 				{
-					char szOpDesc[64] = {};
-					unsigned char pbHeader[16] = {};
-					memcpy(pbHeader, "IDXCRYPTTPYRCXDI", 16);
-
-					printf("Done!\n");
-
-					memcpy(szOpDesc, "Encrypting the input file...\0", 29);
-
-					printf(szOpDesc);
-
-					/* write the random salt */
-					/* write the random IV */
-
-					if ((cbSalt != fwrite(pbSalt, 1, cbSalt, fout)) || (16 != fwrite(pbIV, 1, 16, fout))) {
-						printf("An unexpected error occured while writing data to the output file. Aborting!\n");
+					if (0 != output.create(fileOutPath))
+					{
+						printf("Failed to open the output file %s for writing. Aborting...\n", fileOutPath.data());
 						iStatus = 1;
 					}
-					else {
-						/* protect encryption memory against swaping */
-						mlock(pbData, sizeof(pbData));
-
-						memcpy(pbData, pbHeader, 16);
-						cbData = 16;
+					else if (job.journal && 0 != job.journal->begin(fileOutPath, output.getTmpPath()))
+					{
+						iStatus = 1;
+					}
+					else
+					{
+						iStatus = opFile(fin, output.getFile(), inputLength, fileOutPath, prf, szPassword, cbSalt, bForDecrypt, options, nullptr, nullptr);
 
-						// AES encryption of the header using IV,DerivedKey
-						if (0 != OpCipher(ctx, pbData, 16, pbData, cbData, cbData, 0))
+						// The output only gets its name once complete (after the next barrier if the job must be durable),
+						// and is only recorded as done by the journal once it has it : a resumed job never skips a lost output
+						if (0 == iStatus && job.tracker)
 						{
-							printf("Unexpected error occured while encrypting. Aborting\n");
-							iStatus = 1;
-						}
+							Job_Journal * journal = job.journal;
+							struct stat input_buf = stat_buf;
 
-						else
+							iStatus = job.tracker->addFile(output, journal ? std::function<int()>([journal, input_buf, fileOutPath]() { return journal->done(input_buf, fileOutPath); }) : nullptr);
+						}
+						else if (0 == iStatus)
 						{
-							// write encrypted header 
-							fwrite(pbData, 1, cbData, fout);
-							startClock = clock();
-
-							// We read 65536 bytes of the file at a time, which we encrypt
-							// Until we reach the last 65536 block which we encrypt here, or we reach final block that is < 65536
-							// We redo the 2nd initialization for every block of 65536 by giving it the currentIV
-							while ((readLen = fread(pbData, 1, READ_BUFFER_SIZE, fin)) == READ_BUFFER_SIZE)
-							{
-								cbData = readLen;
-								if (0 == OpCipher(ctx, pbData, cbData, pbData, cbData, cbData, 0))
-								{
-									totalProcessed += (__int64)READ_BUFFER_SIZE;
-									if (cbData == fwrite(pbData, 1, cbData, fout))
-									{
-										ShowProgress(szOpDesc, inputLength, totalProcessed, false);
-									}
-									else
-									{
-										printf("Not all encrypted bytes were written to disk. Aborting!\n");
-										iStatus = 1;
-										break;
-									}
-								}
-								else
-								{
-									printf("Unexpected error occured while encrypting. Aborting!\n");
-									iStatus = 1;
-									break;
-								}
-							}
-
-							if (iStatus == 0) {
-								if (readLen < READ_BUFFER_SIZE && 0 != readLen)
-								{
-									if (ferror(fin))
-									{
-										printf("Unexpected error occured while reading data from input file. Aborting\n");
-										iStatus = 1;
-									}
-									else
-									{
-										cbData = readLen;
-										if (0 == OpCipher(ctx, pbData, cbData, pbData, cbData + 16, cbData, 1))
-										{
-											totalProcessed += (__int64)readLen;
-											if (cbData == fwrite(pbData, 1, cbData, fout))
-											{
-												ShowProgress(szOpDesc, inputLength, totalProcessed, true);
-											}
-											else
-											{
-												printf("Not all encrypted bytes were written to disk. Aborting!\n");
-												iStatus = 1;
-											}
-										}
-										else {
-											printf("Unexpected error occured while encrypting. Aborting\n");
-											iStatus = 1;
-										}
-									}
-								}
-							}
+							iStatus = output.publish();
+							if (0 == iStatus && job.journal) iStatus = job.journal->done(stat_buf, fileOutPath);
 						}
+
+						if (0 == iStatus && job.manifest) job.manifest->record(stat_buf, fileInPath, fileOutPath);
 					}
 				}
 			}
+			my_memclr(&stat_buf, sizeof(stat_buf));
 		}
+		else        // stat error : while getting stat structure
+		{
+			std::cerr << "An error occured when trying to get " << fileInPath << " ST_STAT. (OpDir - fstat) Error code : " << errno << ". Aborting...\n";
+			iStatus = 1;
+		}
+		fclose(fin);
 	}
 
-	if (0 == iStatus) {
-		printf("Flushing output file data to disk, please wait...");
-		printf("\rInput file %s successfully as \"%s\"\n", bForDecrypt ? "decrypted" : "encrypted", outPath.data());
-	}
-
-	ctx.cleanCtx();
-	my_memclr(pbData, READ_BUFFER_SIZE + 32);
-	my_memclr(pbDerivedKey, 32);
-	my_memclr(pbIV, 16);
-	my_memclr(pbSalt, 64);
-
-	return (iStatus);
+	return iStatus;
 }
 
 /*
 * Variant of Recursive Depth-First-Search(DFS) algorithm without an explicit stack used
+* A failing entry is reported and the walk goes on : 1 is returned once it is over if any entry failed
 */
-static int opDir(DIR* dir, const std::string finPath, const std::string foutPath, Hmac_PRF & prf, const char szPassword[], size_t & cbSalt, const int & bForDecrypt)
+static int opDir(DIR* dir, const std::string finPath, const std::string foutPath, Hmac_PRF & prf, const char szPassword[], size_t & cbSalt, const int & bForDecrypt, const Op_Options & options, Dir_Job & job)
 {
 	int iStatus = 0;
+	int bFailed = 0;							// an entry failed : the walk is incomplete
 	std::string fileName{}, fileInPath{}, fileOutPath{};
-	__int64 inputLength = 0;
 	dirent *entry = {};                         // to collect the dir entries info (names...)
 
 	while ((entry = readdir(dir)) != nullptr)	// As long as there	are still entries in the directory pointed by dir
 	{
+		if (0 != iStatus) bFailed = 1;
+		iStatus = 0;
+
 		fileName = entry->d_name;
 		if ((fileName == ".") || (fileName == ".."))
 		{
@@ -440,11 +1421,16 @@ static int opDir(DIR* dir, const std::string finPath, const std::string foutPath
 
 			// mode 755 for directories
 			// If there is an error creating the output directory and this error is not "Directory already exists"
-			if (0 != mkdir(fileOutPath.data(), S_IRWXU | S_IRGRP | S_IXGRP | S_IROTH | S_IXOTH) && errno != EEXIST)
+			int bCreated = (0 == mkdir(fileOutPath.data(), S_IRWXU | S_IRGRP | S_IXGRP | S_IROTH | S_IXOTH));
+			if (!bCreated && errno != EEXIST)
 			{
 				std::cerr << "An error occured while attempting to create the output directory " << fileOutPath << " . (OpDir - mkdir) Error code : " << errno << ". Aborting...\n";
 				iStatus = 1;
 			}
+			else if (bCreated && job.tracker && 0 != job.tracker->addDirectory(fileOutPath))
+			{
+				iStatus = 1;
+			}
 			else
 			{
 				DIR* dir = opendir(fileInPath.data()); // Contains info about all directories under fileInPath
@@ -456,7 +1442,7 @@ static int opDir(DIR* dir, const std::string finPath, const std::string foutPath
 				}
 				else {
 					// Recursive call 
-					iStatus = opDir(dir, fileInPath, fileOutPath, prf, szPassword, (size_t&)cbSalt, bForDecrypt);
+					iStatus = opDir(dir, fileInPath, fileOutPath, prf, szPassword, (size_t&)cbSalt, bForDecrypt, options, job);
 					closedir(dir);
 				}
 			}
@@ -464,87 +1450,144 @@ static int opDir(DIR* dir, const std::string finPath, const std::string foutPath
 
 		else if (entry->d_type == DT_REG)		// Entry is a regular File
 		{
-			struct stat stat_buf {};
-			FILE * fin = nullptr;
-			FILE * fout = nullptr;
+			iStatus = opDirFile(finPath + fileName, foutPath + getOutputName(fileName, bForDecrypt), prf, szPassword, cbSalt, bForDecrypt, options, job);
+		}
+	}
 
-			fileOutPath = foutPath;
-			if (0 == bForDecrypt)           // if the file is to be encrypted => add .idx extension
-			{
-				fileOutPath += fileName;
-				fileOutPath += ".idx";
-			}
-			else fileOutPath += fileName.substr(0, fileName.length() - 4); // if decrypting, remove the .idx extension
+	return bFailed ? 1 : iStatus;
+}
 
-			fileInPath = finPath + fileName;
+/*
+* Creates the output directories of file, a path relative to outRoot (a watched file can be in a new directory)
+*/
+static int makeOutputDirs(const std::string & outRoot, const std::string & file, Durability_Tracker * tracker)
+{
+	size_t pos = 0;
 
-			fin = fopen(fileInPath.data(), "rb");
+	while (std::string::npos != (pos = file.find('/', pos)))
+	{
+		std::string dirPath = outRoot + file.substr(0, ++pos);
 
-			if (!fin)
-			{
-				printf("Failed to open the input file (%s) for reading. Aborting...\n", fileInPath.data());
-				iStatus = 1;
-			}
-			else
-			{
-				// Retrieve information about the file
-				if (0 == stat(fileInPath.data(), &stat_buf))		// stat ok
-				{
-					if ((inputLength = stat_buf.st_size) == 0)
-					{
-						printf("The input file %s is empty. Aborting...\n", fileInPath.data());
-						iStatus = 1;
-						my_memclr(&stat_buf, sizeof(stat_buf));
-					}
-					else
-					{
-						my_memclr(&stat_buf, sizeof(stat_buf));
-						if (bForDecrypt && ((strcmp(fileInPath.data() + fileInPath.size() - 4, ".idx") != 0) || (inputLength < (__int64)(48 + cbSalt)) || (inputLength % 16))) // salt+IV+header+some data (>=16) at least
-						{
-							printf("Error : input file %s is not a valid encrypted file. Aborting...\n", fileInPath.data());
-							iStatus = 1;
-						}
-						else
-						{
-							fout = fopen(fileOutPath.data(), "wb");
-							if (!fout)
-							{
-								printf("Failed to open the output file %s for writing. Aborting...\n", fileOutPath.data());
-								iStatus = 1;
-							}
-							else iStatus = opFile(fin, fout, inputLength, fileOutPath, prf, szPassword, cbSalt, bForDecrypt);
-						}
-					}
-				}
-				else        // stat error : while getting stat structure
-				{
-					std::cerr << "An error occured when trying to get " << fileInPath << " ST_STAT. (OpDir - fstat) Error code : " << errno << ". Aborting...\n";
-					iStatus = 1;
-				}
-				if (fin) fclose(fin);
-				if (fout) {
-					fclose(fout);
-					if (iStatus != 0) remove(fileOutPath.data());     // Delete output file in case of an error
-				}
-			}
+		// mode 755 for directories
+		int bCreated = (0 == mkdir(dirPath.data(), S_IRWXU | S_IRGRP | S_IXGRP | S_IROTH | S_IXOTH));
+		if (!bCreated && errno != EEXIST)
+		{
+			std::cerr << "An error occured while attempting to create the output directory " << dirPath << " . (makeOutputDirs - mkdir) Error code : " << errno << ".\n";
+			return 1;
 		}
+		if (bCreated && tracker && 0 != tracker->addDirectory(dirPath)) return 1;
+	}
+
+	return 0;
+}
+
+/*
+* Watch mode (/watch) : once the folder is up to date, its files are processed by a pool of workers as they are
+* completed, until SIGINT or SIGTERM. The libraries, the password and the options stay loaded from one file to the next.
+* Each worker has its own PRF (Idx_Context.h), and makes each of its outputs durable on its own (/sync).
+* A file that fails is reported, and the watch goes on.
+*/
+static int opWatch(Folder_Watcher & watcher, const std::string & inPath, const std::string & outPath, Hmac_PRF & prf, const char szPassword[], const size_t & cbSalt, const int & bForDecrypt, const Op_Options & options)
+{
+	size_t cWorkers = std::max<size_t>(1, std::thread::hardware_concurrency());
+	Context_Pool contexts{};
+	std::vector<std::string> ready{};
+	Worker_Pool pool{};
+	bool bStop = false;
+	int iStatus = 0;
+
+	auto work = [&](const size_t & worker, const std::string & file) {
+		Durability_Tracker tracker(true);		// quiet, as the rest of the processing of a worker
+		Dir_Job job{};
+		size_t pos = file.rfind('/');		// npos + 1 = 0 : file directly in the folder
+		std::string fileInPath = inPath + "/" + file;
+		std::string fileOutPath = outPath + "/" + file.substr(0, pos + 1) + getOutputName(file.substr(pos + 1), bForDecrypt);
+		int iFileStatus = 0;
+
+		bShowProgress = false;
+		job.tracker = options.bDurable ? &tracker : nullptr;
+
+		iFileStatus = makeOutputDirs(outPath + "/", file, job.tracker);
+		if (0 == iFileStatus) iFileStatus = opDirFile(fileInPath, fileOutPath, contexts.get(worker), szPassword, cbSalt, bForDecrypt, options, job);
+		if (0 == iFileStatus && options.bDurable) iFileStatus = tracker.checkpoint();
+
+		if (0 == iFileStatus) printf("%s -> %s\n", fileInPath.data(), fileOutPath.data());
+		else std::cerr << "The file " << fileInPath << " could not be " << (bForDecrypt ? "decrypted" : "encrypted") << ", the watch goes on.\n";
+	};
+
+	// The signals are blocked before the workers are created : they inherit the mask, and only the watch sees them
+	iStatus = watcher.catchSignals();
+	if (0 == iStatus && 0 != contexts.init(prf, cWorkers))
+	{
+		printf("An error occured while allocating the contexts of the workers. Aborting...\n");
+		iStatus = 1;
+	}
+	if (0 == iStatus) iStatus = pool.start(cWorkers, work);
+
+	if (0 == iStatus) printf("Watching %s with %llu worker(s). Press Ctrl+C to stop.\n", inPath.data(), (unsigned long long)cWorkers);
+
+	while (0 == iStatus && !bStop)
+	{
+		iStatus = watcher.wait(ready, bStop);
+
+		for (const std::string & file : ready) pool.submit(file);
 	}
 
+	if (bStop) printf("Stopping the watch once the files being processed are done...\n");
+
+	pool.stop();
+	contexts.clean();
+
 	return iStatus;
 }
 
-int Linux_File::Op(Hmac_PRF & prf, const char szPassword[], const size_t & cbSalt, const int & bForDecrypt)
+int Linux_File::Op(Hmac_PRF & prf, const char szPassword[], const size_t & cbSalt, const int & bForDecrypt, const Op_Options & options)
 {
+	Durability_Tracker tracker{};
 	struct stat stat_buf {};
 	FILE* fin = nullptr;
-	FILE* fout = nullptr;
+	Output_File output{};
+	Change_Manifest manifest{};
+	Job_Journal journal{};
+	Dir_Job job{};
+	File_Checkpoint checkpoint{};
+	File_Checkpoint * pCheckpoint = nullptr;		// /checkpoint : resumable encryption of a regular file
+	Folder_Watcher watcher{};					// /watch
+	Volume_Reader volumes{};					// input written in volumes (File.idx.000)
+	bool bVolumes = false;
 	int isFile = 1;
 	__int64 inputLength = 0;
 	int initial_fd = 0;
 	int iStatus = 0;
 
+	// Check whether the user entered the output file with the correct extension ".idx"
+	// Add it if it's not the case, before creating the file
+	auto addIdxExtension = [this, &bForDecrypt]() {
+		if (!bForDecrypt && absOutpath != "-" && (absOutpath.size() < 4 || memcmp(absOutpath.data() + absOutpath.size() - 4, ".idx", 4) != 0))
+			absOutpath += ".idx";
+	};
+
+	// File.idx.000 : the first of the volumes of an encrypted file, read as one input
+	bVolumes = (bForDecrypt && absInpath.size() > 8 && 0 == absInpath.compare(absInpath.size() - 8, 8, ".idx" VOLUME_FIRST_SUFFIX));
+
+	if (absInpath == "-" && (!options.manifestPath.empty() || !options.journalPath.empty() || options.bWatch))
+	{
+		std::cerr << "A manifest, a journal or a watch can only be used with an input folder. Aborting...\n";
+		iStatus = 1;
+	}
+	else if (absInpath == "-" && options.bCheckpoint)
+	{
+		std::cerr << "A checkpoint can only be used with an input file. Aborting...\n";
+		iStatus = 1;
+	}
+	else if (absInpath == "-")		// standard input : the length of the input is unknown, opFile relies on look-ahead
+	{
+		enlargePipe(STDIN_FILENO);
+		addIdxExtension();
+		iStatus = opFileToPath(stdin, -1, absOutpath, output, options.bDurable ? &tracker : nullptr, prf, szPassword, cbSalt, bForDecrypt, options, nullptr, nullptr);
+	}
 	// First, attempt to get a file descriptor of absInpath
-	if ((initial_fd = open(absInpath.data(), O_RDONLY)) <= 0) {        // open error
+	else if ((initial_fd = open(absInpath.data(), O_RDONLY)) <= 0) {        // open error
 		std::cerr << "An error occured when trying to get " << absInpath << " File Descriptor. (Op - open) Error code : " << errno << ". Aborting...\n";
 		iStatus = 1;
 	}
@@ -554,7 +1597,12 @@ int Linux_File::Op(Hmac_PRF & prf, const char szPassword[], const size_t & cbSal
 		if (0 == fstat(initial_fd, &stat_buf))                  // fstat OK
 		{
 			close(initial_fd);
-			if ((stat_buf.st_mode & S_IFMT) == S_IFREG)         // if regular file
+			if ((stat_buf.st_mode & S_IFMT) == S_IFREG && (!options.manifestPath.empty() || !options.journalPath.empty() || options.bWatch))
+			{
+				std::cerr << "A manifest, a journal or a watch can only be used with an input folder. Aborting...\n";
+				iStatus = 1;
+			}
+			else if ((stat_buf.st_mode & S_IFMT) == S_IFREG)         // if regular file
 			{
 				isFile = 1;
 				if ((inputLength = stat_buf.st_size) == 0)      // N.B : stat_buf.st_size is not always accurate
@@ -572,9 +1620,16 @@ int Linux_File::Op(Hmac_PRF & prf, const char szPassword[], const size_t & cbSal
 						iStatus = 1;
 					}
 
+					else if (bVolumes && 0 != volumes.open(absInpath))
+					{
+						iStatus = 1;
+					}
+
 					else
 					{
-						if (bForDecrypt && ((memcmp(absInpath.data() + absInpath.size() - 4, ".idx", 4) != 0) || (inputLength < (__int64)(48 + cbSalt)) || (inputLength % 16))) // salt+IV+header at least + some data (at least 16 because of padding, otherwise > 16)
+						if (bVolumes) inputLength = volumes.getLength();
+
+						if (bForDecrypt && ((!bVolumes && memcmp(absInpath.data() + absInpath.size() - 4, ".idx", 4) != 0) || (inputLength < (__int64)(48 + cbSalt)) || (inputLength % 16))) // salt+IV+header at least + some data (at least 16 because of padding, otherwise > 16)
 						{
 							std::cerr << "Error : input file " << absInpath << " is not a valid encrypted file. Aborting...\n";
 							iStatus = 1;
@@ -582,39 +1637,42 @@ int Linux_File::Op(Hmac_PRF & prf, const char szPassword[], const size_t & cbSal
 
 						else
 						{
-							// Check whether the user entered the output file with the correct extension ".idx"
-							// Add it if it's not the case, before creating the file
-							if (!bForDecrypt) {
-								if (memcmp(absOutpath.data() + absOutpath.size() - 4, ".idx", 4) != 0)
-								{
-									absOutpath += ".idx";
-								}
-							}
-
-							fout = fopen(absOutpath.data(), "wb");
-							if (!fout)
-							{
-								std::cerr << "Failed to open the output file " << absOutpath << " for writing. Error code : " << errno << " .Aborting...\n";
-								iStatus = 1;
-							}
-							else
-							{
-								iStatus = opFile(fin, fout, inputLength, absOutpath, prf, szPassword, cbSalt, bForDecrypt);
-							}
+							addIdxExtension();
+							if (options.bCheckpoint && 0 == (iStatus = checkpoint.open(absOutpath, fin, cbSalt, options.bResume))) pCheckpoint = &checkpoint;
+							if (0 == iStatus) iStatus = opFileToPath(bVolumes ? volumes.getFile() : fin, inputLength, absOutpath, output, options.bDurable ? &tracker : nullptr, prf, szPassword, cbSalt, bForDecrypt, options, pCheckpoint, bVolumes ? &volumes : nullptr);
 						}
 					}
 				}
 			}
+			else if ((stat_buf.st_mode & S_IFMT) == S_IFDIR && options.bCheckpoint)
+			{
+				std::cerr << "A checkpoint can only be used with an input file. Aborting...\n";
+				iStatus = 1;
+			}
+			else if ((stat_buf.st_mode & S_IFMT) == S_IFDIR && options.volumeSize > 0)
+			{
+				std::cerr << "Volumes can only be written for an input file. Aborting...\n";
+				iStatus = 1;
+			}
+			else if ((stat_buf.st_mode & S_IFMT) == S_IFDIR && absOutpath == "-")
+			{
+				std::cerr << "A directory cannot be written to the standard output. Aborting...\n";
+				iStatus = 1;
+			}
 			else if ((stat_buf.st_mode & S_IFMT) == S_IFDIR)    // if directory
 			{
 				isFile = 0;
 
 				// mode 755 for directories (Owner : all permissions, Group : read and search, Others : read and search)
 				// If there is an error creating the output directory and this error is not "Directory already exists"
-				if (0 != mkdir(absOutpath.data(), S_IRWXU | S_IRGRP | S_IXGRP | S_IROTH | S_IXOTH) && errno != EEXIST) {
+				int bCreated = (0 == mkdir(absOutpath.data(), S_IRWXU | S_IRGRP | S_IXGRP | S_IROTH | S_IXOTH));
+				if (!bCreated && errno != EEXIST) {
 					std::cerr << "An error occured while attempting to create the output directory " << absOutpath << " . (Op - mkdir) Error code : " << errno << ". Aborting...\n";
 					iStatus = 1;
 				}
+				else if (bCreated && options.bDurable && 0 != tracker.addDirectory(absOutpath)) {
+					iStatus = 1;
+				}
 				else
 				{
 					DIR* dir = opendir(absInpath.data());   // Contains info about all directories under input directory
@@ -626,8 +1684,41 @@ int Linux_File::Op(Hmac_PRF & prf, const char szPassword[], const size_t & cbSal
 					}
 					else
 					{
-						iStatus = opDir(dir, absInpath + "/", absOutpath + "/", prf, szPassword, (size_t&)cbSalt, bForDecrypt);
+						job.tracker = options.bDurable ? &tracker : nullptr;
+						job.manifest = options.manifestPath.empty() ? nullptr : &manifest;
+
+						// The watch starts before the walk : a file completed during the walk is not missed
+						if (options.bWatch) iStatus = watcher.open(absInpath, absOutpath);
+						// The manifest would be processed as an input, and change at every run
+						if (0 == iStatus && job.manifest && isInFolder(options.manifestPath, absInpath + "/"))
+						{
+							std::cerr << "The manifest " << options.manifestPath << " must not be in the input folder. Aborting...\n";
+							iStatus = 1;
+						}
+						if (0 == iStatus && job.manifest) iStatus = manifest.open(options.manifestPath, bForDecrypt, prf, szPassword, cbSalt, options, absInpath + "/", absOutpath + "/");
+						if (0 == iStatus && !options.journalPath.empty() && isInFolder(options.journalPath, absInpath + "/"))
+						{
+							std::cerr << "The journal " << options.journalPath << " must not be in the input folder. Aborting...\n";
+							iStatus = 1;
+						}
+						if (0 == iStatus && !options.journalPath.empty() && 0 == (iStatus = journal.open(options.journalPath, bForDecrypt, prf, szPassword, cbSalt, options, options.bResume))) job.journal = &journal;
+
+						if (0 == iStatus && 0 != (iStatus = opDir(dir, absInpath + "/", absOutpath + "/", prf, szPassword, (size_t&)cbSalt, bForDecrypt, options, job)))
+						{
+							// The walk went on after its failures : the outputs completed are kept, as without /sync
+							if (job.tracker) tracker.checkpoint();
+						}
 						closedir(dir);
+
+						if (job.journal && journal.getResumed()) printf("%llu file(s) completed by the interrupted run skipped.\n", (unsigned long long)journal.getResumed());
+
+						// Pruning and the new manifest need the complete list of inputs : only after a walk without any failure
+						if (0 == iStatus && job.manifest)
+						{
+							printf("%llu unchanged file(s) skipped.\n", (unsigned long long)manifest.getSkipped());
+							if (options.bPrune) printf("%llu output(s) of deleted input(s) pruned.\n", (unsigned long long)manifest.prune());
+							iStatus = manifest.save(options.bDurable ? &tracker : nullptr);
+						}
 					}
 				}
 			}
@@ -643,14 +1734,31 @@ int Linux_File::Op(Hmac_PRF & prf, const char szPassword[], const size_t & cbSal
 		}
 	}
 
-	if (fin) fclose(fin);
-	if (fout) {
-		fclose(fout);
-		if (iStatus != 0) remove(absOutpath.data());     // Delete output file in case of an error
+	// Last barrier of the job : everything still pending reaches the disk
+	if (0 == iStatus && options.bDurable) iStatus = tracker.checkpoint();
+
+	// The journal is only needed to resume an unsuccessful job
+	if (job.journal)
+	{
+		if (0 == iStatus) iStatus = journal.finish();
+		else std::cerr << "The job can be resumed with /journal " << options.journalPath << " /resume\n";
 	}
+
+	// The checkpoint is only needed to resume an unsuccessful encryption, whose partial output is kept
+	if (pCheckpoint)
+	{
+		if (0 == iStatus) iStatus = checkpoint.finish();
+		else std::cerr << "The encryption can be resumed with /checkpoint /resume\n";
+	}
+
+	// The folder is up to date : its new files are processed as they come
+	if (0 == iStatus && options.bWatch) iStatus = opWatch(watcher, absInpath, absOutpath, prf, szPassword, cbSalt, bForDecrypt, options);
+
+	if (fin) fclose(fin);
+	output.discard();     // Nothing is left behind in case of an error
 	my_memclr(&stat_buf, sizeof(stat_buf));
 
-	return 0;
+	return iStatus;
 }
 
 #endif
@@ -47,7 +47,7 @@ public:
 
 	int setPaths(const std::string & pIn, const std::string & pOut) override;
 
-	int Op(Hmac_PRF & prf, const char szPassword[], const size_t & cbSalt, const int & bForDecrypt) override;
+	int Op(Hmac_PRF & prf, const char szPassword[], const size_t & cbSalt, const int & bForDecrypt, const Op_Options & options) override;
 
 };
 
@@ -0,0 +1,83 @@
+/*
+*	=====================================
+*	Copyright (c) El Mostafa IDRASSI 2017
+*	mostafa.idrassi@tutanota.com
+*	Apache License
+*	=====================================
+*/
+
+#ifdef __linux__
+
+#include "Linux_Fingerprint.h"
+
+#include "HMAC_Context.h"						// HMAC-SHA256 of the label
+#include "Idx_Engine.h"							// deriveKey
+#include "Idx_Random.h"							// getRandomBytes
+#include "Idx_SelfTest.h"						// requireSelfTests
+#include "mem_impl.h"							// my_memclr
+
+#include <cstring>								// memcpy, strlen
+
+static uint32_t getOptionBits(const Op_Options & options)
+{
+	return (options.bSparse ? FINGERPRINT_OPT_SPARSE : 0) | (options.bDigest ? FINGERPRINT_OPT_DIGEST : 0) |
+		(options.bMerkle ? FINGERPRINT_OPT_MERKLE : 0) | (options.bEnvelope ? FINGERPRINT_OPT_ENVELOPE : 0) |
+		(options.bCompress ? FINGERPRINT_OPT_COMPRESS : 0) | (options.bRequireMerkle ? FINGERPRINT_OPT_REQ_MERKLE : 0) |
+		(options.bRequireDigest ? FINGERPRINT_OPT_REQ_DIGEST : 0);
+}
+
+/*
+* HMAC-SHA256(key derived from the password and pbSalt, FINGERPRINT_CHECK_LABEL)
+*/
+static int computeCheck(Hmac_PRF & prf, const char szPassword[], const unsigned char pbSalt[], const size_t & cbSalt, unsigned char pbCheck[32])
+{
+	unsigned char pbKey[32]{};
+	size_t cbCheck = 0;
+	HMAC_Context hmac{};
+	int iStatus = 0;
+
+	if (0 != deriveKey(prf, szPassword, pbSalt, cbSalt, pbKey) || 0 != requireSelfTests(SELFTEST_HMAC) || 0 != hmac.setHPtr(sha256f) || 0 != hmac.setKey(pbKey, 32) ||
+		0 != hmac.HMAC((const unsigned char*)FINGERPRINT_CHECK_LABEL, strlen(FINGERPRINT_CHECK_LABEL), pbCheck, cbCheck) || 32 != cbCheck)
+		iStatus = 1;
+
+	hmac.cleanData();
+	my_memclr(pbKey, sizeof(pbKey));
+
+	return iStatus;
+}
+
+int makeJobFingerprint(Hmac_PRF & prf, const char szPassword[], const size_t & cbSalt, const Op_Options & options, Job_Fingerprint & fingerprint)
+{
+	memset(&fingerprint, 0, sizeof(fingerprint));
+
+	fingerprint.hmacAlgo = (uint32_t)prf.getHmacAlgo();
+	fingerprint.options = getOptionBits(options);
+	fingerprint.cbSalt = (uint32_t)cbSalt;
+
+	if (cbSalt > sizeof(fingerprint.salt) || 0 != getRandomBytes(fingerprint.salt, cbSalt) ||
+		0 != computeCheck(prf, szPassword, fingerprint.salt, cbSalt, fingerprint.check))
+	{
+		printf("An error occured while computing the fingerprint of the job. Aborting...\n");
+		return 1;
+	}
+
+	return 0;
+}
+
+bool matchJobFingerprint(Hmac_PRF & prf, const char szPassword[], const size_t & cbSalt, const Op_Options & options, const Job_Fingerprint & stored)
+{
+	unsigned char pbCheck[32]{};
+	unsigned char diff = 0;
+
+	if (stored.hmacAlgo != (uint32_t)prf.getHmacAlgo() || stored.options != getOptionBits(options) || stored.cbSalt != (uint32_t)cbSalt ||
+		cbSalt > sizeof(stored.salt) || 0 != computeCheck(prf, szPassword, stored.salt, cbSalt, pbCheck))
+		return false;
+
+	// Constant time
+	for (size_t i = 0; i < sizeof(pbCheck); i++) diff |= (unsigned char)(pbCheck[i] ^ stored.check[i]);
+	my_memclr(pbCheck, sizeof(pbCheck));
+
+	return 0 == diff;
+}
+
+#endif
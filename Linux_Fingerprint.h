@@ -0,0 +1,63 @@
+/*
+*	=====================================
+*	Copyright (c) El Mostafa IDRASSI 2017
+*	mostafa.idrassi@tutanota.com
+*	Apache License
+*	=====================================
+*/
+
+#ifndef LINUX_FINGERPRINT_H
+#define LINUX_FINGERPRINT_H
+
+#ifdef __linux__
+
+#include "File_Struct.h"				// Op_Options
+#include "Hmac_PRF.h"					// Hmac_PRF
+
+#include <cstdint>
+
+#define FINGERPRINT_CHECK_LABEL		"IDXCRYPT job check"	// HMAC-SHA256(key derived from the password and the salt, label)
+
+#define FINGERPRINT_OPT_SPARSE		0x01
+#define FINGERPRINT_OPT_DIGEST		0x02
+#define FINGERPRINT_OPT_MERKLE		0x04
+#define FINGERPRINT_OPT_ENVELOPE	0x08
+#define FINGERPRINT_OPT_COMPRESS	0x10
+#define FINGERPRINT_OPT_REQ_MERKLE	0x20
+#define FINGERPRINT_OPT_REQ_DIGEST	0x40
+
+/*
+*	=====================================================================================================
+*	 Fingerprint of a folder job, recorded by its manifest and its journal (Linux_Manifest.h, Linux_Journal.h)
+*
+*	 The outputs of a job depend on its password, on the hash algorithm of the key derivation and on its
+*	 options : a manifest or a journal only applies to a job which has the same ones, otherwise the files
+*	 it describes would be skipped although their outputs were made differently.
+*	 The password is checked with an HMAC of a fixed label keyed with the key derived from it and from a
+*	 salt of the fingerprint, as any key of the files : nothing that helps guessing the password is stored.
+*	=====================================================================================================
+*/
+
+struct Job_Fingerprint
+{
+	uint32_t hmacAlgo;					// of the key derivation (Hmac_PRF)
+	uint32_t options;					// FINGERPRINT_OPT_*
+	uint32_t cbSalt;
+	uint32_t reserved;
+	unsigned char salt[64];
+	unsigned char check[32];			// HMAC-SHA256(derived key, FINGERPRINT_CHECK_LABEL)
+};
+
+/*
+*	Fingerprint of the job, with a new salt (1 key derivation)
+*/
+int makeJobFingerprint(Hmac_PRF & prf, const char szPassword[], const size_t & cbSalt, const Op_Options & options, Job_Fingerprint & fingerprint);
+
+/*
+*	True if stored is the fingerprint of the job : same algorithm and options, then same password (1 key derivation)
+*/
+bool matchJobFingerprint(Hmac_PRF & prf, const char szPassword[], const size_t & cbSalt, const Op_Options & options, const Job_Fingerprint & stored);
+
+#endif // !__linux__
+
+#endif // !LINUX_FINGERPRINT_H
@@ -0,0 +1,258 @@
+/*
+*	=====================================
+*	Copyright (c) El Mostafa IDRASSI 2017
+*	mostafa.idrassi@tutanota.com
+*	Apache License
+*	=====================================
+*/
+
+#ifdef __linux__
+
+#include "Linux_Journal.h"
+
+#include "Linux_Output.h"						// Output_File
+
+#include <errno.h>
+#include <algorithm>							// max
+#include <vector>
+
+static int64_t getNs(const struct timespec & ts)
+{
+	return (int64_t)ts.tv_sec * 1000000000 + (int64_t)ts.tv_nsec;
+}
+
+Job_Journal::Job_Journal()
+{
+}
+
+Job_Journal::~Job_Journal()
+{
+	if (fd >= 0) close(fd);
+}
+
+int Job_Journal::append(const Journal_Record & record, const std::string & outPath, const std::string & tmpPath)
+{
+	std::string buffer((const char*)&record, sizeof(record));
+	size_t cbWritten = 0;
+	ssize_t cbDone = 0;
+
+	buffer += outPath;
+	buffer += tmpPath;
+
+	// 1 record = 1 write : a crash can only tear the last record
+	while (cbWritten < buffer.size())
+	{
+		if ((cbDone = write(fd, buffer.data() + cbWritten, buffer.size() - cbWritten)) < 0)
+		{
+			if (EINTR == errno) continue;
+
+			std::cerr << "An error occured while writing to the journal " << path << " . Error code : " << errno << ". Aborting...\n";
+			return 1;
+		}
+		cbWritten += (size_t)cbDone;
+	}
+
+	cRecords++;
+
+	return 0;
+}
+
+/*
+* Reads the journal of the interrupted run and deletes its temporary files
+*/
+int Job_Journal::load(Hmac_PRF & prf, const char szPassword[], const Op_Options & options, const int & bResume)
+{
+	std::vector<char> content{};
+	Journal_Header fileHeader{};
+	FILE* fin = nullptr;
+	size_t pos = sizeof(Journal_Header);
+
+	if (!bResume) return makeJobFingerprint(prf, szPassword, header.cbSalt, options, header.fingerprint);
+
+	if (nullptr == (fin = fopen(path.data(), "rb")))
+	{
+		if (ENOENT == errno)
+		{
+			printf("The journal %s doesn't exist, nothing to resume.\n", path.data());
+			return makeJobFingerprint(prf, szPassword, header.cbSalt, options, header.fingerprint);
+		}
+
+		std::cerr << "An error occured while opening the journal " << path << " . Error code : " << errno << ". Aborting...\n";
+		return 1;
+	}
+
+	if (0 == fseeko(fin, 0, SEEK_END)) content.resize((size_t)ftello(fin));
+	rewind(fin);
+
+	if (content.size() != fread(content.data(), 1, content.size(), fin) || content.size() < sizeof(Journal_Header))
+	{
+		fclose(fin);
+		std::cerr << "The journal " << path << " can't be read. Aborting...\n";
+		return 1;
+	}
+	fclose(fin);
+
+	memcpy(&fileHeader, content.data(), sizeof(fileHeader));
+	if (0 != memcmp(fileHeader.magic, header.magic, sizeof(header.magic)) || fileHeader.version != header.version ||
+		fileHeader.bForDecrypt != header.bForDecrypt || fileHeader.cbSalt != header.cbSalt)
+	{
+		std::cerr << "The journal " << path << " was made by another kind of job. Aborting...\n";
+		return 1;
+	}
+
+	// Its outputs were made with another password, hash algorithm or options : they can't be mixed with those of this job
+	if (!matchJobFingerprint(prf, szPassword, header.cbSalt, options, fileHeader.fingerprint))
+	{
+		std::cerr << "The journal " << path << " was made with another password, hash algorithm or options. Aborting...\n";
+		return 1;
+	}
+	header.fingerprint = fileHeader.fingerprint;
+
+	while (pos + sizeof(Journal_Record) <= content.size())
+	{
+		Journal_Record record{};
+		memcpy(&record, content.data() + pos, sizeof(record));
+		pos += sizeof(record);
+
+		if ((JOURNAL_BEGIN != record.type && JOURNAL_DONE != record.type) ||
+			record.pathLength > content.size() - pos || record.tmpLength > content.size() - pos - record.pathLength)
+			break;			// torn record
+
+		std::string outPath(content.data() + pos, record.pathLength);
+		std::string tmpPath(content.data() + pos + record.pathLength, record.tmpLength);
+		pos += record.pathLength + record.tmpLength;
+
+		// The temporary file of an unfinished output, or of an output which was not published yet (/sync)
+		if (!tmpPath.empty()) unlink(tmpPath.data());
+
+		if (JOURNAL_DONE == record.type) doneFiles[outPath] = record;
+	}
+
+	return 0;
+}
+
+/*
+* Rewrites the journal with the completed files only, atomically
+*/
+int Job_Journal::compact()
+{
+	Output_File output{};
+	FILE* fout = nullptr;
+	int iStatus = 0;
+
+	if (0 != output.create(path)) return 1;
+
+	fout = output.getFile();
+
+	if (1 != fwrite(&header, sizeof(header), 1, fout)) iStatus = 1;
+
+	for (const auto & file : doneFiles)
+	{
+		if (0 != iStatus) break;
+
+		if (1 != fwrite(&file.second, sizeof(Journal_Record), 1, fout) ||
+			file.first.size() != fwrite(file.first.data(), 1, file.first.size(), fout))
+			iStatus = 1;
+	}
+
+	if (0 == iStatus) iStatus = output.publish();
+
+	if (fd >= 0) close(fd);
+	fd = -1;
+
+	if (0 == iStatus && (fd = ::open(path.data(), O_WRONLY | O_APPEND | O_CLOEXEC)) < 0) iStatus = 1;
+
+	if (0 != iStatus)
+	{
+		std::cerr << "An error occured while writing the journal " << path << " . Error code : " << errno << ". Aborting...\n";
+		return 1;
+	}
+
+	cRecords = doneFiles.size();
+
+	return 0;
+}
+
+int Job_Journal::open(const std::string & journalPath, const int & bForDecrypt, Hmac_PRF & prf, const char szPassword[], const size_t & cbSalt, const Op_Options & options, const int & bResume)
+{
+	path = journalPath;
+
+	memcpy(header.magic, JOURNAL_MAGIC, 8);
+	header.version = JOURNAL_VERSION;
+	header.bForDecrypt = (uint32_t)bForDecrypt;
+	header.cbSalt = (uint32_t)cbSalt;
+
+	if (0 != load(prf, szPassword, options, bResume)) return 1;
+
+	if (!doneFiles.empty()) printf("Resuming the job : %llu file(s) were completed by the previous run.\n", (unsigned long long)doneFiles.size());
+
+	// A fresh journal, or the one of the interrupted run without its useless records
+	for (auto & file : doneFiles) file.second.tmpLength = 0;
+
+	return compact();
+}
+
+bool Job_Journal::isDone(const struct stat & stat_buf, const std::string & outPath)
+{
+	struct stat out_buf {};
+	auto file = doneFiles.find(outPath);
+
+	if (doneFiles.end() == file) return false;
+
+	const Journal_Record & record = file->second;
+
+	if (record.dev != (uint64_t)stat_buf.st_dev || record.ino != (uint64_t)stat_buf.st_ino || record.size != (int64_t)stat_buf.st_size ||
+		record.mtimeNs != getNs(stat_buf.st_mtim) || record.ctimeNs != getNs(stat_buf.st_ctim) || 0 != stat(outPath.data(), &out_buf))
+		return false;
+
+	cResumed++;
+
+	return true;
+}
+
+int Job_Journal::begin(const std::string & outPath, const std::string & tmpPath)
+{
+	Journal_Record record{};
+
+	record.type = JOURNAL_BEGIN;
+	record.pathLength = (uint32_t)outPath.size();
+	record.tmpLength = (uint32_t)tmpPath.size();
+
+	return append(record, outPath, tmpPath);
+}
+
+int Job_Journal::done(const struct stat & stat_buf, const std::string & outPath)
+{
+	Journal_Record record{ JOURNAL_DONE, (uint32_t)outPath.size(), 0, 0,
+		(uint64_t)stat_buf.st_dev, (uint64_t)stat_buf.st_ino, (int64_t)stat_buf.st_size, getNs(stat_buf.st_mtim), getNs(stat_buf.st_ctim) };
+
+	if (0 != append(record, outPath, std::string{})) return 1;
+
+	doneFiles[outPath] = record;
+
+	// Amortized : a compaction is paid by at least as many appends
+	if (cRecords - doneFiles.size() > std::max<size_t>(JOURNAL_COMPACT_MIN, doneFiles.size())) return compact();
+
+	return 0;
+}
+
+size_t Job_Journal::getResumed() const
+{
+	return cResumed;
+}
+
+int Job_Journal::finish()
+{
+	if (fd >= 0) close(fd);
+	fd = -1;
+
+	if (0 != unlink(path.data()) && ENOENT != errno)
+	{
+		std::cerr << "An error occured while deleting the journal " << path << " . Error code : " << errno << ".\n";
+		return 1;
+	}
+
+	return 0;
+}
+
+#endif
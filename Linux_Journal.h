@@ -0,0 +1,127 @@
+/*
+*	=====================================
+*	Copyright (c) El Mostafa IDRASSI 2017
+*	mostafa.idrassi@tutanota.com
+*	Apache License
+*	=====================================
+*/
+
+#ifndef LINUX_JOURNAL_H
+#define LINUX_JOURNAL_H
+
+#ifdef __linux__
+
+#include "MyLinuxSysFunctions.h"		// stat
+#include "Linux_Fingerprint.h"			// Job_Fingerprint
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+
+#define JOURNAL_MAGIC			"IDXJRNL"
+#define JOURNAL_VERSION			2
+
+#define JOURNAL_BEGIN			1		// an output is being written (its temporary file, if any, is recorded)
+#define JOURNAL_DONE			2		// the output is complete and published (durable, with /sync)
+
+#define JOURNAL_COMPACT_MIN		4096	// the journal is compacted once it holds that many useless records, and more than useful ones
+
+/*
+*	=====================================================================================================
+*	 Journal of a folder job ("/journal path"), to resume it after a crash ("/resume")
+*
+*	 A record is appended (1 write) when an output file is started, then once it is published, with the
+*	 identity (dev, ino, size, mtime_ns, ctime_ns) of its input. With /sync, the completion is only recorded
+*	 by the barrier which made the output durable : a completed output may otherwise be lost in a crash while
+*	 an older version of it still exists. A job resumed with /resume skips the files that were completed by
+*	 the interrupted run, did not change since, and whose output exists : the others are simply redone.
+*	 The temporary files left behind by the interrupted run (see Output_File) are deleted.
+*	 The journal is compacted (rewritten with its useful records only) as the useless ones pile up, and
+*	 deleted once the job is successful.
+*	 It records the fingerprint of the job (password, hash algorithm, options : Linux_Fingerprint.h) : a job
+*	 resumed with another one is refused, its outputs would mix two keys or two formats.
+*
+*	 File layout (native byte order) : Journal_Header | (Journal_Record | path | tmpPath)*, tmpPath empty for a DONE record
+*	 A torn record at the end (crash during a write) is ignored.
+*	=====================================================================================================
+*/
+
+struct Journal_Header
+{
+	char magic[8];
+	uint32_t version;
+	uint32_t bForDecrypt;				// a journal only applies to jobs of the same kind
+	uint32_t cbSalt;
+	uint32_t reserved;
+	Job_Fingerprint fingerprint;
+};
+
+struct Journal_Record
+{
+	uint32_t type;
+	uint32_t pathLength;				// output path, follows the record
+	uint32_t tmpLength;					// temporary file, follows the output path
+	uint32_t reserved;
+	uint64_t dev;
+	uint64_t ino;
+	int64_t size;
+	int64_t mtimeNs;
+	int64_t ctimeNs;
+};
+
+class Job_Journal
+{
+private:
+
+	std::string path{};
+	Journal_Header header{};
+	int fd = -1;
+	size_t cRecords = 0;					// records in the file
+	size_t cResumed = 0;
+	std::unordered_map<std::string, Journal_Record> doneFiles{};	// by output path
+
+	int append(const Journal_Record & record, const std::string & outPath, const std::string & tmpPath);
+	int load(Hmac_PRF & prf, const char szPassword[], const Op_Options & options, const int & bResume);
+	int compact();
+
+public:
+
+	Job_Journal();
+
+	// Copy, Move constructor and assignment operators deleted : the object owns a file descriptor
+	Job_Journal(const Job_Journal & other) = delete;
+	Job_Journal & operator=(const Job_Journal & other) = delete;
+	Job_Journal(Job_Journal && other) = delete;
+	Job_Journal & operator=(Job_Journal && other) = delete;
+
+	~Job_Journal();
+
+	/*
+	*	Opens the journal. With bResume, the files completed by the interrupted run are loaded and its
+	*	temporary files deleted (refused if the run had another fingerprint), otherwise the journal starts empty.
+	*/
+	int open(const std::string & journalPath, const int & bForDecrypt, Hmac_PRF & prf, const char szPassword[], const size_t & cbSalt, const Op_Options & options, const int & bResume);
+
+	/*
+	*	True if the interrupted run completed outPath from the input described by stat_buf, which didn't change since
+	*/
+	bool isDone(const struct stat & stat_buf, const std::string & outPath);
+
+	int begin(const std::string & outPath, const std::string & tmpPath);
+
+	/*
+	*	outPath is published : with /sync, only once a barrier made it durable
+	*/
+	int done(const struct stat & stat_buf, const std::string & outPath);
+
+	size_t getResumed() const;
+
+	/*
+	*	The job is successful : the journal is deleted
+	*/
+	int finish();
+};
+
+#endif // !__linux__
+
+#endif // !LINUX_JOURNAL_H
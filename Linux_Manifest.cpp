@@ -0,0 +1,241 @@
+/*
+*	=====================================
+*	Copyright (c) El Mostafa IDRASSI 2017
+*	mostafa.idrassi@tutanota.com
+*	Apache License
+*	=====================================
+*/
+
+#ifdef __linux__
+
+#include "Linux_Manifest.h"
+
+#include "Linux_Output.h"						// Output_File
+#include "Linux_Durability.h"					// Durability_Tracker
+
+#include <errno.h>
+#include <sys/mman.h>							// mmap
+#include <algorithm>							// sort, lower_bound
+#include <unordered_set>
+
+static int64_t getNs(const struct timespec & ts)
+{
+	return (int64_t)ts.tv_sec * 1000000000 + (int64_t)ts.tv_nsec;
+}
+
+static bool isLess(const Manifest_Entry & a, const Manifest_Entry & b)
+{
+	return (a.dev < b.dev) || (a.dev == b.dev && a.ino < b.ino);
+}
+
+/*
+* True if path is in the folder root (with its trailing "/"), without going back up : read from the manifest, it is not trusted
+*/
+static bool isUnder(const std::string & path, const std::string & root)
+{
+	return path.size() > root.size() && 0 == path.compare(0, root.size(), root) && std::string::npos == path.find("/../", root.size() - 1);
+}
+
+Change_Manifest::Change_Manifest()
+{
+}
+
+Change_Manifest::~Change_Manifest()
+{
+	if (pMap) munmap(pMap, cbMap);
+}
+
+int Change_Manifest::open(const std::string & manifestPath, const int & bForDecrypt, Hmac_PRF & prf, const char szPassword[], const size_t & cbSalt, const Op_Options & options,
+	const std::string & inRoot, const std::string & outRoot)
+{
+	struct stat stat_buf {};
+	const Manifest_Header* header = nullptr;
+	int fd = -1;
+	int iStatus = 0;
+
+	path = manifestPath;
+	this->bForDecrypt = bForDecrypt;
+	this->cbSalt = cbSalt;
+	this->inRoot = inRoot;
+	this->outRoot = outRoot;
+	newPool = inRoot + outRoot;
+
+	if ((fd = ::open(path.data(), O_RDONLY | O_CLOEXEC)) < 0)
+	{
+		if (ENOENT == errno) return makeJobFingerprint(prf, szPassword, cbSalt, options, fingerprint);		// first run
+
+		std::cerr << "An error occured while opening the manifest " << path << " . Error code : " << errno << ". Aborting...\n";
+		return 1;
+	}
+
+	if (0 == fstat(fd, &stat_buf) && stat_buf.st_size >= (off_t)sizeof(Manifest_Header))
+	{
+		cbMap = (size_t)stat_buf.st_size;
+		pMap = mmap(nullptr, cbMap, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (MAP_FAILED == pMap) pMap = nullptr;
+	}
+	close(fd);
+
+	if (nullptr == pMap)
+	{
+		printf("The manifest %s can't be read, every file will be processed.\n", path.data());
+		return makeJobFingerprint(prf, szPassword, cbSalt, options, fingerprint);
+	}
+
+	header = (const Manifest_Header*)pMap;
+
+	// Every field is checked against the size of the file before the entries and the pool are trusted
+	if (0 != memcmp(header->magic, MANIFEST_MAGIC, 8) || MANIFEST_VERSION != header->version ||
+		header->count > (cbMap - sizeof(Manifest_Header)) / sizeof(Manifest_Entry) ||
+		header->cbPool != cbMap - sizeof(Manifest_Header) - header->count * sizeof(Manifest_Entry) ||
+		header->cbInRoot > header->cbPool || header->cbOutRoot > header->cbPool - header->cbInRoot)
+	{
+		printf("The manifest %s is not valid, every file will be processed.\n", path.data());
+	}
+	else if ((uint32_t)bForDecrypt != header->bForDecrypt || (uint32_t)cbSalt != header->cbSalt)
+	{
+		printf("The manifest %s was made by another kind of job, every file will be processed.\n", path.data());
+	}
+	else
+	{
+		const char* pool = (const char*)((const Manifest_Entry*)(header + 1) + header->count);
+		std::string oldInRoot(pool, header->cbInRoot), oldOutRoot(pool + header->cbInRoot, header->cbOutRoot);
+
+		// Its entries, and the outputs pruned, are those of other folders
+		if (oldInRoot != inRoot || oldOutRoot != outRoot)
+		{
+			std::cerr << "The manifest " << path << " was made for the input folder " << oldInRoot << " and the output folder " << oldOutRoot << " : another manifest must be used for other folders. Aborting...\n";
+			iStatus = 1;
+		}
+		// Same folders, but the outputs were made with another password, hash algorithm or options
+		else if (!matchJobFingerprint(prf, szPassword, cbSalt, options, header->fingerprint))
+		{
+			printf("The manifest %s was made by another kind of job (password, hash algorithm or options), every file will be processed.\n", path.data());
+		}
+		else
+		{
+			oldEntries = (const Manifest_Entry*)(header + 1);
+			oldCount = header->count;
+			oldPool = pool;
+			fingerprint = header->fingerprint;
+		}
+	}
+
+	if (0 == iStatus && nullptr == oldEntries) iStatus = makeJobFingerprint(prf, szPassword, cbSalt, options, fingerprint);
+
+	return iStatus;
+}
+
+const Manifest_Entry* Change_Manifest::find(const struct stat & stat_buf) const
+{
+	Manifest_Entry key{};
+
+	key.dev = (uint64_t)stat_buf.st_dev;
+	key.ino = (uint64_t)stat_buf.st_ino;
+
+	const Manifest_Entry* entry = std::lower_bound(oldEntries, oldEntries + oldCount, key, isLess);
+
+	if (entry == oldEntries + oldCount || entry->dev != key.dev || entry->ino != key.ino) return nullptr;
+
+	return entry;
+}
+
+std::string Change_Manifest::getOldPath(const uint64_t & offset, const uint32_t & length) const
+{
+	const Manifest_Header* header = (const Manifest_Header*)pMap;
+
+	if (offset > header->cbPool || length > header->cbPool - offset) return std::string{};
+
+	return std::string(oldPool + offset, length);
+}
+
+bool Change_Manifest::skipUnchanged(const struct stat & stat_buf, const std::string & inPath, const std::string & outPath)
+{
+	struct stat out_buf {};
+	const Manifest_Entry* entry = oldEntries ? find(stat_buf) : nullptr;
+
+	if (nullptr == entry || MANIFEST_STATE_DONE != entry->state ||
+		entry->size != (int64_t)stat_buf.st_size || entry->mtimeNs != getNs(stat_buf.st_mtim) || entry->ctimeNs != getNs(stat_buf.st_ctim) ||
+		getOldPath(entry->pathOffset, entry->pathLength) != outPath || 0 != stat(outPath.data(), &out_buf))
+		return false;
+
+	record(stat_buf, inPath, outPath);
+	cSkipped++;
+
+	return true;
+}
+
+size_t Change_Manifest::getSkipped() const
+{
+	return cSkipped;
+}
+
+void Change_Manifest::record(const struct stat & stat_buf, const std::string & inPath, const std::string & outPath)
+{
+	newEntries.push_back(Manifest_Entry{ (uint64_t)stat_buf.st_dev, (uint64_t)stat_buf.st_ino, (int64_t)stat_buf.st_size,
+		getNs(stat_buf.st_mtim), getNs(stat_buf.st_ctim), (uint64_t)newPool.size(), (uint32_t)outPath.size(), MANIFEST_STATE_DONE,
+		(uint64_t)(newPool.size() + outPath.size()), (uint32_t)inPath.size(), 0 });
+	newPool += outPath;
+	newPool += inPath;
+}
+
+size_t Change_Manifest::prune()
+{
+	std::unordered_set<std::string> outputs{};
+	size_t cbPruned = 0;
+
+	for (const Manifest_Entry & entry : newEntries) outputs.insert(newPool.substr(entry.pathOffset, entry.pathLength));
+
+	for (uint64_t i = 0; i < oldCount; i++)
+	{
+		struct stat stat_buf {};
+		std::string oldPath = getOldPath(oldEntries[i].pathOffset, oldEntries[i].pathLength);
+		std::string oldInPath = getOldPath(oldEntries[i].inPathOffset, oldEntries[i].inPathLength);
+
+		if (!isUnder(oldPath, outRoot) || outputs.count(oldPath)) continue;
+
+		// Only the outputs of the inputs which are gone : an input this run didn't produce for another reason keeps its output
+		if (!isUnder(oldInPath, inRoot) || 0 == lstat(oldInPath.data(), &stat_buf) || ENOENT != errno) continue;
+
+		if (0 == unlink(oldPath.data())) cbPruned++;
+		else if (ENOENT != errno) std::cerr << "Failed to delete the output " << oldPath << " of a deleted input. Error code : " << errno << ".\n";
+	}
+
+	return cbPruned;
+}
+
+int Change_Manifest::save(Durability_Tracker * tracker)
+{
+	Manifest_Header header{};
+	Output_File output{};
+	FILE* fout = nullptr;
+
+	std::sort(newEntries.begin(), newEntries.end(), isLess);
+
+	memcpy(header.magic, MANIFEST_MAGIC, 8);
+	header.version = MANIFEST_VERSION;
+	header.bForDecrypt = (uint32_t)bForDecrypt;
+	header.cbSalt = (uint32_t)cbSalt;
+	header.cbInRoot = (uint32_t)inRoot.size();
+	header.count = newEntries.size();
+	header.cbPool = newPool.size();
+	header.cbOutRoot = (uint32_t)outRoot.size();
+	header.fingerprint = fingerprint;
+
+	if (0 != output.create(path)) return 1;
+
+	fout = output.getFile();
+
+	if (1 != fwrite(&header, sizeof(header), 1, fout) ||
+		newEntries.size() != fwrite(newEntries.data(), sizeof(Manifest_Entry), newEntries.size(), fout) ||
+		newPool.size() != fwrite(newPool.data(), 1, newPool.size(), fout) ||
+		0 != (tracker ? tracker->addFile(output) : output.publish()))
+	{
+		std::cerr << "An error occured while writing the manifest " << path << " . Error code : " << errno << ".\n";
+		return 1;
+	}
+
+	return 0;
+}
+
+#endif
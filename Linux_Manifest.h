@@ -0,0 +1,151 @@
+/*
+*	=====================================
+*	Copyright (c) El Mostafa IDRASSI 2017
+*	mostafa.idrassi@tutanota.com
+*	Apache License
+*	=====================================
+*/
+
+#ifndef LINUX_MANIFEST_H
+#define LINUX_MANIFEST_H
+
+#ifdef __linux__
+
+#include "MyLinuxSysFunctions.h"		// __int64, stat
+#include "Linux_Fingerprint.h"			// Job_Fingerprint
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+class Durability_Tracker;
+
+#define MANIFEST_MAGIC			"IDXMANIF"
+#define MANIFEST_VERSION		3
+
+#define MANIFEST_STATE_DONE		1		// the output is complete and matches the recorded input
+
+/*
+*	=====================================================================================================
+*	 Change manifest of a folder job ("/manifest path") : incremental encryption/decryption
+*
+*	 Every input file of a successful run is recorded with the identity of its version
+*	 (dev, ino, size, mtime_ns, ctime_ns), its path and its output path. The next run skips the files whose
+*	 identity and output path did not change (and whose output still exists) : no key derivation and no
+*	 rewrite, so the run time depends on the churn rather than on the size of the folder.
+*	 With "/prune", the outputs of the inputs that disappeared (deleted or renamed) are deleted.
+*
+*	 A manifest belongs to the input and output folders of the run which made it : a job on other folders
+*	 is refused, so that pruning never deletes files of a folder the manifest doesn't describe.
+*	 It also records the fingerprint of the job (password, hash algorithm, options : Linux_Fingerprint.h) :
+*	 a job with another one processes every file, as a job of another kind.
+*
+*	 File layout (native byte order, read with mmap : a lookup only touches the pages it needs)
+*	 Manifest_Header | Manifest_Entry[count] sorted by (dev, ino) | pool : input root, output root, paths
+*	 The manifest is rewritten as a whole at the end of each successful run (Output_File : atomically).
+*	=====================================================================================================
+*/
+
+struct Manifest_Header
+{
+	char magic[8];
+	uint32_t version;
+	uint32_t bForDecrypt;				// a manifest only applies to jobs of the same kind
+	uint32_t cbSalt;
+	uint32_t cbInRoot;					// length of the input folder, at the start of the pool
+	uint64_t count;						// number of entries
+	uint64_t cbPool;					// length of the pool of paths
+	uint32_t cbOutRoot;					// length of the output folder, after the input folder
+	uint32_t reserved;
+	Job_Fingerprint fingerprint;
+};
+
+struct Manifest_Entry
+{
+	uint64_t dev;
+	uint64_t ino;
+	int64_t size;
+	int64_t mtimeNs;
+	int64_t ctimeNs;
+	uint64_t pathOffset;				// output path, in the pool
+	uint32_t pathLength;
+	uint32_t state;
+	uint64_t inPathOffset;				// input path, in the pool
+	uint32_t inPathLength;
+	uint32_t reserved;
+};
+
+class Change_Manifest
+{
+private:
+
+	std::string path{};
+	int bForDecrypt = 0;
+	size_t cbSalt = 0;
+	std::string inRoot{};				// folders of the job, with their trailing "/"
+	std::string outRoot{};
+	Job_Fingerprint fingerprint{};		// of this job : the one of the previous run if it matches, a new one otherwise
+
+	// Previous run (mapped)
+	void* pMap = nullptr;
+	size_t cbMap = 0;
+	const Manifest_Entry* oldEntries = nullptr;
+	uint64_t oldCount = 0;
+	const char* oldPool = nullptr;
+
+	// This run
+	std::vector<Manifest_Entry> newEntries{};
+	std::string newPool{};
+	size_t cSkipped = 0;
+
+	const Manifest_Entry* find(const struct stat & stat_buf) const;
+	std::string getOldPath(const uint64_t & offset, const uint32_t & length) const;
+
+public:
+
+	Change_Manifest();
+
+	// Copy, Move constructor and assignment operators deleted : the object owns a mapping
+	Change_Manifest(const Change_Manifest & other) = delete;
+	Change_Manifest & operator=(const Change_Manifest & other) = delete;
+	Change_Manifest(Change_Manifest && other) = delete;
+	Change_Manifest & operator=(Change_Manifest && other) = delete;
+
+	~Change_Manifest();
+
+	/*
+	*	Maps the manifest of the previous run, if any. A missing, invalid manifest or a manifest of another kind
+	*	of job (fingerprint included) is ignored : every file is processed. A manifest of other folders than inRoot
+	*	and outRoot is refused.
+	*/
+	int open(const std::string & manifestPath, const int & bForDecrypt, Hmac_PRF & prf, const char szPassword[], const size_t & cbSalt, const Op_Options & options,
+		const std::string & inRoot, const std::string & outRoot);
+
+	/*
+	*	True if the input described by stat_buf was processed into outPath by the previous run and didn't change since :
+	*	it is then recorded again, and there is nothing to do
+	*/
+	bool skipUnchanged(const struct stat & stat_buf, const std::string & inPath, const std::string & outPath);
+
+	/*
+	*	Records the input file inPath whose output is complete
+	*/
+	void record(const struct stat & stat_buf, const std::string & inPath, const std::string & outPath);
+
+	/*
+	*	Deletes the outputs of the previous run which no input of this run produced, whose input no longer exists and
+	*	which are in the output folder. Returns the number of deleted outputs.
+	*/
+	size_t prune();
+
+	size_t getSkipped() const;
+
+	/*
+	*	Writes the manifest of this run. It is handed over to tracker when the job must be durable (nullptr otherwise).
+	*/
+	int save(Durability_Tracker * tracker);
+};
+
+#endif // !__linux__
+
+#endif // !LINUX_MANIFEST_H
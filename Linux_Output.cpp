@@ -0,0 +1,225 @@
+/*
+*	=====================================
+*	Copyright (c) El Mostafa IDRASSI 2017
+*	mostafa.idrassi@tutanota.com
+*	Apache License
+*	=====================================
+*/
+
+#ifdef __linux__
+
+#include "Linux_Output.h"
+
+#include "MyLinuxSysFunctions.h"				// dirname_base_separator
+
+#include <errno.h>
+#include <atomic>
+#include <iostream>								// cerr
+
+#define OUTPUT_MODE		(S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH | S_IWOTH)		// same as fopen, umask applies
+
+static std::atomic<unsigned int> tmpCounter{ 0 };
+
+/*
+* Builds a unique, hidden name in the directory of path : dir/.base.idxtmp.pid.n
+*/
+static std::string getTmpName(const std::string & path)
+{
+	std::string dir{}, base{};
+
+	dirname_base_separator(path, dir, base);
+
+	return dir + "." + base + ".idxtmp." + std::to_string(getpid()) + "." + std::to_string(tmpCounter++);
+}
+
+/*
+* True if /proc is mounted : an anonymous file is published through /proc/self/fd unless the process may use AT_EMPTY_PATH
+*/
+static bool hasProcFd()
+{
+	static const bool bProcFd = (0 == access("/proc/self/fd", X_OK));
+
+	return bProcFd;
+}
+
+/*
+* Links the anonymous file fd as path : directly with AT_EMPTY_PATH (needs CAP_DAC_READ_SEARCH), else through its /proc entry
+*/
+static int linkAnonymous(int fd, const char szProcPath[], const std::string & path)
+{
+	if (0 == linkat(fd, "", AT_FDCWD, path.data(), AT_EMPTY_PATH)) return 0;
+	if (EEXIST == errno) return -1;
+
+	return linkat(AT_FDCWD, szProcPath, AT_FDCWD, path.data(), AT_SYMLINK_FOLLOW);
+}
+
+int publishOutput(int fd, const std::string & tmpPath, const std::string & path)
+{
+	char szProcPath[32]{};
+	std::string linkPath{};
+	int iStatus = 1;
+
+	// Named temporary file : a rename does it
+	if (!tmpPath.empty())
+	{
+		if (0 == rename(tmpPath.data(), path.data())) return 0;
+
+		std::cerr << "An error occured while publishing the output file " << path << " . (publishOutput - rename) Error code : " << errno << ".\n";
+		return 1;
+	}
+
+	// Anonymous file : link it into the directory
+	snprintf(szProcPath, sizeof(szProcPath), "/proc/self/fd/%d", fd);
+
+	if (0 == linkAnonymous(fd, szProcPath, path)) return 0;
+
+	// linkat never replaces an existing file : link under a free temporary name, then rename it over the final path
+	while (EEXIST == errno)
+	{
+		linkPath = getTmpName(path);
+
+		if (0 == linkAnonymous(fd, szProcPath, linkPath))
+		{
+			if (0 == rename(linkPath.data(), path.data())) iStatus = 0;
+			else unlink(linkPath.data());
+			break;
+		}
+	}
+
+	if (0 != iStatus)
+		std::cerr << "An error occured while publishing the output file " << path << " . (publishOutput - linkat) Error code : " << errno << ".\n";
+
+	return iStatus;
+}
+
+Output_File::Output_File()
+{
+}
+
+Output_File::~Output_File()
+{
+	discard();
+}
+
+int Output_File::create(const std::string & outPath)
+{
+	std::string dir{}, base{};
+	int fd = -1;
+
+	discard();
+
+	path = outPath;
+	dirname_base_separator(outPath, dir, base);
+
+	// Without /proc, an anonymous file could only be published with AT_EMPTY_PATH, which most users may not use
+	if (hasProcFd()) fd = open(dir.data(), O_TMPFILE | O_WRONLY | O_CLOEXEC, OUTPUT_MODE);
+
+	// O_TMPFILE not supported by the kernel or the filesystem, or no /proc => hidden temporary file
+	while (fd < 0)
+	{
+		tmpPath = getTmpName(outPath);
+		fd = open(tmpPath.data(), O_CREAT | O_EXCL | O_WRONLY | O_CLOEXEC, OUTPUT_MODE);
+
+		if (fd < 0 && errno != EEXIST)
+		{
+			tmpPath.clear();
+			break;
+		}
+	}
+
+	if (fd < 0 || nullptr == (fout = fdopen(fd, "wb")))
+	{
+		std::cerr << "Failed to create the output file " << outPath << " . Error code : " << errno << ".\n";
+		if (fd >= 0) close(fd);
+		discard();
+		return 1;
+	}
+
+	return 0;
+}
+
+int Output_File::createResumable(const std::string & outPath, const std::string & partialPath, const bool & bResume)
+{
+	int fd = -1;
+
+	discard();
+
+	path = outPath;
+	tmpPath = partialPath;
+	bKeep = true;
+
+	fd = open(tmpPath.data(), bResume ? (O_RDWR | O_CLOEXEC) : (O_CREAT | O_TRUNC | O_RDWR | O_CLOEXEC), OUTPUT_MODE);
+
+	if (fd < 0 || nullptr == (fout = fdopen(fd, bResume ? "r+b" : "w+b")))
+	{
+		std::cerr << "Failed to open the partial output file " << partialPath << " . Error code : " << errno << ".\n";
+		if (fd >= 0) close(fd);
+		discard();
+		return 1;
+	}
+
+	return 0;
+}
+
+FILE* Output_File::getFile()
+{
+	return fout;
+}
+
+const std::string & Output_File::getPath() const
+{
+	return path;
+}
+
+const std::string & Output_File::getTmpPath() const
+{
+	return tmpPath;
+}
+
+int Output_File::publish()
+{
+	int iStatus = 0;
+
+	if (nullptr == fout || 0 != fflush(fout))
+	{
+		std::cerr << "An error occured while writing the output file " << path << " . Error code : " << errno << ".\n";
+		return 1;
+	}
+
+	iStatus = publishOutput(fileno(fout), tmpPath, path);
+
+	if (0 == iStatus)
+	{
+		tmpPath.clear();	// now known under its final name
+		if (0 != fclose(fout)) iStatus = 1;
+		fout = nullptr;
+	}
+
+	return iStatus;
+}
+
+int Output_File::release()
+{
+	int iStatus = 0;
+
+	if (nullptr == fout) return 1;
+
+	if (0 != fclose(fout)) iStatus = 1;
+
+	fout = nullptr;
+	tmpPath.clear();		// owned by the caller from now on
+
+	return iStatus;
+}
+
+void Output_File::discard()
+{
+	if (fout) fclose(fout);
+	if (!tmpPath.empty() && !bKeep) unlink(tmpPath.data());
+
+	fout = nullptr;
+	tmpPath.clear();
+	bKeep = false;
+}
+
+#endif
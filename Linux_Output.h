@@ -0,0 +1,92 @@
+/*
+*	=====================================
+*	Copyright (c) El Mostafa IDRASSI 2017
+*	mostafa.idrassi@tutanota.com
+*	Apache License
+*	=====================================
+*/
+
+#ifndef LINUX_OUTPUT_H
+#define LINUX_OUTPUT_H
+
+#ifdef __linux__
+
+#include <cstdio>						// FILE
+#include <string>
+
+/*
+*	=====================================================================================================
+*	 Output file which only appears under its final path once it has been completely written
+*
+*	 The data is written into an anonymous file (O_TMPFILE) created in the output directory, and
+*	 publish() gives it its name with linkat (AT_EMPTY_PATH, else its /proc/self/fd entry). If the job
+*	 fails or the process dies before that, the anonymous file simply vanishes : there is never a
+*	 truncated output to look for and delete.
+*	 Filesystems without O_TMPFILE support, and processes without /proc, get a hidden temporary file
+*	 (".name.idxtmp.pid.n") in the same directory instead, which publish() renames over the final path.
+*	 In both cases, an existing file with the final name is atomically replaced.
+*	=====================================================================================================
+*/
+class Output_File
+{
+private:
+
+	std::string path{};				// final path of the output
+	std::string tmpPath{};			// path of the temporary file (fallback), empty when the file is anonymous
+	FILE* fout = nullptr;
+	bool bKeep = false;				// the temporary file survives a failure (resumable output)
+
+public:
+
+	Output_File();
+
+	// Copy, Move constructor and assignment operators deleted : the object owns the file
+	Output_File(const Output_File & other) = delete;
+	Output_File & operator=(const Output_File & other) = delete;
+	Output_File(Output_File && other) = delete;
+	Output_File & operator=(Output_File && other) = delete;
+
+	// Discards the file if it was not published nor released
+	~Output_File();
+
+	/*
+	*	Creates the unnamed output file in the directory of outPath
+	*/
+	int create(const std::string & outPath);
+
+	/*
+	*	Uses partialPath as the temporary file of outPath : a named file which is kept if the job fails, so that
+	*	the job can be resumed (see File_Checkpoint). bResume opens the existing file for reading and writing, as is.
+	*/
+	int createResumable(const std::string & outPath, const std::string & partialPath, const bool & bResume);
+
+	FILE* getFile();
+	const std::string & getPath() const;
+	const std::string & getTmpPath() const;
+
+	/*
+	*	Flushes the data and gives the file its final name
+	*/
+	int publish();
+
+	/*
+	*	Flushes and closes the file without publishing it : the caller (Durability_Tracker) has taken
+	*	its own descriptor and will publish it with publishOutput later
+	*/
+	int release();
+
+	/*
+	*	Closes the file and deletes the temporary file, if any (unless resumable)
+	*/
+	void discard();
+};
+
+/*
+*	Gives the file open on fd its final name path. tmpPath is the name of the temporary file,
+*	or is empty if fd refers to an anonymous O_TMPFILE file.
+*/
+int publishOutput(int fd, const std::string & tmpPath, const std::string & path);
+
+#endif // !__linux__
+
+#endif // !LINUX_OUTPUT_H
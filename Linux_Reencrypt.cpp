@@ -0,0 +1,259 @@
+/*
+*	=====================================
+*	Copyright (c) El Mostafa IDRASSI 2017
+*	mostafa.idrassi@tutanota.com
+*	Apache License
+*	=====================================
+*/
+
+#ifdef __linux__
+
+#include "Linux_Reencrypt.h"
+
+#include "MyLinuxSysFunctions.h"				// open, stat, mkdir
+#include "File_Struct.h"						// READ_BUFFER_SIZE
+#include "Linux_Arena.h"						// Secure_Buffer
+#include "Linux_Output.h"						// Output_File
+#include "Linux_Rekey.h"						// listEncryptedFiles
+#include "Idx_Context.h"						// Context_Pool
+#include "Idx_Engine.h"							// Idx_Decryptor, Idx_Encryptor
+
+#include <errno.h>
+#include <atomic>
+#include <cstdio>								// printf
+#include <system_error>
+#include <thread>
+#include <vector>
+
+#define REENCRYPT_OUT_SIZE		(READ_BUFFER_SIZE + IDX_PREFIX_SIZE(IDX_MAX_SALT) + 32)	// what an update may write
+
+struct Reencrypt_Job
+{
+	std::string inPath;
+	std::string outPath;
+};
+
+/*
+* Creates outDir and the missing directories of outPath below it
+*/
+static int makeParentDirs(const std::string & outDir, const std::string & outPath)
+{
+	size_t pos = outDir.size();
+
+	for (pos = outPath.find('/', pos); std::string::npos != pos; pos = outPath.find('/', pos + 1))
+	{
+		if (0 != mkdir(outPath.substr(0, pos).data(), S_IRWXU | S_IRGRP | S_IXGRP | S_IROTH | S_IXOTH) && EEXIST != errno)
+		{
+			printf("An error occured while attempting to create the output directory %s (Error code : %d). Aborting...\n", outPath.substr(0, pos).data(), errno);
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+static void reportError(const int & iStatus, const std::string & path, const int & lastErrno)
+{
+	switch (iStatus)
+	{
+	case IDX_ERR_PASSWORD:
+		printf("Password incorrect or the file %s is not a valid encrypted file. Aborting...\n", path.data());
+		break;
+	case IDX_ERR_FORMAT:
+		printf("The file %s has a sparse map, a digest, a hash tree, a key of its own, compressed data or was written in volumes : it can only be re-encrypted by decrypting it. Aborting...\n", path.data());
+		break;
+	case IDX_ERR_TRUNCATED:
+		printf("The file %s is truncated. Aborting...\n", path.data());
+		break;
+	case IDX_ERR_IO:
+		printf("An error occured while re-encrypting the file %s (Error code : %d). Aborting...\n", path.data(), lastErrno);
+		break;
+	default:
+		printf("An unexpected error occured while re-encrypting the file %s. Aborting...\n", path.data());
+		break;
+	}
+}
+
+/*
+* Decrypts job.inPath into plain and encrypts plain into job.outPath, a buffer at a time
+*/
+static int reencryptFile(const Reencrypt_Job & job, Idx_Decryptor & decryptor, Idx_Encryptor & encryptor, const Idx_Encryptor & master,
+	std::vector<unsigned char> & input, std::vector<unsigned char> & output)
+{
+	Output_File outputFile{};
+	Secure_Buffer plain(READ_BUFFER_SIZE + 16);		// locked, left out of core dumps, wiped when given back
+	FILE* fout = nullptr;
+	size_t cbPlain = 0, cbOut = 0;
+	ssize_t cbRead = 0;
+	int fd = open(job.inPath.data(), O_RDONLY | O_CLOEXEC);
+	int iStatus = IDX_OK;
+
+	if (fd < 0)
+	{
+		printf("Failed to open the file %s for reading (Error code : %d). Aborting...\n", job.inPath.data(), errno);
+		return 1;
+	}
+
+	if (nullptr == plain.data() || IDX_OK != decryptor.restart() || IDX_OK != encryptor.init(master))
+	{
+		printf("An unexpected error occured while preparing the re-encryption of the file %s. Aborting...\n", job.inPath.data());
+		close(fd);
+		return 1;
+	}
+
+	if (0 != outputFile.create(job.outPath))
+	{
+		close(fd);
+		return 1;
+	}
+
+	fout = outputFile.getFile();
+	posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+	plain.touch(plain.size());
+
+	while (IDX_OK == iStatus && 0 != (cbRead = read(fd, input.data(), READ_BUFFER_SIZE)))
+	{
+		if (cbRead < 0)
+		{
+			if (EINTR != errno) iStatus = IDX_ERR_IO;
+		}
+		else if (IDX_OK == (iStatus = decryptor.update(input.data(), (size_t)cbRead, plain.data(), plain.size(), cbPlain)) &&
+			IDX_OK == (iStatus = encryptor.update(plain.data(), cbPlain, output.data(), output.size(), cbOut)) &&
+			cbOut != fwrite(output.data(), 1, cbOut, fout))
+		{
+			iStatus = IDX_ERR_IO;
+		}
+	}
+
+	// The last block of the input, then the padded last block of the output
+	if (IDX_OK == iStatus && IDX_OK == (iStatus = decryptor.finish(plain.data(), plain.size(), cbPlain)) &&
+		IDX_OK == (iStatus = encryptor.update(plain.data(), cbPlain, output.data(), output.size(), cbOut)) &&
+		cbOut != fwrite(output.data(), 1, cbOut, fout))
+	{
+		iStatus = IDX_ERR_IO;
+	}
+
+	if (IDX_OK == iStatus && IDX_OK == (iStatus = encryptor.finish(output.data(), output.size(), cbOut)) &&
+		(cbOut != fwrite(output.data(), 1, cbOut, fout) || 0 != fflush(fout) || 0 != fdatasync(fileno(fout)) || 0 != outputFile.publish()))
+	{
+		iStatus = IDX_ERR_IO;
+	}
+
+	if (IDX_OK != iStatus)
+	{
+		reportError(iStatus, job.inPath, errno);
+		outputFile.discard();
+	}
+
+	close(fd);
+
+	return (IDX_OK == iStatus) ? 0 : 1;
+}
+
+int reencryptPath(const std::string & inPath, const std::string & outPath, const Hmac_PRF & oldPrf, const size_t & cbOldSalt, const char szOldPassword[],
+	const Hmac_PRF & newPrf, const size_t & cbNewSalt, const char szNewPassword[], const size_t & cThreads)
+{
+	struct stat stat_buf {};
+	std::vector<std::string> files{};
+	std::vector<Reencrypt_Job> jobs{};
+	std::vector<std::thread> threads{};
+	std::atomic<size_t> next{ 0 };
+	std::atomic<size_t> cFailed{ 0 };
+	Context_Pool oldPool{};
+	Context_Pool newPool{};
+	Idx_Encryptor master{};							// the new salt and key, copied by the encryptor of each worker
+	std::string inDir{}, outDir{};
+	size_t cWorkers = 0;
+
+	if (0 != stat(inPath.data(), &stat_buf))
+	{
+		printf("The path %s doesn't exist (Error code : %d). Aborting...\n", inPath.data(), errno);
+		return 1;
+	}
+
+	if (S_ISDIR(stat_buf.st_mode))
+	{
+		inDir = (inPath.size() > 1 && inPath.back() == '/') ? inPath.substr(0, inPath.size() - 1) : inPath;
+		outDir = (outPath.size() > 1 && outPath.back() == '/') ? outPath.substr(0, outPath.size() - 1) : outPath;
+
+		listEncryptedFiles(inDir, files);
+
+		for (auto & file : files)
+		{
+			jobs.push_back({ file, outDir + file.substr(inDir.size()) });
+
+			if (0 != makeParentDirs(outDir, jobs.back().outPath)) return 1;
+		}
+	}
+	else
+	{
+		jobs.push_back({ inPath, outPath });
+	}
+
+	if (jobs.empty())
+	{
+		printf("No encrypted file (.idx) found in %s. Aborting...\n", inPath.data());
+		return 1;
+	}
+
+	cWorkers = (cThreads < jobs.size()) ? cThreads : jobs.size();
+
+	if (0 != oldPool.init(oldPrf, cWorkers) || 0 != newPool.init(newPrf, 1))
+	{
+		printf("An error occured while allocating the contexts of the workers. Aborting...\n");
+		return 1;
+	}
+
+	if (IDX_OK != master.init(newPool.get(0), szNewPassword, cbNewSalt))
+	{
+		printf("An unexpected error occured while creating the new key. Aborting...\n");
+		oldPool.clean();
+		newPool.clean();
+		return 1;
+	}
+
+	auto work = [&](const size_t & worker) {
+		Idx_Decryptor decryptor{};
+		Idx_Encryptor encryptor{};
+		std::vector<unsigned char> input(READ_BUFFER_SIZE);
+		std::vector<unsigned char> output(REENCRYPT_OUT_SIZE);
+		size_t i = 0;
+
+		if (IDX_OK != decryptor.init(oldPool.get(worker), szOldPassword, cbOldSalt))
+		{
+			printf("An unexpected error occured while preparing the decryption. Aborting...\n");
+			return;
+		}
+
+		while ((i = next++) < jobs.size())
+			if (0 != reencryptFile(jobs[i], decryptor, encryptor, master, input, output)) cFailed++;
+
+		decryptor.clean();
+		encryptor.clean();
+	};
+
+	// A thread that can't be created leaves its share to the others
+	try
+	{
+		for (size_t t = 1; t < cWorkers; t++) threads.emplace_back(work, t);
+	}
+	catch (const std::system_error &) {}
+
+	work(0);
+
+	for (auto & thread : threads) thread.join();
+
+	// Jobs left by a worker whose decryptor couldn't be initialized
+	if (next < jobs.size()) cFailed += jobs.size() - next;
+
+	if (0 == cFailed) printf("%zu file(s) re-encrypted.\n", jobs.size());
+	else printf("%zu of %zu file(s) could not be re-encrypted.\n", cFailed.load(), jobs.size());
+
+	master.clean();
+	oldPool.clean();
+	newPool.clean();
+
+	return (0 == cFailed) ? 0 : 1;
+}
+
+#endif
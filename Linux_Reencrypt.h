@@ -0,0 +1,46 @@
+/*
+*	=====================================
+*	Copyright (c) El Mostafa IDRASSI 2017
+*	mostafa.idrassi@tutanota.com
+*	Apache License
+*	=====================================
+*/
+
+#ifndef LINUX_REENCRYPT_H
+#define LINUX_REENCRYPT_H
+
+#ifdef __linux__
+
+#include "Hmac_PRF.h"					// Hmac_PRF
+
+#include <cstddef>						// size_t
+#include <string>
+
+/*
+*	=====================================================================================================
+*	 Re-encryption of encrypted files ("/reencrypt Input OldPassword Output NewPassword")
+*
+*	 Each file is decrypted and encrypted again in one pass, READ_BUFFER_SIZE bytes at a time : what
+*	 an Idx_Decryptor gives is handed to an Idx_Encryptor in a buffer of the secure arena, so that the
+*	 plaintext is never written to disk, and a file is read once and written once instead of twice
+*	 each. The old and new passwords may use different hash algorithms (/hash, /newhash), and the
+*	 output is in format 2. The files of a folder (*.idx, recursively) are spread over threads, each
+*	 with its own contexts (Context_Pool) ; the new key is derived once for the whole run.
+*	 Every output is made durable before it replaces its path (Output_File) : Output may be Input,
+*	 a file being then re-encrypted in place without ever being lost.
+*	 Files with a sparse map, a digest, a hash tree, a key of their own, compressed data or written
+*	 in volumes are not handled by the in-memory decryption (Idx_Engine.h) : they are reported and left as they are.
+*	=====================================================================================================
+*/
+
+/*
+*	Re-encrypts inPath (an encrypted file, or a folder of them) into outPath (a file, or a folder with the same
+*	tree) with cThreads threads. oldPrf / cbOldSalt and newPrf / cbNewSalt are those of the key derivations
+*	of the two passwords. Returns 0 if every file was re-encrypted.
+*/
+int reencryptPath(const std::string & inPath, const std::string & outPath, const Hmac_PRF & oldPrf, const size_t & cbOldSalt, const char szOldPassword[],
+	const Hmac_PRF & newPrf, const size_t & cbNewSalt, const char szNewPassword[], const size_t & cThreads);
+
+#endif // !__linux__
+
+#endif // !LINUX_REENCRYPT_H
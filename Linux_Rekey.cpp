@@ -0,0 +1,353 @@
+/*
+*	=====================================
+*	Copyright (c) El Mostafa IDRASSI 2017
+*	mostafa.idrassi@tutanota.com
+*	Apache License
+*	=====================================
+*/
+
+#ifdef __linux__
+
+#include "Linux_Rekey.h"
+
+#include "MyLinuxSysFunctions.h"				// opendir, readdir, stat
+#include "File_Struct.h"						// AES
+#include "Linux_Output.h"						// Output_File
+#include "Idx_Context.h"						// Context_Pool
+#include "Idx_Engine.h"							// deriveKey, IDX_MAX_SALT
+#include "Idx_Format.h"							// parseHeader
+#include "Idx_Random.h"							// getRandomBytes
+#include "Idx_SelfTest.h"						// requireSelfTests
+#include "mem_impl.h"							// my_memclr
+
+#include <errno.h>
+#include <atomic>
+#include <cstdio>								// printf
+#include <cstring>								// memcpy, memcmp
+#include <system_error>
+#include <thread>
+#include <vector>
+
+/*
+* Key of the last salt seen by a worker : files rekeyed by the same run share their salt
+*/
+struct Rekey_Cache
+{
+	unsigned char pbSalt[IDX_MAX_SALT];
+	unsigned char pbKey[32];
+	bool bKey;
+};
+
+/*
+* The new password, derived once for the run
+*/
+struct Rekey_Target
+{
+	unsigned char pbSalt[IDX_MAX_SALT];
+	unsigned char pbKey[32];
+	size_t cbSalt;
+};
+
+static int readAt(int fd, unsigned char * pb, const size_t & cb, const off_t & offset)
+{
+	size_t cbDone = 0;
+	ssize_t cbRead = 0;
+
+	while (cbDone < cb)
+	{
+		if ((cbRead = pread(fd, pb + cbDone, cb - cbDone, offset + (off_t)cbDone)) < 0 && EINTR == errno) continue;
+		if (cbRead <= 0) return 1;
+
+		cbDone += (size_t)cbRead;
+	}
+
+	return 0;
+}
+
+static int writeAt(int fd, const unsigned char * pb, const size_t & cb, const off_t & offset)
+{
+	size_t cbDone = 0;
+	ssize_t cbWritten = 0;
+
+	while (cbDone < cb)
+	{
+		if ((cbWritten = pwrite(fd, pb + cbDone, cb - cbDone, offset + (off_t)cbDone)) < 0 && EINTR == errno) continue;
+		if (cbWritten <= 0) return 1;
+
+		cbDone += (size_t)cbWritten;
+	}
+
+	return 0;
+}
+
+void listEncryptedFiles(const std::string & dirPath, std::vector<std::string> & files)
+{
+	dirent* entry = nullptr;
+	DIR* dir = opendir(dirPath.data());
+
+	if (nullptr == dir) return;
+
+	while (nullptr != (entry = readdir(dir)))
+	{
+		std::string name = entry->d_name;
+
+		if (name == "." || name == "..") continue;
+
+		if (DT_DIR == entry->d_type) listEncryptedFiles(dirPath + "/" + name, files);
+		else if (DT_REG == entry->d_type && name.size() > 4 && 0 == name.compare(name.size() - 4, 4, ".idx")) files.push_back(dirPath + "/" + name);
+	}
+
+	closedir(dir);
+}
+
+/*
+* Decrypts the prefix of a file (salt | IV | header | records) read from fd with the old password, into plain (header | records)
+*/
+static int openPrefix(int fd, const std::string & path, Hmac_PRF & prf, const char szOldPassword[], const size_t & cbSalt, Rekey_Cache & cache, std::vector<unsigned char> & prefix, std::vector<unsigned char> & plain)
+{
+	Idx_Header header{};
+	AES_CTX ctx{};
+	size_t cbData = 0, cbExt = 0;
+	int iStatus = 0;
+
+	prefix.resize(cbSalt + 16 + IDX_HEADER_SIZE);
+	plain.resize(IDX_HEADER_SIZE);
+
+	if (0 != readAt(fd, prefix.data(), prefix.size(), 0))
+	{
+		printf("An unexpected error occured while reading the file %s (Error code : %d). Aborting...\n", path.data(), errno);
+		return 1;
+	}
+
+	if (!cache.bKey || 0 != memcmp(cache.pbSalt, prefix.data(), cbSalt))
+	{
+		cache.bKey = false;
+
+		if (0 != deriveKey(prf, szOldPassword, prefix.data(), cbSalt, cache.pbKey))
+		{
+			printf("An unexpected error occured while creating the key of the file %s. Aborting...\n", path.data());
+			return 1;
+		}
+
+		memcpy(cache.pbSalt, prefix.data(), cbSalt);
+		cache.bKey = true;
+	}
+
+	memcpy(plain.data(), prefix.data() + cbSalt + 16, IDX_HEADER_SIZE);
+
+	if (0 != requireSelfTests(SELFTEST_AES) || 0 != CreateCipher(ctx, CBC, cache.pbKey, 256, prefix.data() + cbSalt, 0) ||
+		0 != OpCipher(ctx, plain.data(), IDX_HEADER_SIZE, plain.data(), IDX_HEADER_SIZE, cbData, 0))
+	{
+		printf("An unexpected error occured while decrypting the header of the file %s. Aborting...\n", path.data());
+		iStatus = 1;
+	}
+	else if (0 != (iStatus = parseHeader(plain.data(), header, cbExt)))
+	{
+		if (1 == iStatus) printf("Password incorrect or the file %s is not a valid encrypted file. Aborting...\n", path.data());
+		else printf("The file %s was encrypted with a format that this version doesn't support. Aborting...\n", path.data());
+		iStatus = 1;
+	}
+	else if (0 == (header.flags & IDX_FLAG_ENVELOPE))
+	{
+		printf("The file %s was not encrypted with /envelope : its password can only be changed by encrypting it again. Aborting...\n", path.data());
+		iStatus = 1;
+	}
+	else if (0 != cbExt)
+	{
+		prefix.resize(prefix.size() + cbExt);
+		plain.resize(IDX_HEADER_SIZE + cbExt);
+
+		if (0 != readAt(fd, prefix.data() + cbSalt + 16 + IDX_HEADER_SIZE, cbExt, (off_t)(cbSalt + 16 + IDX_HEADER_SIZE)) ||
+			(memcpy(plain.data() + IDX_HEADER_SIZE, prefix.data() + cbSalt + 16 + IDX_HEADER_SIZE, cbExt),
+			0 != OpCipher(ctx, plain.data() + IDX_HEADER_SIZE, cbExt, plain.data() + IDX_HEADER_SIZE, cbExt, cbData, 0)))
+		{
+			printf("An unexpected error occured while reading the header of the file %s. Aborting...\n", path.data());
+			iStatus = 1;
+		}
+	}
+
+	ctx.cleanCtx();
+
+	return iStatus;
+}
+
+/*
+* Opens the sidecar left by a previous run (previous prefix | prefix written), or returns -1. If the file already starts
+* with the prefix written, that run completed and only failed to delete the sidecar : it is removed and -1 is returned.
+*/
+static int openSidecar(int fd, const std::string & sidecarPath)
+{
+	struct stat stat_buf {};
+	std::vector<unsigned char> written{}, current{};
+	int sidecar = open(sidecarPath.data(), O_RDONLY | O_CLOEXEC);
+
+	if (sidecar < 0 || fd < 0 || 0 != fstat(sidecar, &stat_buf) || 0 == stat_buf.st_size || 0 != stat_buf.st_size % 2) return sidecar;
+
+	written.resize((size_t)stat_buf.st_size / 2);
+	current.resize(written.size());
+
+	if (0 == readAt(sidecar, written.data(), written.size(), (off_t)written.size()) && 0 == readAt(fd, current.data(), current.size(), 0) && written == current)
+	{
+		// Replaced by saveSidecar anyway if the unlink fails
+		close(sidecar);
+		unlink(sidecarPath.data());
+		return -1;
+	}
+
+	return sidecar;
+}
+
+/*
+* Saves the previous prefix of the file and the one that replaces it in its sidecar, atomically and durably
+*/
+static int saveSidecar(const std::string & sidecarPath, const std::vector<unsigned char> & prefix, const std::vector<unsigned char> & rekeyed)
+{
+	Output_File output{};
+
+	if (0 != output.create(sidecarPath) || prefix.size() != fwrite(prefix.data(), 1, prefix.size(), output.getFile()) ||
+		rekeyed.size() != fwrite(rekeyed.data(), 1, rekeyed.size(), output.getFile()) ||
+		0 != fflush(output.getFile()) || 0 != fdatasync(fileno(output.getFile())) || 0 != output.publish())
+	{
+		printf("An error occured while writing the file %s (Error code : %d). Aborting...\n", sidecarPath.data(), errno);
+		return 1;
+	}
+
+	return 0;
+}
+
+static int rekeyFile(const std::string & path, Hmac_PRF & prf, const char szOldPassword[], const Rekey_Target & target, Rekey_Cache & cache)
+{
+	std::string sidecarPath = path + REKEY_EXT;
+	std::vector<unsigned char> prefix{};		// as it is on disk : salt | IV | encrypted header and records
+	std::vector<unsigned char> plain{};			// header | records (the key of the data)
+	std::vector<unsigned char> rekeyed{};		// prefix with the new password
+	unsigned char pbIV[16]{};
+	AES_CTX ctx{};
+	size_t cbData = 0;
+	int fd = open(path.data(), O_RDWR | O_CLOEXEC);
+	int sidecar = openSidecar(fd, sidecarPath);	// left by an interrupted run : the prefix before it
+	int iStatus = 0;
+
+	if (fd < 0)
+	{
+		printf("Failed to open the file %s for reading and writing (Error code : %d). Aborting...\n", path.data(), errno);
+		iStatus = 1;
+	}
+	else if (0 != openPrefix(sidecar >= 0 ? sidecar : fd, path, prf, szOldPassword, target.cbSalt, cache, prefix, plain))
+	{
+		iStatus = 1;
+	}
+	else if (0 != getRandomBytes(pbIV, 16) || 0 != CreateCipher(ctx, CBC, target.pbKey, 256, pbIV, 1) ||
+		0 != OpCipher(ctx, plain.data(), plain.size(), plain.data(), plain.size(), cbData, 0) || plain.size() != cbData)
+	{
+		printf("An unexpected error occured while encrypting the header of the file %s. Aborting...\n", path.data());
+		iStatus = 1;
+	}
+	else
+	{
+		// Same length : the data that follows is left as it is
+		rekeyed.resize(prefix.size());
+		memcpy(rekeyed.data(), target.pbSalt, target.cbSalt);
+		memcpy(rekeyed.data() + target.cbSalt, pbIV, 16);
+		memcpy(rekeyed.data() + target.cbSalt + 16, plain.data(), plain.size());
+
+		// Also when the sidecar of an interrupted run is reused, so that it names the prefix written now
+		if (0 != saveSidecar(sidecarPath, prefix, rekeyed))
+		{
+			iStatus = 1;
+		}
+		else if (0 != writeAt(fd, rekeyed.data(), rekeyed.size(), 0) || 0 != fdatasync(fd))
+		{
+			printf("An error occured while writing the header of the file %s (Error code : %d). Run /rekey again with the same passwords. Aborting...\n", path.data(), errno);
+			iStatus = 1;
+		}
+		else if (0 != unlink(sidecarPath.data()))
+		{
+			// The file is rekeyed : the next /rekey recognizes the sidecar and removes it
+			printf("The file %s was rekeyed, but its sidecar %s could not be deleted (Error code : %d).\n", path.data(), sidecarPath.data(), errno);
+		}
+	}
+
+	if (sidecar >= 0) close(sidecar);
+	if (fd >= 0) close(fd);
+
+	ctx.cleanCtx();
+	my_memclr(plain.data(), plain.size());
+
+	return iStatus;
+}
+
+int rekeyPath(const std::string & path, const Hmac_PRF & prf, const char szOldPassword[], const char szNewPassword[], const size_t & cbSalt, const size_t & cThreads)
+{
+	struct stat stat_buf {};
+	std::vector<std::string> files{};
+	std::vector<Rekey_Cache> caches{};
+	std::vector<std::thread> threads{};
+	std::atomic<size_t> next{ 0 };
+	std::atomic<size_t> cFailed{ 0 };
+	Context_Pool pool{};
+	Rekey_Target target{};
+	size_t cWorkers = 0;
+
+	if (0 != stat(path.data(), &stat_buf))
+	{
+		printf("The path %s doesn't exist (Error code : %d). Aborting...\n", path.data(), errno);
+		return 1;
+	}
+
+	if (S_ISDIR(stat_buf.st_mode)) listEncryptedFiles((path.size() > 1 && path.back() == '/') ? path.substr(0, path.size() - 1) : path, files);
+	else files.push_back(path);
+
+	if (files.empty())
+	{
+		printf("No encrypted file (.idx) found in %s. Aborting...\n", path.data());
+		return 1;
+	}
+
+	cWorkers = (cThreads < files.size()) ? cThreads : files.size();
+	target.cbSalt = cbSalt;
+
+	if (cbSalt > IDX_MAX_SALT || 0 != pool.init(prf, cWorkers))
+	{
+		printf("An error occured while allocating the contexts of the workers. Aborting...\n");
+		return 1;
+	}
+
+	if (0 != getRandomBytes(target.pbSalt, cbSalt) || 0 != deriveKey(pool.get(0), szNewPassword, target.pbSalt, cbSalt, target.pbKey))
+	{
+		printf("An unexpected error occured while creating the new key. Aborting...\n");
+		pool.clean();
+		return 1;
+	}
+
+	caches.resize(cWorkers, Rekey_Cache{});
+
+	auto work = [&](const size_t & worker) {
+		size_t i = 0;
+
+		while ((i = next++) < files.size())
+			if (0 != rekeyFile(files[i], pool.get(worker), szOldPassword, target, caches[worker])) cFailed++;
+	};
+
+	// A thread that can't be created leaves its share to the others
+	try
+	{
+		for (size_t t = 1; t < cWorkers; t++) threads.emplace_back(work, t);
+	}
+	catch (const std::system_error &) {}
+
+	work(0);
+
+	for (auto & thread : threads) thread.join();
+
+	if (0 == cFailed) printf("%zu file(s) rekeyed.\n", files.size());
+	else printf("%zu of %zu file(s) could not be rekeyed.\n", cFailed.load(), files.size());
+
+	for (auto & cache : caches) my_memclr(&cache, sizeof(cache));
+	my_memclr(&target, sizeof(target));
+	pool.clean();
+
+	return (0 == cFailed) ? 0 : 1;
+}
+
+#endif
@@ -0,0 +1,52 @@
+/*
+*	=====================================
+*	Copyright (c) El Mostafa IDRASSI 2017
+*	mostafa.idrassi@tutanota.com
+*	Apache License
+*	=====================================
+*/
+
+#ifndef LINUX_REKEY_H
+#define LINUX_REKEY_H
+
+#ifdef __linux__
+
+#include "Hmac_PRF.h"					// Hmac_PRF
+
+#include <cstddef>						// size_t
+#include <string>
+#include <vector>
+
+#define REKEY_EXT				".rekey"		// sidecar : the previous salt | IV | encrypted header, then the ones that replace them
+
+/*
+*	=====================================================================================================
+*	 Change of the password of encrypted files ("/rekey Path OldPassword NewPassword")
+*
+*	 A file encrypted with /envelope (IDX_FLAG_ENVELOPE) holds the key of its data in its header : only
+*	 salt | IV | encrypted header and records depend on the password. They are decrypted with the old
+*	 password, and encrypted again with the new one, in place : the data is neither read nor written,
+*	 whatever the size of the file. The files of a folder (*.idx, recursively) are spread over threads.
+*	 The new key is derived once for the whole run (one salt for all the files), so that the next run
+*	 derives the old key once per thread rather than once per file.
+*	 Before being rewritten, the previous prefix of a file is made durable in file.rekey, followed by the
+*	 prefix that replaces it : a file whose rewrite was interrupted gets it back when /rekey is run again,
+*	 with the same old password. A file that already starts with the second one was rewritten, only the
+*	 deletion of its sidecar failed : the next /rekey removes the sidecar and rekeys the file as it is.
+*	=====================================================================================================
+*/
+
+/*
+*	Encrypted files of a folder (*.idx), recursively : dirPath/relative path, without a trailing '/' in dirPath
+*/
+void listEncryptedFiles(const std::string & dirPath, std::vector<std::string> & files);
+
+/*
+*	Rekeys path (an encrypted file, or a folder of them) with cThreads threads, prf and cbSalt being those of
+*	the key derivation of the files (/hash). Returns 0 if every file was rekeyed.
+*/
+int rekeyPath(const std::string & path, const Hmac_PRF & prf, const char szOldPassword[], const char szNewPassword[], const size_t & cbSalt, const size_t & cThreads);
+
+#endif // !__linux__
+
+#endif // !LINUX_REKEY_H
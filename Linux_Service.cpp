@@ -0,0 +1,708 @@
+/*
+*	=====================================
+*	Copyright (c) El Mostafa IDRASSI 2017
+*	mostafa.idrassi@tutanota.com
+*	Apache License
+*	=====================================
+*/
+
+#ifdef __linux__
+
+#include "Linux_Service.h"
+
+#include "Linux_Agent.h"						// listenOnSocket
+#include "MyLinuxSysFunctions.h"				// unlink
+#include "File_Struct.h"						// READ_BUFFER_SIZE
+#include "mem_impl.h"							// my_memclr
+
+#include <errno.h>
+#include <signal.h>
+#include <sys/epoll.h>
+#include <sys/prctl.h>							// PR_SET_DUMPABLE
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <thread>
+#include <vector>
+
+/*
+* Microseconds of the monotonic clock
+*/
+static uint64_t getNowUs()
+{
+	return (uint64_t)std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static int readAll(const int & fd, unsigned char * buffer, const size_t & cb, size_t & cbRead)
+{
+	ssize_t cbDone = 0;
+
+	cbRead = 0;
+
+	while (cbRead < cb)
+	{
+		if ((cbDone = read(fd, buffer + cbRead, cb - cbRead)) < 0)
+		{
+			if (EINTR == errno) continue;
+			return 1;
+		}
+		if (0 == cbDone) break;
+
+		cbRead += (size_t)cbDone;
+	}
+
+	return 0;
+}
+
+static int writeAll(const int & fd, const unsigned char * buffer, const size_t & cb)
+{
+	size_t cbWritten = 0;
+	ssize_t cbDone = 0;
+
+	while (cbWritten < cb)
+	{
+		if ((cbDone = write(fd, buffer + cbWritten, cb - cbWritten)) < 0)
+		{
+			if (EINTR == errno) continue;
+			return 1;
+		}
+
+		cbWritten += (size_t)cbDone;
+	}
+
+	return 0;
+}
+
+static int sendAll(const int & fd, const void * buffer, const size_t & cb)
+{
+	size_t cbSent = 0;
+	ssize_t cbDone = 0;
+
+	while (cbSent < cb)
+	{
+		if ((cbDone = send(fd, (const unsigned char*)buffer + cbSent, cb - cbSent, MSG_NOSIGNAL)) < 0)
+		{
+			if (EINTR == errno) continue;
+			return 1;
+		}
+
+		cbSent += (size_t)cbDone;
+	}
+
+	return 0;
+}
+
+static int recvAll(const int & fd, void * buffer, const size_t & cb)
+{
+	size_t cbReceived = 0;
+	ssize_t cbDone = 0;
+
+	while (cbReceived < cb)
+	{
+		if ((cbDone = recv(fd, (unsigned char*)buffer + cbReceived, cb - cbReceived, MSG_WAITALL)) < 0)
+		{
+			if (EINTR == errno) continue;
+			return 1;
+		}
+		if (0 == cbDone) return 1;
+
+		cbReceived += (size_t)cbDone;
+	}
+
+	return 0;
+}
+
+/*
+*	=====================================================================================================
+*	 State shared by the dispatcher (epoll) and the workers
+*	=====================================================================================================
+*/
+class Service_State
+{
+private:
+
+	struct Job
+	{
+		int fd;
+		uint64_t readyUs;					// when epoll reported the request
+	};
+
+	std::deque<Job> queue{};
+	std::mutex queueMutex{};
+	std::condition_variable ready{};
+	bool bStopping = false;
+
+	std::set<int> connections{};
+	std::mutex connectionsMutex{};
+
+	Service_Stats stats{};
+	std::mutex statsMutex{};
+
+	int epfd = -1;
+
+public:
+
+	explicit Service_State(const int & epfd, const size_t & cWorkers)
+		: epfd(epfd)
+	{
+		stats.workers = (uint32_t)cWorkers;
+	}
+
+	Service_State(const Service_State & other) = delete;
+	Service_State & operator=(const Service_State & other) = delete;
+	Service_State(Service_State && other) = delete;
+	Service_State & operator=(Service_State && other) = delete;
+
+	~Service_State()
+	{
+		for (int fd : connections) close(fd);
+	}
+
+	int addConnection(const int & fd)
+	{
+		struct epoll_event ev {};
+
+		ev.events = EPOLLIN | EPOLLRDHUP | EPOLLONESHOT;
+		ev.data.fd = fd;
+
+		std::lock_guard<std::mutex> lock(connectionsMutex);
+
+		if (0 != epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev)) return 1;
+
+		connections.insert(fd);
+
+		return 0;
+	}
+
+	/*
+	* The connection is watched again once its request is served (EPOLLONESHOT : a single worker at a time)
+	*/
+	void rearmConnection(const int & fd)
+	{
+		struct epoll_event ev {};
+
+		ev.events = EPOLLIN | EPOLLRDHUP | EPOLLONESHOT;
+		ev.data.fd = fd;
+
+		if (0 != epoll_ctl(epfd, EPOLL_CTL_MOD, fd, &ev)) closeConnection(fd);
+	}
+
+	void closeConnection(const int & fd)
+	{
+		std::lock_guard<std::mutex> lock(connectionsMutex);
+
+		epoll_ctl(epfd, EPOLL_CTL_DEL, fd, nullptr);
+		connections.erase(fd);
+		close(fd);
+	}
+
+	void push(const int & fd, const uint64_t & readyUs)
+	{
+		{
+			std::lock_guard<std::mutex> lock(queueMutex);
+			queue.push_back(Job{ fd, readyUs });
+		}
+		ready.notify_one();
+	}
+
+	/*
+	* Waits for a request. Returns false once the service stops.
+	*/
+	bool pop(int & fd, uint64_t & readyUs, uint32_t & queueDepth)
+	{
+		std::unique_lock<std::mutex> lock(queueMutex);
+
+		ready.wait(lock, [&]() { return bStopping || !queue.empty(); });
+
+		if (bStopping) return false;
+
+		fd = queue.front().fd;
+		readyUs = queue.front().readyUs;
+		queue.pop_front();
+		queueDepth = (uint32_t)queue.size();
+
+		return true;
+	}
+
+	void stop()
+	{
+		{
+			std::lock_guard<std::mutex> lock(queueMutex);
+			bStopping = true;
+		}
+		ready.notify_all();
+	}
+
+	void record(const bool & bError, const uint64_t & cbIn, const uint64_t & cbOut, const uint64_t & latencyUs)
+	{
+		std::lock_guard<std::mutex> lock(statsMutex);
+
+		stats.requests++;
+		if (bError) stats.errors++;
+		stats.bytesIn += cbIn;
+		stats.bytesOut += cbOut;
+		stats.totalLatencyUs += latencyUs;
+		if (latencyUs > stats.maxLatencyUs) stats.maxLatencyUs = latencyUs;
+	}
+
+	Service_Stats getStats()
+	{
+		Service_Stats current{};
+
+		{
+			std::lock_guard<std::mutex> lock(statsMutex);
+			current = stats;
+		}
+		{
+			std::lock_guard<std::mutex> lock(queueMutex);
+			current.queueDepth = (uint32_t)queue.size();
+		}
+
+		return current;
+	}
+};
+
+/*
+*	=====================================================================================================
+*	 A worker of the service, and the keys of the last passwords it was given
+*	=====================================================================================================
+*/
+class Service_Worker
+{
+private:
+
+	struct Key_Slot
+	{
+		HmacAlgo algo = sha256h;
+		char szPassword[IDX_MAX_PASSWORD + 1]{};
+		Hmac_PRF prf{};
+		Idx_Encryptor encryptor{};
+		Idx_Decryptor decryptor{};
+		bool bEncryptor = false;			// initialized : a request only restarts it
+		bool bDecryptor = false;
+		uint64_t lastUse = 0;				// 0 : free
+	};
+
+	Service_State & state;
+	Key_Slot slots[SERVICE_CACHE_SLOTS]{};
+	uint64_t uses = 0;
+	std::vector<unsigned char> input{};		// reused from a request to the next
+	std::vector<unsigned char> output{};
+
+	/*
+	* The slot of password, else a free one, else the least recently used one (wiped)
+	*/
+	Key_Slot & getSlot(const HmacAlgo & algo, const char szPassword[])
+	{
+		Key_Slot * slot = nullptr;
+
+		for (size_t i = 0; i < SERVICE_CACHE_SLOTS; i++)
+		{
+			if (0 != slots[i].lastUse && algo == slots[i].algo && 0 == strcmp(slots[i].szPassword, szPassword)) { slot = &slots[i]; break; }
+			if (nullptr == slot || slots[i].lastUse < slot->lastUse) slot = &slots[i];
+		}
+
+		if (0 == slot->lastUse || algo != slot->algo || 0 != strcmp(slot->szPassword, szPassword))
+		{
+			slot->encryptor.clean();
+			slot->decryptor.clean();
+			slot->prf.cleanData();
+			slot->prf.setHmacContext(algo);
+			slot->algo = algo;
+			my_memclr(slot->szPassword, sizeof(slot->szPassword));
+			memcpy(slot->szPassword, szPassword, strlen(szPassword));
+			slot->bEncryptor = false;
+			slot->bDecryptor = false;
+		}
+
+		slot->lastUse = ++uses;
+
+		return *slot;
+	}
+
+	int startEncryptor(Key_Slot & slot)
+	{
+		int iStatus = IDX_OK;
+
+		if (slot.bEncryptor) return slot.encryptor.restart();
+
+		if (IDX_OK == (iStatus = slot.encryptor.init(slot.prf, slot.szPassword, (sha256h == slot.algo) ? 16 : 64))) slot.bEncryptor = true;
+
+		return iStatus;
+	}
+
+	int startDecryptor(Key_Slot & slot)
+	{
+		int iStatus = IDX_OK;
+
+		if (slot.bDecryptor) return slot.decryptor.restart();
+
+		if (IDX_OK == (iStatus = slot.decryptor.init(slot.prf, slot.szPassword, (sha256h == slot.algo) ? 16 : 64))) slot.bDecryptor = true;
+
+		return iStatus;
+	}
+
+	/*
+	* Input descriptor to output descriptor, READ_BUFFER_SIZE bytes at a time
+	*/
+	int processDescriptors(Key_Slot & slot, const bool & bEncrypt, const int & fdIn, const int & fdOut, uint64_t & cbIn, uint64_t & cbOut)
+	{
+		size_t cbRead = 0, cbData = 0;
+		int iStatus = bEncrypt ? startEncryptor(slot) : startDecryptor(slot);
+
+		while (IDX_OK == iStatus)
+		{
+			if (0 != readAll(fdIn, input.data(), READ_BUFFER_SIZE, cbRead)) { iStatus = IDX_ERR_IO; break; }
+
+			if (0 == cbRead)
+			{
+				iStatus = bEncrypt ? slot.encryptor.finish(output.data(), output.size(), cbData) : slot.decryptor.finish(output.data(), output.size(), cbData);
+			}
+			else
+			{
+				iStatus = bEncrypt ? slot.encryptor.update(input.data(), cbRead, output.data(), output.size(), cbData) : slot.decryptor.update(input.data(), cbRead, output.data(), output.size(), cbData);
+			}
+
+			if (IDX_OK == iStatus && 0 != writeAll(fdOut, output.data(), cbData)) iStatus = IDX_ERR_IO;
+
+			cbIn += cbRead;
+			cbOut += cbData;
+
+			if (0 == cbRead) break;
+		}
+
+		return iStatus;
+	}
+
+	/*
+	* Receives a request and the descriptors passed with it (-1 if none). Returns 1 if the connection must be closed.
+	*/
+	int receiveRequest(const int & fd, Service_Request & req, int fds[2], size_t & cFds)
+	{
+		union
+		{
+			char buffer[CMSG_SPACE(2 * sizeof(int))];
+			struct cmsghdr align;
+		} control{};
+		struct iovec iov { &req, sizeof(req) };
+		struct msghdr msg {};
+		struct cmsghdr * cmsg = nullptr;
+		ssize_t cbReceived = 0;
+
+		msg.msg_iov = &iov;
+		msg.msg_iovlen = 1;
+		msg.msg_control = control.buffer;
+		msg.msg_controllen = sizeof(control.buffer);
+
+		cFds = 0;
+
+		while ((cbReceived = recvmsg(fd, &msg, MSG_WAITALL | MSG_CMSG_CLOEXEC)) < 0 && EINTR == errno);
+
+		for (cmsg = CMSG_FIRSTHDR(&msg); nullptr != cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg))
+		{
+			if (SOL_SOCKET != cmsg->cmsg_level || SCM_RIGHTS != cmsg->cmsg_type) continue;
+
+			for (size_t i = 0; i < (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int); i++)
+			{
+				int received = -1;
+
+				memcpy(&received, CMSG_DATA(cmsg) + i * sizeof(int), sizeof(int));
+
+				if (cFds < 2) fds[cFds++] = received;
+				else close(received);
+			}
+		}
+
+		if (cbReceived <= 0) return 1;
+
+		// The rest of a request split by the client
+		if ((size_t)cbReceived < sizeof(req) && 0 != recvAll(fd, (unsigned char*)&req + cbReceived, sizeof(req) - (size_t)cbReceived)) return 1;
+
+		if (0 != memcmp(req.magic, SERVICE_MAGIC, 8) || SERVICE_VERSION != req.version) return 1;
+
+		req.szPassword[IDX_MAX_PASSWORD] = 0;
+
+		return 0;
+	}
+
+	/*
+	* Serves one request of the connection fd. Returns 1 if the connection must be closed.
+	*/
+	int serve(const int & fd, const uint64_t & readyUs, const uint32_t & queueDepth)
+	{
+		Service_Request req{};
+		Service_Reply reply{};
+		Service_Stats stats{};
+		int fds[2] = { -1, -1 };
+		size_t cFds = 0, cbData = 0;
+		uint64_t cbIn = 0, cbOut = 0;
+		bool bEncrypt = false, bReply = true;
+		int iResult = 0;
+
+		if (0 != receiveRequest(fd, req, fds, cFds))
+		{
+			bReply = false;
+		}
+		else if (SERVICE_STATS == req.op)
+		{
+			stats = state.getStats();
+			reply.status = IDX_OK;
+			reply.cbData = sizeof(stats);
+		}
+		else if ((SERVICE_ENCRYPT != req.op && SERVICE_DECRYPT != req.op) || req.algo > (uint32_t)sha512h || 0 == req.szPassword[0] ||
+			(0 != cFds && 2 != cFds) || (2 == cFds && 0 != req.cbData) || req.cbData > SERVICE_MAX_STREAM)
+		{
+			reply.status = IDX_ERR_PARAM;
+			if (0 != req.cbData) iResult = 1;		// the data of the request is not read : the connection is closed after the reply
+		}
+		else
+		{
+			Key_Slot & slot = getSlot((HmacAlgo)req.algo, req.szPassword);
+
+			bEncrypt = (SERVICE_ENCRYPT == req.op);
+
+			if (2 == cFds)
+			{
+				reply.status = (uint32_t)processDescriptors(slot, bEncrypt, fds[0], fds[1], cbIn, cbOut);
+				reply.cbData = cbOut;
+			}
+			else
+			{
+				// The whole stream, then its encryption or decryption after the reply
+				cbIn = req.cbData;
+				if (input.size() < (size_t)cbIn) input.resize((size_t)cbIn);
+				if (output.size() < getEncryptedLength((size_t)cbIn, IDX_MAX_SALT)) output.resize(getEncryptedLength((size_t)cbIn, IDX_MAX_SALT));
+
+				if (0 != cbIn && 0 != recvAll(fd, input.data(), (size_t)cbIn))
+				{
+					bReply = false;
+				}
+				else
+				{
+					reply.status = (uint32_t)(bEncrypt ? startEncryptor(slot) : startDecryptor(slot));
+
+					if (IDX_OK == reply.status)
+						reply.status = (uint32_t)(bEncrypt ? slot.encryptor.encrypt(input.data(), (size_t)cbIn, output.data(), output.size(), cbData) : slot.decryptor.decrypt(input.data(), (size_t)cbIn, output.data(), output.size(), cbData));
+
+					if (IDX_OK == reply.status) reply.cbData = cbOut = cbData;
+				}
+			}
+		}
+
+		for (size_t i = 0; i < cFds; i++) close(fds[i]);
+		my_memclr(req.szPassword, sizeof(req.szPassword));
+
+		if (!bReply) return 1;
+
+		reply.queueDepth = queueDepth;
+		reply.latencyUs = getNowUs() - readyUs;
+
+		if (0 != sendAll(fd, &reply, sizeof(reply))) iResult = 1;
+		else if (SERVICE_STATS == req.op && 0 != sendAll(fd, &stats, sizeof(stats))) iResult = 1;
+		else if (SERVICE_STATS != req.op && 0 == cFds && 0 != reply.cbData && 0 != sendAll(fd, output.data(), (size_t)reply.cbData)) iResult = 1;
+
+		if (SERVICE_STATS != req.op) state.record(IDX_OK != reply.status, cbIn, cbOut, reply.latencyUs);
+
+		return iResult;
+	}
+
+public:
+
+	explicit Service_Worker(Service_State & state)
+		: state(state), input(READ_BUFFER_SIZE), output(getEncryptedLength(READ_BUFFER_SIZE, IDX_MAX_SALT))
+	{
+	}
+
+	Service_Worker(const Service_Worker & other) = delete;
+	Service_Worker & operator=(const Service_Worker & other) = delete;
+	Service_Worker(Service_Worker && other) = delete;
+	Service_Worker & operator=(Service_Worker && other) = delete;
+
+	~Service_Worker()
+	{
+		for (size_t i = 0; i < SERVICE_CACHE_SLOTS; i++) my_memclr(slots[i].szPassword, sizeof(slots[i].szPassword));
+		if (!input.empty()) my_memclr(input.data(), input.size());
+		if (!output.empty()) my_memclr(output.data(), output.size());
+	}
+
+	void run()
+	{
+		int fd = -1;
+		uint64_t readyUs = 0;
+		uint32_t queueDepth = 0;
+
+		while (state.pop(fd, readyUs, queueDepth))
+		{
+			if (0 == serve(fd, readyUs, queueDepth)) state.rearmConnection(fd);
+			else state.closeConnection(fd);
+		}
+	}
+};
+
+/*
+* Only processes of the same user are served
+*/
+static int acceptClient(const int & fd, Service_State & state)
+{
+	struct ucred cred {};
+	socklen_t cbCred = sizeof(cred);
+	struct timeval timeout { SERVICE_TIMEOUT, 0 };		// a client can't hold a worker
+	int client = -1;
+
+	if ((client = accept4(fd, nullptr, nullptr, SOCK_CLOEXEC)) < 0) return 1;
+
+	if (0 != getsockopt(client, SOL_SOCKET, SO_PEERCRED, &cred, &cbCred) || cred.uid != geteuid())
+	{
+		std::cerr << "Connection to the service refused (uid " << cred.uid << ").\n";
+		close(client);
+		return 1;
+	}
+
+	setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+	setsockopt(client, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+	if (0 != state.addConnection(client))
+	{
+		close(client);
+		return 1;
+	}
+
+	return 0;
+}
+
+int runService(const std::string & socketPath, const size_t & cWorkers)
+{
+	struct epoll_event ev {};
+	struct epoll_event events[64]{};
+	std::vector<std::unique_ptr<Service_Worker>> workers{};
+	std::vector<std::thread> threads{};
+	Service_Stats stats{};
+	sigset_t mask{};
+	int fd = -1, sfd = -1, epfd = -1, count = 0;
+	int iStatus = 0;
+
+	// The libraries are tested once, for all the requests
+	if (0 != IdxLib_Init())
+	{
+		std::cerr << "The self-tests of the crypto libraries failed. Aborting...\n";
+		return 1;
+	}
+
+	// The service holds passwords and keys : no core dumps nor ptrace by other processes of the user
+	if (0 != prctl(PR_SET_DUMPABLE, 0, 0, 0, 0))
+	{
+		std::cerr << "An error occured while protecting the service process. Error code : " << errno << ". Aborting...\n";
+		return 1;
+	}
+
+	sigemptyset(&mask);
+	sigaddset(&mask, SIGINT);
+	sigaddset(&mask, SIGTERM);
+	sigaddset(&mask, SIGHUP);
+
+	// Blocked before the workers are started : they inherit the mask
+	if (0 != sigprocmask(SIG_BLOCK, &mask, nullptr) || (sfd = signalfd(-1, &mask, SFD_CLOEXEC)) < 0)
+	{
+		std::cerr << "An error occured while setting up the signals of the service. Error code : " << errno << ". Aborting...\n";
+		return 1;
+	}
+
+	signal(SIGPIPE, SIG_IGN);
+
+	if ((fd = listenOnSocket(socketPath, "service")) < 0)
+	{
+		close(sfd);
+		return 1;
+	}
+
+	if ((epfd = epoll_create1(EPOLL_CLOEXEC)) < 0)
+	{
+		std::cerr << "An error occured while creating the epoll instance of the service. Error code : " << errno << ". Aborting...\n";
+		close(fd);
+		close(sfd);
+		unlink(socketPath.data());
+		return 1;
+	}
+
+	{
+		Service_State state(epfd, cWorkers);
+
+		ev.events = EPOLLIN;
+		ev.data.fd = fd;
+		if (0 != epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev)) iStatus = 1;
+
+		ev.data.fd = sfd;
+		if (0 != epoll_ctl(epfd, EPOLL_CTL_ADD, sfd, &ev)) iStatus = 1;
+
+		try
+		{
+			for (size_t i = 0; 0 == iStatus && i < cWorkers; i++)
+			{
+				workers.emplace_back(new Service_Worker(state));
+				threads.emplace_back(&Service_Worker::run, workers.back().get());
+			}
+		}
+		catch (const std::exception & e)
+		{
+			std::cerr << "An error occured while starting the workers of the service : " << e.what() << ". Aborting...\n";
+			iStatus = 1;
+		}
+
+		if (0 == iStatus)
+		{
+			printf("Service listening on %s with %zu workers. Stopped by Ctrl+C.\n", socketPath.data(), cWorkers);
+			fflush(stdout);
+		}
+
+		while (0 == iStatus)
+		{
+			if ((count = epoll_wait(epfd, events, 64, -1)) < 0)
+			{
+				if (EINTR == errno) continue;
+
+				std::cerr << "An error occured while waiting for the clients of the service. Error code : " << errno << ".\n";
+				iStatus = 1;
+				break;
+			}
+
+			bool bStop = false;
+
+			for (int i = 0; i < count; i++)
+			{
+				if (sfd == events[i].data.fd) bStop = true;
+				else if (fd == events[i].data.fd) acceptClient(fd, state);
+				else state.push(events[i].data.fd, getNowUs());
+			}
+
+			if (bStop) break;
+		}
+
+		// The requests being served are completed, the ones waiting are dropped with their connections
+		state.stop();
+		for (auto & thread : threads) thread.join();
+		threads.clear();
+		workers.clear();
+
+		stats = state.getStats();
+	}
+
+	printf("Service stopped : %llu requests (%llu failed), %llu bytes in, %llu bytes out, latency %llu us on average, %llu us at most.\n",
+		(unsigned long long)stats.requests, (unsigned long long)stats.errors, (unsigned long long)stats.bytesIn, (unsigned long long)stats.bytesOut,
+		(unsigned long long)(stats.requests ? stats.totalLatencyUs / stats.requests : 0), (unsigned long long)stats.maxLatencyUs);
+
+	close(epfd);
+	close(fd);
+	close(sfd);
+	unlink(socketPath.data());
+
+	return iStatus;
+}
+
+#endif
@@ -0,0 +1,89 @@
+/*
+*	=====================================
+*	Copyright (c) El Mostafa IDRASSI 2017
+*	mostafa.idrassi@tutanota.com
+*	Apache License
+*	=====================================
+*/
+
+#ifndef LINUX_SERVICE_H
+#define LINUX_SERVICE_H
+
+#ifdef __linux__
+
+#include "Idx_Engine.h"					// IDX_MAX_PASSWORD, IDX_OK, IDX_ERR_*
+
+#include <cstdint>
+#include <cstddef>
+#include <string>
+
+#define SERVICE_MAGIC			"IDXSRVC"
+#define SERVICE_VERSION			1
+
+#define SERVICE_ENCRYPT			1		// with 2 descriptors (input, output) passed by SCM_RIGHTS, or cbData bytes following the request
+#define SERVICE_DECRYPT			2
+#define SERVICE_STATS			3		// the reply is followed by a Service_Stats
+
+#define SERVICE_MAX_STREAM		(64 * 1024 * 1024)	// bytes following a request ; larger inputs are passed as descriptors
+#define SERVICE_CACHE_SLOTS		16		// passwords whose keys each worker keeps, the least recently used is dropped first
+#define SERVICE_TIMEOUT			30		// seconds a worker waits for a client in the middle of a request
+
+/*
+*	=====================================================================================================
+*	 Encryption service ("/serve SocketPath [/workers count]")
+*
+*	 Serves encrypt and decrypt requests on a Unix socket, so that a program doesn't pay a process,
+*	 the self-tests of the crypto libraries and a key derivation per file. The connections are
+*	 watched with epoll ; a request ready on one of them is taken by the next free worker of a pool
+*	 of threads started once. Each worker keeps the keys of the last passwords it was given : a
+*	 password encrypts with the same salt and key (and a new IV) until it is dropped, so that its
+*	 later requests, encryptions and decryptions alike, don't derive a key again.
+*	 The data is either passed as file descriptors (SCM_RIGHTS : the input is read until its end,
+*	 the output is written from its current position), or follows the request and the reply.
+*	 The output is in format 2 (Idx_Engine.h). Every reply reports the latency of its request and the
+*	 number of requests waiting for a worker when it was taken. The socket is only reachable by its
+*	 owner (0600), and the service checks the identity of every client (SO_PEERCRED).
+*	 SIGINT, SIGTERM and SIGHUP stop the service once the requests being served are complete.
+*	=====================================================================================================
+*/
+
+struct Service_Request
+{
+	char magic[8];
+	uint32_t version;
+	uint32_t op;
+	uint32_t algo;							// HmacAlgo of the key derivation
+	uint32_t reserved;
+	uint64_t cbData;						// bytes following the request (0 with descriptors)
+	char szPassword[IDX_MAX_PASSWORD + 1];	// null terminated
+	char padding[7];
+};
+
+struct Service_Reply
+{
+	uint32_t status;						// IDX_OK or IDX_ERR_*
+	uint32_t queueDepth;					// requests waiting for a worker when this one was taken
+	uint64_t cbData;						// bytes following the reply, or written to the output descriptor
+	uint64_t latencyUs;						// from the request being ready to its reply
+};
+
+struct Service_Stats
+{
+	uint64_t requests;
+	uint64_t errors;
+	uint64_t bytesIn;
+	uint64_t bytesOut;
+	uint64_t totalLatencyUs;
+	uint64_t maxLatencyUs;
+	uint32_t queueDepth;					// requests waiting for a worker
+	uint32_t workers;
+};
+
+/*
+*	Runs the service on socketPath with cWorkers workers until it is stopped by a signal
+*/
+int runService(const std::string & socketPath, const size_t & cWorkers);
+
+#endif // !__linux__
+
+#endif // !LINUX_SERVICE_H
@@ -0,0 +1,188 @@
+/*
+*	=====================================
+*	Copyright (c) El Mostafa IDRASSI 2017
+*	mostafa.idrassi@tutanota.com
+*	Apache License
+*	=====================================
+*/
+
+#ifdef __linux__
+
+#include "Linux_Sparse.h"
+
+#include <errno.h>
+#include <algorithm>							// min
+
+int getDataExtents(int fd, const __int64 & fileLength, std::vector<Idx_Extent> & extents)
+{
+	std::vector<Idx_Extent> dataExtents{};
+	__int64 minHole = SPARSE_MIN_HOLE;
+	off_t offset = 0, dataStart = 0, holeStart = 0;
+
+	extents.clear();
+
+	while (offset < fileLength)
+	{
+		if ((dataStart = lseek(fd, offset, SEEK_DATA)) < 0)
+		{
+			if (ENXIO == errno) break;			// nothing but a hole up to the end of the file
+			if (EINVAL != errno) return 1;
+
+			// SEEK_DATA not supported : all data
+			dataExtents.assign(1, Idx_Extent{ 0, fileLength });
+			break;
+		}
+
+		if (dataStart >= fileLength) break;
+
+		if ((holeStart = lseek(fd, dataStart, SEEK_HOLE)) < 0) return 1;
+		if (holeStart > fileLength) holeStart = fileLength;
+
+		dataExtents.push_back(Idx_Extent{ dataStart, holeStart - dataStart });
+		offset = holeStart;
+	}
+
+	// Merge the extents separated by small holes, until the map fits in the header
+	do
+	{
+		extents.clear();
+		for (const Idx_Extent & extent : dataExtents)
+		{
+			if (!extents.empty() && extent.offset - (extents.back().offset + extents.back().length) < minHole)
+				extents.back().length = extent.offset + extent.length - extents.back().offset;
+			else
+				extents.push_back(extent);
+		}
+		minHole *= 2;
+	} while (6 + 8 + 16 * extents.size() > IDX_MAX_EXT_LENGTH);
+
+	return 0;
+}
+
+Extent_Reader::Extent_Reader(FILE* fin, const std::vector<Idx_Extent> & extents)
+	: fin(fin), extents(extents)
+{
+}
+
+size_t Extent_Reader::read(unsigned char * pbData, const size_t & cbData)
+{
+	size_t cbRead = 0;
+
+	while (!bFailed && cbRead < cbData)
+	{
+		if (0 == remaining)
+		{
+			if (extents.size() == index) break;
+
+			if (0 != fseeko(fin, (off_t)extents[index].offset, SEEK_SET))
+			{
+				bFailed = true;
+				break;
+			}
+			remaining = extents[index++].length;
+		}
+
+		size_t cbChunk = (size_t)std::min<__int64>(remaining, (__int64)(cbData - cbRead));
+		size_t cbDone = fread(pbData + cbRead, 1, cbChunk, fin);
+
+		if (cbDone != cbChunk) bFailed = true;
+
+		cbRead += cbDone;
+		remaining -= (__int64)cbDone;
+	}
+
+	return bFailed ? 0 : cbRead;
+}
+
+bool Extent_Reader::atEnd() const
+{
+	return extents.size() == index && 0 == remaining;
+}
+
+bool Extent_Reader::failed() const
+{
+	return bFailed;
+}
+
+Extent_Writer::Extent_Writer(FILE* fout, const __int64 & fileLength, const std::vector<Idx_Extent> & extents)
+	: fout(fout), extents(extents), fileLength(fileLength)
+{
+	struct stat stat_buf {};
+
+	bSeekable = (0 == fstat(fileno(fout), &stat_buf)) && S_ISREG(stat_buf.st_mode);
+}
+
+/*
+* Moves the output to offset : a seek leaves a hole in a regular file, a pipe gets zeros
+*/
+int Extent_Writer::fillHole(const __int64 & offset)
+{
+	static const unsigned char pbZeros[4096]{};
+
+	if (bSeekable)
+	{
+		if (0 != fseeko(fout, (off_t)offset, SEEK_SET)) return 1;
+		position = offset;
+	}
+
+	while (position < offset)
+	{
+		size_t cbChunk = (size_t)std::min<__int64>(offset - position, (__int64)sizeof(pbZeros));
+
+		if (cbChunk != fwrite(pbZeros, 1, cbChunk, fout)) return 1;
+		position += (__int64)cbChunk;
+	}
+
+	return 0;
+}
+
+int Extent_Writer::write(const unsigned char * pbData, const size_t & cbData)
+{
+	size_t cbWritten = 0;
+
+	while (cbWritten < cbData)
+	{
+		if (0 == remaining)
+		{
+			if (extents.size() == index || 0 != fillHole(extents[index].offset)) return 1;
+			remaining = extents[index++].length;
+		}
+
+		size_t cbChunk = (size_t)std::min<__int64>(remaining, (__int64)(cbData - cbWritten));
+
+		if (cbChunk != fwrite(pbData + cbWritten, 1, cbChunk, fout)) return 1;
+
+		cbWritten += cbChunk;
+		remaining -= (__int64)cbChunk;
+		position += (__int64)cbChunk;
+	}
+
+	return 0;
+}
+
+int Extent_Writer::finish()
+{
+	__int64 end = 0;
+
+	// Less data than mapped : truncated input
+	if (extents.size() != index || 0 != remaining) return 1;
+
+	// Give back the blocks preallocated where the holes are (best effort)
+	// The output is extended first : filesystems don't punch beyond the end of a file
+	if (bSeekable)
+	{
+		if (0 != fflush(fout) || 0 != ftruncate(fileno(fout), (off_t)fileLength)) return 1;
+
+		for (const Idx_Extent & extent : extents)
+		{
+			if (extent.offset > end) fallocate(fileno(fout), FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, (off_t)end, (off_t)(extent.offset - end));
+			end = extent.offset + extent.length;
+		}
+		if (fileLength > end) fallocate(fileno(fout), FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, (off_t)end, (off_t)(fileLength - end));
+	}
+
+	// Trailing hole : a pipe gets its zeros, a regular output is positioned at its end (see trimOutput)
+	return fillHole(fileLength);
+}
+
+#endif
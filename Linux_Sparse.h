@@ -0,0 +1,102 @@
+/*
+*	=====================================
+*	Copyright (c) El Mostafa IDRASSI 2017
+*	mostafa.idrassi@tutanota.com
+*	Apache License
+*	=====================================
+*/
+
+#ifndef LINUX_SPARSE_H
+#define LINUX_SPARSE_H
+
+#ifdef __linux__
+
+#include "MyLinuxSysFunctions.h"		// __int64
+#include "Idx_Format.h"					// Idx_Extent
+
+#include <cstdio>						// FILE
+#include <vector>
+
+#define SPARSE_MIN_HOLE		(64 * 1024)		// shorter holes are encrypted as data (doubled until the map fits in IDX_MAX_EXT_LENGTH)
+
+/*
+*	=====================================================================================================
+*	 Sparse files ("/sparse")
+*
+*	 The data extents of the input are found with SEEK_DATA/SEEK_HOLE and only they are read and
+*	 encrypted, back to back, after a map of the extents (IDX_EXT_SPARSE_MAP). The decryption writes
+*	 every extent at its offset and recreates the holes : the output is extended to its apparent size
+*	 and the holes are punched (FALLOC_FL_PUNCH_HOLE) to release any preallocated block.
+*	 The time and the output size depend on the allocated data, not on the apparent size.
+*	=====================================================================================================
+*/
+
+/*
+*	Maps the data extents of the regular file fd of fileLength bytes
+*	A filesystem without SEEK_DATA support gives 1 extent covering the whole file
+*/
+int getDataExtents(int fd, const __int64 & fileLength, std::vector<Idx_Extent> & extents);
+
+/*
+*	Reads the data extents of fin one after the other, as one stream
+*/
+class Extent_Reader
+{
+private:
+
+	FILE* fin = nullptr;
+	const std::vector<Idx_Extent> & extents;
+	size_t index = 0;					// extent being read
+	__int64 remaining = 0;				// bytes left in it
+	bool bFailed = false;
+
+public:
+
+	Extent_Reader(FILE* fin, const std::vector<Idx_Extent> & extents);
+
+	/*
+	*	Returns the number of bytes read, < cbData at the end of the last extent
+	*	Returns 0 and sets failed() if the file can't be read (or got shorter than mapped)
+	*/
+	size_t read(unsigned char * pbData, const size_t & cbData);
+
+	bool atEnd() const;
+	bool failed() const;
+};
+
+/*
+*	Writes a stream back to the data extents of fout, and the holes between them
+*	A non-regular output (pipe) gets zeros in place of the holes
+*/
+class Extent_Writer
+{
+private:
+
+	FILE* fout = nullptr;
+	const std::vector<Idx_Extent> & extents;
+	__int64 fileLength = 0;
+	bool bSeekable = false;
+	size_t index = 0;					// extent being written
+	__int64 remaining = 0;				// bytes left in it
+	__int64 position = 0;				// current offset in the output
+
+	int fillHole(const __int64 & offset);
+
+public:
+
+	Extent_Writer(FILE* fout, const __int64 & fileLength, const std::vector<Idx_Extent> & extents);
+
+	/*
+	*	Returns 1 if there is more data than extents, or if the output can't be written
+	*/
+	int write(const unsigned char * pbData, const size_t & cbData);
+
+	/*
+	*	Checks that every extent was written, then recreates the holes up to the apparent size
+	*/
+	int finish();
+};
+
+#endif // !__linux__
+
+#endif // !LINUX_SPARSE_H
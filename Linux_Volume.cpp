@@ -0,0 +1,440 @@
+/*
+*	=====================================
+*	Copyright (c) El Mostafa IDRASSI 2017
+*	mostafa.idrassi@tutanota.com
+*	Apache License
+*	=====================================
+*/
+
+#ifdef __linux__
+
+#include "Linux_Volume.h"
+
+#include "MyLinuxSysFunctions.h"				// open, stat, unlink
+#include "File_Struct.h"						// AES, READ_BUFFER_SIZE
+#include "Linux_Arena.h"						// Secure_Buffer
+#include "Linux_Durability.h"					// Durability_Tracker
+#include "Linux_Output.h"						// Output_File
+#include "Idx_Engine.h"							// IDX_OK, IDX_ERR_*
+#include "mem_impl.h"							// my_memclr
+
+#include <errno.h>
+#include <stdio.h>								// fopencookie
+#include <sys/resource.h>						// getrlimit, setrlimit
+#include <algorithm>							// std::min
+#include <atomic>
+#include <cstdlib>								// strtoull
+#include <cstring>								// memcpy
+#include <iostream>								// cerr
+#include <system_error>
+#include <thread>
+#include <vector>
+
+#define VOLUME_SPARE_FDS		64				// descriptors left to the rest of the job by Volume_Reader::open
+
+static int readFd(int fd, unsigned char * pb, const size_t & cb, const off_t & offset)
+{
+	size_t cbDone = 0;
+	ssize_t cbRead = 0;
+
+	while (cbDone < cb)
+	{
+		if ((cbRead = pread(fd, pb + cbDone, cb - cbDone, offset + (off_t)cbDone)) < 0 && EINTR == errno) continue;
+		if (cbRead <= 0) return 1;
+
+		cbDone += (size_t)cbRead;
+	}
+
+	return 0;
+}
+
+static int writeFd(int fd, const unsigned char * pb, const size_t & cb, const off_t & offset)
+{
+	size_t cbDone = 0;
+	ssize_t cbWritten = 0;
+
+	while (cbDone < cb)
+	{
+		if ((cbWritten = pwrite(fd, pb + cbDone, cb - cbDone, offset + (off_t)cbDone)) < 0 && EINTR == errno) continue;
+		if (cbWritten <= 0) return 1;
+
+		cbDone += (size_t)cbWritten;
+	}
+
+	return 0;
+}
+
+std::string getVolumePath(const std::string & path, const size_t & index)
+{
+	char szSuffix[32]{};
+
+	snprintf(szSuffix, sizeof(szSuffix), ".%03zu", index);
+
+	return path + szSuffix;
+}
+
+__int64 parseVolumeSize(const char * szSize)
+{
+	char* pEnd = nullptr;
+	unsigned long long size = strtoull(szSize, &pEnd, 10);
+	unsigned int shift = 0;
+
+	if (pEnd == szSize || '-' == szSize[0]) return 0;
+
+	switch (*pEnd)
+	{
+	case '\0': break;
+	case 'K': case 'k': shift = 10; pEnd++; break;
+	case 'M': case 'm': shift = 20; pEnd++; break;
+	case 'G': case 'g': shift = 30; pEnd++; break;
+	default: return 0;
+	}
+
+	if ('\0' != *pEnd || size > (0x7FFFFFFFFFFFFFFFULL >> shift)) return 0;
+
+	size <<= shift;
+
+	return (size >= VOLUME_MIN_SIZE && 0 == (size % 16)) ? (__int64)size : 0;
+}
+
+Volume_Writer::Volume_Writer()
+{
+}
+
+Volume_Writer::~Volume_Writer()
+{
+	if (nullptr != stream || current) discard();
+}
+
+int Volume_Writer::nextVolume()
+{
+	current.reset(new Output_File());
+	cbVolume = 0;
+
+	// Output_File reports the failure
+	return current->create(getVolumePath(path, cVolumes));
+}
+
+int Volume_Writer::endVolume()
+{
+	int iStatus = 0;
+
+	// Recorded before it is handed over : a barrier of the tracker may publish it before the encryption fails
+	written.push_back(current->getPath());
+	iStatus = tracker ? tracker->addFile(*current) : current->publish();
+
+	current.reset();
+	cVolumes++;
+
+	return iStatus;
+}
+
+ssize_t Volume_Writer::writeStream(void * cookie, const char * buf, size_t size)
+{
+	Volume_Writer* writer = (Volume_Writer*)cookie;
+	size_t cbDone = 0;
+
+	// A volume is only created once it has data (or is the last one) : the set doesn't end with an empty volume for nothing
+	while (!writer->bFailed && cbDone < size)
+	{
+		size_t cb = (size_t)std::min<__int64>((__int64)(size - cbDone), writer->volumeSize - writer->cbVolume);
+
+		if ((!writer->current && 0 != writer->nextVolume()) || cb != fwrite(buf + cbDone, 1, cb, writer->current->getFile()))
+		{
+			writer->bFailed = true;
+			break;
+		}
+
+		cbDone += cb;
+		writer->cbVolume += (__int64)cb;
+
+		if (writer->cbVolume == writer->volumeSize && 0 != writer->endVolume()) writer->bFailed = true;
+	}
+
+	// 0 : error (a cookie write function must not return a negative value)
+	return writer->bFailed ? 0 : (ssize_t)size;
+}
+
+int Volume_Writer::open(const std::string & path, const __int64 & volumeSize, Durability_Tracker * tracker)
+{
+	cookie_io_functions_t functions{ nullptr, writeStream, nullptr, nullptr };
+
+	this->path = path;
+	this->volumeSize = volumeSize;
+	this->tracker = tracker;
+
+	if (volumeSize < VOLUME_MIN_SIZE || 0 != (volumeSize % 16) || nullptr == (stream = fopencookie(this, "wb", functions)))
+	{
+		std::cerr << "Failed to open the output file " << path << " for writing. Error code : " << errno << " .Aborting...\n";
+		return 1;
+	}
+
+	setvbuf(stream, nullptr, _IOFBF, READ_BUFFER_SIZE);
+
+	return 0;
+}
+
+FILE* Volume_Writer::getFile()
+{
+	return stream;
+}
+
+int Volume_Writer::finish()
+{
+	int iStatus = (0 == fclose(stream)) ? 0 : 1;
+
+	stream = nullptr;
+
+	// The last volume is never full : it is created empty if the stream ended with a full volume
+	if (0 == iStatus && !bFailed && !current && 0 != nextVolume()) iStatus = 1;
+	if (0 == iStatus && !bFailed) iStatus = endVolume();
+
+	if (0 != iStatus || bFailed)
+	{
+		printf("An error occured while writing the volumes of the output file %s (Error code : %d). Aborting...\n", path.data(), errno);
+		discard();
+		return 1;
+	}
+
+	return 0;
+}
+
+void Volume_Writer::discard()
+{
+	// What is left in the buffer of the stream is dropped
+	bFailed = true;
+
+	if (nullptr != stream) fclose(stream);
+	stream = nullptr;
+
+	if (current) current->discard();
+	current.reset();
+
+	// Those still pending in the tracker are not published : the job failed, it runs no barrier anymore
+	for (const std::string & volumePath : written) unlink(volumePath.data());
+	written.clear();
+}
+
+Volume_Reader::Volume_Reader()
+{
+}
+
+Volume_Reader::~Volume_Reader()
+{
+	close();
+}
+
+ssize_t Volume_Reader::readStream(void * cookie, char * buf, size_t size)
+{
+	Volume_Reader* reader = (Volume_Reader*)cookie;
+	ssize_t cbRead = 0;
+
+	// The volumes one after the other : a read stops at the end of a volume
+	while (reader->index < reader->fds.size())
+	{
+		if ((cbRead = read(reader->fds[reader->index], buf, size)) < 0 && EINTR == errno) continue;
+		if (cbRead != 0) return cbRead;
+
+		reader->index++;
+	}
+
+	return 0;
+}
+
+int Volume_Reader::open(const std::string & firstPath)
+{
+	cookie_io_functions_t functions{ readStream, nullptr, nullptr, nullptr };
+	std::string path = firstPath.substr(0, firstPath.size() - (sizeof(VOLUME_FIRST_SUFFIX) - 1));
+	struct stat stat_buf {};
+	struct rlimit limit {};
+	int fd = -1;
+
+	close();
+
+	// Up to the first volume missing
+	offsets.push_back(0);
+
+	while (0 == stat(getVolumePath(path, paths.size()).data(), &stat_buf) && S_ISREG(stat_buf.st_mode))
+	{
+		paths.push_back(getVolumePath(path, paths.size()));
+	}
+
+	// A descriptor per volume : the soft limit is raised up to the hard one if needed (best effort)
+	if (0 == getrlimit(RLIMIT_NOFILE, &limit) && limit.rlim_cur < (rlim_t)paths.size() + VOLUME_SPARE_FDS && limit.rlim_cur < limit.rlim_max)
+	{
+		limit.rlim_cur = std::min<rlim_t>(limit.rlim_max, (rlim_t)paths.size() + VOLUME_SPARE_FDS);
+		setrlimit(RLIMIT_NOFILE, &limit);
+	}
+
+	// The sizes are those of the files opened
+	for (const std::string & volumePath : paths)
+	{
+		if ((fd = ::open(volumePath.data(), O_RDONLY | O_CLOEXEC)) < 0 || 0 != fstat(fd, &stat_buf))
+		{
+			if (fd >= 0) ::close(fd);
+			std::cerr << "Failed to open the volume " << volumePath << " for reading. Error code : " << errno << ". Aborting...\n";
+			close();
+			return 1;
+		}
+
+		fds.push_back(fd);
+		offsets.push_back(offsets.back() + (__int64)stat_buf.st_size);
+	}
+
+	if (paths.empty() || nullptr == (stream = fopencookie(this, "rb", functions)))
+	{
+		std::cerr << "Failed to open the input file " << firstPath << " for reading. Error code : " << errno << ". Aborting...\n";
+		close();
+		return 1;
+	}
+
+	setvbuf(stream, nullptr, _IOFBF, READ_BUFFER_SIZE);
+
+	return 0;
+}
+
+FILE* Volume_Reader::getFile()
+{
+	return stream;
+}
+
+__int64 Volume_Reader::getLength() const
+{
+	return offsets.empty() ? 0 : offsets.back();
+}
+
+size_t Volume_Reader::getVolumeCount() const
+{
+	return paths.size();
+}
+
+__int64 Volume_Reader::getVolumeOffset(const size_t & index) const
+{
+	return offsets[index];
+}
+
+int Volume_Reader::checkVolumeSize(const __int64 & volumeSize) const
+{
+	for (size_t i = 0; i < paths.size(); i++)
+	{
+		__int64 length = offsets[i + 1] - offsets[i];
+
+		if ((i + 1 < paths.size()) ? (length != volumeSize) : (length >= volumeSize)) return 1;
+	}
+
+	return 0;
+}
+
+int Volume_Reader::readAt(unsigned char * pb, const size_t & cb, const __int64 & offset) const
+{
+	size_t cbDone = 0;
+	size_t i = (size_t)(std::upper_bound(offsets.begin(), offsets.end(), offset) - offsets.begin());
+
+	if (0 == i || offset < 0 || offset + (__int64)cb > getLength()) return 1;
+
+	// From the volume holding offset, to the next ones if needed
+	for (i--; cbDone < cb; i++)
+	{
+		__int64 position = offset + (__int64)cbDone - offsets[i];
+		size_t cbPart = (size_t)std::min<__int64>((__int64)(cb - cbDone), offsets[i + 1] - offsets[i] - position);
+
+		if (0 != readFd(fds[i], pb + cbDone, cbPart, (off_t)position)) return 1;
+
+		cbDone += cbPart;
+	}
+
+	return 0;
+}
+
+void Volume_Reader::close()
+{
+	if (nullptr != stream) fclose(stream);
+	for (const int & fd : fds) ::close(fd);
+
+	stream = nullptr;
+	index = 0;
+	paths.clear();
+	fds.clear();
+	offsets.clear();
+}
+
+int decryptVolumes(const Volume_Reader & volumes, const unsigned char pbKey[32], const unsigned char * pbIV, const __int64 & dataOffset, int fdOut, const size_t & cThreads, __int64 & plainLength)
+{
+	std::vector<__int64> bounds{ dataOffset };		// ranges of the data : one per volume, on the blocks of the cipher
+	std::vector<std::thread> threads{};
+	std::atomic<size_t> next{ 0 };
+	std::atomic<int> result{ IDX_OK };
+	__int64 endOffset = volumes.getLength();
+	size_t cWorkers = 0;
+
+	if (endOffset <= dataOffset || 0 != ((endOffset - dataOffset) % 16)) return IDX_ERR_TRUNCATED;
+
+	for (size_t i = 1; i < volumes.getVolumeCount(); i++)
+	{
+		__int64 bound = volumes.getVolumeOffset(i);
+
+		if (bound > dataOffset) bound = dataOffset + ((bound - dataOffset) / 16) * 16;
+		if (bound > bounds.back() && bound < endOffset) bounds.push_back(bound);
+	}
+
+	bounds.push_back(endOffset);
+	cWorkers = std::min(std::max<size_t>(1, cThreads), bounds.size() - 1);
+
+	auto work = [&]() {
+		Secure_Buffer buffer(READ_BUFFER_SIZE + 16);
+		unsigned char pbRangeIV[16]{};
+		AES_CTX ctx{};
+		size_t r = 0;
+
+		if (nullptr == buffer.data()) { result = IDX_ERR_IO; return; }
+
+		while (IDX_OK == result && (r = next++) + 1 < bounds.size())
+		{
+			bool bLastRange = (r + 2 == bounds.size());
+			int iStatus = IDX_OK;
+
+			// CBC : the IV of a range is the last encrypted block before it
+			if (0 == r && nullptr != pbIV) memcpy(pbRangeIV, pbIV, 16);
+			else if (0 != volumes.readAt(pbRangeIV, 16, bounds[r] - 16)) iStatus = IDX_ERR_IO;
+
+			ctx.cleanCtx();
+			if (IDX_OK == iStatus && 0 != CreateCipher(ctx, CBC, pbKey, 256, pbRangeIV, 0)) iStatus = IDX_ERR_CRYPTO;
+
+			for (__int64 offset = bounds[r]; IDX_OK == iStatus && offset < bounds[r + 1]; )
+			{
+				size_t cb = (size_t)std::min<__int64>(READ_BUFFER_SIZE, bounds[r + 1] - offset);
+				size_t cbData = 0;
+				bool bFinal = bLastRange && (offset + (__int64)cb == endOffset);
+
+				buffer.touch(cb + 16);
+
+				if (0 != volumes.readAt(buffer.data(), cb, offset)) iStatus = IDX_ERR_IO;
+				else if (0 != OpCipher(ctx, buffer.data(), cb, buffer.data(), cb + 16, cbData, bFinal ? 1 : 0)) iStatus = IDX_ERR_CRYPTO;
+				else if (0 != writeFd(fdOut, buffer.data(), cbData, (off_t)(offset - dataOffset))) iStatus = IDX_ERR_IO;
+				else if (bFinal) plainLength = offset - dataOffset + (__int64)cbData;
+
+				offset += (__int64)cb;
+			}
+
+			if (IDX_OK != iStatus) result = iStatus;
+		}
+
+		ctx.cleanCtx();
+		my_memclr(pbRangeIV, 16);
+	};
+
+	// A thread that can't be created leaves its share to the others
+	try
+	{
+		for (size_t t = 1; t < cWorkers; t++) threads.emplace_back(work);
+	}
+	catch (const std::system_error &) {}
+
+	work();
+
+	for (auto & thread : threads) thread.join();
+
+	return result;
+}
+
+#endif
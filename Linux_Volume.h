@@ -0,0 +1,164 @@
+/*
+*	=====================================
+*	Copyright (c) El Mostafa IDRASSI 2017
+*	mostafa.idrassi@tutanota.com
+*	Apache License
+*	=====================================
+*/
+
+#ifndef LINUX_VOLUME_H
+#define LINUX_VOLUME_H
+
+#ifdef __linux__
+
+#include "MyLinuxSysFunctions.h"		// __int64
+
+#include <cstddef>						// size_t
+#include <cstdio>						// FILE
+#include <memory>
+#include <string>
+#include <vector>
+
+#define VOLUME_FIRST_SUFFIX		".000"
+#define VOLUME_MIN_SIZE			65536
+
+class Output_File;
+class Durability_Tracker;
+
+/*
+*	=====================================================================================================
+*	 Encrypted files split in volumes (/volume size)
+*
+*	 The encrypted stream is written directly to File.idx.000, File.idx.001... of size bytes each
+*	 (a multiple of 16), the last one being shorter, possibly empty : a set whose last volume is full
+*	 is known to be incomplete. The volumes are slices of the stream, nothing is added to them :
+*	 cat File.idx.* is the whole encrypted file. The size of the volumes is recorded in the header
+*	 (IDX_EXT_VOLUMES), so that the decryption checks the set it is given.
+*	 The volumes are written and read through FILE streams (fopencookie), so that the encryption and
+*	 the decryption see a single output and a single input. A stream which is neither sparse, nor
+*	 compressed, nor followed by a digest or a hash tree maps each volume to a range of the plaintext
+*	 (CBC : the IV of a volume is the last block of the previous one) : the volumes of such a file are
+*	 then decrypted by several threads at once, each writing its range of the output in place.
+*	=====================================================================================================
+*/
+
+/*
+*	path.000, path.001... (3 digits at least)
+*/
+std::string getVolumePath(const std::string & path, const size_t & index);
+
+/*
+*	Size of the volumes from the command line : bytes, or K, M, G (binary). 0 unless it is a multiple of 16
+*	of VOLUME_MIN_SIZE bytes at least.
+*/
+__int64 parseVolumeSize(const char * szSize);
+
+/*
+*	Output of an encryption, written in volumes. Each volume only appears once complete (Output_File) : it is then
+*	published, or handed to the durability tracker. discard deletes every volume completed, whoever published it.
+*/
+class Volume_Writer
+{
+private:
+
+	std::string path{};
+	__int64 volumeSize = 0;
+	__int64 cbVolume = 0;							// bytes written to the current volume
+	size_t cVolumes = 0;							// volumes completed
+	std::unique_ptr<Output_File> current{};
+	std::vector<std::string> written{};				// volumes completed : published, or handed to the tracker
+	Durability_Tracker * tracker = nullptr;			// /sync : the volumes are published by its barriers
+	FILE* stream = nullptr;
+	bool bFailed = false;							// nothing more is written (discard)
+
+	int nextVolume();
+	int endVolume();
+
+	static ssize_t writeStream(void * cookie, const char * buf, size_t size);
+
+public:
+
+	Volume_Writer();
+
+	// Copy, Move constructor and assignment operators deleted : the object owns the files
+	Volume_Writer(const Volume_Writer & other) = delete;
+	Volume_Writer & operator=(const Volume_Writer & other) = delete;
+	Volume_Writer(Volume_Writer && other) = delete;
+	Volume_Writer & operator=(Volume_Writer && other) = delete;
+
+	// Discards the volumes if they were not finished
+	~Volume_Writer();
+
+	int open(const std::string & path, const __int64 & volumeSize, Durability_Tracker * tracker);
+
+	FILE* getFile();
+
+	/*
+	*	Flushes the stream and completes the last volume (empty if the stream ended with a full one)
+	*/
+	int finish();
+
+	void discard();
+};
+
+/*
+*	The volumes of an encrypted file, read as one stream
+*/
+class Volume_Reader
+{
+private:
+
+	std::vector<std::string> paths{};
+	std::vector<int> fds{};							// of each volume, open until close : readAt only preads
+	std::vector<__int64> offsets{};					// of each volume in the stream, then its length
+	size_t index = 0;								// volume read by the stream
+	FILE* stream = nullptr;
+
+	static ssize_t readStream(void * cookie, char * buf, size_t size);
+
+public:
+
+	Volume_Reader();
+
+	// Copy, Move constructor and assignment operators deleted : the object owns the files
+	Volume_Reader(const Volume_Reader & other) = delete;
+	Volume_Reader & operator=(const Volume_Reader & other) = delete;
+	Volume_Reader(Volume_Reader && other) = delete;
+	Volume_Reader & operator=(Volume_Reader && other) = delete;
+
+	~Volume_Reader();
+
+	/*
+	*	firstPath : File.idx.000. The volumes that follow it are found up to the first one missing, and opened.
+	*/
+	int open(const std::string & firstPath);
+
+	FILE* getFile();
+	__int64 getLength() const;
+	size_t getVolumeCount() const;
+	__int64 getVolumeOffset(const size_t & index) const;
+
+	/*
+	*	0 if the set is complete for volumes of volumeSize bytes (each volume full, but the last one)
+	*/
+	int checkVolumeSize(const __int64 & volumeSize) const;
+
+	/*
+	*	Reads cb bytes at offset of the stream, from the volumes holding them (thread-safe, the stream is not moved)
+	*/
+	int readAt(unsigned char * pb, const size_t & cb, const __int64 & offset) const;
+
+	void close();
+};
+
+/*
+*	Decrypts the data of the volumes (from dataOffset, the prefix being read) into fdOut with cThreads threads,
+*	a volume at a time : its plaintext is written at its offset. pbIV is the IV of the data, nullptr if the
+*	encryption of the data follows that of the header. plainLength receives the length of the plaintext.
+*	Returns IDX_OK, IDX_ERR_TRUNCATED, IDX_ERR_IO or IDX_ERR_CRYPTO (the padding as well).
+*/
+int decryptVolumes(const Volume_Reader & volumes, const unsigned char pbKey[32], const unsigned char * pbIV, const __int64 & dataOffset, int fdOut, const size_t & cThreads, __int64 & plainLength);
+
+#endif // !__linux__
+
+#endif // !LINUX_VOLUME_H
@@ -0,0 +1,306 @@
+/*
+*	=====================================
+*	Copyright (c) El Mostafa IDRASSI 2017
+*	mostafa.idrassi@tutanota.com
+*	Apache License
+*	=====================================
+*/
+
+#ifdef __linux__
+
+#include "Linux_Watch.h"
+
+#include "MyLinuxSysFunctions.h"				// opendir, readdir
+
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/inotify.h>
+#include <sys/signalfd.h>
+#include <algorithm>							// find_if
+#include <system_error>
+
+#define WATCH_MASK		(IN_CLOSE_WRITE | IN_MOVED_TO | IN_MOVED_FROM | IN_CREATE | IN_DELETE | IN_ONLYDIR | IN_EXCL_UNLINK)
+
+Folder_Watcher::Folder_Watcher()
+{
+}
+
+Folder_Watcher::~Folder_Watcher()
+{
+	if (fd >= 0) close(fd);
+	if (sfd >= 0) close(sfd);
+}
+
+/*
+* Watches relDir and its subdirectories. With bPending, the files they hold are ready after the debounce delay.
+* A directory which vanished in the meantime is not an error.
+*/
+int Folder_Watcher::addWatches(const std::string & relDir, const bool & bPending)
+{
+	std::string path = root + relDir;
+	dirent* entry = nullptr;
+	DIR* dir = nullptr;
+	int wd = -1;
+	int iStatus = 0;
+
+	if ((wd = inotify_add_watch(fd, path.data(), WATCH_MASK)) < 0)
+	{
+		if (ENOENT == errno || ENOTDIR == errno) return 0;
+
+		std::cerr << "An error occured while watching the directory " << path << " (ENOSPC : see /proc/sys/fs/inotify/max_user_watches). Error code : " << errno << ". Aborting...\n";
+		return 1;
+	}
+
+	dirs[wd] = relDir;		// a directory moved within the tree keeps its watch descriptor
+
+	if (nullptr == (dir = opendir(path.data()))) return 0;
+
+	while (0 == iStatus && nullptr != (entry = readdir(dir)))
+	{
+		std::string name = entry->d_name;
+
+		if (name == "." || name == "..") continue;
+
+		if (DT_DIR == entry->d_type) iStatus = addWatches(relDir + name + "/", bPending);
+		else if (DT_REG == entry->d_type && bPending) pending[relDir + name] = Clock::now() + std::chrono::milliseconds(WATCH_DEBOUNCE_MS);
+	}
+
+	closedir(dir);
+
+	return iStatus;
+}
+
+/*
+* Stops watching relDir and its subdirectories (moved out of the tree)
+*/
+void Folder_Watcher::removeWatches(const std::string & relDir)
+{
+	for (auto it = dirs.begin(); it != dirs.end();)
+	{
+		if (0 == it->second.compare(0, relDir.size(), relDir))
+		{
+			inotify_rm_watch(fd, it->first);
+			it = dirs.erase(it);
+		}
+		else it++;
+	}
+
+	for (auto it = pending.lower_bound(relDir); it != pending.end() && 0 == it->first.compare(0, relDir.size(), relDir);) it = pending.erase(it);
+}
+
+int Folder_Watcher::open(const std::string & inPath, const std::string & outPath)
+{
+	root = (inPath.back() == '/') ? inPath : inPath + "/";
+
+	if (0 == (outPath + "/").compare(0, root.size(), root))
+	{
+		std::cerr << "The output folder of a watched folder must not be in it. Aborting...\n";
+		return 1;
+	}
+
+	if ((fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC)) < 0)
+	{
+		std::cerr << "An error occured while initializing the watch (inotify_init1). Error code : " << errno << ". Aborting...\n";
+		return 1;
+	}
+
+	return addWatches("", false);
+}
+
+int Folder_Watcher::catchSignals()
+{
+	sigset_t mask{};
+
+	sigemptyset(&mask);
+	sigaddset(&mask, SIGINT);
+	sigaddset(&mask, SIGTERM);
+
+	if (0 != pthread_sigmask(SIG_BLOCK, &mask, nullptr) || (sfd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC)) < 0)
+	{
+		std::cerr << "An error occured while setting up the signals of the watch. Error code : " << errno << ". Aborting...\n";
+		return 1;
+	}
+
+	return 0;
+}
+
+int Folder_Watcher::readEvents()
+{
+	alignas(struct inotify_event) char buffer[WATCH_EVENT_BUFFER_SIZE];
+	ssize_t cbRead = 0;
+
+	while ((cbRead = read(fd, buffer, sizeof(buffer))) > 0)
+	{
+		for (char* p = buffer; p < buffer + cbRead; p += sizeof(struct inotify_event) + ((struct inotify_event*)p)->len)
+		{
+			const struct inotify_event* event = (const struct inotify_event*)p;
+
+			// Events were lost : the whole tree is looked at again
+			if (event->mask & IN_Q_OVERFLOW)
+			{
+				printf("Too many events at once, the whole input folder is processed again.\n");
+				if (0 != addWatches("", true)) return 1;
+				continue;
+			}
+
+			if (event->mask & IN_IGNORED)
+			{
+				dirs.erase(event->wd);
+				continue;
+			}
+
+			auto dir = dirs.find(event->wd);
+			if (dirs.end() == dir || 0 == event->len) continue;
+
+			std::string path = dir->second + event->name;
+
+			if (event->mask & IN_ISDIR)
+			{
+				if (event->mask & (IN_CREATE | IN_MOVED_TO)) { if (0 != addWatches(path + "/", true)) return 1; }
+				else if (event->mask & IN_MOVED_FROM) removeWatches(path + "/");
+			}
+			else if (event->mask & (IN_CLOSE_WRITE | IN_MOVED_TO))
+			{
+				pending[path] = Clock::now() + std::chrono::milliseconds(WATCH_DEBOUNCE_MS);
+			}
+			else if (event->mask & (IN_MOVED_FROM | IN_DELETE))
+			{
+				pending.erase(path);
+			}
+		}
+	}
+
+	if (cbRead < 0 && EAGAIN != errno && EINTR != errno)
+	{
+		std::cerr << "An error occured while reading the events of the watch. Error code : " << errno << ". Aborting...\n";
+		return 1;
+	}
+
+	return 0;
+}
+
+int Folder_Watcher::wait(std::vector<std::string> & ready, bool & bStop)
+{
+	struct pollfd fds[2] = { { fd, POLLIN, 0 }, { sfd, POLLIN, 0 } };
+	int timeout = -1;
+
+	ready.clear();
+	bStop = false;
+
+	// Until the next file becomes ready
+	for (const auto & file : pending)
+	{
+		auto delay = std::chrono::duration_cast<std::chrono::milliseconds>(file.second - Clock::now()).count() + 1;
+		if (timeout < 0 || delay < timeout) timeout = (delay > 0) ? (int)delay : 0;
+	}
+
+	if (poll(fds, (sfd >= 0) ? 2 : 1, timeout) < 0 && EINTR != errno)
+	{
+		std::cerr << "An error occured while waiting for the events of the watch. Error code : " << errno << ". Aborting...\n";
+		return 1;
+	}
+
+	if (fds[1].revents & POLLIN)
+	{
+		bStop = true;
+		return 0;
+	}
+
+	if ((fds[0].revents & POLLIN) && 0 != readEvents()) return 1;
+
+	for (auto it = pending.begin(); it != pending.end();)
+	{
+		if (it->second <= Clock::now())
+		{
+			ready.push_back(it->first);
+			it = pending.erase(it);
+		}
+		else it++;
+	}
+
+	return 0;
+}
+
+Worker_Pool::Worker_Pool()
+{
+}
+
+Worker_Pool::~Worker_Pool()
+{
+	stop();
+}
+
+void Worker_Pool::run(const size_t & worker)
+{
+	std::unique_lock<std::mutex> lock(mutex);
+	auto next = queue.end();
+
+	while (true)
+	{
+		// The first item that no other worker is processing
+		ready.wait(lock, [&]() {
+			next = std::find_if(queue.begin(), queue.end(), [&](const std::string & item) { return 0 == active.count(item); });
+			return bStopping || queue.end() != next;
+		});
+
+		if (bStopping) return;
+
+		std::string item = std::move(*next);
+		queue.erase(next);
+		queued.erase(item);
+		active.insert(item);
+
+		lock.unlock();
+		work(worker, item);
+		lock.lock();
+
+		// An item submitted again while it was processed can now be taken
+		active.erase(item);
+		ready.notify_all();
+	}
+}
+
+int Worker_Pool::start(const size_t & count, const Work & work)
+{
+	this->work = work;
+
+	try
+	{
+		for (size_t i = 0; i < count; i++) workers.emplace_back(&Worker_Pool::run, this, i);
+	}
+	catch (const std::system_error & e)
+	{
+		std::cerr << "An error occured while starting the workers. Error code : " << e.code().value() << ". Aborting...\n";
+		stop();
+		return 1;
+	}
+
+	return 0;
+}
+
+void Worker_Pool::submit(const std::string & item)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+
+	if (bStopping || !queued.insert(item).second) return;
+
+	queue.push_back(item);
+	ready.notify_one();
+}
+
+void Worker_Pool::stop()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		bStopping = true;
+		queue.clear();
+		queued.clear();
+	}
+	ready.notify_all();
+
+	for (auto & worker : workers) worker.join();
+	workers.clear();
+}
+
+#endif
@@ -0,0 +1,141 @@
+/*
+*	=====================================
+*	Copyright (c) El Mostafa IDRASSI 2017
+*	mostafa.idrassi@tutanota.com
+*	Apache License
+*	=====================================
+*/
+
+#ifndef LINUX_WATCH_H
+#define LINUX_WATCH_H
+
+#ifdef __linux__
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#define WATCH_DEBOUNCE_MS		500		// quiet time after the last event of a file before it is processed
+#define WATCH_EVENT_BUFFER_SIZE	65536	// inotify events read at a time
+
+/*
+*	=====================================================================================================
+*	 Watch of an input folder ("/watch")
+*
+*	 Every directory of the tree is watched with inotify. A file is ready once it was closed after
+*	 being written (IN_CLOSE_WRITE) or moved into the tree (IN_MOVED_TO), and no other event came for
+*	 it during WATCH_DEBOUNCE_MS : a file written in several rounds is processed once.
+*	 New directories are watched as they appear, and the files they already hold are ready as well.
+*	 SIGINT and SIGTERM (blocked, read from a signalfd) stop the watch.
+*	=====================================================================================================
+*/
+class Folder_Watcher
+{
+private:
+
+	typedef std::chrono::steady_clock Clock;
+
+	int fd = -1;								// inotify
+	int sfd = -1;								// signalfd : SIGINT, SIGTERM
+	std::string root{};							// input folder, with a trailing "/"
+	std::unordered_map<int, std::string> dirs{};	// watch descriptor -> directory, relative to root ("" or "dir/")
+	std::map<std::string, Clock::time_point> pending{};	// file, relative to root -> time it becomes ready
+
+	int addWatches(const std::string & relDir, const bool & bPending);
+	void removeWatches(const std::string & relDir);
+	int readEvents();
+
+public:
+
+	Folder_Watcher();
+
+	// Copy, Move constructor and assignment operators deleted : the object owns file descriptors
+	Folder_Watcher(const Folder_Watcher & other) = delete;
+	Folder_Watcher & operator=(const Folder_Watcher & other) = delete;
+	Folder_Watcher(Folder_Watcher && other) = delete;
+	Folder_Watcher & operator=(Folder_Watcher && other) = delete;
+
+	~Folder_Watcher();
+
+	/*
+	*	Watches the tree of inPath. outPath must not be in it (its files would be processed in turn).
+	*	Called before the first walk of the folder, so that no file is missed in between.
+	*/
+	int open(const std::string & inPath, const std::string & outPath);
+
+	/*
+	*	Blocks SIGINT and SIGTERM in the calling thread (and the threads it creates from then on) :
+	*	they are only seen by wait
+	*/
+	int catchSignals();
+
+	/*
+	*	Waits for files to be ready (paths relative to the input folder). bStop is set by SIGINT or SIGTERM.
+	*/
+	int wait(std::vector<std::string> & ready, bool & bStop);
+};
+
+/*
+*	=====================================================================================================
+*	 Persistent pool of worker threads, fed with items (file paths) by the watch
+*
+*	 An item submitted again while it is waiting is only queued once. An item being processed is not
+*	 given to another worker before the first one is done with it : a file is never processed twice at
+*	 the same time, and the last version of it is always processed.
+*	=====================================================================================================
+*/
+class Worker_Pool
+{
+public:
+
+	typedef std::function<void(const size_t & worker, const std::string & item)> Work;
+
+private:
+
+	std::vector<std::thread> workers{};
+	std::deque<std::string> queue{};
+	std::unordered_set<std::string> queued{};
+	std::unordered_set<std::string> active{};
+	std::mutex mutex{};
+	std::condition_variable ready{};
+	bool bStopping = false;
+	Work work{};
+
+	void run(const size_t & worker);
+
+public:
+
+	Worker_Pool();
+
+	// Copy, Move constructor and assignment operators deleted : the object owns threads
+	Worker_Pool(const Worker_Pool & other) = delete;
+	Worker_Pool & operator=(const Worker_Pool & other) = delete;
+	Worker_Pool(Worker_Pool && other) = delete;
+	Worker_Pool & operator=(Worker_Pool && other) = delete;
+
+	~Worker_Pool();
+
+	/*
+	*	Starts count workers, each running work for the items it takes (worker is its index, from 0 to count - 1)
+	*/
+	int start(const size_t & count, const Work & work);
+
+	void submit(const std::string & item);
+
+	/*
+	*	Waits for the items being processed, drops the others, and joins the workers
+	*/
+	void stop();
+};
+
+#endif // !__linux__
+
+#endif // !LINUX_WATCH_H
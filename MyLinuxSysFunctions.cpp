@@ -910,5 +910,22 @@ int my_mkdir(const std::string && path, __mode_t mode)
 	return (my_mkdir(pathCopy, mode));
 }
 
+int detachStandardOutput()
+{
+	static int dataFd = -1;
+
+	if (dataFd >= 0) return dataFd;
+
+	fflush(stdout);
+
+	if ((dataFd = dup(STDOUT_FILENO)) >= 0 && dup2(STDERR_FILENO, STDOUT_FILENO) < 0)
+	{
+		close(dataFd);
+		dataFd = -1;
+	}
+
+	return dataFd;
+}
+
 
 #endif /* __linux__ */
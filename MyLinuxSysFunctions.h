@@ -240,6 +240,15 @@ int my_open(const std::string && path, int oflag);
 int my_mkdir(const std::string & path, __mode_t mode);
 int my_mkdir(const std::string && path, __mode_t mode);
 
+/*
+* int detachStandardOutput()
+* Reserves the original standard output for the data, when the output path is "-"
+* Returns a duplicate of file descriptor 1, which is then redirected to stderr, so that
+* everything printed afterwards (progress, errors) doesn't end up in the data
+* Can be called several times : the same descriptor is returned. Returns -1 on error.
+*/
+int detachStandardOutput();
+
 
 #endif /* __linux__ */
 
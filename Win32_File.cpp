@@ -13,6 +13,7 @@
 #include "mem_impl.h"                     // my_memclr
 
 #include "ANSI_UTF16_converter.h"
+#include "Idx_SelfTest.h"						// requireSelfTests
 
 #include <Shlwapi.h>							// PathIsRelative and company
 #include <io.h>									// _filelengthi64
@@ -204,7 +205,7 @@ static int opFile(FILE* fin, FILE* fout, const std::wstring & outPath, Hmac_PRF
 			printf("Generating the decryption key...");
 
 			// Generate the decryption key using Hmac-PBKDF using the salt retrieved from the file + user password
-			if (0 != PBKDF2(prf, STRONG_ITERATIONS, (unsigned char*)szPassword, (unsigned int)strlen(szPassword), pbSalt, (unsigned int)cbSalt, pbDerivedKey, 32))
+			if (0 != requireSelfTests(SELFTEST_KDF | SELFTEST_MEMCLR) || 0 != PBKDF2(prf, STRONG_ITERATIONS, (unsigned char*)szPassword, (unsigned int)strlen(szPassword), pbSalt, (unsigned int)cbSalt, pbDerivedKey, 32))
 			{
 				printf("Error!\nAn unexpected error occured while creating the decryption key. Aborting...\n");
 				iStatus = 1;
@@ -215,7 +216,7 @@ static int opFile(FILE* fin, FILE* fout, const std::wstring & outPath, Hmac_PRF
 				printf("Done!\nInitializing decryption...");
 
 				// Initialization of the AES context
-				if (0 != CreateCipher(ctx, CBC, pbDerivedKey, 256, pbIV, 0)) {
+				if (0 != requireSelfTests(SELFTEST_AES) || 0 != CreateCipher(ctx, CBC, pbDerivedKey, 256, pbIV, 0)) {
 					printf("An error occured during the creationg of the decryption context. Aborting...\n");
 					iStatus = 1;
 				}
@@ -347,7 +348,7 @@ static int opFile(FILE* fin, FILE* fout, const std::wstring & outPath, Hmac_PRF
 			printf("Generating the encryption key...");
 
 			// Generate the encryption key using Hmac-PBKDF using the salt generated randomly + user password
-			if (0 != PBKDF2(prf, STRONG_ITERATIONS, (unsigned char*)szPassword, (unsigned int)strlen(szPassword), pbSalt, (unsigned int)cbSalt, pbDerivedKey, 32))
+			if (0 != requireSelfTests(SELFTEST_KDF | SELFTEST_MEMCLR) || 0 != PBKDF2(prf, STRONG_ITERATIONS, (unsigned char*)szPassword, (unsigned int)strlen(szPassword), pbSalt, (unsigned int)cbSalt, pbDerivedKey, 32))
 			{
 				printf("Error!\nAn unexpected error occured while creating the encryption key. Aborting...\n");
 				iStatus = 1;
@@ -359,7 +360,7 @@ static int opFile(FILE* fin, FILE* fout, const std::wstring & outPath, Hmac_PRF
 				BOOL bStatus = 0;
 
 				// Initialization of the AES context
-				if (0 != CreateCipher(ctx, CBC, pbDerivedKey, 256, pbIV, 1)) {
+				if (0 != requireSelfTests(SELFTEST_AES) || 0 != CreateCipher(ctx, CBC, pbDerivedKey, 256, pbIV, 1)) {
 					printf("An error occured during the creationg of the encryption context. Aborting...\n");
 					iStatus = 1;
 				}
@@ -490,7 +491,7 @@ static int opFile(FILE* fin, FILE* fout, const std::wstring & outPath, Hmac_PRF
 * Variant of Recursive Depth-First-Search(DFS) Algorithm
 */
 
-static int opDir(WIN32_FIND_DATAW f, HANDLE h, const std::wstring finPath, const std::wstring foutPath, Hmac_PRF & prf, const char szPassword[], size_t & cbSalt, const int & bForDecrypt)
+static int opDir(WIN32_FIND_DATAW f, HANDLE h, const std::wstring finPath, const std::wstring foutPath, Hmac_PRF & prf, const char szPassword[], size_t & cbSalt, const int & bForDecrypt, const int & bDurable)
 {
 	FILE* fin = NULL;
 	FILE* fout = NULL;
@@ -519,7 +520,7 @@ static int opDir(WIN32_FIND_DATAW f, HANDLE h, const std::wstring finPath, const
 				WIN32_FIND_DATAW F{};
 				HANDLE H = FindFirstFileW(fileInPath.data(), &F);
 				// Recursive call
-				iStatus = opDir(F, H, fileInPath, fileOutPath, prf, szPassword, cbSalt, bForDecrypt);
+				iStatus = opDir(F, H, fileInPath, fileOutPath, prf, szPassword, cbSalt, bForDecrypt, bDurable);
 				FindClose(H);
 				SecureZeroMemory(&F, sizeof(F));
 			}
@@ -566,6 +567,12 @@ static int opDir(WIN32_FIND_DATAW f, HANDLE h, const std::wstring finPath, const
 						}
 						else {
 							iStatus = opFile(fin, fout, fileOutPath, prf, szPassword, cbSalt, bForDecrypt);
+
+							// No batching on Windows : each output file is committed on its own
+							if (0 == iStatus && bDurable && (0 != fflush(fout) || 0 != _commit(_fileno(fout)))) {
+								printf("Failed to flush the output file %ls to disk. Aborting...\n", fileOutPath.data());
+								iStatus = 1;
+							}
 						}
 					}
 				}
@@ -586,7 +593,7 @@ static int opDir(WIN32_FIND_DATAW f, HANDLE h, const std::wstring finPath, const
 // if file, calls opfile
 // if dir, calls opdir
 
-int Win32_File::Op(Hmac_PRF & prf, const char szPassword[], const size_t & cbSalt, const int & bForDecrypt)
+int Win32_File::Op(Hmac_PRF & prf, const char szPassword[], const size_t & cbSalt, const int & bForDecrypt, const Op_Options & options)
 {
 	WIN32_FIND_DATAW FindFileData = {};
 	HANDLE hFind = {};
@@ -658,6 +665,11 @@ int Win32_File::Op(Hmac_PRF & prf, const char szPassword[], const size_t & cbSal
 						else
 						{
 							iStatus = opFile(fin, fout, absWideOutpath, prf, szPassword, cbSalt, bForDecrypt);
+
+							if (0 == iStatus && options.bDurable && (0 != fflush(fout) || 0 != _commit(_fileno(fout)))) {
+								printf("Failed to flush the output file %s to disk. Aborting...\n", absOutpath.data());
+								iStatus = 1;
+							}
 						}
 					}
 				}
@@ -686,7 +698,7 @@ int Win32_File::Op(Hmac_PRF & prf, const char szPassword[], const size_t & cbSal
 
 				hFind = FindFirstFileW(absWideInpath.data(), &FindFileData);
 
-				iStatus = opDir(FindFileData, hFind, absWideInpath, absWideOutpath, prf, szPassword, (size_t&)cbSalt, bForDecrypt);
+				iStatus = opDir(FindFileData, hFind, absWideInpath, absWideOutpath, prf, szPassword, (size_t&)cbSalt, bForDecrypt, options.bDurable);
 			}
 		}
 	}
@@ -31,12 +31,31 @@
  */
 
 #include "File_Struct.h"
+#include "Idx_SelfTest.h"		// requireSelfTests, self-test cache
+
+#ifdef __linux__
+#include "MyLinuxSysFunctions.h"	// detachStandardOutput
+#include "Linux_Agent.h"			// runKeyAgent
+#include "Linux_Service.h"		// runService
+#include "Idx_TreeHash.h"			// treeHashFile
+#include "Idx_Merkle.h"			// verifyMerkleFile
+#include "Idx_Engine.h"			// IDX_ERR_*
+#include "Linux_Reencrypt.h"		// reencryptPath
+#include "Linux_Rekey.h"			// rekeyPath
+#include "Linux_Volume.h"			// parseVolumeSize
+
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
 
 #include "mem_impl.h"           // my_memclr
 
 #include <cstdio>				// printf
 #include <cstring>				// memcpy, memcmp
 #include <cstddef>				// size_t
+#include <cstdlib>				// strtoul
+#include <thread>				// hardware_concurrency
 
 #ifdef	__linux__
 #include <sys/mman.h>
@@ -69,23 +88,329 @@
 void ShowUsage()
 {
 	printf("\nMiD_idxcrypt - Simple yet Strong file encryptor. By El Mostafa IDRASSI (mostafa.idrassi@tutanota.com)\n\nCopyright 2017\n\n\n");
-	printf("To encrypt an entire folder : MiD_idxcrypt InputFolder Password OutputFolder [/d] [/hash algo]\n");
+	printf("To encrypt an entire folder : MiD_idxcrypt InputFolder Password OutputFolder [/d] [/hash algo] [/sync] [/sparse] [/digest] [/merkle] [/envelope] [/compress] [/require merkle|digest] [/manifest path [/prune]] [/journal path [/resume]] [/watch]\n");
 	printf("\tInputFolder example : C:\\inputFolder (absolute path) or inputFolder (relative path to the current working directory) \n");
 	printf("\tOutputFolder example : C:\\outputFolder (absolute path) or outputFolder (relative path to the current working directory) \n\n");
-	printf("To encrypt a file : MiD_idxcrypt InputFile Password OutputFile [/d] [/hash_algo]\n");
+	printf("To encrypt a file : MiD_idxcrypt InputFile Password OutputFile [/d] [/hash_algo] [/sync] [/sparse] [/digest] [/merkle] [/envelope] [/compress] [/require merkle|digest] [/checkpoint [/resume]] [/volume size]\n");
 	printf("\tInputFile example : C:\\inputFile (absolute path) or inputFile (relative path to the current working directory) \n");
-	printf("\tOutputFile example : C:\\outputFile (absolute path) or outputFile (relative path to the current working directory)\n\n");
+	printf("\tOutputFile example : C:\\outputFile (absolute path) or outputFile (relative path to the current working directory)\n");
+#ifdef __linux__
+	printf("\tInputFile and OutputFile can be - for the standard input/output (pipes)\n");
+#endif
+	printf("\n");
 	printf("\tParameters:\n");
 	printf("\t  /d: Perform decryption instead of encryption (default)\n");
 	printf("\t  /hash algo: Specifies hash algorithm to use for key derivation.\n");
 	printf("\t              Possible values of algo are md5, sha1, sha256, sha384 and sha512.\n");
 	printf("\t              sha256 is the default\n");
+	printf("\t  /sync: Make the output files durable (on disk) before exiting.\n");
+	printf("\t         Output files are synchronized in batches rather than one at a time.\n");
+#ifdef __linux__
+	printf("\t  /sparse: Encrypt only the data of sparse input files (VM images, databases) and record their holes.\n");
+	printf("\t           The holes are recreated by the decryption. Such files can only be decrypted on Linux.\n");
+	printf("\t  /digest: Store the SHA-256 of each file in its output (encrypted), computed while it is encrypted.\n");
+	printf("\t           The decryption checks it. Such files can only be decrypted on Linux.\n");
+	printf("\t  /merkle: Append a hash tree of the encrypted data to each output, authenticated by the key.\n");
+	printf("\t           The decryption checks every 64 KiB chunk before decrypting it, /verify checks a file without\n");
+	printf("\t           decrypting it. Such files can only be decrypted on Linux, from a file (not a pipe).\n");
+	printf("\t  /require what: With /d, refuse the files without a hash tree (merkle) or a digest (digest), which\n");
+	printf("\t                 can be repeated. The flags of a file are not authenticated : without it, a tree or\n");
+	printf("\t                 a digest removed from a file goes unnoticed.\n");
+	printf("\t  /envelope: Encrypt the data of each file with a random key, held by its header, so that /rekey\n");
+	printf("\t             changes its password without encrypting it again. Such files can only be decrypted on Linux.\n");
+	printf("\t  /compress: Compress the data of each file (LZ4, by blocks of 64 KiB spread over the CPUs) before\n");
+	printf("\t             encrypting it. Such files can only be decrypted on Linux.\n");
+	printf("\t  /manifest path: Incremental folder job. The files which didn't change since the previous run\n");
+	printf("\t                 with the same manifest are skipped. The manifest must not be in InputFolder,\n");
+	printf("\t                 and it can only be used again with the same InputFolder and OutputFolder.\n");
+	printf("\t  /prune: With /manifest, delete the outputs of the files deleted since the previous run.\n");
+	printf("\t  /journal path: Record the progress of a folder job, so that it can be resumed if interrupted.\n");
+	printf("\t                The journal must not be in InputFolder. It is deleted once the job is successful.\n");
+	printf("\t  /resume: With /journal, skip the files completed by the interrupted job.\n");
+	printf("\t           With /checkpoint, resume the interrupted encryption of InputFile from its last checkpoint.\n");
+	printf("\t  /checkpoint: Checkpoint the encryption of a large file, so that it can be resumed if interrupted.\n");
+	printf("\t              The output is written to OutputFile.partial until it is complete.\n");
+	printf("\t  /volume size: Write the encrypted file directly in volumes of size bytes (K, M, G : KiB, MiB, GiB),\n");
+	printf("\t                OutputFile.idx.000, .001... Decrypt them from OutputFile.idx.000, or from their\n");
+	printf("\t                concatenation. The size is a multiple of 16 bytes, of 64 KiB at least.\n");
+	printf("\t  /watch: Once InputFolder is processed, keep running and process its new and modified files as they\n");
+	printf("\t          are completed, with one worker per CPU, until Ctrl+C. OutputFolder must not be in InputFolder.\n");
+	printf("\n");
+	printf("To run a key agent : MiD_idxcrypt /agent SocketPath [/ttl seconds]\n");
+	printf("\tThe agent keeps the keys derived by the processes run with %s=SocketPath (default TTL : %u s),\n", AGENT_ENV, AGENT_DEFAULT_TTL);
+	printf("\tso that a file whose key is held is processed without deriving it again. Stopped by Ctrl+C.\n");
+	printf("To run the encryption service : MiD_idxcrypt /serve SocketPath [/workers count]\n");
+	printf("\tEncrypts and decrypts the files and the data sent to SocketPath (Linux_Service.h), with count workers\n");
+	printf("\t(default : one per CPU) which keep the keys of the last passwords they were given. Stopped by Ctrl+C.\n");
+	printf("To compute the fingerprint of a file : MiD_idxcrypt /fingerprint File [/threads count]\n");
+	printf("\tPrints the BLAKE3 tree hash of File (- for the standard input), hashed by count threads (default : one per CPU).\n");
+	printf("To verify an encrypted file : MiD_idxcrypt /verify File Password [/hash algo] [/threads count]\n");
+	printf("\tChecks the data of File, encrypted with /merkle, against its hash tree without decrypting it,\n");
+	printf("\tchunk by chunk with count threads (default : one per CPU).\n");
+	printf("To change the password of encrypted files : MiD_idxcrypt /rekey Path OldPassword NewPassword [/hash algo] [/threads count]\n");
+	printf("\tRewrites the header of Path (a file, or the .idx files of a folder), encrypted with /envelope,\n");
+	printf("\twith count threads (default : one per CPU). The data is left as it is.\n");
+	printf("To re-encrypt encrypted files : MiD_idxcrypt /reencrypt Input OldPassword Output NewPassword [/hash algo] [/newhash algo] [/threads count]\n");
+	printf("\tDecrypts Input (a file, or the .idx files of a folder) and encrypts it again into Output in one pass,\n");
+	printf("\twithout writing the plaintext to disk. /newhash is the hash algorithm of the new password (default : that of /hash).\n");
+	printf("\tOutput may be Input (in place).\n");
+#endif
 	printf("\n");
 #ifdef _WIN32
 	printf("\nPlease use backslashes rather than slashes!\n");
 #endif
 }
 
+/*
+* /hash algo : the PRF of the key derivation, and the length of the salt that goes with it
+* Returns 1 if algo is not known
+*/
+static int setHashAlgo(const char* szAlgo, Hmac_PRF & prf, size_t & cbSalt)
+{
+	if (0 == memcmp(szAlgo, "md5", 3)) {
+		prf.cleanData();
+		prf.setHmacContext(md5h);
+		cbSalt = 64;
+	}
+	else if (0 == memcmp(szAlgo, "sha1", 4)) {
+		prf.cleanData();
+		prf.setHmacContext(sha1h);
+		cbSalt = 64;
+	}
+	else if (0 == memcmp(szAlgo, "sha256", 6)) {}
+	else if (0 == memcmp(szAlgo, "sha384", 6))
+	{
+		prf.cleanData();
+		prf.setHmacContext(sha384h);
+		cbSalt = 64;
+	}
+	else if (0 == memcmp(szAlgo, "sha512", 6))
+	{
+		prf.cleanData();
+		prf.setHmacContext(sha512h);
+		cbSalt = 64;
+	}
+	else
+	{
+		return 1;
+	}
+
+	return 0;
+}
+
+#ifdef __linux__
+/*
+* BLAKE3 of a file ("/fingerprint"), as printed by b3sum
+*/
+static int runFingerprint(const char* szPath, const size_t & cThreads)
+{
+	unsigned char pbDigest[TREEHASH_SIZE]{};
+	int fd = (0 == strcmp(szPath, "-")) ? STDIN_FILENO : open(szPath, O_RDONLY | O_CLOEXEC);
+	int iStatus = 0;
+
+	if (fd < 0)
+	{
+		printf("Failed to open the file %s for reading. Aborting...\n", szPath);
+		return 1;
+	}
+
+	if (0 != treeHashFile(fd, pbDigest, cThreads))
+	{
+		printf("An error occured while hashing the file %s (Error code : %d). Aborting...\n", szPath, errno);
+		iStatus = 1;
+	}
+	else
+	{
+		for (size_t i = 0; i < TREEHASH_SIZE; i++) printf("%02x", pbDigest[i]);
+		printf("  %s\n", szPath);
+	}
+
+	if (STDIN_FILENO != fd) close(fd);
+
+	return iStatus;
+}
+
+/*
+* [/hash algo] [/threads count] from argv[first] on (/verify, /rekey), and [/newhash algo] if pNewPrf is given (/reencrypt)
+*/
+static int parseModeOptions(int argc, char* argv[], const int & first, Hmac_PRF & prf, size_t & cbSalt, unsigned long & cThreads,
+	Hmac_PRF * pNewPrf = nullptr, size_t * pcbNewSalt = nullptr, bool * pbNewHash = nullptr)
+{
+	for (int i = first; i < argc; i += 2)
+	{
+		if (i + 1 >= argc) return 1;
+		else if (0 == strcmp(argv[i], "/hash")) { if (0 != setHashAlgo(argv[i + 1], prf, cbSalt)) return 1; }
+		else if (nullptr != pNewPrf && 0 == strcmp(argv[i], "/newhash")) { if (0 != setHashAlgo(argv[i + 1], *pNewPrf, *pcbNewSalt)) return 1; *pbNewHash = true; }
+		else if (0 != strcmp(argv[i], "/threads") || 0 == (cThreads = strtoul(argv[i + 1], nullptr, 10)) || cThreads > 1024) return 1;
+	}
+
+	return 0;
+}
+
+/*
+* Copies a password of the command line into locked memory, and clears it in the command line
+*/
+static int takePassword(char szPassword[129], char* szArg)
+{
+	if (strlen(szArg) > 128)
+	{
+		printf("Password too long. Maximum password length is : 128 ANSI-encoded characters. Aborting...\n");
+		return 1;
+	}
+
+	mlock(szPassword, 129);
+	memcpy(szPassword, szArg, strlen(szArg));
+	my_memclr(szArg, strlen(szArg));
+
+	return 0;
+}
+
+/*
+* Verification of a file encrypted with /merkle ("/verify File Password [/hash algo] [/threads count]") : the tests
+* of the libraries it uses run before their first use
+*/
+static int runVerify(int argc, char* argv[])
+{
+	Hmac_PRF prf{};
+	size_t cbSalt = 16;
+	unsigned long cThreads = (std::thread::hardware_concurrency() > 0) ? std::thread::hardware_concurrency() : 1;
+	char szPassword[129]{};
+	uint64_t badChunk = 0;
+	int fd = -1;
+	int iStatus = 0;
+
+	prf.setHmacContext(sha256h);
+
+	if (argc < 4 || 0 != parseModeOptions(argc, argv, 4, prf, cbSalt, cThreads))
+	{
+		ShowUsage();
+		prf.cleanData();
+		return 1;
+	}
+
+	if (0 != takePassword(szPassword, argv[3]))
+	{
+		prf.cleanData();
+		return 1;
+	}
+
+	if ((fd = open(argv[2], O_RDONLY | O_CLOEXEC)) < 0)
+	{
+		printf("Failed to open the file %s for reading. Aborting...\n", argv[2]);
+		iStatus = 1;
+	}
+	else
+	{
+		switch (verifyMerkleFile(fd, prf, szPassword, cbSalt, (size_t)cThreads, badChunk))
+		{
+		case IDX_OK:
+			printf("%s : OK\n", argv[2]);
+			break;
+		case IDX_ERR_PASSWORD:
+			printf("Password incorrect or the file %s is not a valid encrypted file. Aborting!\n", argv[2]);
+			iStatus = 1;
+			break;
+		case IDX_ERR_FORMAT:
+			printf("The file %s was not encrypted with /merkle : it has no hash tree to verify. Aborting!\n", argv[2]);
+			iStatus = 1;
+			break;
+		case IDX_ERR_CORRUPTED:
+			if (UINT64_MAX == badChunk) printf("%s : CORRUPTED (its hash tree is not valid)\n", argv[2]);
+			else printf("%s : CORRUPTED (chunk %llu of the encrypted data)\n", argv[2], (unsigned long long)badChunk);
+			iStatus = 1;
+			break;
+		default:
+			printf("An unexpected error occured while verifying the file %s (Error code : %d). Aborting...\n", argv[2], errno);
+			iStatus = 1;
+			break;
+		}
+
+		close(fd);
+	}
+
+	my_memclr(szPassword, sizeof(szPassword));
+	prf.cleanData();
+
+	return iStatus;
+}
+
+/*
+* Change of the password of files encrypted with /envelope ("/rekey Path OldPassword NewPassword [/hash algo] [/threads count]")
+*/
+static int runRekey(int argc, char* argv[])
+{
+	Hmac_PRF prf{};
+	size_t cbSalt = 16;
+	unsigned long cThreads = (std::thread::hardware_concurrency() > 0) ? std::thread::hardware_concurrency() : 1;
+	char szOldPassword[129]{};
+	char szNewPassword[129]{};
+	int iStatus = 0;
+
+	prf.setHmacContext(sha256h);
+
+	if (argc < 5 || 0 != parseModeOptions(argc, argv, 5, prf, cbSalt, cThreads))
+	{
+		ShowUsage();
+		prf.cleanData();
+		return 1;
+	}
+
+	if (0 == takePassword(szOldPassword, argv[3]) && 0 == takePassword(szNewPassword, argv[4]))
+		iStatus = rekeyPath(argv[2], prf, szOldPassword, szNewPassword, cbSalt, (size_t)cThreads);
+	else
+		iStatus = 1;
+
+	my_memclr(szOldPassword, sizeof(szOldPassword));
+	my_memclr(szNewPassword, sizeof(szNewPassword));
+	prf.cleanData();
+
+	return iStatus;
+}
+
+/*
+* Re-encryption of encrypted files ("/reencrypt Input OldPassword Output NewPassword [/hash algo] [/newhash algo] [/threads count]")
+*/
+static int runReencrypt(int argc, char* argv[])
+{
+	Hmac_PRF oldPrf{};
+	Hmac_PRF newPrf{};
+	size_t cbOldSalt = 16;
+	size_t cbNewSalt = 16;
+	bool bNewHash = false;
+	unsigned long cThreads = (std::thread::hardware_concurrency() > 0) ? std::thread::hardware_concurrency() : 1;
+	char szOldPassword[129]{};
+	char szNewPassword[129]{};
+	int iStatus = 0;
+
+	oldPrf.setHmacContext(sha256h);
+	newPrf.setHmacContext(sha256h);
+
+	if (argc < 6 || 0 != parseModeOptions(argc, argv, 6, oldPrf, cbOldSalt, cThreads, &newPrf, &cbNewSalt, &bNewHash))
+	{
+		ShowUsage();
+		oldPrf.cleanData();
+		newPrf.cleanData();
+		return 1;
+	}
+
+	// Without /newhash, the new password is derived as the old one
+	for (int i = 6; !bNewHash && i + 1 < argc; i += 2)
+		if (0 == strcmp(argv[i], "/hash")) setHashAlgo(argv[i + 1], newPrf, cbNewSalt);
+
+	if (0 == takePassword(szOldPassword, argv[3]) && 0 == takePassword(szNewPassword, argv[5]))
+		iStatus = reencryptPath(argv[2], argv[4], oldPrf, cbOldSalt, szOldPassword, newPrf, cbNewSalt, szNewPassword, (size_t)cThreads);
+	else
+		iStatus = 1;
+
+	my_memclr(szOldPassword, sizeof(szOldPassword));
+	my_memclr(szNewPassword, sizeof(szNewPassword));
+	oldPrf.cleanData();
+	newPrf.cleanData();
+
+	return iStatus;
+}
+#endif
+
 int main(int argc, char* argv[])
 {
 	/*
@@ -140,8 +465,55 @@ int main(int argc, char* argv[])
 	SetConsoleOutputCP(GetACP());
 #endif
 
-	/* Load the human readable error strings for libcrypto */
-	ERR_load_crypto_strings();
+#ifdef __linux__
+	// Key agent : it only holds keys, the libraries are not needed
+	if (argc >= 2 && 0 == strcmp(argv[1], "/agent"))
+	{
+		unsigned long ttl = AGENT_DEFAULT_TTL;
+
+		if (3 == argc || (5 == argc && 0 == strcmp(argv[3], "/ttl") && (ttl = strtoul(argv[4], nullptr, 10)) > 0 && ttl <= 86400 * 365))
+			return runKeyAgent(argv[2], (unsigned int)ttl);
+
+		ShowUsage();
+		return 1;
+	}
+
+	// Encryption service : it tests the libraries itself, once for all its requests
+	if (argc >= 2 && 0 == strcmp(argv[1], "/serve"))
+	{
+		unsigned long cWorkers = (std::thread::hardware_concurrency() > 0) ? std::thread::hardware_concurrency() : 1;
+
+		if (3 == argc || (5 == argc && 0 == strcmp(argv[3], "/workers") && (cWorkers = strtoul(argv[4], nullptr, 10)) > 0 && cWorkers <= 1024))
+			return runService(argv[2], (size_t)cWorkers);
+
+		ShowUsage();
+		return 1;
+	}
+
+	// Fingerprint : only the tree hash, which runs its own known-answer tests
+	if (argc >= 2 && 0 == strcmp(argv[1], "/fingerprint"))
+	{
+		unsigned long cThreads = (std::thread::hardware_concurrency() > 0) ? std::thread::hardware_concurrency() : 1;
+
+		if (3 == argc || (5 == argc && 0 == strcmp(argv[3], "/threads") && (cThreads = strtoul(argv[4], nullptr, 10)) > 0 && cThreads <= 1024))
+			return runFingerprint(argv[2], (size_t)cThreads);
+
+		ShowUsage();
+		return 1;
+	}
+
+	// Verification of a hash tree : only the libraries it relies on, tested before their first use
+	if (argc >= 2 && 0 == strcmp(argv[1], "/verify")) return runVerify(argc, argv);
+
+	// Change of password : the header of the files only
+	if (argc >= 2 && 0 == strcmp(argv[1], "/rekey")) return runRekey(argc, argv);
+
+	// Re-encryption : decryption and encryption in one pass, in memory
+	if (argc >= 2 && 0 == strcmp(argv[1], "/reencrypt")) return runReencrypt(argc, argv);
+
+	// Output to "-" (pipe) : the standard output is kept for the data only, from the very first message
+	if (argc >= 4 && 0 == strcmp(argv[3], "-")) detachStandardOutput();
+#endif
 
 	int iStatus = 0;
 
@@ -151,6 +523,7 @@ int main(int argc, char* argv[])
 	char szPassword[129]{};         // Maximum 128 ANSI-encoded chars + trailing \0
 
 	int bForDecrypt = 0;
+	Op_Options options{};
 
 	File_Struct * RootFile = nullptr;
 
@@ -159,54 +532,71 @@ int main(int argc, char* argv[])
 	std::string foutPath(argv[3]);
 
 
-	// HashLib Initialization
-	iStatus = HashLib_Init();
-	if (0 == iStatus)
-	{
-		printf("\nHashLib initialization OK. Moving on...\n");
+	int selfTestMode = getSelfTestMode();
 
-		// HmacLib Initialization
-		iStatus = HMACLib_Init();
+	// Self-tests of the libraries : skipped if they passed with this binary on this CPU, or deferred (IDXCRYPT_SELFTEST)
+	if (SELFTEST_MODE_LAZY == selfTestMode)
+	{
+		printf("\nSelf-tests deferred to the first use of each library. Moving on...\n\n");
+	}
+	else if (SELFTEST_MODE_CACHED == selfTestMode && 0 == loadSelfTestCache())
+	{
+		printf("\nSelf-tests already passed by this binary on this CPU. Moving on...\n\n");
+	}
+	else
+	{
+		// HashLib Initialization
+		iStatus = requireSelfTests(SELFTEST_HASH);
 		if (0 == iStatus)
 		{
-			printf("\nHmacLib initialization OK. Moving on...\n");
+			printf("\nHashLib initialization OK. Moving on...\n");
 
-			// PBKDF2 Initialization
-			iStatus = PBKDF2_Init();
+			// HmacLib Initialization
+			iStatus = requireSelfTests(SELFTEST_HMAC);
 			if (0 == iStatus)
 			{
-				printf("\nPBKDF2 initialization OK. Moving on...\n");
+				printf("\nHmacLib initialization OK. Moving on...\n");
 
-				// AES Initialization
-				iStatus = AesLib_Init();
+				// PBKDF2 Initialization
+				iStatus = requireSelfTests(SELFTEST_PBKDF2);
 				if (0 == iStatus)
 				{
-					printf("\nAesLib initialization OK. Moving on...\n\n");
+					printf("\nPBKDF2 initialization OK. Moving on...\n");
+
+					// AES Initialization
+					iStatus = requireSelfTests(SELFTEST_AES);
+					if (0 == iStatus)
+					{
+						printf("\nAesLib initialization OK. Moving on...\n\n");
+
+						// The next processes of this binary on this CPU skip them
+						if (SELFTEST_MODE_CACHED == selfTestMode) saveSelfTestCache();
+					}
+
+					else
+					{
+						printf("\nAesLib initialization KO. Aborting...\n\n");
+					}
+
 				}
 
 				else
 				{
-					printf("\nAesLib initialization KO. Aborting...\n\n");
+					printf("\nPBKDF2 initialization KO. Aborting...\n");
 				}
-
 			}
 
 			else
 			{
-				printf("\nPBKDF2 initialization KO. Aborting...\n");
+				printf("\nHmacLib initialization KO. Aborting...\n");
 			}
+
 		}
 
 		else
 		{
-			printf("\nHmacLib initialization KO. Aborting...\n");
+			printf("\nHashLib initialization KO. Aborting...\n");
 		}
-
-	}
-
-	else
-	{
-		printf("\nHashLib initialization KO. Aborting...\n");
 	}
 
 	if (iStatus == 0) {
@@ -214,7 +604,7 @@ int main(int argc, char* argv[])
 		// Interpretation of user's input
 
 		if ((2 == argc && (0 == memcmp(argv[1], "-h", 2) || 0 == memcmp(argv[1], "--help", 6))) ||
-			argc < 4 || argc > 7)
+			argc < 4)
 		{
 			ShowUsage();
 			iStatus = 1;
@@ -232,38 +622,109 @@ int main(int argc, char* argv[])
 						iStatus = 1;
 						break;
 					}
-					else  if (0 == memcmp(argv[i + 1], "md5", 3)) {
-						prf.cleanData();
-						prf.setHmacContext(md5h);
-						cbSalt = 64;
-					}
-					else if (0 == memcmp(argv[i + 1], "sha1", 4)) {
-						prf.cleanData();
-						prf.setHmacContext(sha1h);
-						cbSalt = 64;
+					else if (0 != setHashAlgo(argv[i + 1], prf, cbSalt))
+					{
+						printf("Unexpected hash algorithm.\n");
+						ShowUsage();
+						iStatus = 1;
+						break;
 					}
-					else if (0 == memcmp(argv[i + 1], "sha256", 6)) {}
-					else if (0 == memcmp(argv[i + 1], "sha384", 6))
+					i++;
+				}
+				else if (0 == strcmp(argv[i], "/sync"))
+				{
+					options.bDurable = 1;
+				}
+#ifdef __linux__
+				else if (0 == strcmp(argv[i], "/sparse"))
+				{
+					options.bSparse = 1;
+				}
+				else if (0 == strcmp(argv[i], "/digest"))
+				{
+					options.bDigest = 1;
+				}
+				else if (0 == strcmp(argv[i], "/merkle"))
+				{
+					options.bMerkle = 1;
+				}
+				else if (0 == strcmp(argv[i], "/envelope"))
+				{
+					options.bEnvelope = 1;
+				}
+				else if (0 == strcmp(argv[i], "/compress"))
+				{
+					options.bCompress = 1;
+				}
+				else if (0 == strcmp(argv[i], "/require"))
+				{
+					if ((i + 1) < argc && 0 == strcmp(argv[i + 1], "merkle"))
 					{
-						prf.cleanData();
-						prf.setHmacContext(sha384h);
-						cbSalt = 64;
+						options.bRequireMerkle = 1;
 					}
-					else if (0 == memcmp(argv[i + 1], "sha512", 6))
+					else if ((i + 1) < argc && 0 == strcmp(argv[i + 1], "digest"))
 					{
-						prf.cleanData();
-						prf.setHmacContext(sha512h);
-						cbSalt = 64;
+						options.bRequireDigest = 1;
 					}
 					else
 					{
-						printf("Unexpected hash algorithm.\n");
+						printf("Missing or unexpected check to require (merkle or digest).\n");
+						ShowUsage();
+						iStatus = 1;
+						break;
+					}
+					i++;
+				}
+				else if (0 == strcmp(argv[i], "/manifest"))
+				{
+					if ((i + 1) >= argc)
+					{
+						printf("Missing manifest path.\n");
+						ShowUsage();
+						iStatus = 1;
+						break;
+					}
+					options.manifestPath = argv[++i];
+				}
+				else if (0 == strcmp(argv[i], "/prune"))
+				{
+					options.bPrune = 1;
+				}
+				else if (0 == strcmp(argv[i], "/journal"))
+				{
+					if ((i + 1) >= argc)
+					{
+						printf("Missing journal path.\n");
+						ShowUsage();
+						iStatus = 1;
+						break;
+					}
+					options.journalPath = argv[++i];
+				}
+				else if (0 == strcmp(argv[i], "/resume"))
+				{
+					options.bResume = 1;
+				}
+				else if (0 == strcmp(argv[i], "/checkpoint"))
+				{
+					options.bCheckpoint = 1;
+				}
+				else if (0 == strcmp(argv[i], "/watch"))
+				{
+					options.bWatch = 1;
+				}
+				else if (0 == strcmp(argv[i], "/volume"))
+				{
+					if ((i + 1) >= argc || 0 == (options.volumeSize = parseVolumeSize(argv[i + 1])))
+					{
+						printf("Missing or invalid volume size (a multiple of 16 bytes, of 64 KiB at least).\n");
 						ShowUsage();
 						iStatus = 1;
 						break;
 					}
 					i++;
 				}
+#endif
 				else if (0 == memcmp(argv[i], "/d", 2))
 				{
 					bForDecrypt = 1;
@@ -279,6 +740,55 @@ int main(int argc, char* argv[])
 		}
 	}
 
+	if (iStatus == 0 && (options.bRequireMerkle || options.bRequireDigest) && !bForDecrypt)
+	{
+		printf("/require only applies to a decryption (/d).\n");
+		ShowUsage();
+		iStatus = 1;
+	}
+	else if (iStatus == 0 && options.bPrune && options.manifestPath.empty())
+	{
+		printf("/prune requires /manifest.\n");
+		ShowUsage();
+		iStatus = 1;
+	}
+	else if (iStatus == 0 && options.bResume && options.journalPath.empty() && !options.bCheckpoint)
+	{
+		printf("/resume requires /journal or /checkpoint.\n");
+		ShowUsage();
+		iStatus = 1;
+	}
+	else if (iStatus == 0 && options.bCheckpoint && (bForDecrypt || options.bSparse || options.bDigest || options.bMerkle || options.bEnvelope || options.bCompress || 0 == strcmp(argv[1], "-") || 0 == strcmp(argv[3], "-")))
+	{
+		printf("/checkpoint only applies to the encryption of a file to a file, without /sparse, /digest, /merkle, /envelope nor /compress.\n");
+		ShowUsage();
+		iStatus = 1;
+	}
+	else if (iStatus == 0 && options.bDigest && options.bSparse)
+	{
+		printf("/digest doesn't apply to sparse files (/sparse).\n");
+		ShowUsage();
+		iStatus = 1;
+	}
+	else if (iStatus == 0 && options.bDigest && options.bCompress)
+	{
+		printf("/digest can't be combined with /compress.\n");
+		ShowUsage();
+		iStatus = 1;
+	}
+	else if (iStatus == 0 && options.bMerkle && options.bEnvelope)
+	{
+		printf("/merkle can't be combined with /envelope (the HMAC of the tree covers the header, which /rekey rewrites).\n");
+		ShowUsage();
+		iStatus = 1;
+	}
+	else if (iStatus == 0 && options.volumeSize > 0 && (bForDecrypt || options.bMerkle || options.bCheckpoint || 0 == strcmp(argv[3], "-")))
+	{
+		printf("/volume only applies to an encryption whose output is a file, without /merkle nor /checkpoint (the volumes are decrypted from the first one).\n");
+		ShowUsage();
+		iStatus = 1;
+	}
+
 	if (iStatus == 0)
 	{
 
@@ -322,7 +832,7 @@ int main(int argc, char* argv[])
 #endif
 
 				// Start the encryption/Decryption operation
-				iStatus = RootFile->Op(prf, szPassword, cbSalt, bForDecrypt);
+				iStatus = RootFile->Op(prf, szPassword, cbSalt, bForDecrypt, options);
 
 #ifdef _WIN32
 				// clear the password in szPassword
@@ -341,8 +851,5 @@ int main(int argc, char* argv[])
 
 	prf.cleanData();
 
-	/* Remove error strings */
-	ERR_free_strings();
-
 	return iStatus;
 }
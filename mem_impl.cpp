@@ -8,12 +8,37 @@
 
 #include "mem_impl.h"
 
+#include <cstdint>
+#include <cstring>
+
+#define MEMCLR_TEST_SIZE	256
+#define MEMCLR_TEST_BYTE	0xA5
+
+#if defined(__GNUC__) || defined(__clang__)
+#define MEMCLR_NOINLINE		__attribute__((noinline))
+#else
+#define MEMCLR_NOINLINE		__declspec(noinline)
+#endif
+
+#if !defined(__GNUC__) && !defined(__clang__)
+/* The compiler can't know which function is called through a volatile pointer, nor skip the call */
+static void * (* volatile memset_v)(void *, int, size_t) = memset;
+#endif
+
+/*
+*	memset (wide stores) followed by a compiler barrier : the asm statement may read the whole memory pointed by ptr,
+*	so the stores can't be dropped as dead, even when the buffer is freed or goes out of scope right after
+*/
 volatile void * my_memset(void * ptr, int value, size_t num) {
-	volatile unsigned char * buf;
-	buf = (volatile unsigned char *)ptr;
+	if (0 == num)
+		return (volatile void *)ptr;
 
-	while (num)
-		buf[--num] = (unsigned char)value;
+#if defined(__GNUC__) || defined(__clang__)
+	memset(ptr, value, num);
+	__asm__ __volatile__("" : : "r"(ptr) : "memory");
+#else
+	memset_v(ptr, value, num);
+#endif
 
 	return (volatile void *)ptr;
 }
@@ -22,3 +47,30 @@ volatile void * my_memclr(void * ptr, size_t num) {
 	return (my_memset(ptr, 0, num));
 }
 
+/*
+*	Fills a buffer of its frame and clears it with my_memclr as its last use : without the barrier, an optimizing compiler
+*	drops the clear as a dead store (as for a key on the stack). Returns the address the buffer had.
+*/
+static MEMCLR_NOINLINE uintptr_t clearDeadBuffer() {
+	unsigned char pb[MEMCLR_TEST_SIZE];
+	volatile unsigned char * pbFill = pb;
+
+	for (size_t i = 0; i < sizeof(pb); i++)
+		pbFill[i] = MEMCLR_TEST_BYTE;
+
+	my_memclr(pb, sizeof(pb));
+
+	return (uintptr_t)pb;
+}
+
+int MemClr_Init() {
+	const volatile unsigned char * pb = (const volatile unsigned char *)clearDeadBuffer();
+	size_t cFilled = 0;
+
+	// The frame is gone but the stack below is not reused before this loop, which reads it through a volatile pointer
+	for (size_t i = 0; i < MEMCLR_TEST_SIZE; i++)
+		if (MEMCLR_TEST_BYTE == pb[i]) cFilled++;
+
+	// A signal handler may have run on that stack meanwhile : only the fill left as it was is a failure
+	return (MEMCLR_TEST_SIZE == cFilled) ? 1 : 0;
+}
@@ -11,9 +11,12 @@
 
 #include <cstddef>
 
-/* memset implementation which counters agressive dead-code elimination by some compilers */
+/* memset implementation which counters agressive dead-code elimination by some compilers (wide stores, then a compiler barrier) */
 volatile void * my_memset(void * ptr, int value, size_t num);
 
 volatile void * my_memclr(void * ptr, size_t num);
 
+/* Self-test : a buffer cleared by my_memclr right before it goes out of scope is found cleared. Returns 0 if it is. */
+int MemClr_Init();
+
 #endif // !MEM_IMPL
\ No newline at end of file